@@ -22,7 +22,9 @@ class AsyncGlQueueApp : public App {
 
 void AsyncGlQueueApp::setup()
 {
-	
+	// spread callbacks and admissions across frames instead of running them all at once
+	AsyncGlQueue::get()->setMaxCallbackTime(0.004);
+	AsyncGlQueue::get()->setMaxAdmissionsPerFrame(256);
 }
 
 void AsyncGlQueueApp::mouseDown( MouseEvent event )
@@ -43,6 +45,10 @@ void AsyncGlQueueApp::update()
 void AsyncGlQueueApp::draw()
 {
 	gl::clear( Color( 0, 0, 0 ) ); 
+
+	const auto stats = AsyncGlQueue::get()->getStats();
+	gl::drawString("Pending: " + to_string(stats.numPending) + " Processing: " + to_string(stats.numProcessing) + " Completed: " + to_string(stats.numCompleted), vec2(10, 10));
+	gl::drawString("Callbacks last frame: " + to_string(stats.numCallbacksLastFrame) + " (" + to_string(stats.callbackTimeLastFrame * 1000.0) + "ms)", vec2(10, 30));
 }
 
 CINDER_APP( AsyncGlQueueApp, RendererGl )
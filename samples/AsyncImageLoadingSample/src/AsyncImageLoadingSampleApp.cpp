@@ -6,7 +6,17 @@
 #include "cinder/params/Params.h"
 
 #include "bluecadet/utils/AsyncImageLoader.h"
+#include "bluecadet/utils/AsyncSurfaceLoader.h"
+#include "bluecadet/utils/CompressedTextureCache.h"
 #include "bluecadet/utils/FileUtils.h"
+#include "bluecadet/utils/MappedFile.h"
+#include "bluecadet/utils/PboUploader.h"
+#include "bluecadet/utils/PixelCache.h"
+#include "bluecadet/utils/PixelBufferPool.h"
+#include "bluecadet/utils/PixelKernels.h"
+#include "bluecadet/utils/TexturePool.h"
+
+#include "HttpTestServer.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -23,34 +33,203 @@ public:
 
 	int mNumTexturesToLoad = 0;
 	int mNumTexturesLoaded = 0;
+	int mMaxSize = 0;
+	double mLoadStartTime = 0;
+	double mLoadDuration = 0; // compare cold (empty pixel cache) vs warm (after restart) load times
 	std::vector<gl::TextureRef> mTextures;
+	std::vector<AtlasRegionRef> mRegions; // thumbnails packed into the texture atlas
+	std::string mKernelStats; // pixel kernel throughput, scalar vs. simd
+	std::string mPoolBenchmark; // sustained loading with pooled vs. new buffers
+	std::string mBenchmarkStats; // result of the last upload, cache or i/o benchmark
+	HttpTestServerRef mHttpServer; // serves the assets over http on localhost to test remote loading
+	bool mRemoteAssets = false; // load assets via mHttpServer instead of from disk
+	std::atomic<int> mNumAnalyzed{ 0 }; // updated on the surface loader's delivery thread
+	std::atomic<int64_t> mLuminanceSum{ 0 };
 };
 
 void AsyncImageLoadingSampleApp::setup() {
 	setFpsSampleInterval(0.1);
 
+	mHttpServer = make_shared<HttpTestServer>(getAssetPath("thf_large"));
+
 	mParams = params::InterfaceGl::create("Settings", toPixels(ivec2(250, 150)));
 	mParams->addButton("Load All Assets", [=] {
 		mNumTexturesToLoad = 0;
 		mNumTexturesLoaded = 0;
+		mLoadStartTime = getElapsedSeconds();
+		mLoadDuration = 0;
 
 		FileUtils::find(getAssetPath("thf_large"), [=] (const ci::fs::path & path) {
 			mNumTexturesToLoad++;
 
-			AsyncImageLoader::get()->load(path.string(), [=] (const string path, gl::TextureRef texture) {
+			const string url = mRemoteAssets ? mHttpServer->getUrl(path) : path.string();
+
+			AsyncImageLoader::get()->load(url, mMaxSize, [=] (const string path, gl::TextureRef texture) {
 				if (texture) {
 					//CI_LOG_I("Loaded image " + path);
 					mNumTexturesLoaded++;
 					mTextures.push_back(texture);
 
+					if (mNumTexturesLoaded == mNumTexturesToLoad) {
+						mLoadDuration = getElapsedSeconds() - mLoadStartTime;
+					}
+
 				} else {
 					CI_LOG_I("Could not load image " + path);
 				}
 			});
 		});
 	}, "key=l");
-	mParams->addParam<int>("Num Threads", [=](int v) { AsyncImageLoader::get()->setNumThreads(v); }, [=] { return AsyncImageLoader::get()->getNumThreads(); });
-	mParams->addButton("Cancel All", [=] { AsyncImageLoader::get()->cancelAll(); mTextures.clear(); mNumTexturesLoaded = 0; mNumTexturesToLoad = 0; }, "key=c");
+	mParams->addButton("Prefetch All Assets", [=] {
+		vector<string> paths;
+		FileUtils::find(getAssetPath("thf_large"), [&] (const ci::fs::path & path) { paths.push_back(path.string()); });
+		AsyncImageLoader::get()->prefetch(paths, AsyncImageLoader::PrefetchLevel::Decode, mMaxSize);
+	}, "key=p");
+	mParams->addButton("Load Atlas Thumbnails", [=] {
+		// small images share a few atlas pages instead of one texture each
+		mNumTexturesToLoad = 0;
+		mNumTexturesLoaded = 0;
+
+		FileUtils::find(getAssetPath("thf_large"), [=] (const ci::fs::path & path) {
+			mNumTexturesToLoad++;
+
+			AsyncImageLoader::get()->loadRegion(path.string(), [=] (const string path, AtlasRegionRef region) {
+				if (region) {
+					mNumTexturesLoaded++;
+					mRegions.push_back(region);
+				}
+			}, 128);
+		});
+	}, "key=t");
+	mParams->addButton("Analyze Luminance (CPU only)", [=] {
+		// decodes channels on all cores without creating textures, like a headless ingest tool would
+		mNumAnalyzed = 0;
+		mLuminanceSum = 0;
+
+		FileUtils::find(getAssetPath("thf_large"), [=] (const ci::fs::path & path) {
+			AsyncSurfaceLoader::get()->loadChannel(path.string(), [=] (const string path, Channel8uRef channel) {
+				if (!channel) return;
+
+				int64_t sum = 0;
+				for (int32_t y = 0; y < channel->getHeight(); ++y) {
+					const uint8_t * row = channel->getData() + y * channel->getRowBytes();
+					for (int32_t x = 0; x < channel->getWidth(); ++x) sum += row[x];
+				}
+
+				mLuminanceSum += sum / max(1, channel->getWidth() * channel->getHeight());
+				mNumAnalyzed++;
+			}, 256);
+		});
+	}, "key=a");
+	mParams->addParam("Max Size (px)", &mMaxSize).min(0);
+	mParams->addParam<int>("Decode Threads", [=](int v) { AsyncImageLoader::get()->setNumDecodeThreads(v); }, [=] { return AsyncImageLoader::get()->getNumDecodeThreads(); });
+	mParams->addParam<int>("Upload Threads", [=](int v) { AsyncImageLoader::get()->setNumUploadThreads(v); }, [=] { return AsyncImageLoader::get()->getNumUploadThreads(); });
+	mParams->addParam<int>("GPU Budget (MB)", [=](int v) { GpuMemoryBudget::get()->setBudget((size_t)max(0, v) * 1024 * 1024); }, [=] { return (int)(GpuMemoryBudget::get()->getBudget() / (1024 * 1024)); });
+	mParams->addParam<int>("Cache Budget (MB)", [=](int v) { AsyncImageLoader::get()->getTextureCache()->setBudget((size_t)max(0, v) * 1024 * 1024); }, [=] { return (int)(AsyncImageLoader::get()->getTextureCache()->getBudget() / (1024 * 1024)); });
+	mParams->addParam<float>("Max Callback Time (ms)", [=](float v) { AsyncImageLoader::get()->setMaxCallbackTime(v < 0 ? -1.0 : v / 1000.0); }, [=] { const double t = AsyncImageLoader::get()->getMaxCallbackTime(); return (float)(t < 0 ? -1.0 : t * 1000.0); });
+	mParams->addParam<bool>("Log Stats", [=](bool v) { AsyncImageLoader::get()->setStatsLogInterval(v ? 5.0 : 0.0); }, [=] { return AsyncImageLoader::get()->getStatsLogInterval() > 0; });
+	mParams->addParam<bool>("Mapped Reads", [=](bool v) { AsyncImageLoader::get()->setMappedReadsEnabled(v); }, [=] { return AsyncImageLoader::get()->getMappedReadsEnabled(); });
+	mParams->addButton("Benchmark Mapped Reads", [=] {
+		const auto result = MappedFile::benchmark(getAssetPath("thf_large"));
+		mBenchmarkStats = "Reads (s stream/mapped): " + to_string(result.numFiles) + " files, " + to_string(result.numBytes / (1024 * 1024)) + " MB, read " + to_string(result.streamReadSeconds) + "/" + to_string(result.mappedReadSeconds) + ", read + decode " + to_string(result.streamDecodeSeconds) + "/" + to_string(result.mappedDecodeSeconds);
+		CI_LOG_I(mBenchmarkStats);
+	});
+	mParams->addParam<bool>("Remote Assets (local server)", [=](bool v) { mRemoteAssets = v && mHttpServer->start(); }, [=] { return mRemoteAssets; });
+	mParams->addParam<float>("Server Latency (ms)", [=](float v) { mHttpServer->setLatency(max(0.0f, v) / 1000.0); }, [=] { return (float)(mHttpServer->getLatency() * 1000.0); });
+	mParams->addParam<bool>("Server Chunked", [=](bool v) { mHttpServer->setChunkedEnabled(v); }, [=] { return mHttpServer->getChunkedEnabled(); });
+	mParams->addParam<bool>("Server Keep-Alive", [=](bool v) { mHttpServer->setKeepAliveEnabled(v); }, [=] { return mHttpServer->getKeepAliveEnabled(); });
+	mParams->addButton("Clear HTTP Cache", [=] {
+		if (AsyncImageLoader::get()->getHttpFetcher()) AsyncImageLoader::get()->getHttpFetcher()->clearCache();
+		AsyncImageLoader::get()->getTextureCache()->clear(); // so the next load goes to the server again
+	});
+	mParams->addButton("Test HTTP Fetcher", [=] {
+		// fetches one asset from the local server through each code path with a separate fetcher and cache; blocks for a few round trips
+		vector<ci::fs::path> paths;
+		FileUtils::find(getAssetPath("thf_large"), [&] (const ci::fs::path & path) { paths.push_back(path); });
+
+		if (paths.empty() || !mHttpServer->start()) {
+			mBenchmarkStats = "HTTP: no assets or server not running";
+			return;
+		}
+
+		auto fetcher = make_shared<HttpFetcher>(ci::fs::temp_directory_path() / "bluecadet_http_test_cache", 2);
+		fetcher->clearCache();
+
+		const bool chunked = mHttpServer->getChunkedEnabled();
+		const bool keepAlive = mHttpServer->getKeepAliveEnabled();
+		const size_t numBytes = (size_t)ci::fs::file_size(paths.front());
+		const string url = mHttpServer->getUrl(paths.front());
+		vector<string> failures;
+
+		auto check = [&] (const string & name, const HttpFetcher::Response & response, const int status, const bool isFromCache) {
+			if (response.status != status || response.isFromCache != isFromCache || !response.body || response.body->getSize() != numBytes) {
+				failures.push_back(name + " (status " + to_string(response.status) + (response.error.empty() ? "" : ", " + response.error) + ")");
+			}
+		};
+
+		mHttpServer->setChunkedEnabled(false);
+		mHttpServer->setKeepAliveEnabled(true);
+		check("get", fetcher->fetch(url), 200, false);
+		check("etag", fetcher->fetch(url), 304, true);
+		mHttpServer->setETagsEnabled(false);
+		check("if-modified-since", fetcher->fetch(url), 304, true);
+		mHttpServer->setETagsEnabled(true);
+		fetcher->clearCache();
+		mHttpServer->setChunkedEnabled(true);
+		check("chunked", fetcher->fetch(url), 200, false);
+		mHttpServer->setChunkedEnabled(false);
+		check("redirect", fetcher->fetch(mHttpServer->getUrl(paths.front(), true)), 304, true);
+
+		const auto fetcherStats = fetcher->getStats();
+
+		if (fetcherStats.numConnectionsOpened != 1) {
+			failures.push_back("keep-alive (" + to_string(fetcherStats.numConnectionsOpened) + " connections opened)");
+		}
+
+		mHttpServer->setChunkedEnabled(chunked);
+		mHttpServer->setKeepAliveEnabled(keepAlive);
+
+		mBenchmarkStats = "HTTP fetcher: " + to_string(fetcherStats.numRequests) + " requests, " + to_string(fetcherStats.numConnectionsReused) + " reused connections, " + to_string(fetcherStats.numCacheRevalidations) + " revalidated, ";
+		if (failures.empty()) {
+			mBenchmarkStats += "all passed";
+		} else {
+			mBenchmarkStats += "failed:";
+			for (const auto & failure : failures) mBenchmarkStats += " " + failure;
+		}
+		CI_LOG_I(mBenchmarkStats);
+	});
+	mParams->addParam<bool>("PBO Uploads", [=](bool v) { AsyncImageLoader::get()->setPboUploadsEnabled(v); }, [=] { return AsyncImageLoader::get()->getPboUploadsEnabled(); });
+	mParams->addParam<bool>("CPU Mipmaps", [=](bool v) { AsyncImageLoader::get()->setCpuMipmapsEnabled(v); }, [=] { return AsyncImageLoader::get()->getCpuMipmapsEnabled(); });
+	mParams->addParam<bool>("Compressed Cache", [=](bool v) { AsyncImageLoader::get()->setCompressedTextureCache(v ? CompressedTextureCache::get() : nullptr); }, [=] { return AsyncImageLoader::get()->getCompressedTextureCache() != nullptr; });
+	mParams->addParam<bool>("Content Dedup", [=](bool v) { AsyncImageLoader::get()->setContentHashIndex(v ? ContentHashIndex::get() : nullptr); }, [=] { return AsyncImageLoader::get()->getContentHashIndex() != nullptr; });
+	mParams->addParam<bool>("Texture Pool", [=](bool v) { AsyncImageLoader::get()->setTexturePool(v ? TexturePool::get() : nullptr); }, [=] { return AsyncImageLoader::get()->getTexturePool() != nullptr; });
+	mParams->addParam<bool>("Pixel Cache", [=](bool v) { AsyncImageLoader::get()->setPixelCache(v ? PixelCache::get() : nullptr); }, [=] { return AsyncImageLoader::get()->getPixelCache() != nullptr; });
+	mParams->addButton("Clear Pixel Cache", [=] { PixelCache::get()->clear(); });
+	mParams->addButton("Benchmark Pixel Cache", [=] {
+		const auto result = PixelCache::benchmark(getAssetPath("thf_large"));
+		mBenchmarkStats = "Pixel cache: " + to_string(result.numFiles) + " files, " + to_string(result.numBytes / (1024 * 1024)) + " MB, cold decode " + to_string(result.decodeSeconds) + "s (+" + to_string(result.storeSeconds) + "s store), warm mapped " + to_string(result.mappedSeconds) + "s";
+		CI_LOG_I(mBenchmarkStats);
+	});
+	mParams->addButton("Benchmark Pixel Kernels", [=] {
+		auto format = [] (double value) { char str[16]; snprintf(str, sizeof(str), "%.1f", value); return string(str); };
+		mKernelStats = "Kernels (GB/s scalar/" + PixelKernels::getName(PixelKernels::getInstructionSet()) + "):";
+		for (const auto & result : PixelKernels::benchmark()) {
+			CI_LOG_I(result.kernel + ": " + to_string(result.scalarGBps) + " GB/s scalar, " + to_string(result.simdGBps) + " GB/s " + PixelKernels::getName(result.instructionSet));
+			mKernelStats += " " + result.kernel + " " + format(result.scalarGBps) + "/" + format(result.simdGBps);
+		}
+	}, "key=b");
+	mParams->addButton("Benchmark Pixel Buffers", [=] {
+		const auto result = PixelBufferPool::benchmark();
+		CI_LOG_I("Pixel buffers: " + to_string(result.numBytes / (1024 * 1024)) + " MB written in " + to_string(result.pooledSeconds) + "s pooled (" + to_string(result.pooledPageFaults) + " page faults), " + to_string(result.heapSeconds) + "s heap (" + to_string(result.heapPageFaults) + " page faults)");
+		mPoolBenchmark = ", benchmark pooled/heap: " + to_string(result.pooledSeconds) + "s/" + to_string(result.heapSeconds) + "s, " + to_string(result.pooledPageFaults) + "/" + to_string(result.heapPageFaults) + " faults";
+	});
+	mParams->addButton("Trim Pixel Buffers", [=] { PixelBufferPool::get()->trim(); });
+	mParams->addButton("Benchmark Uploads", [=] {
+		const auto result = PboUploader::benchmark();
+		mBenchmarkStats = "Uploads (MB/s pbo/direct): " + to_string(result.pboMegabytesPerSecond) + "/" + to_string(result.directMegabytesPerSecond) + ", frame ms avg " + to_string(result.pboFrameTimeAvg * 1000.0) + "/" + to_string(result.directFrameTimeAvg * 1000.0) + ", peak " + to_string(result.pboFrameTimePeak * 1000.0) + "/" + to_string(result.directFrameTimePeak * 1000.0);
+		CI_LOG_I(mBenchmarkStats);
+	});
+	mParams->addButton("Cancel All", [=] { AsyncImageLoader::get()->cancelAll(); mTextures.clear(); mRegions.clear(); mNumTexturesLoaded = 0; mNumTexturesToLoad = 0; }, "key=c");
 }
 
 void AsyncImageLoadingSampleApp::draw() {
@@ -72,6 +251,17 @@ void AsyncImageLoadingSampleApp::draw() {
 			cell.y += 1;
 		}
 	}
+
+	for (auto region : mRegions) {
+		vec2 pos = cell * cellSize;
+		Rectf rect(pos, pos + cellSize);
+		gl::draw(region->getTexture(), region->getArea(), rect);
+		cell.x += 1;
+		if (cell.x >= numCells.x) {
+			cell.x = 0;
+			cell.y += 1;
+		}
+	}
 	
 	vec2 size(200);
 	vec2 pos((sinf(getElapsedSeconds()) * 0.5f + 0.5f) * (vec2(getWindowSize()) - size));
@@ -82,6 +272,52 @@ void AsyncImageLoadingSampleApp::draw() {
 	gl::drawString("FPS: " + to_string(getAverageFps()), vec2(0, getWindowHeight() - 20 - 2.0f * font.getSize()), color, font);
 	gl::drawString("Loaded  " + to_string(mNumTexturesLoaded) + "/" + to_string(mNumTexturesToLoad), vec2(0, getWindowHeight() - 20 - font.getSize()), color, font);
 
+	const auto budget = GpuMemoryBudget::get();
+	gl::drawString("GPU MB: " + to_string(budget->getReservedBytes() / (1024 * 1024)) + " (peak " + to_string(budget->getPeakReservedBytes() / (1024 * 1024)) + ")", vec2(0, getWindowHeight() - 20 - 3.0f * font.getSize()), color, font);
+
+	const auto cacheStats = AsyncImageLoader::get()->getTextureCache()->getStats();
+	gl::drawString("Cache: " + to_string(cacheStats.numHits) + " hits, " + to_string(cacheStats.numMisses) + " misses, " + to_string(cacheStats.numEvictions) + " evictions", vec2(0, getWindowHeight() - 20 - 4.0f * font.getSize()), color, font);
+
+	const auto loaderStats = AsyncImageLoader::get()->getStats();
+	gl::drawString("Delivery: " + to_string(loaderStats.numPendingResults) + " pending, " + to_string(loaderStats.deliveryTimePeak * 1000.0) + "ms peak, stalls io/decode/budget: " + to_string(loaderStats.ioStallTime) + "/" + to_string(loaderStats.decodeStallTime) + "/" + to_string(loaderStats.budgetStallTime) + "s", vec2(0, getWindowHeight() - 20 - 6.0f * font.getSize()), color, font);
+
+	const auto pixelStats = PixelCache::get()->getStats();
+	gl::drawString("Load time: " + to_string(mLoadDuration) + "s, pixel cache: " + to_string(pixelStats.numHits) + " hits, " + to_string(pixelStats.numMisses) + " misses, " + to_string(pixelStats.numBytes / (1024 * 1024)) + " MB", vec2(0, getWindowHeight() - 20 - 5.0f * font.getSize()), color, font);
+
+	const auto httpStats = AsyncImageLoader::get()->getHttpFetcher() ? AsyncImageLoader::get()->getHttpFetcher()->getStats() : HttpFetcher::Stats();
+	const auto httpServerStats = mHttpServer->getStats();
+	const string serverStats = mHttpServer->isRunning() ? ", server: " + to_string(httpServerStats.numRequests) + " requests, " + to_string(httpServerStats.numNotModified) + " not modified, " + to_string(httpServerStats.numConnections) + " connections" : "";
+	gl::drawString("HTTP: " + to_string(httpStats.numRequests) + " requests, " + to_string(httpStats.numCacheRevalidations) + " revalidated, " + to_string(httpStats.numConnectionsReused) + "/" + to_string(httpStats.numConnectionsOpened) + " connections reused/opened" + serverStats, vec2(0, getWindowHeight() - 20 - 7.0f * font.getSize()), color, font);
+
+	const auto atlasStats = TextureAtlas::get()->getStats();
+	gl::drawString("Atlas: " + to_string(atlasStats.numRegions) + " regions on " + to_string(atlasStats.numPages) + " pages, " + to_string((int)(atlasStats.occupancy * 100.0f)) + "% occupied", vec2(0, getWindowHeight() - 20 - 8.0f * font.getSize()), color, font);
+
+	const auto & readLatencies = loaderStats.getLatencies(AsyncImageLoader::Stage::Read);
+	const auto & decodeLatencies = loaderStats.getLatencies(AsyncImageLoader::Stage::Decode);
+	const auto & uploadLatencies = loaderStats.getLatencies(AsyncImageLoader::Stage::Upload);
+	const auto & totalLatencies = loaderStats.getLatencies(AsyncImageLoader::Stage::Total);
+	gl::drawString("p95 ms read/decode/upload/total: " + to_string(readLatencies.getPercentile(0.95) * 1000.0) + "/" + to_string(decodeLatencies.getPercentile(0.95) * 1000.0) + "/" + to_string(uploadLatencies.getPercentile(0.95) * 1000.0) + "/" + to_string(totalLatencies.getPercentile(0.95) * 1000.0) + ", queues " + to_string(loaderStats.numPendingRequests) + "/" + to_string(loaderStats.numEncodedImages) + "/" + to_string(loaderStats.numDecodedImages), vec2(0, getWindowHeight() - 20 - 10.0f * font.getSize()), color, font);
+
+	gl::drawString("Dedup: " + to_string(loaderStats.numDeduplicated) + " shared textures, " + to_string(loaderStats.numBytesDeduplicated / (1024 * 1024)) + " MB saved", vec2(0, getWindowHeight() - 20 - 9.0f * font.getSize()), color, font);
+
+	const auto poolStats = PixelBufferPool::get()->getStats();
+	gl::drawString("Pixel buffers: " + to_string(poolStats.numReused) + "/" + to_string(poolStats.numAcquired) + " reused, " + to_string(poolStats.numAllocated) + " allocated, " + to_string(poolStats.numBytesInUse / (1024 * 1024)) + " MB in use, " + to_string(poolStats.numBytesRetained / (1024 * 1024)) + " MB retained, " + to_string(poolStats.numPageFaults) + " page faults" + mPoolBenchmark, vec2(0, getWindowHeight() - 20 - 11.0f * font.getSize()), color, font);
+
+	const auto texturePoolStats = TexturePool::get()->getStats();
+	gl::drawString("Texture pool: " + to_string(texturePoolStats.numReused) + "/" + to_string(texturePoolStats.numAcquired) + " reused, " + to_string(texturePoolStats.numIdleTextures) + " idle (" + to_string(texturePoolStats.numIdleBytes / (1024 * 1024)) + " MB), " + to_string(texturePoolStats.numDestroyed) + " destroyed", vec2(0, getWindowHeight() - 20 - 12.0f * font.getSize()), color, font);
+
+	if (mNumAnalyzed > 0) {
+		gl::drawString("CPU only: " + to_string(mNumAnalyzed) + " images analyzed, mean luminance " + to_string(mLuminanceSum / mNumAnalyzed) + ", " + to_string(AsyncSurfaceLoader::get()->getNumPendingRequests()) + " pending", vec2(0, getWindowHeight() - 20 - 14.0f * font.getSize()), color, font);
+	}
+
+	if (!mBenchmarkStats.empty()) {
+		gl::drawString(mBenchmarkStats, vec2(0, getWindowHeight() - 20 - 15.0f * font.getSize()), color, font);
+	}
+
+	if (!mKernelStats.empty()) {
+		gl::drawString(mKernelStats, vec2(0, getWindowHeight() - 20 - 13.0f * font.getSize()), color, font);
+	}
+
 	mParams->draw();
 }
 
@@ -0,0 +1,527 @@
+#include "HttpTestServer.h"
+
+#include "cinder/Log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "bluecadet/utils/FileUtils.h"
+
+#if defined(CINDER_MSW)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace ci;
+using namespace std;
+using namespace bluecadet::utils;
+
+namespace {
+	const intptr_t INVALID_SOCKET_VALUE = -1;
+	const size_t MAX_REQUEST_HEADER_SIZE = 64 * 1024;
+	const size_t CHUNK_SIZE = 16 * 1024;
+	const long POLL_INTERVAL_USEC = 100 * 1000; // how quickly threads notice that the server has been stopped
+
+#if defined(MSG_NOSIGNAL)
+	const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+	const int SEND_FLAGS = 0;
+#endif
+
+	void initializeSockets() {
+#if defined(CINDER_MSW)
+		static bool isInitialized = false;
+		static std::mutex initMutex;
+		lock_guard<mutex> lock(initMutex);
+
+		if (!isInitialized) {
+			WSADATA data;
+			isInitialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}
+#endif
+	}
+
+	std::string toLower(std::string value) {
+		transform(value.begin(), value.end(), value.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+		return value;
+	}
+
+	std::string trim(const std::string & value) {
+		const size_t start = value.find_first_not_of(" \t");
+		const size_t end = value.find_last_not_of(" \t\r");
+		return start == string::npos ? "" : value.substr(start, end - start + 1);
+	}
+
+	std::string getHeader(const std::map<std::string, std::string> & headers, const std::string & name) {
+		auto it = headers.find(name);
+		return it != headers.end() ? it->second : "";
+	}
+
+	std::string formatHttpDate(const time_t time) {
+		tm gmt;
+#if defined(CINDER_MSW)
+		gmtime_s(&gmt, &time);
+#else
+		gmtime_r(&time, &gmt);
+#endif
+		char result[64];
+		strftime(result, sizeof(result), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+		return result;
+	}
+
+	std::string encodeUrlPath(const std::string & path) {
+		static const char * HEX = "0123456789ABCDEF";
+		string result;
+
+		for (const char c : path) {
+			const unsigned char u = (unsigned char)c;
+
+			if (isalnum(u) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~') {
+				result += c;
+			} else {
+				result += '%';
+				result += HEX[u >> 4];
+				result += HEX[u & 0xf];
+			}
+		}
+
+		return result;
+	}
+
+	std::string decodeUrlPath(const std::string & path) {
+		string result;
+
+		for (size_t i = 0; i < path.size(); ++i) {
+			if (path[i] == '%' && i + 2 < path.size() && isxdigit((unsigned char)path[i + 1]) && isxdigit((unsigned char)path[i + 2])) {
+				result += (char)strtol(path.substr(i + 1, 2).c_str(), nullptr, 16);
+				i += 2;
+			} else {
+				result += path[i];
+			}
+		}
+
+		return result;
+	}
+
+	std::string getStatusText(const int status) {
+		switch (status) {
+			case 200: return "OK";
+			case 302: return "Found";
+			case 304: return "Not Modified";
+			case 404: return "Not Found";
+			case 405: return "Method Not Allowed";
+			case 500: return "Internal Server Error";
+			default: return "Unknown";
+		}
+	}
+}
+
+HttpTestServer::HttpTestServer(const ci::fs::path & rootDir, const int port) :
+	mRootDir(rootDir),
+	mPort(port),
+	mLatency(0),
+	mChunkedEnabled(false),
+	mKeepAliveEnabled(true),
+	mETagsEnabled(true),
+	mLastModifiedEnabled(true),
+	mIsRunning(false),
+	mListenSocket(INVALID_SOCKET_VALUE)
+{
+	initializeSockets();
+}
+
+HttpTestServer::~HttpTestServer() {
+	stop();
+}
+
+bool HttpTestServer::start() {
+	if (mIsRunning) {
+		return true;
+	}
+
+	mListenSocket = (Socket)::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (mListenSocket == INVALID_SOCKET_VALUE) {
+		CI_LOG_E("Could not create socket");
+		return false;
+	}
+
+	const int reuseAddress = 1;
+	setsockopt(mListenSocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuseAddress, sizeof(reuseAddress));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((uint16_t)mPort.load());
+
+	socklen_t addressLength = sizeof(address);
+
+	if (::bind(mListenSocket, (const sockaddr *)&address, sizeof(address)) != 0
+		|| ::listen(mListenSocket, SOMAXCONN) != 0
+		|| ::getsockname(mListenSocket, (sockaddr *)&address, &addressLength) != 0) {
+		CI_LOG_E("Could not listen on port " + to_string(mPort));
+		close(mListenSocket);
+		mListenSocket = INVALID_SOCKET_VALUE;
+		return false;
+	}
+
+	mPort = (int)ntohs(address.sin_port);
+	mLastModified = formatHttpDate(time(nullptr));
+	mIsRunning = true;
+	mAcceptThread = std::thread(&HttpTestServer::acceptConnections, this);
+
+	return true;
+}
+
+void HttpTestServer::stop() {
+	if (!mIsRunning) {
+		return;
+	}
+
+	mIsRunning = false;
+
+	if (mAcceptThread.joinable()) {
+		mAcceptThread.join();
+	}
+
+	close(mListenSocket);
+	mListenSocket = INVALID_SOCKET_VALUE;
+
+	// connection threads notice that the server has stopped within one poll interval
+	vector<ConnectionRef> connections;
+	{
+		lock_guard<mutex> lock(mMutex);
+		connections.swap(mConnections);
+	}
+
+	for (auto & connection : connections) {
+		if (connection->thread.joinable()) {
+			connection->thread.join();
+		}
+	}
+}
+
+std::string HttpTestServer::getUrl(const ci::fs::path & path, const bool redirect) const {
+	string relativePath = path.is_absolute() ? fs::relative(path, mRootDir).generic_string() : path.generic_string();
+	return "http://127.0.0.1:" + to_string(mPort) + (redirect ? "/redirect/" : "/") + encodeUrlPath(relativePath);
+}
+
+HttpTestServer::Stats HttpTestServer::getStats() {
+	lock_guard<mutex> lock(mMutex);
+	return mStats;
+}
+
+void HttpTestServer::resetStats() {
+	lock_guard<mutex> lock(mMutex);
+	mStats = Stats();
+}
+
+void HttpTestServer::acceptConnections() {
+	while (mIsRunning) {
+		if (!waitForData(mListenSocket)) {
+			continue;
+		}
+
+		Socket socket = (Socket)::accept(mListenSocket, nullptr, nullptr);
+
+		if (socket == INVALID_SOCKET_VALUE) {
+			continue;
+		}
+
+		const int noDelay = 1;
+		setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+#if defined(SO_NOSIGPIPE)
+		const int noSigPipe = 1;
+		setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&noSigPipe, sizeof(noSigPipe));
+#endif
+
+		auto connection = make_shared<Connection>();
+		connection->socket = socket;
+
+		lock_guard<mutex> lock(mMutex);
+		mStats.numConnections++;
+
+		// join threads of closed connections
+		for (auto it = mConnections.begin(); it != mConnections.end();) {
+			if ((*it)->isDone) {
+				(*it)->thread.join();
+				it = mConnections.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		mConnections.push_back(connection);
+		connection->thread = std::thread(&HttpTestServer::handleConnection, this, connection);
+	}
+}
+
+void HttpTestServer::handleConnection(ConnectionRef connection) {
+	const Socket socket = connection->socket;
+	std::vector<char> data;
+	bool keepAlive = true;
+
+	while (keepAlive && mIsRunning) {
+		// read until the end of the request headers
+		auto headerEnd = search(data.begin(), data.end(), "\r\n\r\n", "\r\n\r\n" + 4);
+
+		if (headerEnd == data.end()) {
+			if (data.size() > MAX_REQUEST_HEADER_SIZE) {
+				break;
+			}
+
+			if (!waitForData(socket)) {
+				continue;
+			}
+
+			char chunk[4096];
+			const auto result = ::recv(socket, chunk, (int)sizeof(chunk), 0);
+
+			if (result <= 0) {
+				break; // closed by client
+			}
+
+			data.insert(data.end(), chunk, chunk + result);
+			continue;
+		}
+
+		// parse request line and headers
+		const string head(data.begin(), headerEnd);
+		data.erase(data.begin(), headerEnd + 4);
+
+		istringstream lines(head);
+		string line;
+		getline(lines, line);
+
+		istringstream requestLine(trim(line));
+		string method, target, version;
+		requestLine >> method >> target >> version;
+
+		std::map<std::string, std::string> headers;
+
+		while (getline(lines, line)) {
+			const size_t colonPos = line.find(':');
+			if (colonPos == string::npos) continue;
+			headers[toLower(trim(line.substr(0, colonPos)))] = trim(line.substr(colonPos + 1));
+		}
+
+		const string connectionHeader = toLower(getHeader(headers, "connection"));
+		const bool clientKeepAlive = version == "HTTP/1.1" ? connectionHeader != "close" : connectionHeader == "keep-alive";
+
+		// request bodies aren't supported, so requests with one can't be followed by another on this connection
+		keepAlive = handleRequest(socket, method, target, headers) && clientKeepAlive && getHeader(headers, "content-length").empty();
+	}
+
+	close(socket);
+	connection->isDone = true;
+}
+
+bool HttpTestServer::handleRequest(const Socket socket, const std::string & method, const std::string & target, const std::map<std::string, std::string> & headers) {
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStats.numRequests++;
+	}
+
+	const double latency = mLatency;
+
+	if (latency > 0) {
+		this_thread::sleep_for(chrono::duration<double>(latency));
+	}
+
+	const bool keepAlive = mKeepAliveEnabled;
+	const vector<uint8_t> noBody;
+
+	if (method != "GET") {
+		sendResponse(socket, 405, "Allow: GET\r\n", noBody, false);
+		return false;
+	}
+
+	// strip query and fragment
+	string path = decodeUrlPath(target.substr(0, target.find_first_of("?#")));
+
+	const string redirectPrefix = "/redirect/";
+
+	if (path.compare(0, redirectPrefix.size(), redirectPrefix) == 0) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.numRedirects++;
+		}
+
+		const string location = target.substr(redirectPrefix.size() - 1);
+		return sendResponse(socket, 302, "Location: " + location + "\r\n", noBody, keepAlive);
+	}
+
+	// only serve files inside the root dir
+	const fs::path relativePath = fs::path(path).relative_path();
+	const fs::path filePath = mRootDir / relativePath;
+	bool isValid = !relativePath.empty();
+
+	for (const auto & part : relativePath) {
+		isValid = isValid && part != "..";
+	}
+
+	try {
+		isValid = isValid && fs::is_regular_file(filePath);
+	} catch (...) {
+		isValid = false;
+	}
+
+	if (!isValid) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.numNotFound++;
+		}
+
+		const string message = "Not found";
+		return sendResponse(socket, 404, "Content-Type: text/plain\r\n", vector<uint8_t>(message.begin(), message.end()), keepAlive);
+	}
+
+	// validators
+	stringstream validatorHeaders;
+	bool isNotModified = false;
+
+	if (mETagsEnabled) {
+		stringstream etag;
+		etag << "\"" << hex << fs::file_size(filePath) << "-" << FileUtils::getModificationTime(filePath) << "\"";
+		validatorHeaders << "ETag: " << etag.str() << "\r\n";
+
+		const string ifNoneMatch = getHeader(headers, "if-none-match");
+		isNotModified = !ifNoneMatch.empty() && (ifNoneMatch == etag.str() || ifNoneMatch == "*");
+	}
+
+	if (mLastModifiedEnabled) {
+		validatorHeaders << "Last-Modified: " << mLastModified << "\r\n";
+
+		// if-modified-since is ignored if the request has an if-none-match header
+		if (!mETagsEnabled || getHeader(headers, "if-none-match").empty()) {
+			isNotModified = isNotModified || getHeader(headers, "if-modified-since") == mLastModified;
+		}
+	}
+
+	if (isNotModified) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.numNotModified++;
+		}
+
+		return sendResponse(socket, 304, validatorHeaders.str(), noBody, keepAlive);
+	}
+
+	ifstream file(filePath.string(), ios::binary | ios::ate);
+	vector<uint8_t> body(file ? (size_t)file.tellg() : 0);
+	file.seekg(0);
+	file.read((char *)body.data(), body.size());
+
+	if (!file) {
+		const string message = "Could not read file";
+		sendResponse(socket, 500, "Content-Type: text/plain\r\n", vector<uint8_t>(message.begin(), message.end()), false);
+		return false;
+	}
+
+	return sendResponse(socket, 200, validatorHeaders.str() + "Content-Type: application/octet-stream\r\n", body, keepAlive);
+}
+
+bool HttpTestServer::sendResponse(const Socket socket, const int status, const std::string & headers, const std::vector<uint8_t> & body, const bool keepAlive) {
+	const bool hasBody = status != 304 && status != 204;
+	const bool isChunked = hasBody && mChunkedEnabled;
+
+	stringstream head;
+	head << "HTTP/1.1 " << status << " " << getStatusText(status) << "\r\n";
+	head << headers;
+	head << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n";
+
+	if (isChunked) {
+		head << "Transfer-Encoding: chunked\r\n";
+	} else if (hasBody) {
+		head << "Content-Length: " << body.size() << "\r\n";
+	}
+
+	head << "\r\n";
+
+	const string headString = head.str();
+
+	if (!send(socket, headString.data(), headString.size())) {
+		return false;
+	}
+
+	if (isChunked) {
+		for (size_t offset = 0; offset < body.size(); offset += CHUNK_SIZE) {
+			const size_t numBytes = min(CHUNK_SIZE, body.size() - offset);
+
+			stringstream chunkSize;
+			chunkSize << hex << numBytes << "\r\n";
+
+			if (!send(socket, chunkSize.str().data(), chunkSize.str().size())
+				|| !send(socket, (const char *)body.data() + offset, numBytes)
+				|| !send(socket, "\r\n", 2)) {
+				return false;
+			}
+		}
+
+		if (!send(socket, "0\r\n\r\n", 5)) {
+			return false;
+		}
+
+	} else if (hasBody && !body.empty()) {
+		if (!send(socket, (const char *)body.data(), body.size())) {
+			return false;
+		}
+	}
+
+	if (hasBody) {
+		lock_guard<mutex> lock(mMutex);
+		mStats.numBytesSent += body.size();
+	}
+
+	return keepAlive;
+}
+
+bool HttpTestServer::waitForData(const Socket socket) const {
+	fd_set sockets;
+	FD_ZERO(&sockets);
+	FD_SET(socket, &sockets);
+
+	timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = POLL_INTERVAL_USEC;
+
+	return ::select((int)socket + 1, &sockets, nullptr, nullptr, &timeout) > 0 && mIsRunning;
+}
+
+bool HttpTestServer::send(const Socket socket, const char * data, const size_t numBytes) {
+	size_t numSent = 0;
+
+	while (numSent < numBytes) {
+		const auto result = ::send(socket, data + numSent, (int)(numBytes - numSent), SEND_FLAGS);
+
+		if (result <= 0) {
+			return false;
+		}
+
+		numSent += (size_t)result;
+	}
+
+	return true;
+}
+
+void HttpTestServer::close(const Socket socket) {
+#if defined(CINDER_MSW)
+	closesocket((SOCKET)socket);
+#else
+	::close((int)socket);
+#endif
+}
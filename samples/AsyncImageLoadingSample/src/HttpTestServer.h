@@ -0,0 +1,115 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::shared_ptr<class HttpTestServer> HttpTestServerRef;
+
+//! Local stand-in HTTP/1.1 server to test HttpFetcher and remote loading via AsyncImageLoader without a network.
+//!
+//! Serves the files in a directory on 127.0.0.1 by their path relative to that directory. Requests to /redirect/<path>
+//! are answered with a 302 redirect to /<path>. Connections are kept alive unless disabled and bodies can be sent with
+//! chunked transfer encoding. Responses carry an ETag (derived from each file's size and modification time) and/or a
+//! Last-Modified header (the time the server was started), and matching If-None-Match/If-Modified-Since requests are
+//! answered with 304 Not Modified. Each response can be delayed to simulate a slow or distant server.
+//!
+//! Each connection is handled on its own thread. Settings can be changed while the server is running and apply to
+//! subsequent requests. Not intended for production use.
+class HttpTestServer {
+
+public:
+	struct Stats {
+		size_t numConnections = 0;		//! Connections accepted
+		size_t numRequests = 0;
+		size_t numNotModified = 0;		//! Requests answered with 304 Not Modified
+		size_t numRedirects = 0;
+		size_t numNotFound = 0;
+		size_t numBytesSent = 0;		//! Body bytes sent
+	};
+
+	//! rootDir: Directory whose files are served. port: Port to listen on; 0 picks a free port (see getPort()).
+	HttpTestServer(const ci::fs::path & rootDir, const int port = 0);
+	~HttpTestServer();
+
+	//! Starts listening on 127.0.0.1. Returns false if the port couldn't be bound.
+	bool start();
+
+	//! Closes all connections and waits for their threads to finish.
+	void stop();
+
+	bool isRunning() const { return mIsRunning; }
+
+	//! The port the server is listening on. Only valid while running.
+	int getPort() const { return mPort; }
+
+	//! Url of a file in the root dir. If redirect is true, the url is answered with a redirect to the file.
+	std::string getUrl(const ci::fs::path & path, const bool redirect = false) const;
+
+	//! Seconds to wait before each response is sent. Default is 0.
+	void setLatency(const double value) { mLatency = value; }
+	double getLatency() const { return mLatency; }
+
+	//! Sends bodies with chunked transfer encoding instead of a Content-Length header. Default is false.
+	void setChunkedEnabled(const bool value) { mChunkedEnabled = value; }
+	bool getChunkedEnabled() const { return mChunkedEnabled; }
+
+	//! Keeps connections open after each response. If disabled, each response closes its connection. Default is true.
+	void setKeepAliveEnabled(const bool value) { mKeepAliveEnabled = value; }
+	bool getKeepAliveEnabled() const { return mKeepAliveEnabled; }
+
+	//! Sends ETag headers and answers matching If-None-Match requests with 304. Default is true.
+	void setETagsEnabled(const bool value) { mETagsEnabled = value; }
+	bool getETagsEnabled() const { return mETagsEnabled; }
+
+	//! Sends Last-Modified headers and answers matching If-Modified-Since requests with 304. Default is true.
+	void setLastModifiedEnabled(const bool value) { mLastModifiedEnabled = value; }
+	bool getLastModifiedEnabled() const { return mLastModifiedEnabled; }
+
+	const ci::fs::path & getRootDir() const { return mRootDir; }
+
+	Stats getStats();
+	void resetStats();
+
+protected:
+	typedef intptr_t Socket;
+
+	struct Connection {
+		Socket socket;
+		std::thread thread;
+		std::atomic<bool> isDone{ false };
+	};
+	typedef std::shared_ptr<Connection> ConnectionRef;
+
+	void acceptConnections();
+	void handleConnection(ConnectionRef connection);
+	bool handleRequest(const Socket socket, const std::string & method, const std::string & target, const std::map<std::string, std::string> & headers); // returns false if the connection should be closed
+
+	bool sendResponse(const Socket socket, const int status, const std::string & headers, const std::vector<uint8_t> & body, const bool keepAlive);
+	bool waitForData(const Socket socket) const; // false if the server has been stopped
+	static bool send(const Socket socket, const char * data, const size_t numBytes);
+	static void close(const Socket socket);
+
+	ci::fs::path mRootDir;
+	std::atomic<int> mPort;
+	std::string mLastModified; // http date of when the server was started
+
+	std::atomic<double> mLatency;
+	std::atomic<bool> mChunkedEnabled;
+	std::atomic<bool> mKeepAliveEnabled;
+	std::atomic<bool> mETagsEnabled;
+	std::atomic<bool> mLastModifiedEnabled;
+
+	std::atomic<bool> mIsRunning;
+	Socket mListenSocket;
+	std::thread mAcceptThread;
+
+	std::mutex mMutex;
+	std::vector<ConnectionRef> mConnections;
+	Stats mStats;
+};
@@ -0,0 +1,272 @@
+#include "AssetArchive.h"
+
+#include "cinder/Log.h"
+
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		const char * MAGIC = "BCAA";
+		const uint32_t VERSION = 1;
+		const uint64_t PAYLOAD_ALIGNMENT = 64; // keeps pixel rows of all entries cache line aligned
+	}
+
+	//==================================================
+	// Writer
+	//
+
+	AssetArchive::Writer::Writer(const ci::fs::path & archivePath) :
+		mArchivePath(archivePath)
+	{
+		static_assert(sizeof(Header) == 64, "AssetArchive::Header needs to keep payloads 64 byte aligned");
+		static_assert(sizeof(IndexEntry) == 40, "AssetArchive::IndexEntry must not be padded");
+
+		// write to a temp file first so that readers never see partial archives
+		stringstream tempFilename;
+		tempFilename << archivePath.filename().string() << "." << std::hash<std::thread::id>()(this_thread::get_id()) << ".tmp";
+		mTempPath = archivePath.parent_path() / tempFilename.str();
+
+		try {
+			if (!archivePath.parent_path().empty()) {
+				fs::create_directories(archivePath.parent_path());
+			}
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not create dir for asset archive at '" + archivePath.string() + "'", e);
+		}
+
+		mFile.open(mTempPath.string(), ios::binary | ios::trunc);
+
+		// header is written by finish() once the index offset is known
+		Header header;
+		memset(&header, 0, sizeof(Header));
+		mFile.write((const char *)&header, sizeof(Header));
+		mNumBytes = sizeof(Header);
+
+		if (!mFile) {
+			CI_LOG_E("Could not write asset archive at '" + mTempPath.string() + "'");
+		}
+	}
+
+	AssetArchive::Writer::~Writer() {
+		if (mIsFinished) {
+			return;
+		}
+
+		mFile.close();
+
+		try {
+			fs::remove(mTempPath);
+		} catch (...) {}
+	}
+
+	bool AssetArchive::Writer::addPixels(const std::string & key, const uint8_t * pixels, const int width, const int height, const bool hasAlpha) {
+		if (!pixels || width <= 0 || height <= 0) {
+			return false;
+		}
+
+		Entry entry;
+		entry.key = key;
+		entry.encoding = Encoding::Rgba;
+		entry.width = width;
+		entry.height = height;
+		entry.hasAlpha = hasAlpha;
+		entry.numBytes = (uint64_t)width * height * 4;
+		return addEntry(entry, pixels);
+	}
+
+	bool AssetArchive::Writer::addDds(const std::string & key, const ci::BufferRef & dds, const bool hasAlpha) {
+		if (!dds || dds->getSize() == 0) {
+			return false;
+		}
+
+		Entry entry;
+		entry.key = key;
+		entry.encoding = Encoding::Dds;
+		entry.hasAlpha = hasAlpha;
+		entry.numBytes = dds->getSize();
+		return addEntry(entry, dds->getData());
+	}
+
+	bool AssetArchive::Writer::addEntry(Entry entry, const void * data) {
+		if (mIsFinished || !mFile) {
+			return false;
+		}
+
+		// pad to the next aligned offset
+		static const char padding[PAYLOAD_ALIGNMENT] = {0};
+		const uint64_t numPaddingBytes = (PAYLOAD_ALIGNMENT - mNumBytes % PAYLOAD_ALIGNMENT) % PAYLOAD_ALIGNMENT;
+		mFile.write(padding, numPaddingBytes);
+
+		entry.offset = mNumBytes + numPaddingBytes;
+		mFile.write((const char *)data, entry.numBytes);
+
+		if (!mFile) {
+			CI_LOG_E("Could not write '" + entry.key + "' to asset archive at '" + mTempPath.string() + "'");
+			return false;
+		}
+
+		mNumBytes = entry.offset + entry.numBytes;
+		mEntries.push_back(entry);
+		return true;
+	}
+
+	bool AssetArchive::Writer::finish() {
+		if (mIsFinished || !mFile) {
+			return false;
+		}
+
+		Header header;
+		memset(&header, 0, sizeof(Header));
+		memcpy(header.magic, MAGIC, 4);
+		header.version = VERSION;
+		header.numEntries = (uint32_t)mEntries.size();
+		header.indexOffset = mNumBytes;
+
+		for (const auto & entry : mEntries) {
+			IndexEntry indexEntry;
+			memset(&indexEntry, 0, sizeof(IndexEntry));
+			indexEntry.offset = entry.offset;
+			indexEntry.numBytes = entry.numBytes;
+			indexEntry.width = (uint32_t)entry.width;
+			indexEntry.height = (uint32_t)entry.height;
+			indexEntry.encoding = (uint32_t)entry.encoding;
+			indexEntry.hasAlpha = entry.hasAlpha ? 1 : 0;
+			indexEntry.keyLength = (uint32_t)entry.key.size();
+
+			mFile.write((const char *)&indexEntry, sizeof(IndexEntry));
+			mFile.write(entry.key.data(), entry.key.size());
+			header.indexSize += sizeof(IndexEntry) + entry.key.size();
+		}
+
+		mFile.seekp(0);
+		mFile.write((const char *)&header, sizeof(Header));
+		mFile.close();
+
+		try {
+			if (mFile.fail()) {
+				throw ci::Exception("Could not write file");
+			}
+
+			fs::rename(mTempPath, mArchivePath);
+			mNumBytes += header.indexSize;
+			mIsFinished = true;
+			return true;
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not write asset archive at '" + mArchivePath.string() + "'", e);
+		}
+
+		try {
+			fs::remove(mTempPath);
+		} catch (...) {}
+
+		return false;
+	}
+
+	//==================================================
+	// Reader
+	//
+
+	AssetArchiveRef AssetArchive::open(const ci::fs::path & archivePath) {
+		// payloads are read front to back when all assets are loaded at once
+		auto file = MappedFile::create(archivePath, MappedFile::Access::Sequential);
+
+		if (!file) {
+			return nullptr;
+		}
+
+		AssetArchiveRef archive(new AssetArchive(file));
+
+		if (!archive->readIndex()) {
+			CI_LOG_E("Invalid asset archive at '" + archivePath.string() + "'");
+			return nullptr;
+		}
+
+		return archive;
+	}
+
+	AssetArchive::AssetArchive(MappedFileRef file) :
+		mFile(file)
+	{
+	}
+
+	bool AssetArchive::readIndex() {
+		const uint8_t * data = mFile->getData();
+		const uint64_t size = mFile->getSize();
+
+		if (size < sizeof(Header)) {
+			return false;
+		}
+
+		Header header;
+		memcpy(&header, data, sizeof(Header));
+
+		if (memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION
+			|| header.indexOffset < sizeof(Header) || header.indexOffset > size || header.indexSize > size - header.indexOffset
+			|| header.numEntries > header.indexSize / sizeof(IndexEntry)) {
+			// each entry needs at least one index record, so a corrupt count can't make us reserve more than the index holds
+			return false;
+		}
+
+		const uint8_t * index = data + header.indexOffset;
+		uint64_t indexPos = 0;
+
+		mEntries.reserve(header.numEntries);
+
+		for (uint32_t i = 0; i < header.numEntries; ++i) {
+			if (header.indexSize - indexPos < sizeof(IndexEntry)) {
+				return false;
+			}
+
+			IndexEntry indexEntry;
+			memcpy(&indexEntry, index + indexPos, sizeof(IndexEntry));
+			indexPos += sizeof(IndexEntry);
+
+			const bool isRgba = indexEntry.encoding == (uint32_t)Encoding::Rgba;
+			const bool isValid = (isRgba || indexEntry.encoding == (uint32_t)Encoding::Dds)
+				&& header.indexSize - indexPos >= indexEntry.keyLength
+				&& indexEntry.offset >= sizeof(Header) && indexEntry.offset % PAYLOAD_ALIGNMENT == 0
+				&& indexEntry.offset <= header.indexOffset && indexEntry.numBytes <= header.indexOffset - indexEntry.offset
+				&& (!isRgba || (indexEntry.width > 0 && indexEntry.height > 0 && indexEntry.numBytes >= (uint64_t)indexEntry.width * indexEntry.height * 4));
+
+			if (!isValid) {
+				return false;
+			}
+
+			Entry entry;
+			entry.key.assign((const char *)index + indexPos, indexEntry.keyLength);
+			entry.encoding = (Encoding)indexEntry.encoding;
+			entry.width = (int)indexEntry.width;
+			entry.height = (int)indexEntry.height;
+			entry.hasAlpha = indexEntry.hasAlpha != 0;
+			entry.offset = indexEntry.offset;
+			entry.numBytes = indexEntry.numBytes;
+			indexPos += indexEntry.keyLength;
+
+			mEntryIndices[entry.key] = mEntries.size();
+			mEntries.push_back(entry);
+		}
+
+		return true;
+	}
+
+	const AssetArchive::Entry * AssetArchive::findEntry(const std::string & key) const {
+		auto it = mEntryIndices.find(key);
+		return it != mEntryIndices.end() ? &mEntries[it->second] : nullptr;
+	}
+
+	ci::BufferRef AssetArchive::getBuffer(const Entry & entry) {
+		// buffer doesn't own the data and holds on to the archive instead
+		auto self = shared_from_this();
+		return ci::BufferRef(new Buffer((void *)getData(entry), (size_t)entry.numBytes), [self](Buffer * buffer) { delete buffer; });
+	}
+
+}
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class AssetArchive> AssetArchiveRef;
+
+//! Single file that packs the pixels of many images, so that apps can load all of their assets with a few large sequential
+//! reads instead of opening, stat-ing and decoding thousands of small files on each start.
+//!
+//! Archives are created once by a build step via Writer (or ImageManager::buildArchive()) and memory-mapped when opened.
+//! Each entry is either tightly packed RGBA pixels or a block-compressed DDS file and is looked up by the same key that
+//! ImageManager would use for the source file. Payloads are stored back to back in the order they were added, followed
+//! by an index of keys, offsets and formats. Archives aren't invalidated when their sources change and need to be rebuilt.
+//! Reading and writing don't require GL.
+class AssetArchive : public std::enable_shared_from_this<AssetArchive> {
+
+public:
+	enum class Encoding {
+		Rgba,	//! width x height tightly packed RGBA pixels
+		Dds		//! DDS file with DXT1/DXT5 blocks (see CompressedTextureCache::createDds())
+	};
+
+	struct Entry {
+		std::string key;
+		Encoding encoding = Encoding::Rgba;
+		int width = 0;
+		int height = 0;
+		bool hasAlpha = true;
+		uint64_t offset = 0;	//! Offset of the payload from the start of the archive
+		uint64_t numBytes = 0;	//! Size of the payload
+	};
+
+	//! Writes an archive. Entries are written to a temp file as they're added and the file is moved to its final path
+	//! by finish(), so readers never see partial archives. Not thread-safe.
+	class Writer {
+	public:
+		Writer(const ci::fs::path & archivePath);
+		~Writer();
+
+		//! Appends width x height RGBA pixels under key. Returns false on failure.
+		bool addPixels(const std::string & key, const uint8_t * pixels, const int width, const int height, const bool hasAlpha);
+
+		//! Appends a DDS file under key. Returns false on failure.
+		bool addDds(const std::string & key, const ci::BufferRef & dds, const bool hasAlpha);
+
+		//! Writes the index and moves the archive to its final path. Returns false on failure, in which case nothing is written.
+		bool finish();
+
+		size_t getNumEntries() const { return mEntries.size(); }
+		uint64_t getNumBytes() const { return mNumBytes; }
+
+	protected:
+		bool addEntry(Entry entry, const void * data);
+
+		ci::fs::path mArchivePath;
+		ci::fs::path mTempPath;
+		std::ofstream mFile;
+		std::vector<Entry> mEntries;
+		uint64_t mNumBytes = 0;
+		bool mIsFinished = false;
+	};
+
+	//! Maps the archive at archivePath and reads its index. Returns nullptr if it doesn't exist or isn't a valid archive.
+	static AssetArchiveRef open(const ci::fs::path & archivePath);
+
+	//! All entries in the order they were added, which is also the order of their payloads in the archive.
+	const std::vector<Entry> & getEntries() const { return mEntries; }
+
+	//! Returns the entry for key or nullptr if there is none. If several entries share a key, the last one is returned.
+	const Entry * findEntry(const std::string & key) const;
+
+	//! Pointer to an entry's payload in the mapped archive. Valid as long as this archive exists.
+	const uint8_t * getData(const Entry & entry) const { return mFile->getData() + entry.offset; }
+
+	//! Buffer that points to an entry's payload without copying it and keeps this archive mapped while referenced.
+	//! DDS entries can be passed to ci::gl::Texture2d::createFromDds() via ci::DataSourceBuffer::create().
+	ci::BufferRef getBuffer(const Entry & entry);
+
+	//! Asks the OS to start reading the whole archive in the background.
+	void prefetch() { mFile->advise(MappedFile::Access::WillNeed); }
+
+	const ci::fs::path & getPath() const { return mFile->getPath(); }
+	size_t getNumBytes() const { return mFile->getSize(); }
+
+protected:
+	//! Header at the start of each archive. The first payload follows at an offset of sizeof(Header).
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t numEntries;
+		uint32_t reserved;
+		uint64_t indexOffset;
+		uint64_t indexSize;
+		uint8_t padding[32];
+	};
+
+	//! Fixed size part of each index entry. Followed by keyLength bytes of the key.
+	struct IndexEntry {
+		uint64_t offset;
+		uint64_t numBytes;
+		uint32_t width;
+		uint32_t height;
+		uint32_t encoding;
+		uint32_t hasAlpha;
+		uint32_t keyLength;
+		uint32_t reserved;
+	};
+
+	AssetArchive(MappedFileRef file);
+
+	bool readIndex();
+
+	MappedFileRef mFile;
+	std::vector<Entry> mEntries;
+	std::map<std::string, size_t> mEntryIndices;
+};
+
+}
+}
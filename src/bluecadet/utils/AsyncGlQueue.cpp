@@ -5,6 +5,8 @@
 #include "cinder/Filesystem.h"
 #include "cinder/imageIo.h"
 
+#include <chrono>
+
 using namespace ci;
 using namespace ci::app;
 using namespace std;
@@ -12,158 +14,195 @@ using namespace std;
 namespace bluecadet {
 namespace utils {
 	
-	// Static properties
-	bool AsyncGlQueue::sIsInitialized = false;
-	std::mutex AsyncGlQueue::mInitializationMutex;
-
-	AsyncGlQueue::AsyncGlQueue(const unsigned int numThreads, const unsigned int queueSize) :
+	AsyncGlQueue::AsyncGlQueue(const unsigned int numThreads, const unsigned int queueSize, GlWorkerPoolRef pool) :
 		mNumThreads(numThreads),
-		mProcessing(max(mNumThreads * 2, queueSize)),
-		mCompleted(max(mNumThreads * 2, queueSize))
+		mQueueSize(max(numThreads * 2, queueSize)),
+		mPool(pool ? pool : GlWorkerPool::get()),
+		mMemoryBudget(GpuMemoryBudget::get()),
+		mCompleted(max(numThreads * 2, queueSize))
 	{
+		mClientId = mPool->addClient(mNumThreads);
+		mPool->requireNumThreads(mNumThreads);
 	}
 	
 	AsyncGlQueue::~AsyncGlQueue() {
-		mProcessing.cancel();
+		mSignalConnections.clear();
+		// drops pending tasks and waits for running ones
+		mPool->removeClient(mClientId);
 		mCompleted.cancel();
-		mThreadsAreAlive = false;
-		for (auto thread : mThreads) {
-			thread->join();
-		}
+
+		// release bytes of tasks that were dropped or whose callbacks haven't been triggered
+		mMemoryBudget->release(mNumBytesReserved.exchange(0));
 	}
 
-	void AsyncGlQueue::run(Task task, Callback optCallback) {
+	void AsyncGlQueue::setNumThreads(const unsigned int value) {
+		mNumThreads = value;
+		mPool->setMaxConcurrency(mClientId, mNumThreads);
+		mPool->requireNumThreads(mNumThreads);
+	}
+
+	void AsyncGlQueue::run(Task task, Callback optCallback, const size_t estimatedBytes) {
 		setup();
-		mTodos.push_back(TaskInfo(task, optCallback));
+		mTodos.push_back(TaskInfo(task, optCallback, estimatedBytes));
 	}
 
 	void AsyncGlQueue::cancelAll() {
+		mTodos.clear();
+		mPool->cancelAll(mClientId);
+
+		{
+			// jobs that have been popped by a worker but not started yet will find their task gone and skip it
+			lock_guard<mutex> lock(mAdmittedMutex);
+			for (const auto & it : mAdmittedTasks) {
+				mNumProcessing--;
+				releaseBytes(it.second);
+			}
+			mAdmittedTasks.clear();
+		}
+
 		TaskInfo info;
-		while (mCompleted.tryPopBack(&info)) {}
+		while (mCompleted.tryPopBack(&info)) {
+			mNumCompleted--;
+			releaseBytes(info);
+		}
 	}
 
-	void AsyncGlQueue::threadLoop(ci::gl::ContextRef context) {
-		ci::ThreadSetup threadSetup;
-
-		context->makeCurrent();
-		initializeLoader();
-
-		while (mThreadsAreAlive) {
-			try {
-
-				TaskInfo info;
-
-				mProcessing.popBack(&info);
+	void AsyncGlQueue::releaseBytes(const TaskInfo & info) {
+		if (info.numBytes > 0) {
+			mNumBytesReserved -= info.numBytes;
+			mMemoryBudget->release(info.numBytes);
+		}
+	}
 
-				if (!mThreadsAreAlive) {
-					return;
-				}
+	AsyncGlQueue::Stats AsyncGlQueue::getStats() const {
+		Stats stats = mStats;
+		stats.numPending = mTodos.size();
+		stats.numProcessing = mNumProcessing;
+		stats.numCompleted = mNumCompleted;
+		stats.numBytesReserved = mNumBytesReserved;
+		return stats;
+	}
 
-				if (!info.task) {
-					CI_LOG_E("Could not fetch new task");
-					continue;
-				}
+	void AsyncGlQueue::runTask(const size_t taskId) {
+		TaskInfo info;
 
-				// execute task
-				info.task();
+		{
+			lock_guard<mutex> lock(mAdmittedMutex);
+			auto it = mAdmittedTasks.find(taskId);
 
-				// create fence after all gpu commands
-				auto fence = gl::Sync::create();
+			if (it == mAdmittedTasks.end()) {
+				return; // canceled
+			}
 
-				// waits until fence has been executed
-				fence->clientWaitSync();
+			info = it->second;
+			mAdmittedTasks.erase(it);
+		}
 
-				info.isCompleted = true;
+		try {
+			// execute task
+			info.task();
 
-				if (!mThreadsAreAlive) {
-					return;
-				}
+			// waits until all gpu commands have been executed
+			mPool->getBackend()->finish();
 
-				// queue for completion
-				mCompleted.pushFront(info);
+			info.isCompleted = true;
 
-			}
-			catch (ci::Exception e) {
-				CI_LOG_EXCEPTION("Could not run task", e);
-			}
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not run task", e);
 		}
+
+		// queue for completion; never blocks since admissions are limited to the queue size
+		mNumProcessing--;
+		mNumCompleted++;
+		mCompleted.pushFront(info);
 	}
 
 	void AsyncGlQueue::setup() {
-		// only set up if # threads has changed
-		if (mNumThreads == mThreads.size()) {
+		// only connect to update loop once
+		if (mIsSetup) {
 			return;
 		}
 
-		// initialize from primary thread
-		App::get()->dispatchSync([=] {
-			
-			// Save current VAO to prevent crashes from calling setup multiple times from params
-			gl::Context::getCurrent()->pushVao();
-
-			try {
-				mSignalConnections.clear();
+		mIsSetup = true;
+		mSignalConnections += mPool->getBackend()->connectUpdate(bind(&AsyncGlQueue::processTasks, this));
+	}
 
-				mThreadsAreAlive = false;
-				//mTodoLock.notify_all();
-				for (auto thread : mThreads) {
-					thread->join();
-				}
-				mThreads.clear();
-				mBackgroundContexts.clear();
-				mThreadsAreAlive = true;
+	void AsyncGlQueue::processTasks() {
+		typedef std::chrono::steady_clock Clock;
 
-				for (unsigned int i = 0; i < mNumThreads; ++i) {
-					auto context = gl::Context::create(gl::Context::getCurrent());
-					mBackgroundContexts.insert(context);
+		// todos
+		size_t numAdmitted = 0;
+		bool isHeldBackByBudget = false;
+		while (!mTodos.empty()) {
+			if (mMaxAdmissionsPerFrame >= 0 && numAdmitted >= (size_t)mMaxAdmissionsPerFrame) {
+				break; // carry over remaining todos to next frame
+			}
 
-					auto thread = make_shared<std::thread>(bind(&AsyncGlQueue::threadLoop, this, context));
-					mThreads.insert(thread);
-				}
+			if (mNumProcessing + mNumCompleted >= mQueueSize) {
+				break; // carry over remaining todos until completed tasks have been processed
+			}
 
-				mSignalConnections += App::get()->getSignalUpdate().connect(bind(&AsyncGlQueue::processTasks, this));
+			const TaskInfo & info = mTodos.back();
 
-			} catch (std::exception & e) {
-				CI_LOG_EXCEPTION("Error in setup", e);
+			if (info.numBytes > 0 && !mMemoryBudget->tryReserve(info.numBytes)) {
+				isHeldBackByBudget = true;
+				break; // hold back remaining todos until memory has been released
 			}
 
-			// Restore previous VAO to prevent crashes from calling setup multiple times from params
-			gl::Context::getCurrent()->popVao();
-		});
-	}
+			mNumProcessing++;
+			mNumBytesReserved += info.numBytes;
+
+			if (info.task) {
+				const size_t taskId = mNumTasksAdmitted++;
+				{
+					lock_guard<mutex> lock(mAdmittedMutex);
+					mAdmittedTasks[taskId] = info;
+				}
+				mPool->submit(mClientId, bind(&AsyncGlQueue::runTask, this, taskId));
+			} else {
+				CI_LOG_E("Could not run empty task");
+				mNumProcessing--;
+				mNumCompleted++;
+				mCompleted.pushFront(info);
+			}
 
-	void AsyncGlQueue::processTasks() {
-		// todos
-		while (!mTodos.empty() && mProcessing.tryPushFront(mTodos.back())) {
 			mTodos.pop_back();
+			numAdmitted++;
 		}
 
 		// completed
+		const auto startTime = Clock::now();
+		double elapsedTime = 0;
+		size_t numCallbacks = 0;
 		TaskInfo info;
-		while (mCompleted.tryPopBack(&info)) {
+
+		while (mMaxCallbacksPerFrame < 0 || numCallbacks < (size_t)mMaxCallbacksPerFrame) {
+			if (!mCompleted.tryPopBack(&info)) {
+				break;
+			}
+
+			mNumCompleted--;
+			numCallbacks++;
+
 			if (info.callback) {
 				info.callback(info.isCompleted, info.isCanceled);
 			}
-		}
-	}
 
-	void AsyncGlQueue::initializeLoader() {
-		lock_guard<mutex> lock(mInitializationMutex);
+			releaseBytes(info);
 
-		if (sIsInitialized) {
-			return;
-		}
+			elapsedTime = std::chrono::duration<double>(Clock::now() - startTime).count();
 
-		App::get()->dispatchSync([=] {
-			try {
-				// load empty image to initialize Cinder's internal load factory on the main thread
-				CI_LOG_D("Initializing Cinder loader");
-				ci::loadImage("");
-			} catch (Exception e) {
+			if (mMaxCallbackTime >= 0.0 && elapsedTime >= mMaxCallbackTime) {
+				break; // carry over remaining callbacks to next frame
 			}
-			sIsInitialized = true;
-		});
+		}
+
+		mStats.numAdmittedLastFrame = numAdmitted;
+		mStats.isHeldBackByBudget = isHeldBackByBudget;
+		mStats.numCallbacksLastFrame = numCallbacks;
+		mStats.callbackTimeLastFrame = elapsedTime;
+		mStats.callbackTimePeak = max(mStats.callbackTimePeak, elapsedTime);
 	}
-	
+
 }
 }
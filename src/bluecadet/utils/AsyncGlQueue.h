@@ -6,6 +6,11 @@
 #include "cinder/gl/Texture.h"
 #include "cinder/ConcurrentCircularBuffer.h"
 
+#include <map>
+#include <mutex>
+
+#include "GlWorkerPool.h"
+#include "GpuMemoryBudget.h"
 #include "ThreadedTaskQueue.h"
 #include "TimedTaskQueue.h"
 
@@ -29,43 +34,100 @@ public:
 	typedef std::function<void(bool completed, bool canceled)> Callback;
 
 	struct TaskInfo {
-		TaskInfo(Task task = nullptr, Callback callback = nullptr) : task(task), callback(callback) {};
-		Task task = nullptr;			//! This will be called on a GL sub-thread
+		TaskInfo(Task task = nullptr, Callback callback = nullptr, size_t numBytes = 0) : task(task), callback(callback), numBytes(numBytes) {};
+		Task task = nullptr;			//! This will be called on a GL sub-thread. Use PboUploader::getForCurrentThread() to stream pixel data.
 		Callback callback = nullptr;	//! This will be called on the main thread
+		size_t numBytes = 0;			//! Estimated GPU memory used by this task
 		bool isCompleted = false;
 		bool isCanceled = false;
 	};
+
+	//! Snapshot of the queue's backlog. Useful for tuning the per-frame budgets against frame time targets.
+	struct Stats {
+		size_t numPending = 0;				//! Tasks that haven't been admitted to worker threads yet
+		size_t numProcessing = 0;			//! Tasks that have been admitted but haven't completed yet
+		size_t numCompleted = 0;			//! Completed tasks whose callbacks haven't been triggered yet
+		size_t numBytesReserved = 0;		//! Estimated GPU memory reserved by admitted tasks whose callbacks haven't been triggered yet
+		bool isHeldBackByBudget = false;	//! True if pending tasks couldn't be admitted during the last update because the memory budget was exceeded
+		size_t numAdmittedLastFrame = 0;	//! Tasks admitted to worker threads during the last update
+		size_t numCallbacksLastFrame = 0;	//! Callbacks triggered during the last update
+		double callbackTimeLastFrame = 0;	//! Seconds spent triggering callbacks during the last update
+		double callbackTimePeak = 0;		//! Max seconds spent triggering callbacks in a single update since the last resetStats()
+	};
 	
-	//! numThreads: Threads used for executing tasks.
+	//! numThreads: Max number of tasks executed concurrently on the worker pool. Grows the pool if it has fewer threads.
 	//! queueSize: The max number of tasks that can be processed per frame. The min size is set to numThreads * 2
-	AsyncGlQueue(const unsigned int numThreads = 1, const unsigned int queueSize = 1024);
+	//! pool: The GL worker pool that tasks are executed on. Uses GlWorkerPool::get() if nullptr.
+	AsyncGlQueue(const unsigned int numThreads = 1, const unsigned int queueSize = 1024, GlWorkerPoolRef pool = nullptr);
 	virtual ~AsyncGlQueue();
 	
-	void run(Task task, Callback optCallback = nullptr);
-	void cancelAll(); // cancels any pending tasks
+	//! Queues task for execution on a GL thread. estimatedBytes is the GPU memory the task is expected to allocate.
+	//! Tasks are held back while their estimate doesn't fit into the memory budget. The bytes are reserved once
+	//! the task is admitted and released after its callback has been triggered, so long-lived resources should be
+	//! accounted for separately via GpuMemoryBudget::reserve() (e.g. by a cache that holds on to them).
+	void run(Task task, Callback optCallback = nullptr, const size_t estimatedBytes = 0);
+	void cancelAll(); // cancels pending tasks, including admitted ones that haven't started yet, and drops completed tasks without triggering their callbacks
+
+	//! Admits pending tasks and triggers completion callbacks. Called automatically on each app update if the
+	//! pool's backend is connected to an update loop; needs to be called manually otherwise (e.g. when running headless).
+	void update() { processTasks(); }
+
+	//! The budget that task estimates are reserved against. Defaults to GpuMemoryBudget::get().
+	void setMemoryBudget(GpuMemoryBudgetRef value) { mMemoryBudget = value; }
+	GpuMemoryBudgetRef getMemoryBudget() const { return mMemoryBudget; }
+
+	//! The shared GL worker pool that tasks are executed on.
+	GlWorkerPoolRef getWorkerPool() const { return mPool; }
+
+	//! Max time in seconds spent on triggering completion callbacks per frame. Remaining callbacks carry over to the next frame. Default is -1, which means infinite time.
+	void setMaxCallbackTime(const double value) { mMaxCallbackTime = value; }
+	double getMaxCallbackTime() const { return mMaxCallbackTime; }
 
-	void setNumThreads(const unsigned int value) { if (mNumThreads != value) { mNumThreads = value; setup(); } }
+	//! Max number of completion callbacks triggered per frame. Remaining callbacks carry over to the next frame. Default is -1, which means no limit.
+	void setMaxCallbacksPerFrame(const int value) { mMaxCallbacksPerFrame = value; }
+	int getMaxCallbacksPerFrame() const { return mMaxCallbacksPerFrame; }
+
+	//! Max number of pending tasks admitted to worker threads per frame. Remaining tasks carry over to the next frame. Default is -1, which means no limit other than the queue size.
+	void setMaxAdmissionsPerFrame(const int value) { mMaxAdmissionsPerFrame = value; }
+	int getMaxAdmissionsPerFrame() const { return mMaxAdmissionsPerFrame; }
+
+	//! Current backlog and timing of the last frame. Should be called from the main thread.
+	Stats getStats() const;
+	void resetStats() { mStats = Stats(); }
+
+	//! Max number of tasks executed concurrently on the worker pool. Grows the pool if it has fewer threads.
+	void setNumThreads(const unsigned int value);
 	unsigned int getNumThreads() const { return mNumThreads; }
 
 protected:
 	void setup();
-	void threadLoop(ci::gl::ContextRef context);
+	void runTask(const size_t taskId); // on worker thread
 	void processTasks();
-
-	static void initializeLoader(); // makes sure that Cinder's internal static factories are initialized once on the main thread
-	static bool sIsInitialized; // need to initialize Cinder image factory on main thread 
-	static std::mutex mInitializationMutex;
+	void releaseBytes(const TaskInfo & info);
 
 	unsigned int mNumThreads = -1;
+	unsigned int mQueueSize;
+
+	double mMaxCallbackTime = -1.0;
+	int mMaxCallbacksPerFrame = -1;
+	int mMaxAdmissionsPerFrame = -1;
+
+	Stats mStats;
+	std::atomic<size_t> mNumProcessing = 0;
+	std::atomic<size_t> mNumCompleted = 0;
 
-	std::set<ci::gl::ContextRef> mBackgroundContexts;
+	GlWorkerPoolRef mPool;
+	GlWorkerPool::ClientId mClientId;
+	GpuMemoryBudgetRef mMemoryBudget;
+	std::atomic<size_t> mNumBytesReserved = 0;
 
 	std::deque<TaskInfo> mTodos;
-	ci::ConcurrentCircularBuffer<TaskInfo> mProcessing;
+	std::mutex mAdmittedMutex;
+	std::map<size_t, TaskInfo> mAdmittedTasks; // admitted to the pool but not started yet; by task id
+	size_t mNumTasksAdmitted = 0; // used as task id
 	ci::ConcurrentCircularBuffer<TaskInfo> mCompleted;
 
-	std::set<std::shared_ptr<std::thread>> mThreads;
-	std::atomic<bool> mThreadsAreAlive = true;
+	bool mIsSetup = false;
 	ci::signals::ConnectionList mSignalConnections;
 };
 
@@ -5,134 +5,1429 @@
 #include "cinder/Filesystem.h"
 #include "cinder/imageIo.h"
 
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "ImageResampler.h"
+#include "MappedFile.h"
+#include "MemoryImageTarget.h"
+#include "PboUploader.h"
+
 using namespace ci;
 using namespace ci::app;
 using namespace std;
 
-namespace bluecadet {
-namespace utils {
-	
-	// Static properties
-	bool AsyncImageLoader::sIsInitialized = false;
-	std::mutex AsyncImageLoader::mInitializationMutex;
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		typedef std::chrono::steady_clock Clock;
+
+		//! Pops the oldest image that isn't a prefetch or the oldest prefetch if there are no other images
+		template <typename T>
+		T popNextImage(std::deque<T> & images, const std::map<std::string, AsyncImageLoader::PrefetchLevel> & prefetches) {
+			auto it = images.begin();
+			while (it != images.end() && prefetches.find(it->key) != prefetches.end()) ++it;
+			if (it == images.end()) it = images.begin();
+
+			T image = std::move(*it);
+			images.erase(it);
+			return image;
+		}
+	}
+	
+	// Static properties
+	ci::gl::Texture::Format AsyncImageLoader::sDefaultFormat;
+	std::once_flag AsyncImageLoader::sDefaultFormatFlag;
+	std::atomic<bool> AsyncImageLoader::sDefaultHasMipmapping(true);
+	std::atomic<int> AsyncImageLoader::sDefaultMaxMipmapLevel(2);
+
+
+	AsyncImageLoader::AsyncImageLoader(const unsigned int numDecodeThreads, const unsigned int numUploadThreads, GlWorkerPoolRef pool) :
+		mNumDecodeThreads(numDecodeThreads > 0 ? numDecodeThreads : max(1u, std::thread::hardware_concurrency())),
+		mNumUploadThreads(max(1u, numUploadThreads)),
+		mQueueSize(max(4u, mNumDecodeThreads * 2)),
+		mPool(pool ? pool : GlWorkerPool::get()),
+		mTextureCache(new TextureCache()),
+		mHttpFetcher(HttpFetcher::get()),
+		mPixelBufferPool(PixelBufferPool::get()),
+		mTexturePool(TexturePool::get()),
+		mTextureAtlas(TextureAtlas::get())
+	{
+		mClientId = mPool->addClient(mNumUploadThreads);
+		mPool->requireNumThreads(mNumUploadThreads);
+		setMemoryBudget(GpuMemoryBudget::get());
+	}
+	
+	AsyncImageLoader::~AsyncImageLoader() {
+		mSignalConnections.clear();
+		mIsAlive = false;
+
+		{
+			lock_guard<mutex> lock(mThreadMutex);
+			stopThreads();
+		}
+
+		// drops pending jobs and waits for running ones
+		mPool->removeClient(mClientId);
+
+		for (const auto & image : mDecodedImages) {
+			mMemoryBudget->release(image.numBytesReserved);
+		}
+
+		for (const auto & request : mResults) {
+			mMemoryBudget->release(request.numBytes);
+		}
+	}
+
+	void AsyncImageLoader::setNumIoThreads(const unsigned int value) {
+		mNumIoThreads = max(1u, value);
+		if (mIsSetup) setup();
+	}
+
+	void AsyncImageLoader::setNumFetchThreads(const unsigned int value) {
+		mNumFetchThreads = max(1u, value);
+		if (mIsSetup) setup();
+	}
+
+	void AsyncImageLoader::setNumDecodeThreads(const unsigned int value) {
+		mNumDecodeThreads = value > 0 ? value : max(1u, std::thread::hardware_concurrency());
+		if (mIsSetup) setup();
+	}
+
+	void AsyncImageLoader::setNumUploadThreads(const unsigned int value) {
+		mNumUploadThreads = max(1u, value);
+		mPool->setMaxConcurrency(mClientId, mNumUploadThreads);
+		mPool->requireNumThreads(mNumUploadThreads);
+	}
+
+	void AsyncImageLoader::readImages(const bool isRemote) {
+		ci::ThreadSetup threadSetup;
+
+		PriorityRequestQueue & requests = isRemote ? mRemoteRequests : mRequests;
+
+		while (true) {
+			EncodedImage image;
+			int priority = 0;
+			bool isPrefetch = false;
+
+			{
+				// wait for next request or, on io threads, for prefetches while other stages are idle
+				unique_lock<mutex> lock(mStageMutex);
+				while (mThreadsAreAlive && requests.empty() && (isRemote || mPrefetchRequests.empty() || !isIdle())) {
+					mStageCondition.wait(lock);
+				}
+
+				if (!mThreadsAreAlive) {
+					return;
+				}
+
+				if (!requests.empty()) {
+					requests.pop(image.key, &priority);
+				} else {
+					mPrefetchRequests.pop(image.key, &priority);
+					isPrefetch = true;
+				}
+
+				auto sourceIt = mSources.find(image.key);
+				if (sourceIt == mSources.end()) continue;
+				image.source = sourceIt->second;
+				mSources.erase(sourceIt);
+			}
+
+			image.timeline[Stage::Queued] = image.source.requestTime;
+			image.timeline[Stage::Read] = Clock::now();
+
+			const std::string & key = image.key;
+			const std::string & path = image.source.path;
+
+			if (path.empty() || !isRequested(key)) continue; // skip if request has been cancelled
+
+			try {
+				auto contentHashIndex = getContentHashIndex();
+				auto httpFetcher = getHttpFetcher();
+
+				const bool isCpuResult = image.source.cpuTarget != CpuTarget::None;
+
+				if (contentHashIndex && !isRemote && !isPrefetch && !isCpuResult && !(httpFetcher && HttpFetcher::isSupported(path))) {
+					// files with identical content only need to be decoded and uploaded once
+					const uint64_t hash = contentHashIndex->getHash(path);
+
+					if (hash != 0) {
+						image.contentKey = getContentKey(hash, image.source);
+						if (shareContent(image)) continue;
+					}
+				}
+
+				if (httpFetcher && HttpFetcher::isSupported(path)) {
+					// remote images skip the local caches, but are revalidated against the fetcher's disk cache
+					auto response = httpFetcher->fetch(path);
+					image.buffer = response.body;
+
+					if (!response.isSuccessful()) {
+						CI_LOG_W("Could not fetch image at '" + path + "': " + response.error);
+					}
+
+				} else {
+					// atlas regions and cpu results need uncompressed pixels
+					auto compressedCache = image.source.isAtlasRegion || isCpuResult ? nullptr : getCompressedTextureCache();
+
+					if (compressedCache) {
+						// skip decoding if the image has been transcoded before
+						image.buffer = compressedCache->load(path, image.source.maxSize, getMaxMipLevel());
+						image.isCompressed = image.buffer != nullptr;
+					}
+
+					auto pixelCache = getPixelCache();
+
+					if (!image.buffer && pixelCache) {
+						// skip decoding if the image has been decoded before
+						image.cachedPixels = pixelCache->load(path, image.source.maxSize);
+					}
+
+					if (!image.buffer && !image.cachedPixels && mMappedReadsEnabled) {
+						// decode straight from the mapped file instead of copying it into a buffer
+						auto file = MappedFile::create(path, MappedFile::Access::Sequential);
+						if (file) image.buffer = file->getBuffer();
+					}
+
+					if (!image.buffer && !image.cachedPixels) {
+						// urls and files that can't be mapped
+						image.buffer = loadFile(path)->getBuffer();
+					}
+				}
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not read image at '" + path + "'.", e);
+			}
+
+			if (!image.buffer && !image.cachedPixels) {
+				// Can't read file
+				cancel(key);
+				continue;
+			}
+
+			image.timeline[Stage::DecodeQueued] = Clock::now();
+
+			{
+				// wait until decode threads can take more work
+				unique_lock<mutex> lock(mStageMutex);
+				mStats.numBytesRead += image.buffer ? image.buffer->getSize() : MemoryImageTarget::getNumBytes(image.cachedPixels->width, image.cachedPixels->height);
+
+				const auto stallStartTime = Clock::now();
+				while (mThreadsAreAlive && mEncodedImages.size() >= mQueueSize) {
+					mStageCondition.wait(lock);
+				}
+				mStats.ioStallTime += std::chrono::duration<double>(Clock::now() - stallStartTime).count();
+
+				if (!mThreadsAreAlive) {
+					// preserve request when restarting threads
+					mSources[key] = image.source;
+					if (isPrefetch) mPrefetchRequests.push(key, priority);
+					else requests.push(key, priority);
+					return;
+				}
+
+				mEncodedImages.push_back(image);
+				mStats.numEncodedImagesPeak = max(mStats.numEncodedImagesPeak, mEncodedImages.size());
+			}
+
+			mStageCondition.notify_all();
+		}
+	}
+
+	void AsyncImageLoader::decodeImages() {
+		ci::ThreadSetup threadSetup;
+
+		const bool hasGl = mPool->getBackend()->hasGl();
+
+		while (true) {
+			EncodedImage encoded;
+
+			{
+				// wait for next encoded image
+				unique_lock<mutex> lock(mStageMutex);
+				while (mThreadsAreAlive && mEncodedImages.empty()) {
+					mStageCondition.wait(lock);
+				}
+
+				if (!mThreadsAreAlive) {
+					return;
+				}
+
+				encoded = popNextImage(mEncodedImages, mPrefetches);
+			}
+
+			// an encoded slot has been freed up
+			mStageCondition.notify_all();
+
+			encoded.timeline[Stage::Decode] = Clock::now();
+			size_t numBytesDecoded = 0;
+
+			const std::string & key = encoded.key;
+			const std::string & path = encoded.source.path;
+
+			if (!isRequested(key) || !mIsAlive) continue; // skip if request has been cancelled
+
+			DecodedImage decoded;
+			decoded.key = key;
+			decoded.isAtlasRegion = encoded.source.isAtlasRegion;
+			decoded.contentKey = encoded.contentKey;
+
+			// prefetches don't hold back decoding while the memory budget is exceeded and cpu results don't use gpu memory
+			const CpuTarget cpuTarget = encoded.source.cpuTarget;
+			const bool reserve = hasGl && cpuTarget == CpuTarget::None && !isPendingPrefetch(key);
+
+			try {
+				if (encoded.prefetched) {
+					// reuse decoded prefetched image
+					decoded = std::move(*encoded.prefetched);
+
+				} else if (encoded.isCompressed) {
+					const ivec2 size = CompressedTextureCache::getDdsSize(encoded.buffer);
+					decoded.width = size.x;
+					decoded.height = size.y;
+					decoded.compressed = encoded.buffer;
+
+					if (reserve) {
+						const size_t numBytes = CompressedTextureCache::getDdsDataSize(encoded.buffer);
+						if (!reserveBytes(key, numBytes)) continue; // skip if request has been cancelled
+						decoded.numBytesReserved = numBytes;
+					}
+
+				} else if (encoded.cachedPixels) {
+					decoded.width = encoded.cachedPixels->width;
+					decoded.height = encoded.cachedPixels->height;
+					decoded.hasAlpha = encoded.cachedPixels->hasAlpha;
+					decoded.cachedPixels = encoded.cachedPixels;
+
+					if (reserve) {
+						const size_t numBytes = getTextureBytes(decoded.width, decoded.height);
+						if (!reserveBytes(key, numBytes)) continue; // skip if request has been cancelled
+						decoded.numBytesReserved = numBytes;
+					}
+
+				} else {
+					auto extension = fs::path(path).extension().string();
+					if (!extension.empty() && extension[0] == '.') {
+						extension.erase(0, 1);
+					}
+
+					auto data = loadImage(DataSourceBuffer::create(encoded.buffer), ImageSource::Options(), extension);
+
+					if (!data) {
+						// Can't decode image
+						cancel(key);
+						continue;
+					}
+
+					const ivec2 srcSize(data->getWidth(), data->getHeight());
+					const ivec2 dstSize = ImageResampler::getFitSize(srcSize, encoded.source.maxSize);
+
+					decoded.width = dstSize.x;
+					decoded.height = dstSize.y;
+					decoded.hasAlpha = data->hasAlpha();
+
+					if (reserve) {
+						const size_t numBytes = getTextureBytes(decoded.width, decoded.height);
+						if (!reserveBytes(key, numBytes)) continue; // skip if request has been cancelled
+						decoded.numBytesReserved = numBytes;
+					}
+
+					auto pixels = acquirePixels(MemoryImageTarget::getNumBytes(srcSize.x, srcSize.y));
+					MemoryImageTarget::load(data, pixels->getData(), srcSize.x, srcSize.y, MemoryImageTarget::getRowBytes(srcSize.x));
+					numBytesDecoded = pixels->getSize();
+
+					if (dstSize != srcSize) {
+						// downscale on cpu so that only the requested size is kept and uploaded
+						decoded.pixels = acquirePixels(MemoryImageTarget::getNumBytes(dstSize.x, dstSize.y));
+						ImageResampler::resize(pixels->getData(), srcSize.x, srcSize.y, MemoryImageTarget::getRowBytes(srcSize.x),
+							decoded.pixels->getData(), dstSize.x, dstSize.y, MemoryImageTarget::getRowBytes(dstSize.x));
+					} else {
+						decoded.pixels = pixels;
+					}
+
+					pixels = nullptr; // return full size buffer to the pool right away
+					auto pixelCache = getPixelCache();
+
+					if (pixelCache) {
+						pixelCache->store(path, decoded.getPixels(), decoded.width, decoded.height, decoded.hasAlpha, encoded.source.maxSize);
+					}
+				}
+
+				if (!encoded.isCompressed && !encoded.prefetched && !decoded.isAtlasRegion && cpuTarget == CpuTarget::None) {
+					auto compressedCache = getCompressedTextureCache();
+
+					if (compressedCache) {
+						// transcode once and upload compressed blocks
+						decoded.compressed = compressedCache->store(path, decoded.getPixels(), decoded.width, decoded.height, decoded.hasAlpha,
+							encoded.source.maxSize, getMaxMipLevel());
+					}
+
+					if (decoded.compressed) {
+						decoded.pixels = nullptr;
+						decoded.cachedPixels = nullptr;
+
+						// compressed textures need less memory than reserved
+						const size_t numBytes = min(decoded.numBytesReserved, CompressedTextureCache::getDdsDataSize(decoded.compressed));
+						mMemoryBudget->release(decoded.numBytesReserved - numBytes);
+						decoded.numBytesReserved = numBytes;
+
+					} else if (hasGl && mCpuMipmapsEnabled && sDefaultHasMipmapping) {
+						generateMipmaps(decoded);
+					}
+				}
+
+			} catch (std::exception & e) {
+				mMemoryBudget->release(decoded.numBytesReserved);
+				CI_LOG_EXCEPTION("Could not decode image at '" + path + "'.", e);
+				cancel(key);
+				continue;
+			}
+
+			{
+				lock_guard<mutex> lock(mStageMutex);
+				mStats.numBytesDecoded += numBytesDecoded;
+
+				auto prefetchIt = mPrefetches.find(key);
+				bool keepInCpuMemory = prefetchIt != mPrefetches.end() && prefetchIt->second == PrefetchLevel::Decode;
+
+				if (prefetchIt != mPrefetches.end() && !keepInCpuMemory && hasGl && decoded.numBytesReserved == 0) {
+					// only upload prefetches if they fit into the memory budget right away
+					const size_t numBytes = getTextureBytes(decoded);
+					keepInCpuMemory = !mMemoryBudget->tryReserve(numBytes);
+					if (!keepInCpuMemory) decoded.numBytesReserved = numBytes;
+				}
+
+				if (keepInCpuMemory) {
+					// keep prefetched pixels until they're loaded
+					mMemoryBudget->release(decoded.numBytesReserved);
+					decoded.numBytesReserved = 0;
+					mPrefetches.erase(prefetchIt);
+
+					mPrefetchedBytes += decoded.getNumBytes();
+					mPrefetchedOrder.push_back(key);
+					mPrefetchedImages[key] = std::move(decoded);
+					trimPrefetchedImages();
+					continue;
+				}
+			}
+
+			if (cpuTarget != CpuTarget::None) {
+				// surfaces and channels skip the upload stage
+				decoded.timeline = encoded.timeline;
+				queueCpuResult(decoded, cpuTarget);
+				continue;
+			}
+
+			if (hasGl && decoded.numBytesReserved == 0) {
+				// prefetched images are only reserved once they're loaded
+				const size_t numBytes = getTextureBytes(decoded);
+				if (!reserveBytes(key, numBytes)) continue; // skip if request has been cancelled
+				decoded.numBytesReserved = numBytes;
+			}
+
+			// prefetched images have their own timeline
+			decoded.timeline = encoded.timeline;
+			decoded.timeline[Stage::UploadQueued] = Clock::now();
+
+			{
+				// wait until upload jobs can take more work
+				unique_lock<mutex> lock(mStageMutex);
+				const auto stallStartTime = Clock::now();
+				while (mThreadsAreAlive && mDecodedImages.size() >= mQueueSize) {
+					mStageCondition.wait(lock);
+				}
+				mStats.decodeStallTime += std::chrono::duration<double>(Clock::now() - stallStartTime).count();
+
+				if (!mThreadsAreAlive) {
+					// preserve image when restarting threads
+					mMemoryBudget->release(decoded.numBytesReserved);
+
+					if (encoded.prefetched) {
+						decoded.numBytesReserved = 0;
+						*encoded.prefetched = std::move(decoded);
+					}
+
+					mEncodedImages.push_front(encoded);
+					return;
+				}
+
+				mDecodedImages.push_back(std::move(decoded));
+				mStats.numDecodedImagesPeak = max(mStats.numDecodedImagesPeak, mDecodedImages.size());
+			}
+
+			// each job uploads the oldest decoded image
+			mPool->submit(mClientId, bind(&AsyncImageLoader::uploadNextImage, this));
+		}
+	}
+
+	bool AsyncImageLoader::reserveBytes(const std::string & key, const size_t numBytes) {
+		// hold back until texture fits into memory budget
+		const auto stallStartTime = Clock::now();
+		bool isReserved = false;
+
+		while (!(isReserved = mMemoryBudget->tryReserve(numBytes))) {
+			if (!isRequested(key) || !mIsAlive) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+
+		{
+			lock_guard<mutex> lock(mStageMutex);
+			mStats.budgetStallTime += std::chrono::duration<double>(Clock::now() - stallStartTime).count();
+		}
+
+		if (!isReserved) {
+			return false;
+		}
+
+		if (!isRequested(key) || !mIsAlive) {
+			mMemoryBudget->release(numBytes);
+			return false;
+		}
+
+		return true;
+	}
+
+	void AsyncImageLoader::generateMipmaps(DecodedImage & image) {
+		const int maxLevel = sDefaultMaxMipmapLevel;
+		int numLevels = ImageResampler::getNumMipLevels(image.width, image.height);
+
+		if (maxLevel >= 0) {
+			numLevels = min(numLevels, maxLevel + 1);
+		}
+
+		image.mipmaps.resize(max(0, numLevels - 1));
+
+		for (int level = 1; level < numLevels; ++level) {
+			// each level is averaged from the previous one
+			const uint8_t * src = level == 1 ? image.getPixels() : image.mipmaps[level - 2]->getData();
+			const ivec2 srcSize = ImageResampler::getMipSize(image.width, image.height, level - 1);
+			const ivec2 dstSize = ImageResampler::getMipSize(image.width, image.height, level);
+			auto dst = acquirePixels(MemoryImageTarget::getNumBytes(dstSize.x, dstSize.y));
+
+			ImageResampler::resize(src, srcSize.x, srcSize.y, MemoryImageTarget::getRowBytes(srcSize.x),
+				dst->getData(), dstSize.x, dstSize.y, MemoryImageTarget::getRowBytes(dstSize.x));
+			image.mipmaps[level - 1] = dst;
+		}
+	}
+
+	PixelBufferRef AsyncImageLoader::acquirePixels(const size_t numBytes) {
+		auto pool = getPixelBufferPool();
+
+		if (!pool) {
+			// temporary pool that retains nothing, so the buffer is freed once released
+			pool = std::make_shared<PixelBufferPool>(0);
+		}
+
+		return pool->acquire(numBytes);
+	}
+
+	void AsyncImageLoader::uploadNextImage() {
+		DecodedImage image;
+
+		{
+			lock_guard<mutex> lock(mStageMutex);
+			if (mDecodedImages.empty()) return;
+			image = popNextImage(mDecodedImages, mPrefetches);
+		}
+
+		// a decoded slot has been freed up
+		mStageCondition.notify_all();
+
+		image.timeline[Stage::Upload] = image.timeline[Stage::Fence] = Clock::now();
+
+		const std::string & key = image.key;
+
+		if (!isRequested(key) || !mIsAlive) {
+			// abort if request has been cancelled
+			mMemoryBudget->release(image.numBytesReserved);
+			return;
+		}
+
+		try {
+			ci::gl::TextureRef texture = nullptr;
+			AtlasRegionRef region = nullptr;
+
+			if (mPool->getBackend()->hasGl()) {
+				auto texturePool = getTexturePool();
+
+				if (image.isAtlasRegion) {
+					// pack small images into shared atlas pages
+					region = insertIntoAtlas(image);
+				}
+
+				if (region) {
+					texture = region->getTexture();
+
+				} else if (image.compressed) {
+					// upload compressed blocks of all levels
+					texture = gl::Texture2d::createFromDds(DataSourceBuffer::create(image.compressed), getDefaultFormat());
+
+				} else if (texturePool) {
+					// re-upload into storage of a previously released texture if possible
+					texture = uploadIntoPool(image, texturePool);
+
+				} else if (!image.mipmaps.empty()) {
+					// allocate all levels up front and upload the mip chain generated on the cpu
+					auto format = getDefaultFormat();
+					format.setInternalFormat(image.hasAlpha ? GL_RGBA8 : GL_RGB8);
+					format.immutableStorage(true);
+
+					texture = gl::Texture2d::create(image.width, image.height, format);
+					uploadLevel(texture, image.getPixels(), 0, image.width, image.height);
+
+					for (size_t i = 0; i < image.mipmaps.size(); ++i) {
+						const int level = (int)i + 1;
+						const ivec2 size = ImageResampler::getMipSize(image.width, image.height, level);
+						uploadLevel(texture, image.mipmaps[i]->getData(), level, size.x, size.y);
+					}
+
+					// rows are stored top to bottom in memory
+					texture->setTopDown(true);
+
+				} else {
+					if (mPboUploadsEnabled) {
+						// stream to gpu memory via mapped pixel buffer
+						auto uploader = PboUploader::getForCurrentThread();
+						const size_t numBytes = MemoryImageTarget::getNumBytes(image.width, image.height);
+						auto slot = uploader->acquire(numBytes);
+
+						if (slot) {
+							memcpy(slot.data, image.getPixels(), numBytes);
+							texture = uploader->upload(slot, image.width, image.height, getDefaultFormat(), image.hasAlpha);
+						}
+					}
+
+					if (!texture) {
+						// create texture and store data on gpu memory
+						// surface only wraps the pixels, which aren't modified
+						ci::Surface8u surface(const_cast<uint8_t *>(image.getPixels()), image.width, image.height, MemoryImageTarget::getRowBytes(image.width), SurfaceChannelOrder::RGBA);
+						texture = gl::Texture::create(surface, getDefaultFormat());
+					}
+				}
+
+				// waits until all gpu commands have been executed
+				image.timeline[Stage::Fence] = Clock::now();
+				mPool->getBackend()->finish();
+			}
+
+			image.timeline[Stage::ResultQueued] = Clock::now();
+
+			if (!isRequested(key) || !mIsAlive) {
+				// abort if request has been cancelled
+				mMemoryBudget->release(image.numBytesReserved);
+				return;
+			}
+
+			// reserved bytes are released once the texture is removed from the cache
+			{
+				Request result(key, texture, image.numBytesReserved);
+				result.region = region;
+				result.contentKey = image.contentKey;
+				result.timeline = image.timeline;
+
+				lock_guard<mutex> lock(mStageMutex);
+				if (texture) mStats.numBytesUploaded += image.getNumBytes();
+				mResults.push_back(result);
+				mStats.numPendingResultsPeak = max(mStats.numPendingResultsPeak, mResults.size());
+			}
+
+			mStageCondition.notify_all();
+
+		} catch (std::exception & e) {
+			mMemoryBudget->release(image.numBytesReserved);
+			CI_LOG_EXCEPTION("Could not upload image for '" + key + "'.", e);
+		}
+	}
+
+	void AsyncImageLoader::queueCpuResult(DecodedImage & image, const CpuTarget target) {
+		const std::string & key = image.key;
+		const int32_t width = image.width;
+		const int32_t height = image.height;
+
+		image.timeline[Stage::UploadQueued] = image.timeline[Stage::Upload] = image.timeline[Stage::Fence] = Clock::now();
+
+		Request result(key, nullptr);
+
+		try {
+			if (target == CpuTarget::Channel) {
+				// convert on decode threads so that it scales with the number of cores
+				auto channelPixels = acquirePixels((size_t)width * height);
+				const uint8_t * src = image.getPixels();
+				uint8_t * dst = channelPixels->getData();
+
+				for (size_t i = 0, numPixels = (size_t)width * height; i < numPixels; ++i, src += 4) {
+					// rec. 601 luma
+					dst[i] = (uint8_t)((77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8);
+				}
+
+				// channel only wraps the pixels, which are returned to the pool once the channel is released
+				result.channel = ci::Channel8uRef(new Channel8u(dst, width, height, width, 1), [channelPixels](Channel8u * channel) { delete channel; });
+
+			} else {
+				auto pixels = image.pixels;
+
+				if (!pixels) {
+					// pixel cache entries are mapped read-only
+					pixels = acquirePixels(MemoryImageTarget::getNumBytes(width, height));
+					memcpy(pixels->getData(), image.getPixels(), pixels->getSize());
+				}
+
+				// surface only wraps the pixels, which are returned to the pool once the surface is released
+				result.surface = ci::Surface8uRef(new Surface8u(pixels->getData(), width, height, MemoryImageTarget::getRowBytes(width), SurfaceChannelOrder::RGBA),
+					[pixels](Surface8u * surface) { delete surface; });
+			}
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not convert image for '" + key + "'.", e);
+			cancel(key);
+			return;
+		}
+
+		image.timeline[Stage::ResultQueued] = Clock::now();
+		result.timeline = image.timeline;
+
+		{
+			// wait until results have been delivered, since they aren't bound by the memory budget
+			unique_lock<mutex> lock(mStageMutex);
+			const auto stallStartTime = Clock::now();
+			while (mThreadsAreAlive && mNumCpuResults >= mQueueSize) {
+				mStageCondition.wait(lock);
+			}
+			mStats.decodeStallTime += std::chrono::duration<double>(Clock::now() - stallStartTime).count();
+
+			mNumCpuResults++;
+			mResults.push_back(result);
+			mStats.numPendingResultsPeak = max(mStats.numPendingResultsPeak, mResults.size());
+		}
+
+		mStageCondition.notify_all();
+	}
+
+	ci::gl::TextureRef AsyncImageLoader::uploadIntoPool(const DecodedImage & image, const TexturePoolRef & texturePool) {
+		auto format = getDefaultFormat();
+		format.setInternalFormat(image.hasAlpha ? GL_RGBA8 : GL_RGB8);
+
+		auto texture = texturePool->acquire(image.width, image.height, format);
+		uploadLevel(texture, image.getPixels(), 0, image.width, image.height);
+
+		if (!image.mipmaps.empty()) {
+			for (size_t i = 0; i < image.mipmaps.size(); ++i) {
+				const int level = (int)i + 1;
+				const ivec2 size = ImageResampler::getMipSize(image.width, image.height, level);
+				uploadLevel(texture, image.mipmaps[i]->getData(), level, size.x, size.y);
+			}
+
+		} else if (format.hasMipmapping()) {
+			gl::ScopedTextureBind scopedTexture(texture);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+
+		// rows are stored top to bottom in memory
+		texture->setTopDown(true);
+
+		return texture;
+	}
+
+	AtlasRegionRef AsyncImageLoader::insertIntoAtlas(DecodedImage & image) {
+		auto atlas = getTextureAtlas();
+
+		if (!atlas || image.compressed || !atlas->fits(image.width, image.height)) {
+			return nullptr;
+		}
+
+		auto region = atlas->insert(image.key, image.getPixels(), image.width, image.height);
+
+		if (region) {
+			// atlas pages are reserved by the atlas itself
+			mMemoryBudget->release(image.numBytesReserved);
+			image.numBytesReserved = 0;
+		}
+
+		return region;
+	}
+
+	void AsyncImageLoader::uploadLevel(const ci::gl::TextureRef & texture, const uint8_t * pixels, const int level, const int width, const int height) {
+		if (mPboUploadsEnabled) {
+			const size_t numBytes = MemoryImageTarget::getNumBytes(width, height);
+			auto uploader = PboUploader::getForCurrentThread();
+			auto slot = uploader->acquire(numBytes);
+
+			if (slot) {
+				memcpy(slot.data, pixels, numBytes);
+				uploader->upload(slot, texture, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, level);
+				return;
+			}
+		}
+
+		texture->update(pixels, GL_RGBA, GL_UNSIGNED_BYTE, level, width, height);
+	}
+
+	void AsyncImageLoader::transferTexturesToMain() {
+		const auto startTime = Clock::now();
+		double elapsedTime = 0;
+		size_t numDelivered = 0;
+		Request request("", nullptr);
+
+		while (mMaxCallbacksPerFrame < 0 || numDelivered < (size_t)mMaxCallbacksPerFrame) {
+			{
+				lock_guard<mutex> lock(mStageMutex);
+				if (mResults.empty()) break;
+				request = mResults.front();
+				mResults.pop_front();
+				if (request.surface || request.channel) mNumCpuResults--;
+			}
+
+			if (request.surface || request.channel) {
+				// a cpu result slot has been freed up
+				mStageCondition.notify_all();
+			}
+
+			numDelivered++;
+			request.timeline[Stage::Delivery] = Clock::now();
+
+			if (request.region) {
+				// atlas pages aren't cached; callbacks receive the region instead
+				mDeliveredRegion = request.region;
+
+			} else if (request.surface || request.channel) {
+				// cpu results aren't cached
+				mDeliveredCpuResult = &request;
+
+			} else if (request.texture && request.contentKey.empty()) {
+				// reserved bytes are released by the cache once the texture is removed or evicted
+				mTextureCache->insert(request.path, request.texture, request.numBytes);
+
+			} else if (request.texture && !request.isShared) {
+				// shared textures are cached once by content
+				mTextureCache->insert(request.contentKey, request.texture, request.numBytes);
+			}
+
+			std::vector<std::pair<std::string, Source>> waitingRequests;
+			bool isPrefetch = false;
+
+			{
+				// completes prefetches to the texture cache
+				lock_guard<mutex> lock(mStageMutex);
+				isPrefetch = mPrefetches.erase(request.path) > 0;
+
+				if (!request.contentKey.empty()) {
+					auto loadIt = mContentLoads.find(request.contentKey);
+
+					if (!request.isShared && loadIt != mContentLoads.end() && loadIt->second.key == request.path) {
+						waitingRequests = std::move(loadIt->second.waitingRequests);
+						mContentLoads.erase(loadIt);
+					}
+
+					if (request.texture && !request.region) {
+						mContentKeys[request.path] = request.contentKey;
+
+						for (const auto & waitingRequest : waitingRequests) {
+							mContentKeys[waitingRequest.first] = request.contentKey;
+						}
+					}
+
+					if (request.texture) {
+						const size_t numShared = waitingRequests.size() + (request.isShared ? 1 : 0);
+						mStats.numDeduplicated += numShared;
+						mStats.numBytesDeduplicated += numShared * getTextureBytes(request.texture);
+					}
+				}
+			}
+
+			triggerCallbacks(request.path, request.texture);
+
+			for (const auto & waitingRequest : waitingRequests) {
+				triggerCallbacks(waitingRequest.first, request.texture);
+			}
+
+			mDeliveredRegion = nullptr;
+			mDeliveredCpuResult = nullptr;
+
+			if (!isPrefetch && !request.isShared) {
+				// prefetches wait for idle stages and shared textures skip most stages, which would skew latencies
+				request.timeline[Stage::Total] = Clock::now();
+
+				{
+					lock_guard<mutex> lock(mStageMutex);
+					for (size_t i = 0; i < NUM_STAGES; ++i) {
+						mStats.latencies[i].add(request.timeline.getDuration((Stage)i));
+					}
+				}
+
+				if (mTimelineCallback) {
+					mTimelineCallback(request.path, request.timeline);
+				}
+			}
+
+			elapsedTime = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+			if (mMaxCallbackTime >= 0.0 && elapsedTime >= mMaxCallbackTime) {
+				break; // carry over remaining results to next frame
+			}
+		}
+
+		// evict textures that have been unpinned since the last update
+		mTextureCache->trim();
+
+		{
+			lock_guard<mutex> lock(mStageMutex);
+			mStats.numDeliveredLastFrame = numDelivered;
+			mStats.deliveryTimeLastFrame = elapsedTime;
+			mStats.deliveryTimePeak = max(mStats.deliveryTimePeak, elapsedTime);
+		}
+
+		if (mStatsLogInterval > 0 && std::chrono::duration<double>(Clock::now() - mStatsLogTime).count() >= mStatsLogInterval) {
+			mStatsLogTime = Clock::now();
+			CI_LOG_I(getStats().toString());
+		}
+	}
 
-	ci::gl::Texture::Format AsyncImageLoader::sDefaultFormat;
-	bool AsyncImageLoader::sDefaultFormatInitialized = false;
+	int AsyncImageLoader::getMaxMipLevel() {
+		return sDefaultHasMipmapping ? max(0, sDefaultMaxMipmapLevel.load()) : 0;
+	}
 
+	void AsyncImageLoader::setCompressedTextureCache(CompressedTextureCacheRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mCompressedTextureCache = value;
+	}
 
-	AsyncImageLoader::AsyncImageLoader(const unsigned int numThreads) :
-		mNumThreads(numThreads),
-		mTextureBuffer(mNumThreads * 2)
-	{
+	CompressedTextureCacheRef AsyncImageLoader::getCompressedTextureCache() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mCompressedTextureCache;
 	}
-	
-	AsyncImageLoader::~AsyncImageLoader() {
-		mTextureBuffer.cancel();
-		mThreadsAreAlive = false;
-		mRequestLock.notify_all();
-		for (auto thread : mThreads) {
-			thread->join();
+
+	AsyncImageLoader::Stats AsyncImageLoader::getStats() {
+		lock_guard<mutex> lock(mStageMutex);
+		Stats stats = mStats;
+		stats.numPendingRequests = mRequests.size() + mRemoteRequests.size();
+		stats.numEncodedImages = mEncodedImages.size();
+		stats.numDecodedImages = mDecodedImages.size();
+		stats.numPendingResults = mResults.size();
+		return stats;
+	}
+
+	std::string AsyncImageLoader::Stats::toString() const {
+		const double mb = 1024.0 * 1024.0;
+		stringstream stream;
+		stream << fixed << setprecision(1);
+		stream << getLatencies(Stage::Total).getCount() << " loaded"
+			<< " | queued requests/encoded/decoded/results: " << numPendingRequests << "/" << numEncodedImages << "/" << numDecodedImages << "/" << numPendingResults
+			<< " | MB read/decoded/uploaded: " << (double)numBytesRead / mb << "/" << (double)numBytesDecoded / mb << "/" << (double)numBytesUploaded / mb
+			<< " | ms p50/p95:";
+
+		for (size_t i = 0; i < NUM_STAGES; ++i) {
+			const auto & latencies = this->latencies[i];
+			stream << " " << getStageName((Stage)i) << " " << latencies.getPercentile(0.5) * 1000.0 << "/" << latencies.getPercentile(0.95) * 1000.0;
 		}
+
+		return stream.str();
 	}
 
-	void AsyncImageLoader::loadImages(ci::gl::ContextRef context) {
-		ci::ThreadSetup threadSetup;
+	double AsyncImageLoader::Timeline::getDuration(const Stage stage) const {
+		const auto & start = stage == Stage::Total ? (*this)[Stage::Queued] : times[(size_t)stage];
+		const auto & end = stage == Stage::Total ? (*this)[Stage::Total] : times[(size_t)stage + 1];
+		return max(0.0, std::chrono::duration<double>(end - start).count());
+	}
+
+	std::string AsyncImageLoader::getStageName(const Stage stage) {
+		switch (stage) {
+			case Stage::Queued: return "queued";
+			case Stage::Read: return "read";
+			case Stage::DecodeQueued: return "decodeQueued";
+			case Stage::Decode: return "decode";
+			case Stage::UploadQueued: return "uploadQueued";
+			case Stage::Upload: return "upload";
+			case Stage::Fence: return "fence";
+			case Stage::ResultQueued: return "resultQueued";
+			case Stage::Delivery: return "delivery";
+			case Stage::Total: return "total";
+			default: return "";
+		}
+	}
 
-		context->makeCurrent();
-		initializeLoader();
+	void AsyncImageLoader::resetStats() {
+		lock_guard<mutex> lock(mStageMutex);
+		mStats = Stats();
+	}
 
-		while (mThreadsAreAlive) {
-			std::string path;
+	void AsyncImageLoader::setPixelCache(PixelCacheRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mPixelCache = value;
+	}
 
-			{
-				// wait for new requests
-				unique_lock<mutex> lock(mRequestMutex);
-				while (mThreadsAreAlive && mRequests.empty()) {
-					mRequestLock.wait(lock);
-				}
+	PixelCacheRef AsyncImageLoader::getPixelCache() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mPixelCache;
+	}
 
-				if (!mThreadsAreAlive) return;
+	void AsyncImageLoader::setTexturePool(TexturePoolRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mTexturePool = value;
+	}
 
-				path = mRequests.front();
-				mRequests.pop_front();
-			}
+	TexturePoolRef AsyncImageLoader::getTexturePool() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mTexturePool;
+	}
 
-			if (!path.empty()) {
-				try {
+	void AsyncImageLoader::setPixelBufferPool(PixelBufferPoolRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mPixelBufferPool = value;
+	}
 
-					auto data = loadImage(path);
+	PixelBufferPoolRef AsyncImageLoader::getPixelBufferPool() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mPixelBufferPool;
+	}
 
-					if (!data) {
-						// Can't load image
-						cancel(path);
-						continue;
-					}
+	void AsyncImageLoader::setHttpFetcher(HttpFetcherRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mHttpFetcher = value;
+	}
 
-					if (!isLoading(path)) continue; // abort if request has been cancelled
-					if (!mThreadsAreAlive) return;
+	HttpFetcherRef AsyncImageLoader::getHttpFetcher() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mHttpFetcher;
+	}
 
-					// create cpu mem surface
-					ci::Surface surface(data);
+	void AsyncImageLoader::setContentHashIndex(ContentHashIndexRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mContentHashIndex = value;
+	}
 
-					// create texture and store data on gpu memory
-					const auto texture = gl::Texture::create(surface, getDefaultFormat());
+	ContentHashIndexRef AsyncImageLoader::getContentHashIndex() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mContentHashIndex;
+	}
 
-					// create fence after all gpu commands
-					auto fence = gl::Sync::create();
+	void AsyncImageLoader::setTextureAtlas(TextureAtlasRef value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mTextureAtlas = value;
+	}
 
-					// waits until fence has been executed
-					fence->clientWaitSync();
+	TextureAtlasRef AsyncImageLoader::getTextureAtlas() {
+		lock_guard<mutex> lock(mStageMutex);
+		return mTextureAtlas;
+	}
 
-					if (!isLoading(path)) continue; // abort if request has been cancelled
-					if (!mThreadsAreAlive) return;
+	size_t AsyncImageLoader::getTextureBytes(const int width, const int height) {
+		return GpuMemoryBudget::estimateTextureBytes(width, height, 4, sDefaultHasMipmapping);
+	}
 
-					Request request(path, texture);
-					mTextureBuffer.pushFront(request);
+	size_t AsyncImageLoader::getTextureBytes(const ci::gl::TextureRef & texture) {
+		return texture ? getTextureBytes(texture->getWidth(), texture->getHeight()) : 0;
+	}
 
-				} catch (ci::Exception e) {
-					CI_LOG_EXCEPTION("Could not load image at '" + path + "'.", e);
-				}
-			}
-		}
+	size_t AsyncImageLoader::getTextureBytes(const DecodedImage & image) {
+		return image.compressed ? CompressedTextureCache::getDdsDataSize(image.compressed) : getTextureBytes(image.width, image.height);
 	}
 
-	void AsyncImageLoader::transferTexturesToMain() {
-		Request request("", nullptr);
-		while (mTextureBuffer.tryPopBack(&request)) {
-			mTextureCache[request.path] = request.texture;
-			triggerCallbacks(request.path, request.texture);
-		}
+	void AsyncImageLoader::setMemoryBudget(GpuMemoryBudgetRef value) {
+		mMemoryBudget = value ? value : GpuMemoryBudget::get();
+		mTextureCache->setMemoryBudget(mMemoryBudget);
 	}
 
 	
-	void AsyncImageLoader::load(const std::string path, Callback callback) {
+	void AsyncImageLoader::load(const std::string path, const int maxSize, Callback callback, const int priority) {
 		setup();
 
+		const std::string key = getCacheKey(path, maxSize);
+
 		// check texture cache
-		auto texIt = mTextureCache.find(path);
-		if (texIt != mTextureCache.end()) {
-			callback(path, texIt->second);
+		auto texture = mTextureCache->get(getTextureKey(key));
+		if (texture) {
+			callback(path, texture);
 			return;
 		}
+
+		if (maxSize > 0) {
+			// callbacks are stored by cache key, but should receive the original path
+			Callback pathCallback = callback;
+			callback = [=](const std::string, ci::gl::TextureRef texture) { pathCallback(path, texture); };
+		}
 		
 		// check existing load tasks/callbacks
 		lock_guard<mutex> lock(mCallbackMutex);
-		auto cbIt = mCallbacks.find(path);
+		auto cbIt = mCallbacks.find(key);
 		if (cbIt != mCallbacks.end()) {
-			mCallbacks[path].push_back(callback);
+			mCallbacks[key].push_back(callback);
 			return;
 		}
 		
 		// load file and add callback
-		mCallbacks[path].push_back(callback);
+		mCallbacks[key].push_back(callback);
+
+		Source source;
+		source.path = path;
+		source.maxSize = maxSize;
+		requestImage(key, source, priority);
+	}
+
+	void AsyncImageLoader::loadRegion(const std::string path, RegionCallback callback, const int maxSize, const int priority) {
+		setup();
+
+		const std::string key = getAtlasKey(path, maxSize);
+
+		// check atlas and textures that were too large for the atlas
+		auto atlas = getTextureAtlas();
+		auto region = atlas ? atlas->get(key) : nullptr;
+
+		if (!region) {
+			auto texture = mTextureCache->get(getTextureKey(key));
+			if (texture) region = make_shared<AtlasRegion>(key, texture);
+		}
+
+		if (region) {
+			callback(path, region);
+			return;
+		}
+
+		// callbacks are stored by texture, so regions are passed on via mDeliveredRegion
+		Callback textureCallback = [=](const std::string, ci::gl::TextureRef texture) {
+			if (!texture) callback(path, nullptr);
+			else if (mDeliveredRegion) callback(path, mDeliveredRegion);
+			else callback(path, make_shared<AtlasRegion>(key, texture));
+		};
+
+		// check existing load tasks/callbacks
+		lock_guard<mutex> lock(mCallbackMutex);
+		auto cbIt = mCallbacks.find(key);
+		if (cbIt != mCallbacks.end()) {
+			mCallbacks[key].push_back(textureCallback);
+			return;
+		}
+
+		// load file and add callback
+		mCallbacks[key].push_back(textureCallback);
+
+		Source source;
+		source.path = path;
+		source.maxSize = maxSize;
+		source.isAtlasRegion = true;
+		requestImage(key, source, priority);
+	}
+
+	void AsyncImageLoader::loadSurface(const std::string path, SurfaceCallback callback, const int maxSize, const int priority) {
+		const std::string key = getSurfaceKey(path, maxSize);
+
+		// callbacks are stored by texture, so surfaces are passed on via mDeliveredCpuResult
+		requestCpuResult(key, path, [=](const std::string, ci::gl::TextureRef) {
+			const bool isDelivered = mDeliveredCpuResult && mDeliveredCpuResult->path == key;
+			callback(path, isDelivered ? mDeliveredCpuResult->surface : nullptr);
+		}, CpuTarget::Surface, maxSize, priority);
+	}
+
+	void AsyncImageLoader::loadChannel(const std::string path, ChannelCallback callback, const int maxSize, const int priority) {
+		const std::string key = getChannelKey(path, maxSize);
+
+		requestCpuResult(key, path, [=](const std::string, ci::gl::TextureRef) {
+			const bool isDelivered = mDeliveredCpuResult && mDeliveredCpuResult->path == key;
+			callback(path, isDelivered ? mDeliveredCpuResult->channel : nullptr);
+		}, CpuTarget::Channel, maxSize, priority);
+	}
+
+	void AsyncImageLoader::requestCpuResult(const std::string & key, const std::string & path, Callback callback, const CpuTarget target, const int maxSize, const int priority) {
+		setup();
+
+		// check existing load tasks/callbacks
+		lock_guard<mutex> lock(mCallbackMutex);
+		auto cbIt = mCallbacks.find(key);
+		if (cbIt != mCallbacks.end()) {
+			mCallbacks[key].push_back(callback);
+			return;
+		}
+
+		// load file and add callback
+		mCallbacks[key].push_back(callback);
+
+		Source source;
+		source.path = path;
+		source.maxSize = maxSize;
+		source.cpuTarget = target;
+		requestImage(key, source, priority);
+	}
+
+	bool AsyncImageLoader::waitForResults(const double timeout) {
+		unique_lock<mutex> lock(mStageMutex);
+		return mStageCondition.wait_for(lock, std::chrono::duration<double>(timeout), [&] { return !mResults.empty(); });
+	}
+
+	void AsyncImageLoader::requestImage(const std::string & key, const Source & source, const int priority) {
+		{
+			lock_guard<mutex> lock(mStageMutex);
+
+			if (promotePrefetchedImage(key)) {
+				// reuse prefetched pixels
+
+			} else if (mPrefetches.erase(key) > 0) {
+				// continue prefetch as regular request
+				if (mPrefetchRequests.remove(key)) {
+					getRequestQueue(source.path).push(key, priority);
+				}
+
+			} else {
+				mSources[key] = source;
+				getRequestQueue(source.path).push(key, priority);
+			}
+		}
+		mStageCondition.notify_all();
+	}
+
+	void AsyncImageLoader::prefetch(const std::vector<std::string> & paths, const PrefetchLevel level, const int maxSize) {
+		setup();
+
+		std::vector<std::pair<std::string, std::string>> requests; // path and key
+
+		for (const auto & path : paths) {
+			const std::string key = getCacheKey(path, maxSize);
+
+			if (!mTextureCache->contains(getTextureKey(key)) && !isLoading(key)) {
+				requests.push_back(make_pair(path, key));
+			}
+		}
+
 		{
-			unique_lock<mutex> lock(mRequestMutex);
-			mRequests.push_back(path);
-			mRequestLock.notify_one();
+			lock_guard<mutex> lock(mStageMutex);
+
+			for (const auto & request : requests) {
+				const std::string & path = request.first;
+				const std::string & key = request.second;
+
+				auto prefetchIt = mPrefetches.find(key);
+
+				if (prefetchIt != mPrefetches.end()) {
+					// upgrade pending prefetch
+					if (level == PrefetchLevel::Upload) prefetchIt->second = level;
+					continue;
+				}
+
+				if (mPrefetchedImages.find(key) != mPrefetchedImages.end()) {
+					// upload prefetched pixels
+					if (level == PrefetchLevel::Upload && promotePrefetchedImage(key)) mPrefetches[key] = level;
+					continue;
+				}
+
+				if (mSources.find(key) != mSources.end()) {
+					continue; // already requested
+				}
+
+				mPrefetches[key] = level;
+				Source & source = mSources[key];
+				source.path = path;
+				source.maxSize = maxSize;
+				mPrefetchRequests.push(key);
+			}
+		}
+
+		mStageCondition.notify_all();
+	}
+
+	void AsyncImageLoader::cancelPrefetches() {
+		lock_guard<mutex> lock(mStageMutex);
+
+		for (const auto & it : mPrefetches) {
+			mSources.erase(it.first);
+		}
+
+		mPrefetchRequests.clear();
+		mPrefetches.clear();
+		mPrefetchedImages.clear();
+		mPrefetchedOrder.clear();
+		mPrefetchedBytes = 0;
+	}
+
+	bool AsyncImageLoader::isPrefetching(const std::string path) {
+		lock_guard<mutex> lock(mStageMutex);
+		return mPrefetches.find(path) != mPrefetches.end() || mPrefetchedImages.find(path) != mPrefetchedImages.end();
+	}
+
+	void AsyncImageLoader::setPrefetchBudget(const size_t value) {
+		lock_guard<mutex> lock(mStageMutex);
+		mPrefetchBudget = value;
+		trimPrefetchedImages();
+	}
+
+	bool AsyncImageLoader::isRequested(const std::string & key) {
+		if (isLoading(key)) {
+			return true;
+		}
+
+		lock_guard<mutex> lock(mStageMutex);
+		return mPrefetches.find(key) != mPrefetches.end();
+	}
+
+	bool AsyncImageLoader::isPendingPrefetch(const std::string & key) {
+		lock_guard<mutex> lock(mStageMutex);
+		return mPrefetches.find(key) != mPrefetches.end();
+	}
+
+	bool AsyncImageLoader::promotePrefetchedImage(const std::string & key) {
+		auto it = mPrefetchedImages.find(key);
+
+		if (it == mPrefetchedImages.end()) {
+			return false;
+		}
+
+		EncodedImage image;
+		image.key = key;
+		image.prefetched = make_shared<DecodedImage>(std::move(it->second));
+		image.timeline[Stage::Queued] = image.timeline[Stage::Read] = image.timeline[Stage::DecodeQueued] = Clock::now();
+
+		mPrefetchedBytes -= image.prefetched->getNumBytes();
+		mPrefetchedOrder.remove(key);
+		mPrefetchedImages.erase(it);
+
+		// skips decoding, so it doesn't need to wait for other images
+		mEncodedImages.push_front(image);
+		return true;
+	}
+
+	void AsyncImageLoader::removePrefetch(const std::string & key) {
+		mPrefetchRequests.remove(key);
+		mPrefetches.erase(key);
+
+		auto it = mPrefetchedImages.find(key);
+
+		if (it != mPrefetchedImages.end()) {
+			mPrefetchedBytes -= it->second.getNumBytes();
+			mPrefetchedOrder.remove(key);
+			mPrefetchedImages.erase(it);
+		}
+	}
+
+	bool AsyncImageLoader::isIdle() {
+		if (!mRequests.empty() || !mRemoteRequests.empty()) {
+			return false;
+		}
+
+		for (const auto & image : mEncodedImages) {
+			if (mPrefetches.find(image.key) == mPrefetches.end()) return false;
+		}
+
+		for (const auto & image : mDecodedImages) {
+			if (mPrefetches.find(image.key) == mPrefetches.end()) return false;
+		}
+
+		return true;
+	}
+
+	PriorityRequestQueue & AsyncImageLoader::getRequestQueue(const std::string & path) {
+		return mHttpFetcher && HttpFetcher::isSupported(path) ? mRemoteRequests : mRequests;
+	}
+
+	void AsyncImageLoader::trimPrefetchedImages() {
+		while (mPrefetchedBytes > mPrefetchBudget && !mPrefetchedOrder.empty()) {
+			auto it = mPrefetchedImages.find(mPrefetchedOrder.front());
+			mPrefetchedOrder.pop_front();
+
+			if (it != mPrefetchedImages.end()) {
+				mPrefetchedBytes -= it->second.getNumBytes();
+				mPrefetchedImages.erase(it);
+			}
+		}
+	}
+
+	bool AsyncImageLoader::shareContent(const EncodedImage & image) {
+		// regions aren't cached, so they can only share loads that are in progress
+		auto texture = image.source.isAtlasRegion ? nullptr : mTextureCache->peek(image.contentKey);
+
+		lock_guard<mutex> lock(mStageMutex);
+
+		if (texture) {
+			// deliver texture of an identical file via the main thread, like any other result
+			Request result(image.key, texture);
+			result.contentKey = image.contentKey;
+			result.isShared = true;
+			mResults.push_back(result);
+			mStats.numPendingResultsPeak = max(mStats.numPendingResultsPeak, mResults.size());
+			mStageCondition.notify_all();
+			return true;
+		}
+
+		auto loadIt = mContentLoads.find(image.contentKey);
+
+		if (loadIt == mContentLoads.end()) {
+			mContentLoads[image.contentKey].key = image.key;
+			return false;
+		}
+
+		if (loadIt->second.key == image.key) {
+			return false; // request has been preserved while restarting threads
+		}
+
+		// wait for identical file to be loaded
+		loadIt->second.waitingRequests.push_back(make_pair(image.key, image.source));
+		return true;
+	}
+
+	std::string AsyncImageLoader::getTextureKey(const std::string & key) {
+		lock_guard<mutex> lock(mStageMutex);
+		auto it = mContentKeys.find(key);
+		return it != mContentKeys.end() ? it->second : key;
+	}
+
+	std::string AsyncImageLoader::getContentKey(const uint64_t hash, const Source & source) {
+		// sizes are decoded separately and regions are packed separately, like their cache keys
+		const std::string key = getCacheKey("#" + ContentHashIndex::toString(hash), source.maxSize);
+		return source.isAtlasRegion ? key + "@atlas" : key;
+	}
+
+	std::string AsyncImageLoader::getCacheKey(const std::string & path, const int maxSize) {
+		return maxSize > 0 ? path + "@" + to_string(maxSize) + "px" : path;
+	}
+
+	std::string AsyncImageLoader::getAtlasKey(const std::string & path, const int maxSize) {
+		return getCacheKey(path, maxSize) + "@atlas";
+	}
+
+	std::string AsyncImageLoader::getSurfaceKey(const std::string & path, const int maxSize) {
+		return getCacheKey(path, maxSize) + "@surface";
+	}
+
+	std::string AsyncImageLoader::getChannelKey(const std::string & path, const int maxSize) {
+		return getCacheKey(path, maxSize) + "@channel";
+	}
+
+	void AsyncImageLoader::setPriority(const std::string path, const int priority) {
+		lock_guard<mutex> lock(mStageMutex);
+		if (!mRequests.setPriority(path, priority)) {
+			mRemoteRequests.setPriority(path, priority);
 		}
 	}
+
+	void AsyncImageLoader::prioritizeOnly(const std::set<std::string> & paths) {
+		lock_guard<mutex> lock(mStageMutex);
+		mRequests.prioritizeOnly(paths);
+		mRemoteRequests.prioritizeOnly(paths);
+	}
 	
 	void AsyncImageLoader::cancel(const std::string path) {
+		{
+			lock_guard<mutex> lock(mStageMutex);
+			mRequests.remove(path);
+			mRemoteRequests.remove(path);
+			mSources.erase(path);
+			removePrefetch(path);
+
+			for (auto it = mContentLoads.begin(); it != mContentLoads.end(); ++it) {
+				if (it->second.key != path) continue;
+
+				// requeue requests that were waiting for this one; the first one read will load the image instead
+				for (const auto & waitingRequest : it->second.waitingRequests) {
+					mSources[waitingRequest.first] = waitingRequest.second;
+					getRequestQueue(waitingRequest.second.path).push(waitingRequest.first);
+				}
+
+				mContentLoads.erase(it);
+				break;
+			}
+		}
+
+		mStageCondition.notify_all();
+
 		// trigger pending callbacks immediately w/o waiting for load to finish
 		// this will remove the callbacks and cancel any pending requests
 		triggerCallbacks(path);
@@ -145,6 +1440,20 @@ namespace utils {
 	}
 
 	void AsyncImageLoader::cancelAll(const bool removeData) {
+		{
+			lock_guard<mutex> lock(mStageMutex);
+			mRequests.clear();
+			mRemoteRequests.clear();
+			mSources.clear();
+			mPrefetchRequests.clear();
+			mPrefetches.clear();
+			mPrefetchedImages.clear();
+			mPrefetchedOrder.clear();
+			mPrefetchedBytes = 0;
+			mContentLoads.clear();
+			if (removeData) mContentKeys.clear();
+		}
+
 		lock_guard<mutex> lock(mCallbackMutex);
 		for (auto it = mCallbacks.begin(); it != mCallbacks.end(); ) {
 			const auto & path = it->first;
@@ -156,37 +1465,46 @@ namespace utils {
 		}
 
 		if (removeData) {
-			lock_guard<mutex> lock(mTextureMutex);
-			mTextureCache.clear();
+			mTextureCache->clear();
 		}
 	}
 	
 	bool AsyncImageLoader::hasTexture(const std::string path) {
-		lock_guard<mutex> lock(mTextureMutex);
-		return mTextureCache.find(path) != mTextureCache.end();
+		return mTextureCache->contains(getTextureKey(path));
 	}
 
 	void AsyncImageLoader::removeTexture(const std::string path) {
-		// remove texture if it was already loaded
+		std::string textureKey = path;
+
 		{
-			lock_guard<mutex> lock(mTextureMutex);
-			auto it = mTextureCache.find(path);
-			if (it != mTextureCache.end()) {
-				mTextureCache.erase(path);
+			lock_guard<mutex> lock(mStageMutex);
+			auto it = mContentKeys.find(path);
+
+			if (it != mContentKeys.end()) {
+				textureKey = it->second;
+				mContentKeys.erase(it);
+
+				for (const auto & contentKey : mContentKeys) {
+					// keep shared texture while other paths still refer to it
+					if (contentKey.second == textureKey) {
+						textureKey.clear();
+						break;
+					}
+				}
 			}
 		}
 
+		// remove texture if it was already loaded
+		if (!textureKey.empty()) {
+			mTextureCache->remove(textureKey);
+		}
+
 		// trigger pending callbacks
 		triggerCallbacks(path);
 	}
 	
 	const ci::gl::TextureRef AsyncImageLoader::getTexture(const std::string path) {
-		lock_guard<mutex> lock(mTextureMutex);
-		auto it = mTextureCache.find(path);
-		if (it == mTextureCache.end()) {
-			return nullptr;
-		}
-		return it->second;
+		return mTextureCache->get(getTextureKey(path));
 	}
 	
 	void AsyncImageLoader::triggerCallbacks(const std::string path, ci::gl::TextureRef texture) {
@@ -209,11 +1527,7 @@ namespace utils {
 
 		if (!texture) {
 			// try to get texture
-			lock_guard<mutex> lock(mTextureMutex);
-			auto texIt = mTextureCache.find(path);
-			if (texIt != mTextureCache.end()) {
-				texture = texIt->second;
-			}
+			texture = mTextureCache->peek(getTextureKey(path));
 		}
 		
 		// trigger callbacks w texture or nullptr
@@ -222,84 +1536,104 @@ namespace utils {
 		}
 	}
 
-	void AsyncImageLoader::setup() {
+	void AsyncImageLoader::setup(const bool force) {
+		if (!mIsSetup) {
+			// only connect to update loop once
+			mIsSetup = true;
+			mSignalConnections += mPool->getBackend()->connectUpdate(bind(&AsyncImageLoader::transferTexturesToMain, this));
+		}
+
+		// decode threads don't run on the worker pool, so image factories need to be initialized separately.
+		// this may wait for the main thread, so it must not hold any locks.
+		GlWorkerPool::initializeLoader(mPool->getBackend());
+
+		// the default format queries GL, so initialize it before workers use it; I/O and decode threads only read snapshots
+		if (mPool->getBackend()->isDispatchThread() && mPool->getBackend()->hasGl()) {
+			getDefaultFormat();
+		}
+
+		lock_guard<mutex> lock(mThreadMutex);
+
 		// only set up if # threads has changed
-		if (mNumThreads == mThreads.size()) {
+		if (!force && mIoThreads.size() == mNumIoThreads && mFetchThreads.size() == mNumFetchThreads && mDecodeThreads.size() == mNumDecodeThreads) {
 			return;
 		}
 
-		// initialize from primary thread
-		App::get()->dispatchSync([=] {
-			
-			// Save current VAO to prevent crashes from calling setup multiple times from params
-			gl::Context::getCurrent()->pushVao();
-
-			try {
-				mSignalConnections.clear();
+		try {
+			stopThreads();
 
-				mThreadsAreAlive = false;
-				mRequestLock.notify_all();
-				for (auto thread : mThreads) {
-					thread->join();
-				}
-				mThreads.clear();
-				mBackgroundContexts.clear();
+			{
+				lock_guard<mutex> stageLock(mStageMutex);
 				mThreadsAreAlive = true;
+			}
 
-				for (unsigned int i = 0; i < mNumThreads; ++i) {
-					auto context = gl::Context::create(gl::Context::getCurrent());
-					mBackgroundContexts.insert(context);
-
-					auto thread = make_shared<std::thread>(bind(&AsyncImageLoader::loadImages, this, context));
-					mThreads.insert(thread);
-				}
+			for (unsigned int i = 0; i < mNumIoThreads; ++i) {
+				mIoThreads.push_back(std::thread(bind(&AsyncImageLoader::readImages, this, false)));
+			}
 
-				mSignalConnections += App::get()->getSignalUpdate().connect(bind(&AsyncImageLoader::transferTexturesToMain, this));
+			for (unsigned int i = 0; i < mNumFetchThreads; ++i) {
+				mFetchThreads.push_back(std::thread(bind(&AsyncImageLoader::readImages, this, true)));
+			}
 
-			} catch (std::exception & e) {
-				CI_LOG_EXCEPTION("Error in setup", e);
+			for (unsigned int i = 0; i < mNumDecodeThreads; ++i) {
+				mDecodeThreads.push_back(std::thread(bind(&AsyncImageLoader::decodeImages, this)));
 			}
 
-			// Restore previous VAO to prevent crashes from calling setup multiple times from params
-			gl::Context::getCurrent()->popVao();
-		});
+			CI_LOG_I("Started " << to_string(mIoThreads.size()) << " io, " << to_string(mFetchThreads.size()) << " fetch and " << to_string(mDecodeThreads.size()) << " decode threads");
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Error in setup", e);
+		}
 	}
 
-	void AsyncImageLoader::initializeLoader() {
-		lock_guard<mutex> lock(mInitializationMutex);
+	void AsyncImageLoader::stopThreads() {
+		{
+			lock_guard<mutex> lock(mStageMutex);
+			mThreadsAreAlive = false;
+		}
 
-		if (sIsInitialized) {
-			return;
+		mStageCondition.notify_all();
+
+		for (auto & thread : mIoThreads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
 		}
 
-		App::get()->dispatchSync([=] {
-			try {
-				// load empty image to initialize Cinder's internal load factory on the main thread
-				CI_LOG_D("Initializing Cinder loader");
-				ci::loadImage("");
-			} catch (Exception e) {
+		for (auto & thread : mFetchThreads) {
+			if (thread.joinable()) {
+				thread.join();
 			}
-			sIsInitialized = true;
-		});
+		}
+
+		for (auto & thread : mDecodeThreads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+
+		mIoThreads.clear();
+		mFetchThreads.clear();
+		mDecodeThreads.clear();
 	}
 
 	const ci::gl::Texture::Format & AsyncImageLoader::getDefaultFormat() {
-		if (!sDefaultFormatInitialized) {
-			sDefaultFormatInitialized = true;
-
+		std::call_once(sDefaultFormatFlag, [] {
 			sDefaultFormat = gl::Texture::Format();
 			sDefaultFormat.setMaxAnisotropy(gl::Texture2d::getMaxAnisotropyMax());
 			sDefaultFormat.enableMipmapping(true);
 			sDefaultFormat.setMaxMipmapLevel(2);
 			sDefaultFormat.setMinFilter(GL_LINEAR_MIPMAP_LINEAR);
 			sDefaultFormat.setMagFilter(GL_LINEAR);
-		}
+		});
 		return sDefaultFormat;
 	}
 
 	void AsyncImageLoader::setDefaultFormat(ci::gl::Texture::Format format) {
+		std::call_once(sDefaultFormatFlag, [] {}); // skips the default initialization
 		sDefaultFormat = format;
-		sDefaultFormatInitialized = true;
+		sDefaultHasMipmapping = format.hasMipmapping();
+		sDefaultMaxMipmapLevel = format.getMaxMipmapLevel();
 	}
 	
 }
@@ -4,8 +4,24 @@
 #include "cinder/app/RendererGl.h"
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Texture.h"
-#include "cinder/ConcurrentCircularBuffer.h"
+#include "cinder/Surface.h"
 
+#include <array>
+#include <chrono>
+#include <list>
+
+#include "GlWorkerPool.h"
+#include "CompressedTextureCache.h"
+#include "ContentHashIndex.h"
+#include "GpuMemoryBudget.h"
+#include "HttpFetcher.h"
+#include "LatencyHistogram.h"
+#include "PixelBufferPool.h"
+#include "PixelCache.h"
+#include "PriorityRequestQueue.h"
+#include "TextureAtlas.h"
+#include "TextureCache.h"
+#include "TexturePool.h"
 #include "ThreadedTaskQueue.h"
 #include "TimedTaskQueue.h"
 
@@ -24,21 +40,174 @@ public:
 		return instance;
 	};
 
+	//! Stages that each request passes through, in order
+	enum class Stage {
+		Queued,			//! Waiting for an I/O or fetch thread
+		Read,			//! Reading, mapping or fetching the file
+		DecodeQueued,	//! Waiting for a decode thread
+		Decode,			//! Decoding, resizing and transcoding, including waits for the memory budget
+		UploadQueued,	//! Waiting for an upload job
+		Upload,			//! Creating the texture and submitting pixels
+		Fence,			//! Waiting for the GPU to finish the upload
+		ResultQueued,	//! Waiting for the main thread
+		Delivery,		//! Caching the texture and triggering callbacks
+		Total,			//! From request to delivery
+		NumStages
+	};
+
+	static const size_t NUM_STAGES = (size_t)Stage::NumStages;
+
+	//! Time points at which a request entered each stage. times[Stage::Total] is the end of delivery.
+	struct Timeline {
+		std::array<std::chrono::steady_clock::time_point, NUM_STAGES> times;
+
+		std::chrono::steady_clock::time_point & operator[](const Stage stage) { return times[(size_t)stage]; }
+		const std::chrono::steady_clock::time_point & operator[](const Stage stage) const { return times[(size_t)stage]; }
+
+		//! Seconds spent in stage
+		double getDuration(const Stage stage) const;
+	};
+
 	struct Request {
 		std::string path;
 		ci::gl::TextureRef texture = nullptr;
+		size_t numBytes = 0; // reserved on the memory budget
+		AtlasRegionRef region = nullptr; // set for requests made via loadRegion()
+		ci::Surface8uRef surface = nullptr; // set for requests made via loadSurface()
+		ci::Channel8uRef channel = nullptr; // set for requests made via loadChannel()
+		std::string contentKey; // key of the texture in the cache if it's shared by content hash (see setContentHashIndex())
+		bool isShared = false; // texture has been loaded for another path with the same content
+		Timeline timeline;
 
-		Request(const std::string path, const ci::gl::TextureRef texture) : path(path), texture(texture) {}
+		Request(const std::string path, const ci::gl::TextureRef texture, const size_t numBytes = 0) : path(path), texture(texture), numBytes(numBytes) {}
 	};
 	
+	//! Snapshot of how long requests spend in each stage, how much data passes through and how results are handed to the
+	//! main thread. Useful for sizing thread counts and budgets and tuning the per-frame delivery budget against frame time targets.
+	struct Stats {
+		size_t numPendingRequests = 0;		//! Requests waiting for I/O and fetch threads
+		size_t numEncodedImages = 0;		//! Read images waiting for decode threads
+		size_t numEncodedImagesPeak = 0;	//! Max number of encoded images since the last resetStats()
+		size_t numDecodedImages = 0;		//! Decoded images waiting for upload jobs
+		size_t numDecodedImagesPeak = 0;	//! Max number of decoded images since the last resetStats()
+		size_t numPendingResults = 0;		//! Uploaded textures waiting to be handed to the main thread
+		size_t numPendingResultsPeak = 0;	//! Max number of pending results since the last resetStats()
+		size_t numDeliveredLastFrame = 0;	//! Results handed to the main thread during the last update
+		double deliveryTimeLastFrame = 0;	//! Seconds spent caching results and triggering callbacks during the last update
+		double deliveryTimePeak = 0;		//! Max seconds spent on delivery in a single update since the last resetStats()
+		double ioStallTime = 0;				//! Seconds I/O threads spent waiting for decode threads to take more work
+		double decodeStallTime = 0;			//! Seconds decode threads spent waiting for upload jobs to take more work
+		double budgetStallTime = 0;			//! Seconds decode threads spent waiting for the memory budget
+		size_t numDeduplicated = 0;			//! Requests served by the texture of another file with the same content (see setContentHashIndex())
+		size_t numBytesDeduplicated = 0;	//! Estimated GPU memory of textures that didn't need to be decoded and uploaded again due to deduplication
+		size_t numBytesRead = 0;			//! Encoded bytes read from files, urls and the on-disk caches
+		size_t numBytesDecoded = 0;			//! RGBA bytes produced by the image decoder before resizing
+		size_t numBytesUploaded = 0;		//! Bytes of pixels and compressed blocks uploaded to the GPU
+
+		//! Durations of each stage of delivered requests since the last resetStats(). Prefetches and shared textures aren't included.
+		std::array<LatencyHistogram, NUM_STAGES> latencies;
+
+		const LatencyHistogram & getLatencies(const Stage stage) const { return latencies[(size_t)stage]; }
+
+		//! One line summary with queue depths, bytes and median/95th percentile latencies per stage
+		std::string toString() const;
+	};
+
+	// Callback type for per-request timelines. Called on the main thread after each delivered request.
+	typedef std::function<void(const std::string key, const Timeline & timeline)> TimelineCallback;
+
 	// Callback type for load requests. Resulting texture will be nullptr if request failed or canceled
 	typedef std::function<void(const std::string path, ci::gl::TextureRef textureOrNull)> Callback;
+
+	// Callback type for loadRegion() requests. Resulting region will be nullptr if request failed or canceled
+	typedef std::function<void(const std::string path, AtlasRegionRef regionOrNull)> RegionCallback;
+
+	// Callback type for loadSurface() requests. Resulting surface will be nullptr if request failed or canceled
+	typedef std::function<void(const std::string path, ci::Surface8uRef surfaceOrNull)> SurfaceCallback;
+
+	// Callback type for loadChannel() requests. Resulting channel will be nullptr if request failed or canceled
+	typedef std::function<void(const std::string path, ci::Channel8uRef channelOrNull)> ChannelCallback;
 	
-	//! numThreads: Threads used for loading + decoding images
-	AsyncImageLoader(const unsigned int numThreads = 1);
+	//! Images are loaded in three stages connected by bounded queues, so that each stage blocks once the next one can't keep up:
+	//! 1. I/O threads read encoded files into memory. http:// urls are read by separate fetch threads via HttpFetcher, so that
+	//!    network latency doesn't hold up local files.
+	//! 2. Decode threads decode images into CPU memory. These don't have GL contexts and scale with the number of cores.
+	//! 3. Upload jobs create textures on the GL worker pool.
+	//!
+	//! numDecodeThreads: Number of CPU threads used for decoding. 0 uses the number of hardware threads.
+	//! numUploadThreads: Max number of textures uploaded concurrently on the worker pool. Grows the pool if it has fewer threads.
+	//! pool: The GL worker pool that textures are uploaded on. Uses GlWorkerPool::get() if nullptr.
+	//! Pools with backends without GL support will only load and decode images and trigger callbacks with nullptr textures.
+	AsyncImageLoader(const unsigned int numDecodeThreads = 0, const unsigned int numUploadThreads = 1, GlWorkerPoolRef pool = nullptr);
 	virtual ~AsyncImageLoader();
 	
-	void load(const std::string path, Callback callback);
+	//! Queues path for loading. Requests with higher priorities are read first. If path is already
+	//! loading, callback is added to the existing request and priority is ignored (see setPriority()).
+	void load(const std::string path, Callback callback, const int priority = 0) { load(path, 0, callback, priority); }
+
+	//! Loads path downscaled on the CPU to fit within maxSize x maxSize pixels, e.g. for thumbnails. Images are never upscaled.
+	//! Each size is cached separately; use getCacheKey(path, maxSize) to access the texture or request via the methods below.
+	//! maxSize <= 0 loads the image at full size.
+	void load(const std::string path, const int maxSize, Callback callback, const int priority = 0);
+
+	//! Key of a request and its texture in the cache. Same as path if maxSize <= 0.
+	static std::string getCacheKey(const std::string & path, const int maxSize);
+
+	//! Loads path into the texture atlas (see setTextureAtlas()), so that many small images share a few page textures.
+	//! Images that are larger than the atlas' max region size, or all images if no atlas is set, are loaded into their own
+	//! textures and wrapped in regions that cover the whole texture. Regions aren't kept in the texture cache; they're freed
+	//! once the last reference is released and can be looked up via the atlas while they're referenced.
+	//! Use getAtlasKey(path, maxSize) to cancel or reprioritize the request.
+	void loadRegion(const std::string path, RegionCallback callback, const int maxSize = 0, const int priority = 0);
+
+	//! Key of a loadRegion() request and its region in the atlas.
+	static std::string getAtlasKey(const std::string & path, const int maxSize = 0);
+
+	//! Loads path into an RGBA surface in CPU memory without creating a texture, e.g. to analyze pixels. Shares the I/O and
+	//! decode threads, request queues, pixel cache and cancellation with texture requests, but skips the upload stage and
+	//! the GPU memory budget. Surfaces aren't cached; they wrap pooled pixel buffers that are returned to the pool once the
+	//! last reference is released. Use getSurfaceKey(path, maxSize) to cancel or reprioritize the request.
+	void loadSurface(const std::string path, SurfaceCallback callback, const int maxSize = 0, const int priority = 0);
+
+	//! Loads path into an 8-bit luminance channel in CPU memory. Converted on decode threads, otherwise same as loadSurface().
+	//! Use getChannelKey(path, maxSize) to cancel or reprioritize the request.
+	void loadChannel(const std::string path, ChannelCallback callback, const int maxSize = 0, const int priority = 0);
+
+	//! Key of a loadSurface() request.
+	static std::string getSurfaceKey(const std::string & path, const int maxSize = 0);
+
+	//! Key of a loadChannel() request.
+	static std::string getChannelKey(const std::string & path, const int maxSize = 0);
+
+	//! How far prefetched images are loaded in advance
+	enum class PrefetchLevel {
+		Decode,	//! Decode into CPU memory. Doesn't use any GPU memory until the image is loaded.
+		Upload	//! Decode and upload into the texture cache
+	};
+
+	//! Speculatively loads paths, e.g. the next page of a gallery, while no other requests are pending. Prefetches
+	//! never delay load() requests: they're only read once all pending requests have been read and are passed over
+	//! by decode threads and upload jobs while other images are waiting. A later load() of a prefetched path reuses
+	//! any work that's been done so far. Decoded images are kept until loaded, cancelled or evicted by the prefetch budget.
+	void prefetch(const std::vector<std::string> & paths, const PrefetchLevel level = PrefetchLevel::Decode, const int maxSize = 0);
+
+	//! Cancels all pending prefetches and discards prefetched images that haven't been loaded yet.
+	void cancelPrefetches();
+
+	//! True if path has been prefetched or is still being prefetched, but hasn't been loaded.
+	bool isPrefetching(const std::string path);
+
+	//! Max number of bytes of decoded images kept in CPU memory by prefetch(). Oldest images are discarded first. Default is 512 MB.
+	void setPrefetchBudget(const size_t value);
+	size_t getPrefetchBudget() const { return mPrefetchBudget; }
+
+	//! Changes the priority of a request that hasn't been read yet, e.g. when an image scrolls into view.
+	void setPriority(const std::string path, const int priority);
+
+	//! Moves requests for paths in front of all other pending requests, e.g. to load the images that are
+	//! currently on screen first. Requests made afterwards are queued based on their priority.
+	void prioritizeOnly(const std::set<std::string> & paths);
+
 	void cancel(const std::string path);
 	bool isLoading(const std::string path);
 	
@@ -48,42 +217,284 @@ public:
 	void removeTexture(const std::string path); // removes texture if it exists and cancels pending requests if it has any
 	const ci::gl::TextureRef getTexture(const std::string path);
 
-	void setNumThreads(const unsigned int value) { mNumThreads = value; setup(); }
-	unsigned int getNumThreads() const { return mNumThreads; }
+	//! Number of threads reading files from disk. Restarts the I/O and decode threads if they're running. Default is 2.
+	void setNumIoThreads(const unsigned int value);
+	unsigned int getNumIoThreads() const { return mNumIoThreads; }
+
+	//! Number of threads fetching http:// urls. Restarts the I/O and decode threads if they're running. Default is 4.
+	//! Concurrent requests per host are also limited by the fetcher (see HttpFetcher::setMaxConnectionsPerHost()).
+	void setNumFetchThreads(const unsigned int value);
+	unsigned int getNumFetchThreads() const { return mNumFetchThreads; }
+
+	//! Number of CPU threads decoding images. Restarts the I/O and decode threads if they're running. 0 uses the number of hardware threads.
+	void setNumDecodeThreads(const unsigned int value);
+	unsigned int getNumDecodeThreads() const { return mNumDecodeThreads; }
+
+	//! Max number of textures uploaded concurrently on the worker pool. Grows the pool if it has fewer threads.
+	void setNumUploadThreads(const unsigned int value);
+	unsigned int getNumUploadThreads() const { return mNumUploadThreads; }
 
+	//! If enabled, decoded pixels are copied into persistently mapped pixel buffers via PboUploader on upload
+	//! threads and transferred to the GPU asynchronously, instead of being uploaded from client memory. Since
+	//! decode threads have no GL context, this costs one copy per image. Enabled by default.
+	void setPboUploadsEnabled(const bool value) { mPboUploadsEnabled = value; }
+	bool getPboUploadsEnabled() const { return mPboUploadsEnabled; }
+
+	//! If enabled, local files are memory-mapped and decoded straight from the mapped pages instead of being copied
+	//! into a buffer first. Urls and files that can't be mapped are always read via ci::loadFile(). Enabled by default.
+	void setMappedReadsEnabled(const bool value) { mMappedReadsEnabled = value; }
+	bool getMappedReadsEnabled() const { return mMappedReadsEnabled; }
+
+	//! If enabled and the default format uses mipmapping, mip chains are generated with a box filter on decode threads
+	//! instead of on the GPU after each upload. This moves work off of the GL threads at the cost of uploading 1/3 more data. Disabled by default.
+	void setCpuMipmapsEnabled(const bool value) { mCpuMipmapsEnabled = value; }
+	bool getCpuMipmapsEnabled() const { return mCpuMipmapsEnabled; }
+
+	//! Cached textures are reserved against this budget. Workers hold back uploads while the budget is exceeded and
+	//! cached textures that aren't referenced elsewhere are evicted when memory is needed. Defaults to GpuMemoryBudget::get().
+	void setMemoryBudget(GpuMemoryBudgetRef value);
+	GpuMemoryBudgetRef getMemoryBudget() const { return mMemoryBudget; }
+
+	//! Optional on-disk cache of block-compressed textures. If set, images are transcoded to BC1/BC3 once on decode threads and
+	//! later loads read the compressed blocks directly, skipping decoding and using less GPU memory. Disabled (nullptr) by default.
+	void setCompressedTextureCache(CompressedTextureCacheRef value);
+	CompressedTextureCacheRef getCompressedTextureCache();
+
+	//! Optional on-disk cache of decoded pixels. If set, decoded images are written to the cache and later loads (e.g. after
+	//! a restart) map the cached pixels straight into the upload path without decoding. Only used for images that aren't
+	//! served by the compressed texture cache. Disabled (nullptr) by default.
+	void setPixelCache(PixelCacheRef value);
+	PixelCacheRef getPixelCache();
+
+	//! Pool that decode threads draw pixel buffers from. Buffers are returned after upload or once prefetched images are
+	//! released, so sustained loading reuses memory instead of allocating (and page faulting) each image anew.
+	//! Defaults to PixelBufferPool::get(). Set to nullptr to allocate a new buffer for each image.
+	void setPixelBufferPool(PixelBufferPoolRef value);
+	PixelBufferPoolRef getPixelBufferPool();
+
+	//! Pool that uncompressed textures are allocated from. Textures that are removed from or evicted by the cache return to
+	//! the pool and later images with the same size and format are uploaded into their storage instead of allocating new
+	//! textures. Defaults to TexturePool::get(). Set to nullptr to create a new texture for each image.
+	void setTexturePool(TexturePoolRef value);
+	TexturePoolRef getTexturePool();
+
+	//! Client used to fetch http:// urls with pooled keep-alive connections and ETag/Last-Modified revalidation against its
+	//! disk cache. Other urls (e.g. https://) are read via ci::loadFile(). Defaults to HttpFetcher::get(). Set to nullptr to
+	//! read all urls via ci::loadFile().
+	void setHttpFetcher(HttpFetcherRef value);
+	HttpFetcherRef getHttpFetcher();
+
+	//! Optional index of file content hashes. If set, local files with identical content (e.g. the same image exported under
+	//! several names) are decoded and uploaded once and share a texture, which is cached under the content hash and can still
+	//! be accessed via each path. Files are only hashed again once they change. Urls and prefetches aren't deduplicated.
+	//! Stats report the memory saved. Disabled (nullptr) by default.
+	void setContentHashIndex(ContentHashIndexRef value);
+	ContentHashIndexRef getContentHashIndex();
+
+	//! Atlas that loadRegion() packs images into. Defaults to TextureAtlas::get().
+	void setTextureAtlas(TextureAtlasRef value);
+	TextureAtlasRef getTextureAtlas();
+
+	//! LRU cache of loaded textures. Use it to set a byte budget for this loader, keep a working set resident or read hit/miss stats.
+	TextureCacheRef getTextureCache() const { return mTextureCache; }
+
+	//! Transfers loaded textures to the cache and triggers callbacks. Called automatically on each app update if the
+	//! pool's backend is connected to an update loop; needs to be called manually otherwise (e.g. when running headless).
+	void update() { transferTexturesToMain(); }
+
+	//! Blocks until results are waiting to be delivered by update() or timeout seconds have passed. Returns true if results
+	//! are waiting. Useful to call update() from a dedicated thread when running headless (see AsyncSurfaceLoader).
+	bool waitForResults(const double timeout);
+
+	//! Max time in seconds spent on handing loaded textures to the main thread per frame. Remaining results carry over
+	//! to the next frame; at least one result is delivered per frame. Default is -1, which means infinite time.
+	void setMaxCallbackTime(const double value) { mMaxCallbackTime = value; }
+	double getMaxCallbackTime() const { return mMaxCallbackTime; }
+
+	//! Max number of loaded textures handed to the main thread per frame. Remaining results carry over to the next frame. Default is -1, which means no limit.
+	void setMaxCallbacksPerFrame(const int value) { mMaxCallbacksPerFrame = value; }
+	int getMaxCallbacksPerFrame() const { return mMaxCallbacksPerFrame; }
+
+	Stats getStats();
+	void resetStats();
+
+	//! Logs getStats().toString() every interval seconds during update(). 0 disables logging, which is the default.
+	void setStatsLogInterval(const double value) { mStatsLogInterval = value; }
+	double getStatsLogInterval() const { return mStatsLogInterval; }
+
+	//! Optional callback that receives the timeline of each delivered request, e.g. to trace slow loads.
+	void setTimelineCallback(TimelineCallback value) { mTimelineCallback = value; }
+
+	static std::string getStageName(const Stage stage);
+
+	//! The shared GL worker pool that images are loaded on.
+	GlWorkerPoolRef getWorkerPool() const { return mPool; }
+
+	//! Format of loaded textures. Queries GL on first access, so it must be first called on the main thread or a GL worker
+	//! (which setup() takes care of).
 	static const ci::gl::Texture::Format & getDefaultFormat();
+
+	//! Should be called on the main thread before loading any images.
 	static void setDefaultFormat(ci::gl::Texture::Format value);
 	
 protected:
-	void loadImages(ci::gl::ContextRef context); // on worker thread
+	//! CPU memory results that skip the upload stage
+	enum class CpuTarget {
+		None,
+		Surface,
+		Channel
+	};
+
+	//! File and target size of a request
+	struct Source {
+		std::string path;
+		int maxSize = 0;
+		bool isAtlasRegion = false; // requested via loadRegion()
+		CpuTarget cpuTarget = CpuTarget::None; // requested via loadSurface() or loadChannel()
+		std::chrono::steady_clock::time_point requestTime = std::chrono::steady_clock::now();
+	};
+
+	//! Tightly packed RGBA pixels passed from decode threads to upload jobs
+	struct DecodedImage {
+		std::string key;
+		PixelBufferRef pixels = nullptr; // returned to the pixel buffer pool once uploaded
+		PixelCache::EntryRef cachedPixels = nullptr; // mapped pixels; replaces pixels if set
+		std::vector<PixelBufferRef> mipmaps; // levels 1+ if generated on the cpu
+		ci::BufferRef compressed = nullptr; // DDS data with all levels; replaces pixels and mipmaps if set
+		int32_t width = 0;
+		int32_t height = 0;
+		bool hasAlpha = true;
+		bool isAtlasRegion = false; // uploaded into the atlas instead of its own texture
+		std::string contentKey; // set if other requests for the same content wait for this image
+		size_t numBytesReserved = 0;
+		Timeline timeline;
+
+		const uint8_t * getPixels() const { return cachedPixels ? cachedPixels->pixels : (pixels ? pixels->getData() : nullptr); }
+
+		//! CPU memory used by pixels of all levels
+		size_t getNumBytes() const {
+			if (compressed) return compressed->getSize();
+			size_t numBytes = cachedPixels ? (size_t)width * height * 4 : (pixels ? pixels->getSize() : 0);
+			for (const auto & level : mipmaps) numBytes += level->getSize();
+			return numBytes;
+		}
+	};
+
+	//! Encoded file data passed from I/O to decode threads
+	struct EncodedImage {
+		std::string key;
+		Source source;
+		ci::BufferRef buffer = nullptr;
+		bool isCompressed = false; // buffer contains DDS data from the compressed texture cache
+		PixelCache::EntryRef cachedPixels = nullptr; // replaces buffer on pixel cache hits
+		std::shared_ptr<DecodedImage> prefetched = nullptr; // replaces buffer for prefetched images that have been requested since
+		std::string contentKey;
+		Timeline timeline;
+	};
+
+	//! Load of an image that other requests with the same content hash wait for
+	struct ContentLoad {
+		std::string key; // request that's being loaded
+		std::vector<std::pair<std::string, Source>> waitingRequests; // by cache key
+	};
+
+	void readImages(const bool isRemote); // on io or fetch thread
+	void decodeImages(); // on decode thread
+	bool isRequested(const std::string & key); // loading or prefetching
+	bool isPendingPrefetch(const std::string & key); // requested by prefetch() only
+	bool promotePrefetchedImage(const std::string & key); // requires stage lock; moves decoded prefetched image back into the decode stage
+	void removePrefetch(const std::string & key); // requires stage lock
+	bool isIdle(); // requires stage lock; true if no requests other than prefetches are waiting in any stage
+	PriorityRequestQueue & getRequestQueue(const std::string & path); // requires stage lock; remote or local requests
+	void trimPrefetchedImages(); // requires stage lock
+	bool shareContent(const EncodedImage & image); // on io thread; true if image will be served by a texture or load with the same content
+	std::string getTextureKey(const std::string & key); // key of the texture in the cache, which is the content key if it's shared
+	static std::string getContentKey(const uint64_t hash, const Source & source);
+
+	bool reserveBytes(const std::string & key, const size_t numBytes); // on decode thread; blocks until reserved and returns false if request has been cancelled
+	void generateMipmaps(DecodedImage & image); // on decode thread
+	void uploadNextImage(); // on worker pool thread
+	ci::gl::TextureRef uploadIntoPool(const DecodedImage & image, const TexturePoolRef & texturePool); // on worker pool thread
+	void queueCpuResult(DecodedImage & image, const CpuTarget target); // on decode threads
+	void requestCpuResult(const std::string & key, const std::string & path, Callback callback, const CpuTarget target, const int maxSize, const int priority);
+	AtlasRegionRef insertIntoAtlas(DecodedImage & image); // on worker pool thread; releases the image's reservation if inserted
+	PixelBufferRef acquirePixels(const size_t numBytes); // on decode threads
+	void uploadLevel(const ci::gl::TextureRef & texture, const uint8_t * pixels, const int level, const int width, const int height); // on worker pool thread
 	void transferTexturesToMain(); // on main thread
 	void triggerCallbacks(const std::string path, ci::gl::TextureRef texture = nullptr); // on main thread
+	void requestImage(const std::string & key, const Source & source, const int priority); // requires callback lock
+
+	static int getMaxMipLevel(); // safe to call on any thread
+	static size_t getTextureBytes(const int width, const int height);
+	static size_t getTextureBytes(const ci::gl::TextureRef & texture);
+	static size_t getTextureBytes(const DecodedImage & image);
 
-	void setup();
-	static void initializeLoader(); // makes sure that Cinder's internal static factories are initialized once on the main thread
-	static bool sIsInitialized; // need to initialize Cinder image factory on main thread 
-	static std::mutex mInitializationMutex;
+	void setup(const bool force = false);
+	void stopThreads();
 
-	unsigned int mNumThreads = -1;
+	unsigned int mNumIoThreads = 2;
+	unsigned int mNumFetchThreads = 4;
+	unsigned int mNumDecodeThreads = 1;
+	unsigned int mNumUploadThreads = 1;
+	size_t mQueueSize; // max number of images waiting in each stage
+	size_t mNumCpuResults = 0; // surfaces and channels waiting for delivery; bounded by mQueueSize
+	std::atomic<bool> mPboUploadsEnabled = true;
+	std::atomic<bool> mMappedReadsEnabled = true;
+	std::atomic<bool> mCpuMipmapsEnabled = false;
+	double mMaxCallbackTime = -1.0;
+	int mMaxCallbacksPerFrame = -1;
+	double mStatsLogInterval = 0;
+	std::chrono::steady_clock::time_point mStatsLogTime; // main thread only
+	TimelineCallback mTimelineCallback = nullptr;
 
 	std::map<std::string, std::vector<Callback>> mCallbacks;
-	std::map<std::string, ci::gl::TextureRef> mTextureCache;
-	std::set<ci::gl::ContextRef> mBackgroundContexts;
-	ci::ConcurrentCircularBuffer<Request> mTextureBuffer;
+	GlWorkerPoolRef mPool;
+	GlWorkerPool::ClientId mClientId;
+	GpuMemoryBudgetRef mMemoryBudget;
+	TextureCacheRef mTextureCache;
+	CompressedTextureCacheRef mCompressedTextureCache = nullptr;
+	PixelCacheRef mPixelCache = nullptr;
+	HttpFetcherRef mHttpFetcher;
+	PixelBufferPoolRef mPixelBufferPool;
+	TexturePoolRef mTexturePool;
+	TextureAtlasRef mTextureAtlas;
+	ContentHashIndexRef mContentHashIndex = nullptr;
+	AtlasRegionRef mDeliveredRegion = nullptr; // region of the result whose callbacks are being triggered; main thread only
+	const Request * mDeliveredCpuResult = nullptr; // surface or channel result whose callbacks are being triggered; main thread only
 
 	std::mutex mCallbackMutex;
-	std::mutex mTextureMutex;
-	std::mutex mRequestMutex;
+	std::mutex mThreadMutex; // for thread management (starting, stopping, etc)
+	std::vector<std::thread> mIoThreads;
+	std::vector<std::thread> mFetchThreads;
+	std::vector<std::thread> mDecodeThreads;
 
-	std::condition_variable mRequestLock;
-	std::deque<std::string> mRequests;
+	std::mutex mStageMutex; // for requests and queues between stages
+	std::condition_variable mStageCondition;
+	PriorityRequestQueue mRequests; // by cache key
+	PriorityRequestQueue mRemoteRequests; // by cache key for http:// urls; read by fetch threads
+	std::map<std::string, Source> mSources; // by cache key for requests that haven't been read yet
+	std::deque<EncodedImage> mEncodedImages;
+	std::deque<DecodedImage> mDecodedImages;
+	std::deque<Request> mResults; // uploaded textures waiting for the main thread; unbounded so that upload jobs never wait on the main thread
+	Stats mStats;
+	PriorityRequestQueue mPrefetchRequests; // by cache key; only read while mRequests is empty
+	std::map<std::string, PrefetchLevel> mPrefetches; // by cache key for prefetches that haven't completed
+	std::map<std::string, DecodedImage> mPrefetchedImages; // by cache key
+	std::list<std::string> mPrefetchedOrder; // oldest first
+	size_t mPrefetchedBytes = 0;
+	size_t mPrefetchBudget = 512 * 1024 * 1024;
+	std::map<std::string, ContentLoad> mContentLoads; // by content key for loads that haven't been delivered yet
+	std::map<std::string, std::string> mContentKeys; // content key by cache key for textures that are shared by content hash
+	bool mThreadsAreAlive = false;
 
-	std::set<std::shared_ptr<std::thread>> mThreads;
-	std::atomic<bool> mThreadsAreAlive = true;
+	std::atomic<bool> mIsAlive = true;
+	bool mIsSetup = false;
 	ci::signals::ConnectionList mSignalConnections;
 	
-	static ci::gl::Texture2d::Format sDefaultFormat;
-	static bool sDefaultFormatInitialized;
+	static ci::gl::Texture2d::Format sDefaultFormat; // only accessed on threads with a GL context
+	static std::once_flag sDefaultFormatFlag;
+	static std::atomic<bool> sDefaultHasMipmapping; // snapshots of sDefaultFormat for I/O and decode threads
+	static std::atomic<int> sDefaultMaxMipmapLevel;
 };
 
 }
@@ -0,0 +1,118 @@
+#include "AsyncSurfaceLoader.h"
+
+#include "GlContextBackend.h"
+#include "GlWorkerPool.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	AsyncSurfaceLoader::AsyncSurfaceLoader(const unsigned int numDecodeThreads) :
+		mIsAlive(true)
+	{
+		// results never reach the upload stage, so the pool only needs a single idle thread without gl
+		auto pool = make_shared<GlWorkerPool>(1, make_shared<NullGlContextBackend>());
+		mLoader = make_shared<AsyncImageLoader>(numDecodeThreads, 1, pool);
+		mLoader->setTexturePool(nullptr);
+		mDeliveryThread = std::thread(bind(&AsyncSurfaceLoader::deliverResults, this));
+	}
+
+	AsyncSurfaceLoader::~AsyncSurfaceLoader() {
+		mIsAlive = false;
+
+		if (mDeliveryThread.joinable()) {
+			mDeliveryThread.join();
+		}
+
+		// triggers callbacks of pending requests with nullptr
+		mLoader->cancelAll();
+	}
+
+	void AsyncSurfaceLoader::load(const std::string path, SurfaceCallback callback, const int maxSize, const int priority) {
+		{
+			lock_guard<mutex> lock(mPendingMutex);
+			mNumPendingRequests++;
+		}
+
+		mLoader->loadSurface(path, [=](const std::string path, ci::Surface8uRef surface) {
+			callback(path, surface);
+			finishRequest();
+		}, maxSize, priority);
+	}
+
+	std::future<ci::Surface8uRef> AsyncSurfaceLoader::load(const std::string path, const int maxSize, const int priority) {
+		auto promise = make_shared<std::promise<ci::Surface8uRef>>();
+		auto future = promise->get_future();
+		load(path, [promise](const std::string, ci::Surface8uRef surface) { promise->set_value(surface); }, maxSize, priority);
+		return future;
+	}
+
+	void AsyncSurfaceLoader::loadChannel(const std::string path, ChannelCallback callback, const int maxSize, const int priority) {
+		{
+			lock_guard<mutex> lock(mPendingMutex);
+			mNumPendingRequests++;
+		}
+
+		mLoader->loadChannel(path, [=](const std::string path, ci::Channel8uRef channel) {
+			callback(path, channel);
+			finishRequest();
+		}, maxSize, priority);
+	}
+
+	std::future<ci::Channel8uRef> AsyncSurfaceLoader::loadChannel(const std::string path, const int maxSize, const int priority) {
+		auto promise = make_shared<std::promise<ci::Channel8uRef>>();
+		auto future = promise->get_future();
+		loadChannel(path, [promise](const std::string, ci::Channel8uRef channel) { promise->set_value(channel); }, maxSize, priority);
+		return future;
+	}
+
+	void AsyncSurfaceLoader::cancel(const std::string path, const int maxSize) {
+		mLoader->cancel(AsyncImageLoader::getSurfaceKey(path, maxSize));
+		mLoader->cancel(AsyncImageLoader::getChannelKey(path, maxSize));
+	}
+
+	void AsyncSurfaceLoader::cancelAll() {
+		mLoader->cancelAll();
+	}
+
+	bool AsyncSurfaceLoader::isLoading(const std::string path, const int maxSize) {
+		return mLoader->isLoading(AsyncImageLoader::getSurfaceKey(path, maxSize)) || mLoader->isLoading(AsyncImageLoader::getChannelKey(path, maxSize));
+	}
+
+	void AsyncSurfaceLoader::setPriority(const std::string path, const int priority, const int maxSize) {
+		mLoader->setPriority(AsyncImageLoader::getSurfaceKey(path, maxSize), priority);
+		mLoader->setPriority(AsyncImageLoader::getChannelKey(path, maxSize), priority);
+	}
+
+	size_t AsyncSurfaceLoader::getNumPendingRequests() {
+		lock_guard<mutex> lock(mPendingMutex);
+		return mNumPendingRequests;
+	}
+
+	void AsyncSurfaceLoader::waitUntilIdle() {
+		unique_lock<mutex> lock(mPendingMutex);
+		mPendingCondition.wait(lock, [&] { return mNumPendingRequests == 0; });
+	}
+
+	void AsyncSurfaceLoader::finishRequest() {
+		{
+			lock_guard<mutex> lock(mPendingMutex);
+			if (mNumPendingRequests > 0) mNumPendingRequests--;
+		}
+
+		mPendingCondition.notify_all();
+	}
+
+	void AsyncSurfaceLoader::deliverResults() {
+		while (mIsAlive) {
+			// short timeout so that the thread can be stopped
+			if (mLoader->waitForResults(0.1)) {
+				mLoader->update();
+			}
+		}
+	}
+
+}
+}
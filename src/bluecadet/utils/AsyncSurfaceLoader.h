@@ -0,0 +1,82 @@
+#pragma once
+
+#include "cinder/Surface.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "AsyncImageLoader.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class AsyncSurfaceLoader> AsyncSurfaceLoaderRef;
+
+//! CPU-only variant of AsyncImageLoader for headless tools (e.g. thumbnail generation or color statistics) that loads
+//! images into surfaces and channels without a GL context or app.
+//!
+//! Requests run through an AsyncImageLoader on a worker pool with a NullGlContextBackend, so reading, decoding, the
+//! pixel cache, pixel buffer pool and cancellation work the same way, while the upload stage is skipped. Decode threads
+//! default to one per hardware thread. Results are delivered by a dedicated thread instead of an app's update loop, so
+//! futures are fulfilled without any other thread calling update(). Callbacks of loaded images are triggered one at a
+//! time on that thread; callbacks of failed or canceled requests are triggered on the thread that failed or canceled them.
+class AsyncSurfaceLoader {
+
+public:
+	typedef AsyncImageLoader::SurfaceCallback SurfaceCallback;
+	typedef AsyncImageLoader::ChannelCallback ChannelCallback;
+
+	//! Optional shared instance. This class can still be independently instantiated.
+	static AsyncSurfaceLoaderRef get() {
+		static auto instance = std::make_shared<AsyncSurfaceLoader>();
+		return instance;
+	}
+
+	//! numDecodeThreads: Number of CPU threads used for decoding. 0 uses the number of hardware threads.
+	AsyncSurfaceLoader(const unsigned int numDecodeThreads = 0);
+	~AsyncSurfaceLoader();
+
+	//! Loads path into an RGBA surface, downscaled to fit within maxSize x maxSize pixels if maxSize > 0.
+	//! The callback receives nullptr if the request failed or was canceled.
+	void load(const std::string path, SurfaceCallback callback, const int maxSize = 0, const int priority = 0);
+	std::future<ci::Surface8uRef> load(const std::string path, const int maxSize = 0, const int priority = 0);
+
+	//! Loads path into an 8-bit luminance channel, downscaled to fit within maxSize x maxSize pixels if maxSize > 0.
+	//! The callback receives nullptr if the request failed or was canceled.
+	void loadChannel(const std::string path, ChannelCallback callback, const int maxSize = 0, const int priority = 0);
+	std::future<ci::Channel8uRef> loadChannel(const std::string path, const int maxSize = 0, const int priority = 0);
+
+	//! Cancels surface and channel requests for path and maxSize.
+	void cancel(const std::string path, const int maxSize = 0);
+	void cancelAll();
+
+	bool isLoading(const std::string path, const int maxSize = 0);
+	void setPriority(const std::string path, const int priority, const int maxSize = 0);
+
+	//! Number of requests whose callbacks haven't been triggered yet.
+	size_t getNumPendingRequests();
+
+	//! Blocks until all pending requests have been delivered, e.g. at the end of a batch.
+	void waitUntilIdle();
+
+	//! The underlying loader. Use it to configure threads, the pixel cache, the pixel buffer pool or the http fetcher and to read stats.
+	AsyncImageLoaderRef getImageLoader() const { return mLoader; }
+
+protected:
+	void deliverResults(); // on delivery thread
+	void finishRequest();
+
+	AsyncImageLoaderRef mLoader;
+	std::thread mDeliveryThread;
+	std::atomic<bool> mIsAlive;
+
+	std::mutex mPendingMutex;
+	std::condition_variable mPendingCondition;
+	size_t mNumPendingRequests = 0;
+};
+
+}
+}
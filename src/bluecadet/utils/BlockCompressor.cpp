@@ -0,0 +1,208 @@
+#include "BlockCompressor.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		inline uint16_t toRgb565(const int r, const int g, const int b) {
+			return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+		}
+
+		inline void fromRgb565(const uint16_t c, int rgb[3]) {
+			const int r = (c >> 11) & 31;
+			const int g = (c >> 5) & 63;
+			const int b = c & 31;
+			rgb[0] = (r << 3) | (r >> 2);
+			rgb[1] = (g << 2) | (g >> 4);
+			rgb[2] = (b << 3) | (b >> 2);
+		}
+	}
+
+	size_t BlockCompressor::getNumBytes(const int width, const int height, const Format format) {
+		const size_t numBlocksX = (size_t)max(1, (width + 3) / 4);
+		const size_t numBlocksY = (size_t)max(1, (height + 3) / 4);
+		return numBlocksX * numBlocksY * getBlockSize(format);
+	}
+
+	void BlockCompressor::encode(const uint8_t * src, const int width, const int height, const ptrdiff_t rowBytes, uint8_t * dst, const Format format) {
+		if (!src || !dst || width <= 0 || height <= 0) {
+			return;
+		}
+
+		uint8_t block[64]; // 4x4 RGBA pixels
+
+		for (int by = 0; by < height; by += 4) {
+			for (int bx = 0; bx < width; bx += 4) {
+
+				// gather block and repeat edge pixels
+				for (int y = 0; y < 4; ++y) {
+					const uint8_t * srcRow = src + min(by + y, height - 1) * rowBytes;
+					for (int x = 0; x < 4; ++x) {
+						const uint8_t * pixel = srcRow + min(bx + x, width - 1) * 4;
+						uint8_t * blockPixel = block + (y * 4 + x) * 4;
+						blockPixel[0] = pixel[0];
+						blockPixel[1] = pixel[1];
+						blockPixel[2] = pixel[2];
+						blockPixel[3] = pixel[3];
+					}
+				}
+
+				if (format == Format::BC3) {
+					encodeAlphaBlock(block, dst);
+					dst += 8;
+				}
+
+				encodeColorBlock(block, dst);
+				dst += 8;
+			}
+		}
+	}
+
+	void BlockCompressor::encodeColorBlock(const uint8_t block[64], uint8_t * dst) {
+		int minColor[3] = {255, 255, 255};
+		int maxColor[3] = {0, 0, 0};
+
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 3; ++c) {
+				minColor[c] = min(minColor[c], (int)block[i * 4 + c]);
+				maxColor[c] = max(maxColor[c], (int)block[i * 4 + c]);
+			}
+		}
+
+		// inset bounding box to reduce the error of the interpolated colors
+		for (int c = 0; c < 3; ++c) {
+			const int inset = (maxColor[c] - minColor[c]) / 16;
+			minColor[c] = min(255, minColor[c] + inset);
+			maxColor[c] = max(0, maxColor[c] - inset);
+		}
+
+		// pick the box diagonal that follows the colors: flip channels that decrease while the channel with the largest range increases
+		int mainChannel = 0;
+		for (int c = 1; c < 3; ++c) {
+			if (maxColor[c] - minColor[c] > maxColor[mainChannel] - minColor[mainChannel]) {
+				mainChannel = c;
+			}
+		}
+
+		int mean[3] = {0, 0, 0};
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 3; ++c) {
+				mean[c] += block[i * 4 + c];
+			}
+		}
+
+		for (int c = 0; c < 3; ++c) {
+			if (c == mainChannel) continue;
+
+			int covariance = 0;
+			for (int i = 0; i < 16; ++i) {
+				covariance += (block[i * 4 + mainChannel] * 16 - mean[mainChannel]) * (block[i * 4 + c] * 16 - mean[c]) / 256;
+			}
+
+			if (covariance < 0) {
+				swap(minColor[c], maxColor[c]);
+			}
+		}
+
+		uint16_t color0 = toRgb565(maxColor[0], maxColor[1], maxColor[2]);
+		uint16_t color1 = toRgb565(minColor[0], minColor[1], minColor[2]);
+
+		// color0 > color1 selects the opaque 4 color mode
+		if (color0 < color1) {
+			swap(color0, color1);
+		}
+
+		uint32_t indices = 0;
+
+		if (color0 != color1) {
+			int palette[4][3];
+			fromRgb565(color0, palette[0]);
+			fromRgb565(color1, palette[1]);
+
+			for (int c = 0; c < 3; ++c) {
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; ++i) {
+				int bestIndex = 0;
+				int bestDistance = INT32_MAX;
+
+				for (int p = 0; p < 4; ++p) {
+					const int dr = block[i * 4 + 0] - palette[p][0];
+					const int dg = block[i * 4 + 1] - palette[p][1];
+					const int db = block[i * 4 + 2] - palette[p][2];
+					const int distance = dr * dr + dg * dg + db * db;
+
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						bestIndex = p;
+					}
+				}
+
+				indices |= (uint32_t)bestIndex << (i * 2);
+			}
+		}
+
+		dst[0] = (uint8_t)(color0 & 0xff);
+		dst[1] = (uint8_t)(color0 >> 8);
+		dst[2] = (uint8_t)(color1 & 0xff);
+		dst[3] = (uint8_t)(color1 >> 8);
+		dst[4] = (uint8_t)(indices & 0xff);
+		dst[5] = (uint8_t)((indices >> 8) & 0xff);
+		dst[6] = (uint8_t)((indices >> 16) & 0xff);
+		dst[7] = (uint8_t)(indices >> 24);
+	}
+
+	void BlockCompressor::encodeAlphaBlock(const uint8_t block[64], uint8_t * dst) {
+		int minAlpha = 255;
+		int maxAlpha = 0;
+
+		for (int i = 0; i < 16; ++i) {
+			minAlpha = min(minAlpha, (int)block[i * 4 + 3]);
+			maxAlpha = max(maxAlpha, (int)block[i * 4 + 3]);
+		}
+
+		uint64_t indices = 0;
+
+		if (maxAlpha != minAlpha) {
+			// alpha0 > alpha1 selects the 8 value mode
+			int palette[8];
+			palette[0] = maxAlpha;
+			palette[1] = minAlpha;
+
+			for (int p = 1; p < 7; ++p) {
+				palette[p + 1] = ((7 - p) * maxAlpha + p * minAlpha) / 7;
+			}
+
+			for (int i = 0; i < 16; ++i) {
+				int bestIndex = 0;
+				int bestDistance = INT32_MAX;
+
+				for (int p = 0; p < 8; ++p) {
+					const int distance = abs(block[i * 4 + 3] - palette[p]);
+
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						bestIndex = p;
+					}
+				}
+
+				indices |= (uint64_t)bestIndex << (i * 3);
+			}
+		}
+
+		dst[0] = (uint8_t)maxAlpha;
+		dst[1] = (uint8_t)minAlpha;
+
+		for (int i = 0; i < 6; ++i) {
+			dst[2 + i] = (uint8_t)((indices >> (i * 8)) & 0xff);
+		}
+	}
+
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bluecadet {
+namespace utils {
+
+//! CPU encoder for S3TC/DXT block-compressed textures from 8-bit RGBA pixels. Blocks are encoded with a fast
+//! bounding-box endpoint fit, which is good enough for photos and UI assets but isn't tuned for maximum quality.
+//! Doesn't depend on GL and can run on any thread.
+class BlockCompressor {
+
+public:
+	enum class Format {
+		BC1,	//! DXT1: 4 bits per pixel, opaque RGB
+		BC3		//! DXT5: 8 bits per pixel, RGB with interpolated alpha
+	};
+
+	//! Number of bytes needed to store a width x height image in format.
+	static size_t getNumBytes(const int width, const int height, const Format format);
+
+	//! Number of bytes per 4x4 block.
+	static size_t getBlockSize(const Format format) { return format == Format::BC1 ? 8 : 16; }
+
+	//! Encodes width x height RGBA pixels from src into dst, which needs to hold at least getNumBytes() bytes.
+	//! Images whose size isn't a multiple of 4 are padded by repeating edge pixels.
+	static void encode(const uint8_t * src, const int width, const int height, const ptrdiff_t rowBytes, uint8_t * dst, const Format format);
+
+protected:
+	static void encodeColorBlock(const uint8_t block[64], uint8_t * dst);
+	static void encodeAlphaBlock(const uint8_t block[64], uint8_t * dst);
+};
+
+}
+}
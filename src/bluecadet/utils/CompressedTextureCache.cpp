@@ -0,0 +1,293 @@
+#include "CompressedTextureCache.h"
+
+#include "cinder/Log.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "ContentHashIndex.h"
+#include "FileUtils.h"
+#include "ImageResampler.h"
+#include "MemoryImageTarget.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		// DDS header layout, see https://docs.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
+		const uint32_t DDSD_CAPS = 0x1;
+		const uint32_t DDSD_HEIGHT = 0x2;
+		const uint32_t DDSD_WIDTH = 0x4;
+		const uint32_t DDSD_PIXELFORMAT = 0x1000;
+		const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+		const uint32_t DDSD_LINEARSIZE = 0x80000;
+		const uint32_t DDPF_FOURCC = 0x4;
+		const uint32_t DDSCAPS_COMPLEX = 0x8;
+		const uint32_t DDSCAPS_TEXTURE = 0x1000;
+		const uint32_t DDSCAPS_MIPMAP = 0x400000;
+		const size_t DDS_HEADER_SIZE = 4 + 124; // magic + header
+
+		// cache files start with this prefix and the full key, followed by the dds data
+		const char * MAGIC = "BCTC";
+		const uint32_t VERSION = 1;
+		const size_t PREFIX_SIZE = 12; // magic + version + key length
+		const std::string EXTENSION = ".tc";
+
+		inline void writeUint32(uint8_t * dst, const uint32_t value) {
+			dst[0] = (uint8_t)(value & 0xff);
+			dst[1] = (uint8_t)((value >> 8) & 0xff);
+			dst[2] = (uint8_t)((value >> 16) & 0xff);
+			dst[3] = (uint8_t)(value >> 24);
+		}
+
+		inline uint32_t readUint32(const uint8_t * src) {
+			return (uint32_t)src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+		}
+
+		inline uint32_t makeFourCC(const char * code) {
+			return (uint32_t)code[0] | (uint32_t)code[1] << 8 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 24;
+		}
+	}
+
+	CompressedTextureCache::CompressedTextureCache(const ci::fs::path & cacheDir, const Mode mode) :
+		mCacheDir(cacheDir),
+		mMode(mode)
+	{
+		try {
+			fs::create_directories(mCacheDir);
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not create texture cache dir at '" + mCacheDir.string() + "'", e);
+		}
+	}
+
+	ci::BufferRef CompressedTextureCache::load(const ci::fs::path & sourcePath, const int maxSize, const int maxMipLevel) {
+		const string key = getCacheKey(sourcePath, maxSize, maxMipLevel);
+
+		if (key.empty()) {
+			return nullptr;
+		}
+
+		const fs::path cachePath = getCachePath(key);
+		ifstream file(cachePath.string(), ios::binary | ios::ate);
+
+		if (!file) {
+			return nullptr;
+		}
+
+		const size_t numFileBytes = (size_t)file.tellg();
+		const size_t ddsOffset = PREFIX_SIZE + key.size();
+
+		if (numFileBytes <= ddsOffset + DDS_HEADER_SIZE) {
+			return nullptr;
+		}
+
+		uint8_t prefix[PREFIX_SIZE];
+		string storedKey(key.size(), '\0');
+		file.seekg(0);
+		file.read((char *)prefix, PREFIX_SIZE);
+		file.read(&storedKey[0], storedKey.size());
+
+		// filenames are hashes, so make sure this is the entry that was requested
+		if (!file || memcmp(prefix, MAGIC, 4) != 0 || readUint32(prefix + 4) != VERSION
+			|| readUint32(prefix + 8) != (uint32_t)key.size() || storedKey != key) {
+			return nullptr;
+		}
+
+		const size_t numBytes = numFileBytes - ddsOffset;
+		auto buffer = make_shared<Buffer>(numBytes);
+		file.read((char *)buffer->getData(), numBytes);
+
+		if (!file || memcmp(buffer->getData(), "DDS ", 4) != 0) {
+			CI_LOG_W("Invalid texture cache file at '" + cachePath.string() + "'");
+			return nullptr;
+		}
+
+		return buffer;
+	}
+
+	ci::BufferRef CompressedTextureCache::store(const ci::fs::path & sourcePath, const uint8_t * pixels, const int width, const int height,
+		const bool hasAlpha, const int maxSize, const int maxMipLevel) {
+
+		const Mode mode = mMode;
+		const bool useBc3 = mode == Mode::BC3 || (mode == Mode::Auto && hasAlpha);
+		auto buffer = createDds(pixels, width, height, useBc3 ? BlockCompressor::Format::BC3 : BlockCompressor::Format::BC1, maxMipLevel);
+
+		const string key = getCacheKey(sourcePath, maxSize, maxMipLevel);
+
+		if (!buffer || key.empty()) {
+			return buffer;
+		}
+
+		const fs::path cachePath = getCachePath(key);
+
+		uint8_t prefix[PREFIX_SIZE];
+		memcpy(prefix, MAGIC, 4);
+		writeUint32(prefix + 4, VERSION);
+		writeUint32(prefix + 8, (uint32_t)key.size());
+
+		try {
+			lock_guard<mutex> lock(mFileMutex);
+
+			// write to temp file first so that readers never see partial files
+			fs::path tempPath = cachePath;
+			tempPath += ".tmp";
+
+			{
+				ofstream file(tempPath.string(), ios::binary | ios::trunc);
+				file.write((const char *)prefix, PREFIX_SIZE);
+				file.write(key.data(), key.size());
+				file.write((const char *)buffer->getData(), buffer->getSize());
+
+				if (!file) {
+					throw ci::Exception("Could not write file");
+				}
+			}
+
+			fs::rename(tempPath, cachePath);
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not write texture cache file at '" + cachePath.string() + "'", e);
+		}
+
+		return buffer;
+	}
+
+	ci::fs::path CompressedTextureCache::getCachePath(const ci::fs::path & sourcePath, const int maxSize, const int maxMipLevel) const {
+		const string key = getCacheKey(sourcePath, maxSize, maxMipLevel);
+		return key.empty() ? fs::path() : getCachePath(key);
+	}
+
+	ci::fs::path CompressedTextureCache::getCachePath(const std::string & key) const {
+		return mCacheDir / (ContentHashIndex::toString(ContentHashIndex::hash(key.data(), key.size())) + EXTENSION);
+	}
+
+	std::string CompressedTextureCache::getCacheKey(const ci::fs::path & sourcePath, const int maxSize, const int maxMipLevel) const {
+		try {
+			const fs::path absPath = fs::absolute(sourcePath);
+
+			if (!fs::exists(absPath)) {
+				return string();
+			}
+
+			stringstream key;
+			key << absPath.string()
+				<< "|" << FileUtils::getModificationTime(absPath)
+				<< "|" << fs::file_size(absPath)
+				<< "|" << maxSize
+				<< "|" << maxMipLevel
+				<< "|" << (int)mMode.load();
+
+			return key.str();
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not create texture cache key for '" + sourcePath.string() + "'", e);
+			return string();
+		}
+	}
+
+	void CompressedTextureCache::clear() {
+		lock_guard<mutex> lock(mFileMutex);
+
+		try {
+			for (const auto & entry : fs::directory_iterator(mCacheDir)) {
+				// also remove plain dds files written by previous versions
+				if (entry.path().extension() == EXTENSION || entry.path().extension() == ".dds") {
+					fs::remove(entry.path());
+				}
+			}
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not clear texture cache at '" + mCacheDir.string() + "'", e);
+		}
+	}
+
+	ci::BufferRef CompressedTextureCache::createDds(const uint8_t * pixels, const int width, const int height, const BlockCompressor::Format format, const int maxMipLevel) {
+		if (!pixels || width <= 0 || height <= 0) {
+			return nullptr;
+		}
+
+		const int numLevels = min(ImageResampler::getNumMipLevels(width, height), max(0, maxMipLevel) + 1);
+
+		size_t numBytes = DDS_HEADER_SIZE;
+		for (int level = 0; level < numLevels; ++level) {
+			const ivec2 size = ImageResampler::getMipSize(width, height, level);
+			numBytes += BlockCompressor::getNumBytes(size.x, size.y, format);
+		}
+
+		auto buffer = make_shared<Buffer>(numBytes);
+		uint8_t * data = (uint8_t *)buffer->getData();
+		memset(data, 0, DDS_HEADER_SIZE);
+
+		// header
+		uint32_t flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
+		uint32_t caps = DDSCAPS_TEXTURE;
+
+		if (numLevels > 1) {
+			flags |= DDSD_MIPMAPCOUNT;
+			caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+		}
+
+		memcpy(data, "DDS ", 4);
+		uint8_t * header = data + 4;
+		writeUint32(header + 0, 124);
+		writeUint32(header + 4, flags);
+		writeUint32(header + 8, (uint32_t)height);
+		writeUint32(header + 12, (uint32_t)width);
+		writeUint32(header + 16, (uint32_t)BlockCompressor::getNumBytes(width, height, format));
+		writeUint32(header + 24, (uint32_t)numLevels);
+
+		// pixel format
+		writeUint32(header + 72, 32);
+		writeUint32(header + 76, DDPF_FOURCC);
+		writeUint32(header + 80, makeFourCC(format == BlockCompressor::Format::BC3 ? "DXT5" : "DXT1"));
+		writeUint32(header + 104, caps);
+
+		// levels
+		uint8_t * dst = data + DDS_HEADER_SIZE;
+		vector<uint8_t> level;
+		vector<uint8_t> nextLevel;
+
+		for (int i = 0; i < numLevels; ++i) {
+			const ivec2 size = ImageResampler::getMipSize(width, height, i);
+
+			if (i > 0) {
+				// each level is averaged from the previous one
+				const ivec2 prevSize = ImageResampler::getMipSize(width, height, i - 1);
+				const uint8_t * src = i == 1 ? pixels : level.data();
+				nextLevel.resize(MemoryImageTarget::getNumBytes(size.x, size.y));
+				ImageResampler::resize(src, prevSize.x, prevSize.y, MemoryImageTarget::getRowBytes(prevSize.x),
+					nextLevel.data(), size.x, size.y, MemoryImageTarget::getRowBytes(size.x));
+				level.swap(nextLevel);
+			}
+
+			const uint8_t * src = i == 0 ? pixels : level.data();
+			BlockCompressor::encode(src, size.x, size.y, MemoryImageTarget::getRowBytes(size.x), dst, format);
+			dst += BlockCompressor::getNumBytes(size.x, size.y, format);
+		}
+
+		return buffer;
+	}
+
+	ci::ivec2 CompressedTextureCache::getDdsSize(const ci::BufferRef & dds) {
+		if (!dds || dds->getSize() <= DDS_HEADER_SIZE) {
+			return ivec2(0);
+		}
+
+		const uint8_t * data = (const uint8_t *)dds->getData();
+
+		if (memcmp(data, "DDS ", 4) != 0) {
+			return ivec2(0);
+		}
+
+		return ivec2((int)readUint32(data + 4 + 12), (int)readUint32(data + 4 + 8));
+	}
+
+	size_t CompressedTextureCache::getDdsDataSize(const ci::BufferRef & dds) {
+		return dds && dds->getSize() > DDS_HEADER_SIZE ? dds->getSize() - DDS_HEADER_SIZE : 0;
+	}
+
+}
+}
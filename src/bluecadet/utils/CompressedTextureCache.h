@@ -0,0 +1,82 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+#include "cinder/Vector.h"
+
+#include <mutex>
+
+#include "BlockCompressor.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class CompressedTextureCache> CompressedTextureCacheRef;
+
+//! Persistent cache that transcodes decoded images once into block-compressed DDS files, so that later loads can
+//! skip decoding and upload compressed blocks directly via ci::gl::Texture2d::createFromDds(). Compressed textures
+//! also use 4-8x less GPU memory than RGBA.
+//!
+//! Entries are keyed by the source's absolute path, modification time and file size plus the requested max size,
+//! mip levels and compression mode, so modified sources are transcoded again. Files are named by the XXH64 of their key
+//! and store the full key in front of the DDS data, so hash collisions are detected on load. Encoding and file access don't
+//! require GL and can run on any thread.
+class CompressedTextureCache {
+
+public:
+	enum class Mode {
+		Auto,	//! BC1 for opaque images and BC3 for images with alpha
+		BC1,
+		BC3
+	};
+
+	//! Optional shared instance that stores files in a directory in the system's temp directory.
+	static CompressedTextureCacheRef get() {
+		static auto instance = std::make_shared<CompressedTextureCache>(ci::fs::temp_directory_path() / "bluecadet_texture_cache");
+		return instance;
+	}
+
+	//! cacheDir: Directory that DDS files are stored in. Created if it doesn't exist.
+	CompressedTextureCache(const ci::fs::path & cacheDir, const Mode mode = Mode::Auto);
+
+	//! Returns the cached DDS data for sourcePath or nullptr if it hasn't been cached or the source has changed since.
+	ci::BufferRef load(const ci::fs::path & sourcePath, const int maxSize = 0, const int maxMipLevel = 0);
+
+	//! Compresses width x height RGBA pixels of the image at sourcePath, generates mip levels up to maxMipLevel on the CPU
+	//! and stores the result. Returns the DDS data, which can be used right away even if it couldn't be written to disk.
+	//! maxSize and maxMipLevel are only used as part of the key and should match the arguments passed to load().
+	ci::BufferRef store(const ci::fs::path & sourcePath, const uint8_t * pixels, const int width, const int height, const bool hasAlpha,
+		const int maxSize = 0, const int maxMipLevel = 0);
+
+	//! Path of the cache file for this combination of arguments. Returns an empty path if sourcePath doesn't exist.
+	ci::fs::path getCachePath(const ci::fs::path & sourcePath, const int maxSize = 0, const int maxMipLevel = 0) const;
+
+	//! Removes all cached files.
+	void clear();
+
+	const ci::fs::path & getCacheDir() const { return mCacheDir; }
+
+	void setMode(const Mode value) { mMode = value; }
+	Mode getMode() const { return mMode; }
+
+	//! Encodes mip levels 0 to maxMipLevel of width x height RGBA pixels into a DDS file with DXT1 or DXT5 blocks.
+	static ci::BufferRef createDds(const uint8_t * pixels, const int width, const int height, const BlockCompressor::Format format, const int maxMipLevel = 0);
+
+	//! Size of the base level of a DDS file or (0, 0) if dds isn't a valid DDS file.
+	static ci::ivec2 getDdsSize(const ci::BufferRef & dds);
+
+	//! Number of bytes of compressed blocks of all levels in a DDS file, which is about the GPU memory it will use.
+	static size_t getDdsDataSize(const ci::BufferRef & dds);
+
+protected:
+	//! Full key of an entry, which is stored in its file and compared on load. Empty if sourcePath doesn't exist.
+	std::string getCacheKey(const ci::fs::path & sourcePath, const int maxSize, const int maxMipLevel) const;
+	ci::fs::path getCachePath(const std::string & key) const;
+
+	ci::fs::path mCacheDir;
+	std::atomic<Mode> mMode;
+	std::mutex mFileMutex; // serializes writes so that concurrent loads of the same source don't write the same file
+};
+
+}
+}
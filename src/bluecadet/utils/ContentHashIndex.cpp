@@ -0,0 +1,181 @@
+#include "ContentHashIndex.h"
+
+#include "cinder/Log.h"
+
+#include <cstring>
+
+#include "FileUtils.h"
+#include "MappedFile.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		// see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+		const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+		const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+		const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+		const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+		const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+		inline uint64_t rotl(const uint64_t value, const int bits) {
+			return (value << bits) | (value >> (64 - bits));
+		}
+
+		inline uint64_t read64(const uint8_t * src) {
+			// little endian, which is what all supported platforms use
+			uint64_t value;
+			memcpy(&value, src, sizeof(value));
+			return value;
+		}
+
+		inline uint32_t read32(const uint8_t * src) {
+			uint32_t value;
+			memcpy(&value, src, sizeof(value));
+			return value;
+		}
+
+		inline uint64_t round(uint64_t acc, const uint64_t input) {
+			acc += input * PRIME64_2;
+			acc = rotl(acc, 31);
+			return acc * PRIME64_1;
+		}
+
+		inline uint64_t mergeRound(uint64_t acc, const uint64_t value) {
+			acc ^= round(0, value);
+			return acc * PRIME64_1 + PRIME64_4;
+		}
+	}
+
+	uint64_t ContentHashIndex::getHash(const ci::fs::path & path) {
+		try {
+			const fs::path absPath = fs::absolute(path);
+			const string key = absPath.string();
+
+			Entry entry;
+			entry.modificationTime = FileUtils::getModificationTime(absPath);
+			entry.fileSize = (uint64_t)fs::file_size(absPath);
+
+			{
+				lock_guard<mutex> lock(mMutex);
+				auto it = mEntries.find(key);
+
+				if (it != mEntries.end() && it->second.modificationTime == entry.modificationTime && it->second.fileSize == entry.fileSize) {
+					mStats.numHits++;
+					return it->second.hash;
+				}
+			}
+
+			// new or changed file; hashed without holding the lock
+			auto file = MappedFile::create(absPath, MappedFile::Access::Sequential);
+
+			if (!file) {
+				return 0;
+			}
+
+			entry.hash = hash(file->getData(), file->getSize());
+
+			lock_guard<mutex> lock(mMutex);
+			mEntries[key] = entry;
+			mStats.numHashed++;
+			mStats.numBytesHashed += file->getSize();
+			return entry.hash;
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not hash file at '" + path.string() + "'", e);
+			return 0;
+		}
+	}
+
+	void ContentHashIndex::remove(const ci::fs::path & path) {
+		try {
+			const string key = fs::absolute(path).string();
+			lock_guard<mutex> lock(mMutex);
+			mEntries.erase(key);
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not remove '" + path.string() + "' from hash index", e);
+		}
+	}
+
+	void ContentHashIndex::clear() {
+		lock_guard<mutex> lock(mMutex);
+		mEntries.clear();
+	}
+
+	ContentHashIndex::Stats ContentHashIndex::getStats() {
+		lock_guard<mutex> lock(mMutex);
+		Stats stats = mStats;
+		stats.numFiles = mEntries.size();
+		return stats;
+	}
+
+	uint64_t ContentHashIndex::hash(const void * data, const size_t numBytes, const uint64_t seed) {
+		const uint8_t * src = (const uint8_t *)data;
+		const uint8_t * end = src + numBytes;
+		uint64_t h;
+
+		if (numBytes >= 32) {
+			// four independent accumulators over 32 byte stripes
+			uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+			uint64_t v2 = seed + PRIME64_2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - PRIME64_1;
+
+			const uint8_t * limit = end - 32;
+
+			do {
+				v1 = round(v1, read64(src));
+				v2 = round(v2, read64(src + 8));
+				v3 = round(v3, read64(src + 16));
+				v4 = round(v4, read64(src + 24));
+				src += 32;
+			} while (src <= limit);
+
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = mergeRound(h, v1);
+			h = mergeRound(h, v2);
+			h = mergeRound(h, v3);
+			h = mergeRound(h, v4);
+
+		} else {
+			h = seed + PRIME64_5;
+		}
+
+		h += (uint64_t)numBytes;
+
+		for (; src + 8 <= end; src += 8) {
+			h ^= round(0, read64(src));
+			h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+		}
+
+		if (src + 4 <= end) {
+			h ^= (uint64_t)read32(src) * PRIME64_1;
+			h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+			src += 4;
+		}
+
+		for (; src < end; ++src) {
+			h ^= (uint64_t)(*src) * PRIME64_5;
+			h = rotl(h, 11) * PRIME64_1;
+		}
+
+		// avalanche
+		h ^= h >> 33;
+		h *= PRIME64_2;
+		h ^= h >> 29;
+		h *= PRIME64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	std::string ContentHashIndex::toString(const uint64_t hash) {
+		char str[17];
+		snprintf(str, sizeof(str), "%016llx", (unsigned long long)hash);
+		return string(str);
+	}
+
+}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class ContentHashIndex> ContentHashIndexRef;
+
+//! Thread-safe index of 64-bit content hashes by absolute file path, used to detect identical images that are stored
+//! under different names. Files are hashed with XXH64 straight from their mapped pages the first time they're requested
+//! and only hashed again once their modification time or size changes.
+class ContentHashIndex {
+
+public:
+	struct Stats {
+		size_t numFiles = 0;		//! Paths in the index
+		size_t numHits = 0;			//! Calls to getHash() answered by the index
+		size_t numHashed = 0;		//! Calls to getHash() that had to hash the file because it was new or had changed
+		size_t numBytesHashed = 0;
+	};
+
+	//! Optional shared instance.
+	static ContentHashIndexRef get() {
+		static auto instance = std::make_shared<ContentHashIndex>();
+		return instance;
+	}
+
+	//! Hash of the content of the file at path. Returns 0 if the file can't be read.
+	uint64_t getHash(const ci::fs::path & path);
+
+	void remove(const ci::fs::path & path);
+	void clear();
+
+	Stats getStats();
+
+	//! XXH64 of numBytes at data.
+	static uint64_t hash(const void * data, const size_t numBytes, const uint64_t seed = 0);
+
+	//! Hash as 16 hex digits.
+	static std::string toString(const uint64_t hash);
+
+protected:
+	struct Entry {
+		int64_t modificationTime = 0;
+		uint64_t fileSize = 0;
+		uint64_t hash = 0;
+	};
+
+	std::mutex mMutex;
+	std::unordered_map<std::string, Entry> mEntries; // by absolute path
+	Stats mStats;
+};
+
+}
+}
@@ -4,6 +4,7 @@
 #include "cinder/Log.h"
 
 #include <algorithm>
+#include <ctime>
 #include <string>
 
 using namespace ci;
@@ -55,5 +56,15 @@ std::string FileUtils::getExtension(const ci::fs::path & path) {
 	return path.extension().string(); // You can ignore any IntelliSense errors here. This should build.
 }
 
+namespace {
+	template <typename T>
+	int64_t toTicks(const T & time) { return (int64_t)time.time_since_epoch().count(); } // std filesystem
+	inline int64_t toTicks(const std::time_t time) { return (int64_t)time; } // boost filesystem
+}
+
+int64_t FileUtils::getModificationTime(const ci::fs::path & path) {
+	return toTicks(fs::last_write_time(path));
+}
+
 }
 }
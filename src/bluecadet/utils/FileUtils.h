@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <set>
 
@@ -29,6 +30,10 @@ public:
 
 	//! Extension starting at the last '.' (e.g. 'file.ext' will return '.ext'). Avoids issues with compiler/IDE version discrepancies.
 	static std::string getExtension(const ci::fs::path & path);
+
+	//! Last modification time in ticks of the filesystem's clock, which is only meaningful for detecting changes. Avoids
+	//! differences between boost and std filesystem return types. Throws if path doesn't exist.
+	static int64_t getModificationTime(const ci::fs::path & path);
 };
 
 }
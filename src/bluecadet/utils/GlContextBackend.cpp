@@ -0,0 +1,219 @@
+#include "GlContextBackend.h"
+
+#include "cinder/Log.h"
+
+#if defined(CINDER_LINUX_EGL_ONLY) || defined(CINDER_HEADLESS_GL_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	//==================================================
+	// GlContextBackend
+	//
+
+	GlContextBackendRef GlContextBackend::sDefault = nullptr;
+	std::mutex GlContextBackend::sDefaultMutex;
+
+	GlContextBackendRef GlContextBackend::getDefault() {
+		lock_guard<mutex> lock(sDefaultMutex);
+		if (!sDefault) {
+			sDefault = make_shared<CinderGlContextBackend>();
+		}
+		return sDefault;
+	}
+
+	void GlContextBackend::setDefault(GlContextBackendRef backend) {
+		lock_guard<mutex> lock(sDefaultMutex);
+		sDefault = backend;
+	}
+
+	//==================================================
+	// CinderGlContextBackend
+	//
+
+	std::vector<ci::gl::ContextRef> CinderGlContextBackend::createSharedContexts(const unsigned int numContexts) {
+		std::vector<ci::gl::ContextRef> contexts;
+
+		dispatchSync([&] {
+			// Save current VAO to prevent crashes from calling setup multiple times from params
+			gl::Context::getCurrent()->pushVao();
+
+			try {
+				for (unsigned int i = 0; i < numContexts; ++i) {
+					contexts.push_back(gl::Context::create(gl::Context::getCurrent()));
+				}
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not create shared contexts", e);
+			}
+
+			// Restore previous VAO to prevent crashes from calling setup multiple times from params
+			gl::Context::getCurrent()->popVao();
+		});
+
+		return contexts;
+	}
+
+	void CinderGlContextBackend::makeCurrent(const ci::gl::ContextRef & context) {
+		if (context) {
+			context->makeCurrent();
+		}
+	}
+
+	void CinderGlContextBackend::finish() {
+		// create fence after all gpu commands
+		auto fence = gl::Sync::create();
+
+		// waits until fence has been executed
+		fence->clientWaitSync();
+	}
+
+	void CinderGlContextBackend::dispatchSync(Fn fn) {
+		App::get()->dispatchSync(fn);
+	}
+
+	bool CinderGlContextBackend::isDispatchThread() const {
+		return App::get() && App::get()->isMainThread();
+	}
+
+	ci::signals::Connection CinderGlContextBackend::connectUpdate(Fn fn) {
+		return App::get()->getSignalUpdate().connect(fn);
+	}
+
+	//==================================================
+	// NullGlContextBackend
+	//
+
+	std::vector<ci::gl::ContextRef> NullGlContextBackend::createSharedContexts(const unsigned int numContexts) {
+		return std::vector<ci::gl::ContextRef>(numContexts, nullptr);
+	}
+
+#if defined(CINDER_LINUX_EGL_ONLY) || defined(CINDER_HEADLESS_GL_EGL)
+
+	//==================================================
+	// EglGlContextBackend
+	//
+
+	EglGlContextBackend::EglGlContextBackend(const int glMajorVersion, const int glMinorVersion) :
+		mGlMajorVersion(glMajorVersion),
+		mGlMinorVersion(glMinorVersion)
+	{
+		EGLDisplay display = EGL_NO_DISPLAY;
+
+		// prefer the surfaceless platform so that we don't need a display server
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay) {
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+		if (display == EGL_NO_DISPLAY) {
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+			throw ci::Exception("Could not initialize EGL display");
+		}
+
+		eglBindAPI(EGL_OPENGL_API);
+
+		// surface type of 0 matches configs without any surface support
+		const EGLint configAttribs[] = {
+			EGL_SURFACE_TYPE, 0,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+
+		EGLConfig config = nullptr;
+		EGLint numConfigs = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+			eglTerminate(display);
+			throw ci::Exception("Could not find EGL config for surfaceless contexts");
+		}
+
+		mDisplay = display;
+		mConfig = config;
+
+		// all worker contexts share objects with this context
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION_KHR, mGlMajorVersion,
+			EGL_CONTEXT_MINOR_VERSION_KHR, mGlMinorVersion,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+			EGL_NONE
+		};
+		mPrimaryContext = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+
+		if (mPrimaryContext == EGL_NO_CONTEXT) {
+			eglTerminate(display);
+			throw ci::Exception("Could not create primary EGL context");
+		}
+	}
+
+	EglGlContextBackend::~EglGlContextBackend() {
+		lock_guard<mutex> lock(mMutex);
+		for (auto context : mContexts) {
+			eglDestroyContext(mDisplay, context);
+		}
+		eglDestroyContext(mDisplay, mPrimaryContext);
+		eglTerminate(mDisplay);
+	}
+
+	std::vector<ci::gl::ContextRef> EglGlContextBackend::createSharedContexts(const unsigned int numContexts) {
+		std::vector<ci::gl::ContextRef> contexts;
+
+		for (unsigned int i = 0; i < numContexts; ++i) {
+			try {
+				contexts.push_back(createContext());
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not create shared context", e);
+			}
+		}
+
+		return contexts;
+	}
+
+	ci::gl::ContextRef EglGlContextBackend::createContext() {
+		lock_guard<mutex> lock(mMutex);
+
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION_KHR, mGlMajorVersion,
+			EGL_CONTEXT_MINOR_VERSION_KHR, mGlMinorVersion,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+			EGL_NONE
+		};
+
+		EGLContext context = eglCreateContext(mDisplay, mConfig, mPrimaryContext, contextAttribs);
+
+		if (context == EGL_NO_CONTEXT) {
+			throw ci::Exception("Could not create EGL context");
+		}
+
+		mContexts.push_back(context);
+
+		// wrap in cinder context so that ci::gl calls can be used on worker threads
+		eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+		auto platformData = std::make_shared<gl::PlatformDataLinux>(context, mDisplay, EGL_NO_SURFACE, mConfig);
+		auto contextRef = gl::Context::createFromExisting(platformData);
+		eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+		return contextRef;
+	}
+
+	void EglGlContextBackend::makeCurrent(const ci::gl::ContextRef & context) {
+		if (context) {
+			context->makeCurrent();
+		}
+	}
+
+	void EglGlContextBackend::finish() {
+		auto fence = gl::Sync::create();
+		fence->clientWaitSync();
+	}
+
+#endif
+
+}
+}
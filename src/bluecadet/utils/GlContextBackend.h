@@ -0,0 +1,100 @@
+#pragma once
+
+#include "cinder/app/App.h"
+#include "cinder/gl/gl.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class GlContextBackend> GlContextBackendRef;
+
+//! Abstracts how background GL contexts are created, shared and synchronized, so that classes
+//! like AsyncGlQueue and AsyncImageLoader can run with or without a running Cinder App.
+class GlContextBackend {
+
+public:
+	typedef std::function<void()> Fn;
+
+	virtual ~GlContextBackend() {}
+
+	//! Creates numContexts contexts that share objects with the backend's primary context.
+	//! Contexts may be nullptr for backends without GL support.
+	virtual std::vector<ci::gl::ContextRef> createSharedContexts(const unsigned int numContexts) = 0;
+
+	//! Binds context to the calling worker thread.
+	virtual void makeCurrent(const ci::gl::ContextRef & context) {}
+
+	//! Blocks until all GL commands issued on the calling thread have been executed.
+	virtual void finish() {}
+
+	//! Runs fn on the thread that owns the primary context and blocks until it's done.
+	virtual void dispatchSync(Fn fn) { fn(); }
+
+	//! True if called on the thread that dispatchSync() runs fn on, so that callers can run fn inline without blocking.
+	virtual bool isDispatchThread() const { return true; }
+
+	//! Connects fn to the app's update loop. Backends without an update loop return an empty
+	//! connection, in which case update() has to be called manually on the owning class.
+	virtual ci::signals::Connection connectUpdate(Fn fn) { return ci::signals::Connection(); }
+
+	//! False if contexts can't execute GL commands (e.g. NullGlContextBackend).
+	virtual bool hasGl() const { return true; }
+
+	//! The backend used by classes that haven't been given one explicitly. Defaults to a CinderGlContextBackend.
+	static GlContextBackendRef getDefault();
+	static void setDefault(GlContextBackendRef backend);
+
+protected:
+	static GlContextBackendRef sDefault;
+	static std::mutex sDefaultMutex;
+};
+
+//! Default backend. Creates contexts shared with the current context of the running App and
+//! dispatches to the App's main thread and update loop.
+class CinderGlContextBackend : public GlContextBackend {
+public:
+	std::vector<ci::gl::ContextRef> createSharedContexts(const unsigned int numContexts) override;
+	void makeCurrent(const ci::gl::ContextRef & context) override;
+	void finish() override;
+	void dispatchSync(Fn fn) override;
+	bool isDispatchThread() const override;
+	ci::signals::Connection connectUpdate(Fn fn) override;
+};
+
+//! Runs tasks without any GL context or App. Useful for measuring scheduling/decoding throughput
+//! on machines without a display. Tasks must not issue GL commands.
+class NullGlContextBackend : public GlContextBackend {
+public:
+	std::vector<ci::gl::ContextRef> createSharedContexts(const unsigned int numContexts) override;
+	bool hasGl() const override { return false; }
+};
+
+#if defined(CINDER_LINUX_EGL_ONLY) || defined(CINDER_HEADLESS_GL_EGL)
+
+//! Headless backend that creates surfaceless EGL contexts (EGL_MESA_platform_surfaceless), which
+//! also run on software rasterizers like Mesa's llvmpipe. Doesn't require an App or display.
+class EglGlContextBackend : public GlContextBackend {
+public:
+	EglGlContextBackend(const int glMajorVersion = 3, const int glMinorVersion = 3);
+	~EglGlContextBackend();
+
+	std::vector<ci::gl::ContextRef> createSharedContexts(const unsigned int numContexts) override;
+	void makeCurrent(const ci::gl::ContextRef & context) override;
+	void finish() override;
+
+protected:
+	ci::gl::ContextRef createContext();
+
+	int mGlMajorVersion;
+	int mGlMinorVersion;
+	void * mDisplay = nullptr;
+	void * mConfig = nullptr;
+	void * mPrimaryContext = nullptr;
+	std::vector<void *> mContexts;
+	std::mutex mMutex;
+};
+
+#endif
+
+}
+}
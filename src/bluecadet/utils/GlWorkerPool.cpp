@@ -0,0 +1,316 @@
+#include "GlWorkerPool.h"
+
+#include "cinder/Log.h"
+#include "cinder/imageIo.h"
+
+using namespace ci;
+using namespace ci::app;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	// Static properties
+	std::atomic<bool> GlWorkerPool::sIsInitialized(false);
+	std::once_flag GlWorkerPool::sInitializationFlag;
+
+	GlWorkerPool::GlWorkerPool(const unsigned int numThreads, GlContextBackendRef backend) :
+		mNumThreads(max(1u, numThreads)),
+		mBackend(backend ? backend : GlContextBackend::getDefault())
+	{
+	}
+
+	GlWorkerPool::~GlWorkerPool() {
+		lock_guard<mutex> lock(mThreadMutex);
+		stopThreads();
+	}
+
+	GlWorkerPool::ClientId GlWorkerPool::addClient(const unsigned int maxConcurrency) {
+		lock_guard<mutex> lock(mJobMutex);
+		mNumClientsCreated = (mNumClientsCreated + 1) % INT_MAX;
+		const ClientId clientId = mNumClientsCreated;
+		mClients[clientId].maxConcurrency = maxConcurrency;
+		return clientId;
+	}
+
+	void GlWorkerPool::removeClient(const ClientId clientId) {
+		unique_lock<mutex> lock(mJobMutex);
+		auto it = mClients.find(clientId);
+
+		if (it == mClients.end()) {
+			return;
+		}
+
+		it->second.isRemoved = true;
+		it->second.pendingJobs.clear();
+
+		// wait for running jobs to complete
+		while (it->second.numRunning > 0) {
+			mClientCondition.wait(lock);
+		}
+
+		mClients.erase(it);
+	}
+
+	void GlWorkerPool::setMaxConcurrency(const ClientId clientId, const unsigned int maxConcurrency) {
+		{
+			lock_guard<mutex> lock(mJobMutex);
+			auto it = mClients.find(clientId);
+			if (it != mClients.end()) {
+				it->second.maxConcurrency = maxConcurrency;
+			}
+		}
+		mJobCondition.notify_all();
+	}
+
+	void GlWorkerPool::submit(const ClientId clientId, Job job) {
+		setup();
+
+		{
+			lock_guard<mutex> lock(mJobMutex);
+			auto it = mClients.find(clientId);
+			if (it == mClients.end() || it->second.isRemoved) {
+				CI_LOG_E("Can't submit job for unknown client " << clientId);
+				return;
+			}
+			it->second.pendingJobs.push_back(job);
+		}
+
+		mJobCondition.notify_one();
+	}
+
+	void GlWorkerPool::cancelAll(const ClientId clientId) {
+		lock_guard<mutex> lock(mJobMutex);
+		auto it = mClients.find(clientId);
+		if (it != mClients.end()) {
+			it->second.pendingJobs.clear();
+		}
+	}
+
+	size_t GlWorkerPool::getNumPendingJobs(const ClientId clientId) {
+		lock_guard<mutex> lock(mJobMutex);
+		auto it = mClients.find(clientId);
+		return it != mClients.end() ? it->second.pendingJobs.size() : 0;
+	}
+
+	size_t GlWorkerPool::getNumRunningJobs(const ClientId clientId) {
+		lock_guard<mutex> lock(mJobMutex);
+		auto it = mClients.find(clientId);
+		return it != mClients.end() ? it->second.numRunning : 0;
+	}
+
+	void GlWorkerPool::setNumThreads(const unsigned int value) {
+		mNumThreads = max(1u, value);
+
+		// restart threads if they're already running; otherwise they'll be started with the next job
+		if (isRunning()) {
+			setup(true);
+		}
+	}
+
+	void GlWorkerPool::setBackend(GlContextBackendRef backend) {
+		bool wasRunning = false;
+
+		{
+			lock_guard<mutex> lock(mThreadMutex);
+			wasRunning = !mThreads.empty();
+			stopThreads();
+			mBackend = backend ? backend : GlContextBackend::getDefault();
+		}
+
+		if (wasRunning) {
+			setup(true);
+		}
+	}
+
+	bool GlWorkerPool::isRunning() {
+		lock_guard<mutex> lock(mThreadMutex);
+		return !mThreads.empty();
+	}
+
+	void GlWorkerPool::setup(const bool force) {
+		GlContextBackendRef backend;
+		unsigned int numThreads = 0;
+
+		{
+			lock_guard<mutex> lock(mThreadMutex);
+
+			// only set up if # threads has changed; a setup that is already in progress picks up any changes
+			if ((!force && mNumThreads == mThreads.size()) || mIsSettingUp) {
+				return;
+			}
+
+			mIsSettingUp = true;
+			backend = mBackend;
+			numThreads = mNumThreads;
+		}
+
+		while (true) {
+			// both may wait for the main thread, which in turn may be waiting for mThreadMutex (e.g. in submit() or
+			// isRunning()), so they run without holding it
+			std::vector<ci::gl::ContextRef> contexts;
+
+			try {
+				initializeLoader(backend);
+				contexts = backend->createSharedContexts(numThreads);
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not create shared contexts", e);
+			}
+
+			lock_guard<mutex> lock(mThreadMutex);
+
+			if (backend != mBackend || numThreads != mNumThreads) {
+				// settings have changed while contexts were created
+				backend = mBackend;
+				numThreads = mNumThreads;
+				continue;
+			}
+
+			try {
+				stopThreads();
+				mBackgroundContexts = contexts;
+
+				{
+					lock_guard<mutex> jobLock(mJobMutex);
+					mThreadsAreAlive = true;
+				}
+
+				for (auto context : mBackgroundContexts) {
+					mThreads.push_back(std::thread(bind(&GlWorkerPool::threadLoop, this, context)));
+				}
+
+				CI_LOG_I("Started " << to_string(mThreads.size()) << " GL worker threads");
+
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Error in setup", e);
+			}
+
+			mIsSettingUp = false;
+			return;
+		}
+	}
+
+	void GlWorkerPool::stopThreads() {
+		{
+			lock_guard<mutex> lock(mJobMutex);
+			mThreadsAreAlive = false;
+		}
+
+		mJobCondition.notify_all();
+
+		for (auto & thread : mThreads) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+
+		mThreads.clear();
+		mBackgroundContexts.clear();
+	}
+
+	void GlWorkerPool::threadLoop(ci::gl::ContextRef context) {
+		ci::ThreadSetup threadSetup;
+
+		mBackend->makeCurrent(context);
+		initializeLoader(mBackend);
+
+		while (true) {
+			Job job;
+			ClientId clientId;
+
+			{
+				// wait for next job that can be scheduled
+				unique_lock<mutex> lock(mJobMutex);
+				while (mThreadsAreAlive && !popNextJob(job, clientId)) {
+					mJobCondition.wait(lock);
+				}
+
+				if (!mThreadsAreAlive) {
+					return;
+				}
+			}
+
+			try {
+				job();
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not run job", e);
+			}
+
+			{
+				lock_guard<mutex> lock(mJobMutex);
+				auto it = mClients.find(clientId);
+				if (it != mClients.end()) {
+					it->second.numRunning--;
+				}
+			}
+
+			// a concurrency slot has been freed up
+			mJobCondition.notify_all();
+			mClientCondition.notify_all();
+		}
+	}
+
+	bool GlWorkerPool::popNextJob(Job & job, ClientId & clientId) {
+		if (mClients.empty()) {
+			return false;
+		}
+
+		// round-robin starting with the client after the one that was scheduled last
+		auto it = mClients.upper_bound(mLastClientId);
+
+		for (size_t i = 0; i < mClients.size(); ++i, ++it) {
+			if (it == mClients.end()) {
+				it = mClients.begin();
+			}
+
+			Client & client = it->second;
+
+			if (client.isRemoved || client.pendingJobs.empty()) {
+				continue;
+			}
+
+			if (client.maxConcurrency > 0 && client.numRunning >= client.maxConcurrency) {
+				continue;
+			}
+
+			job = std::move(client.pendingJobs.front());
+			client.pendingJobs.pop_front();
+			client.numRunning++;
+			clientId = it->first;
+			mLastClientId = it->first;
+			return true;
+		}
+
+		return false;
+	}
+
+	void GlWorkerPool::initializeLoader(GlContextBackendRef backend) {
+		if (sIsInitialized) {
+			return;
+		}
+
+		if (backend->isDispatchThread()) {
+			initializeLoader();
+			return;
+		}
+
+		// no locks are held while waiting, since the main thread might be waiting on the caller
+		backend->dispatchSync([] {
+			initializeLoader();
+		});
+	}
+
+	void GlWorkerPool::initializeLoader() {
+		std::call_once(sInitializationFlag, [] {
+			try {
+				// load empty image to initialize Cinder's internal load factory on the main thread
+				CI_LOG_D("Initializing Cinder loader");
+				ci::loadImage("");
+			} catch (Exception e) {
+			}
+			sIsInitialized = true;
+		});
+	}
+
+}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "cinder/app/App.h"
+#include "cinder/gl/gl.h"
+
+#include <atomic>
+#include <mutex>
+
+#include "GlContextBackend.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class GlWorkerPool> GlWorkerPoolRef;
+
+//! A single set of GL worker threads with shared background contexts that multiple clients (e.g. AsyncGlQueue,
+//! AsyncImageLoader) submit jobs to. Jobs are scheduled round-robin across clients, so a client with a large
+//! backlog can't starve others, and each client can limit how many of its jobs run concurrently.
+class GlWorkerPool {
+
+public:
+	typedef int ClientId;
+	typedef std::function<void()> Job;
+
+	//! Optional shared instance used by AsyncGlQueue and AsyncImageLoader. This class can still be independently instantiated.
+	static GlWorkerPoolRef get() {
+		static auto instance = std::make_shared<GlWorkerPool>();
+		return instance;
+	}
+
+	//! numThreads: Number of worker threads, each with its own shared context.
+	//! backend: Creates and binds GL contexts for worker threads. Uses GlContextBackend::getDefault() if nullptr.
+	GlWorkerPool(const unsigned int numThreads = 2, GlContextBackendRef backend = nullptr);
+	~GlWorkerPool();
+
+	//! Registers a new client. maxConcurrency limits how many of the client's jobs can run at the same time (0 means no limit).
+	ClientId addClient(const unsigned int maxConcurrency = 0);
+
+	//! Removes pending jobs of a client and blocks until its running jobs have completed.
+	void removeClient(const ClientId clientId);
+
+	void setMaxConcurrency(const ClientId clientId, const unsigned int maxConcurrency);
+
+	//! Queues job to run on a worker thread with a GL context bound. Jobs of the same client start in
+	//! first-in-first-out order. Thread-safe. Starts worker threads if necessary.
+	void submit(const ClientId clientId, Job job);
+
+	//! Removes all pending jobs of a client. Running jobs will be completed.
+	void cancelAll(const ClientId clientId);
+
+	size_t getNumPendingJobs(const ClientId clientId);
+	size_t getNumRunningJobs(const ClientId clientId);
+
+	//! Restarts worker threads with numThreads new contexts if they're running. Pending jobs are preserved.
+	void setNumThreads(const unsigned int value);
+	unsigned int getNumThreads() const { return mNumThreads; }
+
+	//! Grows the pool to at least numThreads worker threads.
+	void requireNumThreads(const unsigned int numThreads) { if (numThreads > mNumThreads) setNumThreads(numThreads); }
+
+	//! Replaces the backend and restarts all worker threads with new contexts.
+	void setBackend(GlContextBackendRef backend);
+	GlContextBackendRef getBackend() const { return mBackend; }
+
+	//! True once worker threads have been started by the first job.
+	bool isRunning();
+
+	//! Makes sure that Cinder's internal image factories are initialized once on the main thread. Called automatically
+	//! by worker threads; needs to be called before decoding images on any other threads. Runs inline if called on
+	//! backend's dispatch thread and only blocks on that thread otherwise, so it's safe to call while workers are waiting on it.
+	static void initializeLoader(GlContextBackendRef backend);
+
+	//! Same as above, but runs inline on the calling thread, which needs to be the main thread.
+	static void initializeLoader();
+
+protected:
+	struct Client {
+		std::deque<Job> pendingJobs;
+		unsigned int maxConcurrency = 0;
+		unsigned int numRunning = 0;
+		bool isRemoved = false;
+	};
+
+	void setup(const bool force = false);
+	void stopThreads();
+	void threadLoop(ci::gl::ContextRef context);
+	bool popNextJob(Job & job, ClientId & clientId); // requires mJobMutex
+
+	static std::atomic<bool> sIsInitialized; // need to initialize Cinder image factory on main thread
+	static std::once_flag sInitializationFlag;
+
+	std::atomic<unsigned int> mNumThreads;
+	GlContextBackendRef mBackend;
+
+	std::mutex mThreadMutex; // for thread management (starting, stopping, etc)
+	std::vector<ci::gl::ContextRef> mBackgroundContexts;
+	std::vector<std::thread> mThreads;
+	bool mIsSettingUp = false; // true while a thread creates contexts without holding mThreadMutex
+
+	std::mutex mJobMutex; // for clients and jobs
+	std::condition_variable mJobCondition;
+	std::condition_variable mClientCondition;
+	std::map<ClientId, Client> mClients;
+	ClientId mNumClientsCreated = 0;
+	ClientId mLastClientId = 0; // last client that a job was scheduled for
+	bool mThreadsAreAlive = false;
+};
+
+}
+}
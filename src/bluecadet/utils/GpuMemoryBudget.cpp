@@ -0,0 +1,128 @@
+#include "GpuMemoryBudget.h"
+
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	GpuMemoryBudget::GpuMemoryBudget(const size_t budget) :
+		mBudget(budget),
+		mReservedBytes(0),
+		mPeakReservedBytes(0)
+	{
+	}
+
+	bool GpuMemoryBudget::tryReserve(const size_t numBytes) {
+		lock_guard<mutex> lock(mReserveMutex);
+
+		if (!fits(numBytes)) {
+			// free whatever exceeds the budget
+			evict(mReservedBytes + numBytes - mBudget);
+
+			if (!fits(numBytes)) {
+				return false;
+			}
+		}
+
+		reserve(numBytes);
+		return true;
+	}
+
+	void GpuMemoryBudget::reserve(const size_t numBytes) {
+		const size_t reserved = mReservedBytes += numBytes;
+
+		// update peak without locking
+		size_t peak = mPeakReservedBytes;
+		while (reserved > peak && !mPeakReservedBytes.compare_exchange_weak(peak, reserved)) {}
+	}
+
+	void GpuMemoryBudget::release(const size_t numBytes) {
+		size_t reserved = mReservedBytes;
+		while (!mReservedBytes.compare_exchange_weak(reserved, reserved - min(reserved, numBytes))) {}
+	}
+
+	size_t GpuMemoryBudget::evict(const size_t numBytes) {
+		std::vector<EvictionHookRef> hooks;
+
+		{
+			// copy hooks so that they can call back into this class without deadlocking
+			lock_guard<mutex> lock(mHookMutex);
+			for (const auto & it : mEvictionHooks) {
+				hooks.push_back(it.second);
+			}
+		}
+
+		size_t numBytesFreed = 0;
+
+		for (auto & hook : hooks) {
+			if (numBytesFreed >= numBytes) {
+				break;
+			}
+
+			{
+				// skip hooks removed since copying and keep removeEvictionHook() waiting until this call has returned
+				lock_guard<mutex> lock(mHookMutex);
+				if (hook->isRemoved) {
+					continue;
+				}
+				hook->numCalls++;
+			}
+
+			try {
+				numBytesFreed += hook->fn(numBytes - numBytesFreed);
+			} catch (...) {
+				endHookCall(hook);
+				throw;
+			}
+
+			endHookCall(hook);
+		}
+
+		return numBytesFreed;
+	}
+
+	GpuMemoryBudget::EvictionHookId GpuMemoryBudget::addEvictionHook(EvictionFn fn) {
+		lock_guard<mutex> lock(mHookMutex);
+		mNumHooksCreated = (mNumHooksCreated + 1) % INT_MAX;
+		const EvictionHookId id = mNumHooksCreated;
+		mEvictionHooks[id] = make_shared<EvictionHook>(fn);
+		return id;
+	}
+
+	void GpuMemoryBudget::removeEvictionHook(const EvictionHookId id) {
+		unique_lock<mutex> lock(mHookMutex);
+		auto it = mEvictionHooks.find(id);
+
+		if (it == mEvictionHooks.end()) {
+			return;
+		}
+
+		EvictionHookRef hook = it->second;
+		hook->isRemoved = true;
+		mEvictionHooks.erase(it);
+
+		while (hook->numCalls > 0) {
+			mHookCondition.wait(lock);
+		}
+	}
+
+	void GpuMemoryBudget::endHookCall(const EvictionHookRef & hook) {
+		{
+			lock_guard<mutex> lock(mHookMutex);
+			hook->numCalls--;
+		}
+		mHookCondition.notify_all();
+	}
+
+	bool GpuMemoryBudget::fits(const size_t numBytes) const {
+		const size_t budget = mBudget;
+		const size_t reserved = mReservedBytes;
+		return budget == 0 || reserved == 0 || reserved + numBytes <= budget;
+	}
+
+}
+}
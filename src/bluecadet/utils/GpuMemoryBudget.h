@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class GpuMemoryBudget> GpuMemoryBudgetRef;
+
+//! Thread-safe accounting of estimated GPU memory. Clients reserve bytes before allocating GPU resources and
+//! release them once those resources are destroyed. If a reservation would exceed the budget, registered
+//! eviction hooks (e.g. texture caches) are asked to free memory first.
+class GpuMemoryBudget {
+
+public:
+	typedef int EvictionHookId;
+
+	//! Called with the number of bytes that should be freed. Should release freed bytes via release() and
+	//! return how many bytes were freed. May be called from any thread that reserves memory.
+	typedef std::function<size_t(size_t numBytesToFree)> EvictionFn;
+
+	//! Optional shared instance used by AsyncGlQueue and AsyncImageLoader. This class can still be independently instantiated.
+	static GpuMemoryBudgetRef get() {
+		static auto instance = std::make_shared<GpuMemoryBudget>();
+		return instance;
+	}
+
+	//! budget: Max number of reserved bytes. 0 means unlimited.
+	GpuMemoryBudget(const size_t budget = 0);
+
+	//! Reserves numBytes if they fit into the budget, running eviction hooks if necessary. Reservations
+	//! always succeed if nothing else is reserved, so that a single oversized resource can't stall forever.
+	bool tryReserve(const size_t numBytes);
+
+	//! Reserves numBytes regardless of the budget.
+	void reserve(const size_t numBytes);
+
+	//! Releases previously reserved bytes.
+	void release(const size_t numBytes);
+
+	//! Asks eviction hooks to free at least numBytes. Returns the number of bytes freed.
+	size_t evict(const size_t numBytes);
+
+	EvictionHookId addEvictionHook(EvictionFn fn);
+
+	//! Removes a hook and blocks until calls to it on other threads have returned, so that objects bound to the hook
+	//! can be destroyed afterwards. Must not be called from within a hook or while holding a lock that a hook takes.
+	void removeEvictionHook(const EvictionHookId id);
+
+	//! Max number of reserved bytes. 0 means unlimited.
+	void setBudget(const size_t value) { mBudget = value; }
+	size_t getBudget() const { return mBudget; }
+
+	bool isOverBudget() const { return mBudget > 0 && mReservedBytes > mBudget; }
+
+	size_t getReservedBytes() const { return mReservedBytes; }
+	size_t getPeakReservedBytes() const { return mPeakReservedBytes; }
+	void resetPeakReservedBytes() { mPeakReservedBytes = mReservedBytes.load(); }
+
+	//! Estimated GPU memory for a width x height texture, including a full mip chain if mipmapped.
+	static size_t estimateTextureBytes(const int width, const int height, const size_t bytesPerPixel = 4, const bool mipmapped = true) {
+		const size_t numBytes = (size_t)width * (size_t)height * bytesPerPixel;
+		return mipmapped ? numBytes + numBytes / 3 : numBytes;
+	}
+
+protected:
+	struct EvictionHook {
+		EvictionHook(EvictionFn fn) : fn(fn) {}
+		EvictionFn fn;
+		int numCalls = 0; // calls in progress
+		bool isRemoved = false;
+	};
+	typedef std::shared_ptr<EvictionHook> EvictionHookRef;
+
+	bool fits(const size_t numBytes) const;
+	void endHookCall(const EvictionHookRef & hook);
+
+	std::atomic<size_t> mBudget;
+	std::atomic<size_t> mReservedBytes;
+	std::atomic<size_t> mPeakReservedBytes;
+
+	std::mutex mReserveMutex;	// serializes reservations so that evictions aren't triggered redundantly
+	std::mutex mHookMutex;
+	std::condition_variable mHookCondition; // notified when a hook call returns
+	std::map<EvictionHookId, EvictionHookRef> mEvictionHooks;
+	EvictionHookId mNumHooksCreated = 0;
+};
+
+}
+}
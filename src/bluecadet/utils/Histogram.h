@@ -3,6 +3,8 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <climits>
+#include <cmath>
 
 namespace bluecadet {
 namespace utils {
@@ -0,0 +1,627 @@
+#include "HttpFetcher.h"
+
+#include "cinder/Log.h"
+
+#include "ContentHashIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if defined(CINDER_MSW)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		const intptr_t INVALID_SOCKET_VALUE = -1;
+		const int MAX_REDIRECTS = 5;
+		const size_t RECEIVE_CHUNK_SIZE = 64 * 1024;
+
+#if defined(MSG_NOSIGNAL)
+		const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+		const int SEND_FLAGS = 0;
+#endif
+
+		void initializeSockets() {
+#if defined(CINDER_MSW)
+			static bool isInitialized = false;
+			static std::mutex initMutex;
+			lock_guard<mutex> lock(initMutex);
+
+			if (!isInitialized) {
+				WSADATA data;
+				isInitialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+			}
+#endif
+		}
+
+		std::string toLower(std::string value) {
+			transform(value.begin(), value.end(), value.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+			return value;
+		}
+
+		std::string trim(const std::string & value) {
+			const size_t start = value.find_first_not_of(" \t");
+			const size_t end = value.find_last_not_of(" \t\r");
+			return start == string::npos ? "" : value.substr(start, end - start + 1);
+		}
+
+		std::string getHeader(const std::map<std::string, std::string> & headers, const std::string & name) {
+			auto it = headers.find(name);
+			return it != headers.end() ? it->second : "";
+		}
+
+	}
+
+	HttpFetcher::HttpFetcher(const ci::fs::path & cacheDir, const int maxConnectionsPerHost) :
+		mCacheDir(cacheDir),
+		mMaxConnectionsPerHost(max(1, maxConnectionsPerHost)),
+		mTimeout(10.0)
+	{
+		initializeSockets();
+
+		if (!mCacheDir.empty()) {
+			try {
+				fs::create_directories(mCacheDir);
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not create http cache dir at '" + mCacheDir.string() + "'", e);
+			}
+		}
+	}
+
+	HttpFetcher::~HttpFetcher() {
+		closeIdleConnections();
+	}
+
+	bool HttpFetcher::isSupported(const std::string & url) {
+		return url.size() > 7 && toLower(url.substr(0, 7)) == "http://";
+	}
+
+	HttpFetcher::Response HttpFetcher::fetch(const std::string & url) {
+		std::string currentUrl = url;
+		Response response;
+
+		for (int i = 0; i <= MAX_REDIRECTS; ++i) {
+			std::string redirectUrl;
+			response = fetchOnce(currentUrl, redirectUrl);
+
+			if (redirectUrl.empty()) {
+				break;
+			}
+
+			if (!isSupported(redirectUrl)) {
+				response.error = "Redirect to unsupported url '" + redirectUrl + "'";
+				break;
+			}
+
+			currentUrl = redirectUrl;
+		}
+
+		lock_guard<mutex> lock(mMutex);
+		mStats.numRequests++;
+
+		if (!response.isSuccessful()) {
+			mStats.numFailedRequests++;
+		}
+
+		return response;
+	}
+
+	HttpFetcher::Response HttpFetcher::fetchOnce(const std::string & url, std::string & redirectUrl) {
+		Response response;
+		Url parsedUrl;
+
+		if (!parseUrl(url, parsedUrl)) {
+			response.error = "Invalid url";
+			return response;
+		}
+
+		const CacheEntry cacheEntry = getCacheEntry(url);
+
+		stringstream request;
+		request << "GET " << parsedUrl.target << " HTTP/1.1\r\n";
+		request << "Host: " << parsedUrl.host << (parsedUrl.port != 80 ? ":" + to_string(parsedUrl.port) : "") << "\r\n";
+		request << "Connection: keep-alive\r\n";
+		request << "Accept-Encoding: identity\r\n";
+		if (!cacheEntry.etag.empty()) request << "If-None-Match: " << cacheEntry.etag << "\r\n";
+		if (!cacheEntry.lastModified.empty()) request << "If-Modified-Since: " << cacheEntry.lastModified << "\r\n";
+		request << "\r\n";
+
+		std::map<std::string, std::string> headers;
+
+		for (int attempt = 0; attempt < 2; ++attempt) {
+			bool isReused = false;
+			Socket socket = acquire(parsedUrl, isReused, response.error);
+
+			if (socket == INVALID_SOCKET_VALUE) {
+				return response;
+			}
+
+			bool keepAlive = false;
+			headers.clear();
+
+			if (send(socket, request.str()) && readResponse(socket, response, headers, keepAlive)) {
+				release(parsedUrl, socket, keepAlive);
+				break;
+			}
+
+			release(parsedUrl, socket, false);
+			response = Response();
+
+			if (!isReused) {
+				response.error = "Could not send request or receive response";
+				return response;
+			}
+
+			// server may have closed the idle connection; retry once on a new one
+		}
+
+		if (response.status == 304 && (!cacheEntry.etag.empty() || !cacheEntry.lastModified.empty())) {
+			response.body = readCachedBody(cacheEntry);
+			response.isFromCache = response.body != nullptr;
+
+			if (response.isFromCache) {
+				lock_guard<mutex> lock(mMutex);
+				mStats.numCacheRevalidations++;
+			} else {
+				response.error = "Could not read cached response";
+			}
+
+		} else if (response.status >= 300 && response.status < 400) {
+			const string location = getHeader(headers, "location");
+
+			if (location.empty()) {
+				response.error = "Redirect without location";
+			} else if (location[0] == '/') {
+				redirectUrl = "http://" + parsedUrl.host + ":" + to_string(parsedUrl.port) + location;
+			} else {
+				redirectUrl = location;
+			}
+
+			response.body = nullptr;
+
+		} else if (response.status >= 200 && response.status < 300) {
+			if (!response.body) {
+				response.body = make_shared<Buffer>(0);
+			}
+
+			{
+				lock_guard<mutex> lock(mMutex);
+				mStats.numBytesReceived += response.body->getSize();
+			}
+
+			storeCacheEntry(cacheEntry, response.body, headers);
+
+		} else {
+			response.error = "HTTP status " + to_string(response.status);
+			response.body = nullptr;
+		}
+
+		return response;
+	}
+
+	void HttpFetcher::closeIdleConnections() {
+		lock_guard<mutex> lock(mMutex);
+
+		for (auto & it : mHosts) {
+			for (auto socket : it.second.idleSockets) {
+				close(socket);
+			}
+			it.second.idleSockets.clear();
+		}
+	}
+
+	void HttpFetcher::clearCache() {
+		if (mCacheDir.empty()) {
+			return;
+		}
+
+		try {
+			for (const auto & entry : fs::directory_iterator(mCacheDir)) {
+				fs::remove(entry.path());
+			}
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not clear http cache at '" + mCacheDir.string() + "'", e);
+		}
+	}
+
+	void HttpFetcher::setMaxConnectionsPerHost(const int value) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mMaxConnectionsPerHost = max(1, value);
+		}
+		mHostCondition.notify_all();
+	}
+
+	HttpFetcher::Stats HttpFetcher::getStats() {
+		lock_guard<mutex> lock(mMutex);
+		return mStats;
+	}
+
+	void HttpFetcher::resetStats() {
+		lock_guard<mutex> lock(mMutex);
+		mStats = Stats();
+	}
+
+	bool HttpFetcher::parseUrl(const std::string & url, Url & result) {
+		if (!isSupported(url)) {
+			return false;
+		}
+
+		const size_t hostStart = 7;
+		size_t hostEnd = url.find_first_of("/?#", hostStart);
+		if (hostEnd == string::npos) hostEnd = url.size();
+
+		string hostAndPort = url.substr(hostStart, hostEnd - hostStart);
+		const size_t atPos = hostAndPort.rfind('@');
+		if (atPos != string::npos) hostAndPort = hostAndPort.substr(atPos + 1); // ignore credentials
+
+		const size_t colonPos = hostAndPort.rfind(':');
+		if (colonPos != string::npos && hostAndPort.find(']', colonPos) == string::npos) {
+			result.host = hostAndPort.substr(0, colonPos);
+			result.port = atoi(hostAndPort.substr(colonPos + 1).c_str());
+		} else {
+			result.host = hostAndPort;
+			result.port = 80;
+		}
+
+		if (!result.host.empty() && result.host.front() == '[' && result.host.back() == ']') {
+			result.host = result.host.substr(1, result.host.size() - 2); // ipv6 literal
+		}
+
+		size_t targetEnd = url.find('#', hostEnd);
+		if (targetEnd == string::npos) targetEnd = url.size();
+
+		result.target = url.substr(hostEnd, targetEnd - hostEnd);
+		if (result.target.empty() || result.target[0] != '/') result.target = "/" + result.target;
+
+		return !result.host.empty() && result.port > 0 && result.port < 65536;
+	}
+
+	HttpFetcher::Socket HttpFetcher::acquire(const Url & url, bool & isReused, std::string & error) {
+		const string hostKey = url.host + ":" + to_string(url.port);
+
+		unique_lock<mutex> lock(mMutex);
+		Host & host = mHosts[hostKey];
+
+		// limit concurrent requests per host
+		while (host.numActive >= mMaxConnectionsPerHost) {
+			mHostCondition.wait(lock);
+		}
+
+		host.numActive++;
+
+		if (!host.idleSockets.empty()) {
+			Socket socket = host.idleSockets.back();
+			host.idleSockets.pop_back();
+			mStats.numConnectionsReused++;
+			isReused = true;
+			return socket;
+		}
+
+		lock.unlock();
+		Socket socket = connect(url, error);
+		lock.lock();
+
+		if (socket == INVALID_SOCKET_VALUE) {
+			host.numActive--;
+			lock.unlock();
+			mHostCondition.notify_all();
+			return socket;
+		}
+
+		mStats.numConnectionsOpened++;
+		isReused = false;
+		return socket;
+	}
+
+	void HttpFetcher::release(const Url & url, const Socket socket, const bool keepAlive) {
+		const string hostKey = url.host + ":" + to_string(url.port);
+
+		{
+			lock_guard<mutex> lock(mMutex);
+			Host & host = mHosts[hostKey];
+			host.numActive--;
+
+			if (keepAlive) {
+				host.idleSockets.push_back(socket);
+			} else {
+				close(socket);
+			}
+		}
+
+		mHostCondition.notify_all();
+	}
+
+	HttpFetcher::Socket HttpFetcher::connect(const Url & url, std::string & error) {
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo * addresses = nullptr;
+
+		if (getaddrinfo(url.host.c_str(), to_string(url.port).c_str(), &hints, &addresses) != 0 || !addresses) {
+			error = "Could not resolve host '" + url.host + "'";
+			return INVALID_SOCKET_VALUE;
+		}
+
+		Socket result = INVALID_SOCKET_VALUE;
+
+		for (addrinfo * address = addresses; address; address = address->ai_next) {
+			Socket socket = (Socket)::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+			if (socket == INVALID_SOCKET_VALUE) {
+				continue;
+			}
+
+			const double timeoutSeconds = mTimeout;
+#if defined(CINDER_MSW)
+			const DWORD timeout = (DWORD)(timeoutSeconds * 1000.0);
+#else
+			timeval timeout;
+			timeout.tv_sec = (long)timeoutSeconds;
+			timeout.tv_usec = (long)((timeoutSeconds - (double)timeout.tv_sec) * 1000000.0);
+#endif
+			const int noDelay = 1;
+			setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+			setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+			setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+
+#if defined(SO_NOSIGPIPE)
+			const int noSigPipe = 1;
+			setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, (const char *)&noSigPipe, sizeof(noSigPipe));
+#endif
+
+			if (::connect(socket, address->ai_addr, (int)address->ai_addrlen) == 0) {
+				result = socket;
+				break;
+			}
+
+			close(socket);
+		}
+
+		freeaddrinfo(addresses);
+
+		if (result == INVALID_SOCKET_VALUE) {
+			error = "Could not connect to '" + url.host + ":" + to_string(url.port) + "'";
+		}
+
+		return result;
+	}
+
+	bool HttpFetcher::send(const Socket socket, const std::string & data) {
+		size_t numSent = 0;
+
+		while (numSent < data.size()) {
+			const auto result = ::send(socket, data.c_str() + numSent, (int)(data.size() - numSent), SEND_FLAGS);
+
+			if (result <= 0) {
+				return false;
+			}
+
+			numSent += (size_t)result;
+		}
+
+		return true;
+	}
+
+	bool HttpFetcher::receive(const Socket socket, std::vector<uint8_t> & buffer) {
+		const size_t offset = buffer.size();
+		buffer.resize(offset + RECEIVE_CHUNK_SIZE);
+
+		const auto result = ::recv(socket, (char *)buffer.data() + offset, (int)RECEIVE_CHUNK_SIZE, 0);
+		buffer.resize(offset + (result > 0 ? (size_t)result : 0));
+
+		return result > 0;
+	}
+
+	bool HttpFetcher::readResponse(const Socket socket, Response & response, std::map<std::string, std::string> & headers, bool & keepAlive) {
+		std::vector<uint8_t> data;
+		size_t pos = 0;
+
+		// reads until the line at pos is complete and returns it without the line break
+		auto readLine = [&](std::string & line) {
+			while (true) {
+				auto it = search(data.begin() + pos, data.end(), "\r\n", "\r\n" + 2);
+
+				if (it != data.end()) {
+					const size_t end = (size_t)(it - data.begin());
+					line.assign((const char *)data.data() + pos, end - pos);
+					pos = end + 2;
+					return true;
+				}
+
+				if (!receive(socket, data)) {
+					return false;
+				}
+			}
+		};
+
+		// reads until at least numBytes are available after pos
+		auto readBytes = [&](const size_t numBytes) {
+			while (data.size() - pos < numBytes) {
+				if (!receive(socket, data)) {
+					return false;
+				}
+			}
+			return true;
+		};
+
+		// status line
+		std::string line;
+
+		if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0) {
+			return false;
+		}
+
+		const size_t statusStart = line.find(' ');
+		if (statusStart == string::npos) return false;
+
+		const string version = line.substr(0, statusStart);
+		response.status = atoi(line.c_str() + statusStart + 1);
+
+		// headers
+		while (true) {
+			if (!readLine(line)) return false;
+			if (line.empty()) break;
+
+			const size_t colonPos = line.find(':');
+			if (colonPos == string::npos) continue;
+
+			headers[toLower(trim(line.substr(0, colonPos)))] = trim(line.substr(colonPos + 1));
+		}
+
+		const string connection = toLower(getHeader(headers, "connection"));
+		keepAlive = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+		// body
+		std::vector<uint8_t> body;
+
+		if (response.status == 204 || response.status == 304 || (response.status >= 100 && response.status < 200)) {
+			// no body
+
+		} else if (toLower(getHeader(headers, "transfer-encoding")).find("chunked") != string::npos) {
+			while (true) {
+				if (!readLine(line)) return false;
+				const size_t chunkSize = (size_t)strtoull(line.c_str(), nullptr, 16);
+
+				if (chunkSize == 0) {
+					// skip trailers
+					do {
+						if (!readLine(line)) return false;
+					} while (!line.empty());
+					break;
+				}
+
+				if (!readBytes(chunkSize + 2)) return false;
+				body.insert(body.end(), data.begin() + pos, data.begin() + pos + chunkSize);
+				pos += chunkSize + 2;
+			}
+
+		} else if (!getHeader(headers, "content-length").empty()) {
+			const size_t contentLength = (size_t)strtoull(getHeader(headers, "content-length").c_str(), nullptr, 10);
+			if (!readBytes(contentLength)) return false;
+			body.assign(data.begin() + pos, data.begin() + pos + contentLength);
+
+		} else {
+			// body ends when the server closes the connection
+			while (receive(socket, data)) {}
+			body.assign(data.begin() + pos, data.end());
+			keepAlive = false;
+		}
+
+		if (!body.empty()) {
+			response.body = make_shared<Buffer>(body.size());
+			memcpy(response.body->getData(), body.data(), body.size());
+		}
+
+		return true;
+	}
+
+	void HttpFetcher::close(const Socket socket) {
+#if defined(CINDER_MSW)
+		closesocket((SOCKET)socket);
+#else
+		::close((int)socket);
+#endif
+	}
+
+	HttpFetcher::CacheEntry HttpFetcher::getCacheEntry(const std::string & url) const {
+		CacheEntry entry;
+
+		if (mCacheDir.empty()) {
+			return entry;
+		}
+
+		entry.url = url;
+		entry.path = mCacheDir / (ContentHashIndex::toString(ContentHashIndex::hash(url.data(), url.size())) + ".http");
+
+		ifstream file(entry.path.string(), ios::binary);
+		string storedUrl, etag, lastModified;
+
+		// files are named by the url's hash, so only use validators stored for the same url
+		if (file && getline(file, storedUrl) && storedUrl == url && getline(file, etag) && getline(file, lastModified)) {
+			entry.etag = etag;
+			entry.lastModified = lastModified;
+		}
+
+		return entry;
+	}
+
+	ci::BufferRef HttpFetcher::readCachedBody(const CacheEntry & entry) const {
+		ifstream file(entry.path.string(), ios::binary | ios::ate);
+
+		if (!file) {
+			return nullptr;
+		}
+
+		const size_t fileSize = (size_t)file.tellg();
+		file.seekg(0);
+
+		// another fetch may have replaced the file since the request was sent
+		string url, etag, lastModified;
+
+		if (!getline(file, url) || !getline(file, etag) || !getline(file, lastModified)
+			|| url != entry.url || etag != entry.etag || lastModified != entry.lastModified) {
+			return nullptr;
+		}
+
+		const size_t numBytes = fileSize - (size_t)file.tellg();
+		auto buffer = make_shared<Buffer>(numBytes);
+		file.read((char *)buffer->getData(), numBytes);
+		return file ? buffer : nullptr;
+	}
+
+	void HttpFetcher::storeCacheEntry(const CacheEntry & entry, const ci::BufferRef & body, const std::map<std::string, std::string> & headers) {
+		const string etag = getHeader(headers, "etag");
+		const string lastModified = getHeader(headers, "last-modified");
+
+		// only store responses that can be revalidated
+		if (entry.path.empty() || !body || (etag.empty() && lastModified.empty())) {
+			return;
+		}
+
+		try {
+			fs::path tempPath = entry.path;
+			tempPath += "." + to_string(std::hash<std::thread::id>()(this_thread::get_id())) + ".tmp";
+
+			{
+				// validators and body share one file, so replacing it can't pair them with another response
+				ofstream file(tempPath.string(), ios::binary | ios::trunc);
+				file << entry.url << "\n" << etag << "\n" << lastModified << "\n";
+				file.write((const char *)body->getData(), body->getSize());
+
+				if (!file) {
+					throw ci::Exception("Could not write file");
+				}
+			}
+
+			fs::rename(tempPath, entry.path);
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not write http cache file at '" + entry.path.string() + "'", e);
+		}
+	}
+
+}
+}
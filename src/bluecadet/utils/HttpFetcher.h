@@ -0,0 +1,131 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class HttpFetcher> HttpFetcherRef;
+
+//! Minimal blocking HTTP/1.1 client for fetching remote assets from worker threads.
+//!
+//! Connections are kept alive and pooled per host, and the number of concurrent requests per host is limited so that
+//! large batches don't flood a server. Responses with an ETag or Last-Modified header can be stored in a disk cache
+//! and are revalidated with If-None-Match/If-Modified-Since on subsequent fetches, so unchanged files aren't downloaded
+//! again. Only plain http:// urls are supported; use ci::loadUrl() or a platform client for https.
+//!
+//! All methods are thread-safe. fetch() blocks the calling thread and should not be called on the main or GL threads.
+class HttpFetcher {
+
+public:
+	struct Response {
+		int status = 0;					//! HTTP status code or 0 if the request failed
+		ci::BufferRef body = nullptr;	//! Body of successful responses
+		bool isFromCache = false;		//! True if the body has been read from the disk cache after revalidation
+		std::string error;				//! Reason if the request failed
+
+		bool isSuccessful() const { return body != nullptr; }
+	};
+
+	struct Stats {
+		size_t numRequests = 0;
+		size_t numFailedRequests = 0;
+		size_t numCacheRevalidations = 0;	//! Requests answered with 304 Not Modified and served from the disk cache
+		size_t numConnectionsOpened = 0;
+		size_t numConnectionsReused = 0;
+		size_t numBytesReceived = 0;		//! Body bytes received over the network
+	};
+
+	//! Optional shared instance that caches responses in a directory in the system's temp directory.
+	static HttpFetcherRef get() {
+		static auto instance = std::make_shared<HttpFetcher>(ci::fs::temp_directory_path() / "bluecadet_http_cache");
+		return instance;
+	}
+
+	//! cacheDir: Directory that revalidatable responses are stored in. Caching is disabled if empty.
+	//! maxConnectionsPerHost: Max number of concurrent requests per host. Other requests wait for a connection to be released.
+	HttpFetcher(const ci::fs::path & cacheDir = ci::fs::path(), const int maxConnectionsPerHost = 4);
+	~HttpFetcher();
+
+	//! True if url can be fetched by this class (i.e. starts with http://).
+	static bool isSupported(const std::string & url);
+
+	//! GETs url and follows up to 5 redirects. Blocks until the response has been received, the request failed or timed out.
+	Response fetch(const std::string & url);
+
+	//! Closes all idle connections.
+	void closeIdleConnections();
+
+	//! Removes all cached responses.
+	void clearCache();
+
+	void setMaxConnectionsPerHost(const int value);
+	int getMaxConnectionsPerHost() const { return mMaxConnectionsPerHost; }
+
+	//! Max seconds to wait for connecting, sending or receiving data. Default is 10.
+	void setTimeout(const double value) { mTimeout = value; }
+	double getTimeout() const { return mTimeout; }
+
+	const ci::fs::path & getCacheDir() const { return mCacheDir; }
+
+	Stats getStats();
+	void resetStats();
+
+protected:
+	typedef intptr_t Socket;
+
+	struct Url {
+		std::string host;
+		int port = 80;
+		std::string target; // path and query
+	};
+
+	struct Host {
+		int numActive = 0;
+		std::vector<Socket> idleSockets;
+	};
+
+	//! Cache files store the url and validators on their first three lines, followed by the body.
+	struct CacheEntry {
+		std::string url;
+		std::string etag;
+		std::string lastModified;
+		ci::fs::path path;
+	};
+
+	static bool parseUrl(const std::string & url, Url & result);
+
+	Response fetchOnce(const std::string & url, std::string & redirectUrl);
+
+	Socket acquire(const Url & url, bool & isReused, std::string & error); // waits for a free slot on the url's host
+	void release(const Url & url, const Socket socket, const bool keepAlive);
+
+	Socket connect(const Url & url, std::string & error);
+	static bool send(const Socket socket, const std::string & data);
+	static bool receive(const Socket socket, std::vector<uint8_t> & buffer); // appends the next chunk of data; false on error or if the connection has been closed
+	static bool readResponse(const Socket socket, Response & response, std::map<std::string, std::string> & headers, bool & keepAlive);
+	static void close(const Socket socket);
+
+	CacheEntry getCacheEntry(const std::string & url) const;
+	ci::BufferRef readCachedBody(const CacheEntry & entry) const; // nullptr if the file no longer matches entry
+	void storeCacheEntry(const CacheEntry & entry, const ci::BufferRef & body, const std::map<std::string, std::string> & headers);
+
+	ci::fs::path mCacheDir;
+	std::atomic<int> mMaxConnectionsPerHost;
+	std::atomic<double> mTimeout;
+
+	std::mutex mMutex;
+	std::condition_variable mHostCondition;
+	std::map<std::string, Host> mHosts; // by host:port
+	Stats mStats;
+};
+
+}
+}
@@ -4,7 +4,13 @@
 #include "cinder/imageIo.h"
 #include "cinder/Log.h"
 
+#include <chrono>
+
 #include "FileUtils.h"
+#include "GlWorkerPool.h"
+#include "MappedFile.h"
+#include "MemoryImageTarget.h"
+#include "PixelBufferPool.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -13,13 +19,46 @@ using namespace std;
 namespace bluecadet {
 namespace utils {
 
+namespace {
+	ci::ImageSourceRef loadMappedImage(const ci::fs::path & absFilePath) {
+		// decode straight from the mapped file instead of streaming it through intermediate buffers
+		auto file = MappedFile::create(absFilePath, MappedFile::Access::Sequential);
+
+		if (!file) {
+			return loadImage(absFilePath);
+		}
+
+		auto extension = absFilePath.extension().string();
+		if (!extension.empty() && extension[0] == '.') {
+			extension.erase(0, 1);
+		}
+
+		return loadImage(DataSourceBuffer::create(file->getBuffer()), ImageSource::Options(), extension);
+	}
+}
+
 ci::gl::Texture::Format ImageManager::sDefaultFormat;
 bool ImageManager::sDefaultFormatInitialized = false;
 
-ImageManager::ImageManager() {
+ImageManager::ImageManager() :
+	mNumDecodeThreads(std::max(1u, std::thread::hardware_concurrency())),
+	mMaxDecodedFiles(mNumDecodeThreads * 4)
+{
 }
 
 ImageManager::~ImageManager() {
+	mUpdateConnection.disconnect();
+
+	{
+		lock_guard<mutex> lock(mBatchMutex);
+		mIsCanceled = true;
+	}
+
+	mBatchCondition.notify_all();
+
+	for (auto & batch : mBatches) {
+		joinThreads(*batch);
+	}
 }
 
 void ImageManager::load(const ci::fs::path & absFilePath, const ci::gl::Texture::Format & format) {
@@ -29,19 +68,145 @@ void ImageManager::load(const ci::fs::path & absFilePath, const ci::gl::Texture:
 
 void ImageManager::load(const ci::fs::path & absFilePath, const std::string & key, const ci::gl::Texture::Format & format) {
 	try {
-		if (const auto img = loadImage(absFilePath)) {
-			mTexturesMap[key] = gl::Texture2d::create(img, format);
+		DecodedFile file;
+		file.path = absFilePath;
+		file.key = key;
+		file.contentHash = mContentHashIndex ? mContentHashIndex->getHash(absFilePath) : 0;
 
-		} else {
-			throw ci::Exception("Could not load image from '" + absFilePath.string() + "'");
+		if (shareContent(file)) {
+			return;
 		}
+
+		decode(file, format, mCompressedTextureCache, mTextureAtlas);
+		upload(file, format);
+
 	} catch (Exception e) {
 		CI_LOG_EXCEPTION("Could not load image from '" + absFilePath.string() + "'", e);
 	}
 }
 
-void ImageManager::loadAllFromDir(const ci::fs::path absDirPath, const LoadOptions options, const ci::gl::Texture::Format & format) {
-	int numImagesLoaded = 0;
+bool ImageManager::shareContent(const DecodedFile & file) {
+	if (file.contentHash == 0) {
+		return false;
+	}
+
+	auto contentIt = mContentMap.find(file.contentHash);
+
+	if (contentIt == mContentMap.end()) {
+		return false;
+	}
+
+	// reuse texture or region of a file with identical content
+	const auto & content = contentIt->second;
+
+	if (content.region) {
+		mRegionsMap[file.key] = content.region;
+		mNumBytesDeduplicated += MemoryImageTarget::getNumBytes(content.region->getSize().x, content.region->getSize().y);
+	} else {
+		mTexturesMap[file.key] = content.texture;
+		mNumBytesDeduplicated += GpuMemoryBudget::estimateTextureBytes(content.texture->getWidth(), content.texture->getHeight(), 4, content.texture->hasMipmapping());
+	}
+
+	mNumDeduplicated++;
+	return true;
+}
+
+void ImageManager::decode(DecodedFile & file, const ci::gl::Texture::Format & format, CompressedTextureCacheRef compressedTextureCache, TextureAtlasRef textureAtlas) {
+	file.image = loadMappedImage(file.path);
+
+	if (!file.image) {
+		throw ci::Exception("Could not load image from '" + file.path.string() + "'");
+	}
+
+	file.width = file.image->getWidth();
+	file.height = file.image->getHeight();
+	file.hasAlpha = file.image->hasAlpha();
+
+	// pack small images into shared atlas pages
+	file.fitsAtlas = textureAtlas && textureAtlas->fits(file.width, file.height);
+
+	const int maxMipLevel = format.hasMipmapping() ? max(0, format.getMaxMipmapLevel()) : 0;
+
+	if (!file.fitsAtlas && compressedTextureCache) {
+		// skip decoding if the image has been transcoded before
+		file.dds = compressedTextureCache->load(file.path, 0, maxMipLevel);
+	}
+
+	if (file.dds) {
+		file.image = nullptr;
+		file.isDecoded = true;
+		return;
+	}
+
+	const bool isGray = file.image->getColorModel() == ImageIo::CM_GRAY;
+
+	if (file.fitsAtlas || compressedTextureCache || (file.image->getDataType() == ImageIo::UINT8 && !isGray)) {
+		// decode into a pooled buffer instead of a new surface for each image; grayscale images keep
+		// their single channel textures unless they need RGBA for the atlas or cache
+		file.pixels = PixelBufferPool::get()->acquire(MemoryImageTarget::getNumBytes(file.width, file.height));
+		MemoryImageTarget::load(file.image, file.pixels->getData(), file.width, file.height, MemoryImageTarget::getRowBytes(file.width));
+		file.image = nullptr;
+	}
+
+	if (!file.fitsAtlas && compressedTextureCache) {
+		// transcode once and load from cache on subsequent runs
+		file.dds = compressedTextureCache->store(file.path, file.pixels->getData(), file.width, file.height, file.hasAlpha, 0, maxMipLevel);
+		if (file.dds) file.pixels = nullptr;
+	}
+
+	file.isDecoded = true;
+}
+
+void ImageManager::upload(DecodedFile & file, const ci::gl::Texture::Format & format) {
+	const std::string & key = file.key;
+
+	if (file.fitsAtlas && file.pixels && mTextureAtlas) {
+		// the file path is unique across managers that share an atlas
+		auto region = mTextureAtlas->insert(file.path.string(), file.pixels->getData(), file.width, file.height);
+
+		if (region) {
+			mRegionsMap[key] = region;
+			if (file.contentHash != 0) mContentMap[file.contentHash].region = region;
+			return;
+		}
+
+		if (mCompressedTextureCache) {
+			// atlas is full
+			const int maxMipLevel = format.hasMipmapping() ? max(0, format.getMaxMipmapLevel()) : 0;
+			file.dds = mCompressedTextureCache->load(file.path, 0, maxMipLevel);
+
+			if (!file.dds) {
+				file.dds = mCompressedTextureCache->store(file.path, file.pixels->getData(), file.width, file.height, file.hasAlpha, 0, maxMipLevel);
+			}
+		}
+	}
+
+	if (file.dds) {
+		mTexturesMap[key] = gl::Texture2d::createFromDds(DataSourceBuffer::create(file.dds), format);
+
+	} else if (file.pixels) {
+		// surface only wraps the pixels while they're uploaded
+		const Surface8u surface(file.pixels->getData(), file.width, file.height, MemoryImageTarget::getRowBytes(file.width), SurfaceChannelOrder::RGBA);
+
+		// pooled pixels are always RGBA, so keep opaque images in RGB textures like the image source would
+		auto pixelFormat = format;
+		if (pixelFormat.getInternalFormat() == -1) {
+			pixelFormat.setInternalFormat(file.hasAlpha ? GL_RGBA8 : GL_RGB8);
+		}
+
+		mTexturesMap[key] = gl::Texture2d::create(surface, pixelFormat);
+
+	} else if (file.image) {
+		mTexturesMap[key] = gl::Texture2d::create(file.image, format);
+
+	} else {
+		throw ci::Exception("Could not load image from '" + file.path.string() + "'");
+	}
+
+	if (file.contentHash != 0) mContentMap[file.contentHash].texture = mTexturesMap[key];
+}
+
+std::vector<std::pair<ci::fs::path, std::string>> ImageManager::findFiles(const ci::fs::path & absDirPath, const LoadOptions & options) {
 	string absDirStr = absDirPath.string();
 
 	if (!absDirStr.empty() && absDirStr.back() != ci::fs::path::preferred_separator) {
@@ -49,6 +214,8 @@ void ImageManager::loadAllFromDir(const ci::fs::path absDirPath, const LoadOptio
 		absDirStr += ci::fs::path::preferred_separator;
 	}
 
+	vector<pair<ci::fs::path, string>> files;
+
 	FileUtils::find(absDirPath, [&](const ci::fs::path & path) {
 
 		string key = options.getKeyMapping() == KeyMapping::Filename ? FileUtils::getFilename(path) : path.string();
@@ -62,11 +229,278 @@ void ImageManager::loadAllFromDir(const ci::fs::path absDirPath, const LoadOptio
 			std::replace(key.begin(), key.end(), '\\', '/');
 		}
 
-		load(path, key, format);
-		numImagesLoaded++;
+		files.push_back(make_pair(path, key));
 	}, options.getExtensions(), options.getRecursive(), options.getForceLowercaseExtensions());
 
-	CI_LOG_I("Loaded " + to_string(numImagesLoaded) + " images from " + absDirPath.string());
+	return files;
+}
+
+void ImageManager::loadAllFromDir(const ci::fs::path absDirPath, const LoadOptions options, const ci::gl::Texture::Format & format) {
+	const auto files = findFiles(absDirPath, options);
+
+	if (!options.getParallel()) {
+		MappedFileRef nextFile = nullptr;
+
+		for (size_t i = 0; i < files.size(); ++i) {
+			if (i + 1 < files.size()) {
+				// start reading the next file in the background while this one is decoded
+				nextFile = MappedFile::create(files[i + 1].first, MappedFile::Access::WillNeed);
+			}
+
+			load(files[i].first, files[i].second, format);
+			mDidUpdateProgress.emit(i + 1, files.size());
+		}
+
+		CI_LOG_I("Loaded " + to_string(files.size()) + " images from " + absDirPath.string());
+		mDidLoadAll.emit(absDirPath);
+		return;
+	}
+
+	// decode threads don't run on the main thread, so image factories need to be initialized first
+	GlWorkerPool::initializeLoader();
+
+	auto batch = make_shared<Batch>();
+	batch->absDirPath = absDirPath;
+	batch->format = format;
+	batch->maxUploadTime = options.getMaxUploadTime();
+	batch->compressedTextureCache = mCompressedTextureCache;
+	batch->textureAtlas = mTextureAtlas;
+	batch->contentHashIndex = mContentHashIndex;
+
+	for (const auto & file : files) {
+		auto decodedFile = make_shared<DecodedFile>();
+		decodedFile->path = file.first;
+		decodedFile->key = file.second;
+		batch->files.push_back(decodedFile);
+	}
+
+	const size_t numThreads = min(mNumDecodeThreads, files.size());
+
+	for (size_t i = 0; i < numThreads; ++i) {
+		batch->threads.push_back(std::thread(bind(&ImageManager::decodeBatch, this, batch)));
+	}
+
+	mBatches.push_back(batch);
+
+	if (!mUpdateConnection.isConnected()) {
+		// results are uploaded in slices on each update
+		mUpdateConnection = AppBase::get()->getSignalUpdate().connect(bind(&ImageManager::uploadBatches, this));
+	}
+
+	CI_LOG_I("Loading " + to_string(files.size()) + " images from " + absDirPath.string() + " on " + to_string(numThreads) + " threads");
+}
+
+bool ImageManager::buildArchive(const ci::fs::path & absDirPath, const ci::fs::path & archivePath, const LoadOptions & options, const bool compress, const int maxMipLevel) {
+	const auto files = findFiles(absDirPath, options);
+
+	AssetArchive::Writer writer(archivePath);
+
+	for (const auto & file : files) {
+		try {
+			const auto image = loadMappedImage(file.first);
+
+			if (!image) {
+				throw ci::Exception("Could not load image from '" + file.first.string() + "'");
+			}
+
+			const int width = image->getWidth();
+			const int height = image->getHeight();
+			auto pixels = PixelBufferPool::get()->acquire(MemoryImageTarget::getNumBytes(width, height));
+			MemoryImageTarget::load(image, pixels->getData(), width, height, MemoryImageTarget::getRowBytes(width));
+
+			if (compress) {
+				const auto blockFormat = image->hasAlpha() ? BlockCompressor::Format::BC3 : BlockCompressor::Format::BC1;
+				const auto dds = CompressedTextureCache::createDds(pixels->getData(), width, height, blockFormat, max(0, maxMipLevel));
+				writer.addDds(file.second, dds, image->hasAlpha());
+			} else {
+				writer.addPixels(file.second, pixels->getData(), width, height, image->hasAlpha());
+			}
+
+		} catch (Exception e) {
+			CI_LOG_EXCEPTION("Could not add image from '" + file.first.string() + "' to archive", e);
+		}
+	}
+
+	if (!writer.finish()) {
+		return false;
+	}
+
+	CI_LOG_I("Packed " + to_string(writer.getNumEntries()) + " of " + to_string(files.size()) + " images from " + absDirPath.string()
+		+ " into " + archivePath.string() + " (" + to_string(writer.getNumBytes() / 1024) + " KB)");
+	return true;
+}
+
+size_t ImageManager::loadArchive(const ci::fs::path & archivePath, const ci::gl::Texture::Format & format) {
+	auto archive = AssetArchive::open(archivePath);
+
+	if (!archive) {
+		CI_LOG_E("Could not open asset archive at '" + archivePath.string() + "'");
+		return 0;
+	}
+
+	// start reading ahead of the first uploads
+	archive->prefetch();
+
+	const auto & entries = archive->getEntries();
+	size_t numLoaded = 0;
+
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const auto & entry = entries[i];
+
+		try {
+			if (entry.encoding == AssetArchive::Encoding::Dds) {
+				mTexturesMap[entry.key] = gl::Texture2d::createFromDds(DataSourceBuffer::create(archive->getBuffer(entry)), format);
+				numLoaded++;
+
+			} else {
+				uint8_t * pixels = (uint8_t *)archive->getData(entry);
+				AtlasRegionRef region = nullptr;
+
+				if (mTextureAtlas && mTextureAtlas->fits(entry.width, entry.height)) {
+					// ids need to be unique across managers that share an atlas
+					region = mTextureAtlas->insert(archivePath.string() + "|" + entry.key, pixels, entry.width, entry.height);
+				}
+
+				if (region) {
+					mRegionsMap[entry.key] = region;
+				} else {
+					// surface only wraps the mapped pixels while they're uploaded
+					const Surface8u surface(pixels, entry.width, entry.height, MemoryImageTarget::getRowBytes(entry.width), SurfaceChannelOrder::RGBA);
+					mTexturesMap[entry.key] = gl::Texture2d::create(surface, format);
+				}
+
+				numLoaded++;
+			}
+
+		} catch (Exception e) {
+			CI_LOG_EXCEPTION("Could not load '" + entry.key + "' from asset archive at '" + archivePath.string() + "'", e);
+		}
+
+		mDidUpdateProgress.emit(i + 1, entries.size());
+	}
+
+	CI_LOG_I("Loaded " + to_string(numLoaded) + " images from " + archivePath.string());
+	mDidLoadAll.emit(archivePath);
+	return numLoaded;
+}
+
+void ImageManager::decodeBatch(BatchRef batch) {
+	ci::ThreadSetup threadSetup;
+
+	const size_t numFiles = batch->files.size();
+
+	while (true) {
+		const size_t index = batch->nextIndex++;
+		DecodedFileRef file = nullptr;
+
+		if (index >= numFiles) {
+			return;
+		}
+
+		{
+			// don't decode too far ahead of uploads
+			unique_lock<mutex> lock(mBatchMutex);
+			while (!mIsCanceled && index >= batch->numUploaded + mMaxDecodedFiles) {
+				mBatchCondition.wait(lock);
+			}
+
+			if (mIsCanceled) {
+				return;
+			}
+
+			file = batch->files[index];
+		}
+
+		DecodedFile decoded;
+		decoded.path = file->path;
+		decoded.key = file->key;
+
+		try {
+			decoded.contentHash = batch->contentHashIndex ? batch->contentHashIndex->getHash(decoded.path) : 0;
+			decode(decoded, batch->format, batch->compressedTextureCache, batch->textureAtlas);
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not load image from '" + decoded.path.string() + "'", e);
+		}
+
+		{
+			lock_guard<mutex> lock(mBatchMutex);
+			*file = std::move(decoded);
+			file->isReady = true;
+		}
+	}
+}
+
+void ImageManager::uploadBatches() {
+	const auto startTime = std::chrono::steady_clock::now();
+	bool isFirstUpload = true;
+
+	while (!mBatches.empty()) {
+		auto batch = mBatches.front();
+		const size_t numFiles = batch->files.size();
+		DecodedFileRef file = nullptr;
+
+		{
+			lock_guard<mutex> lock(mBatchMutex);
+
+			if (batch->numUploaded < numFiles) {
+				file = batch->files[batch->numUploaded];
+
+				if (!file->isReady) {
+					// files are uploaded in order, so that keys and shared content match loading them one by one
+					return;
+				}
+			}
+		}
+
+		if (!file) {
+			// all files of this batch have been uploaded
+			mBatches.pop_front();
+			joinThreads(*batch);
+			CI_LOG_I("Loaded " + to_string(numFiles) + " images from " + batch->absDirPath.string());
+			mDidLoadAll.emit(batch->absDirPath);
+			continue;
+		}
+
+		const double elapsedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		if (!isFirstUpload && batch->maxUploadTime >= 0 && elapsedTime >= batch->maxUploadTime) {
+			// carry over remaining files to the next frame; at least one file is uploaded per frame
+			return;
+		}
+
+		isFirstUpload = false;
+
+		try {
+			if (!shareContent(*file) && file->isDecoded) {
+				upload(*file, batch->format);
+			}
+		} catch (Exception e) {
+			CI_LOG_EXCEPTION("Could not load image from '" + file->path.string() + "'", e);
+		}
+
+		size_t numUploaded = 0;
+
+		{
+			// release decoded pixels right away
+			lock_guard<mutex> lock(mBatchMutex);
+			batch->files[batch->numUploaded] = nullptr;
+			numUploaded = ++batch->numUploaded;
+		}
+
+		mBatchCondition.notify_all();
+		mDidUpdateProgress.emit(numUploaded, numFiles);
+	}
+}
+
+void ImageManager::joinThreads(Batch & batch) {
+	for (auto & thread : batch.threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	batch.threads.clear();
 }
 
 bool ImageManager::hasTexture(const std::string & key) const {
@@ -86,8 +520,23 @@ void ImageManager::add(const std::string& key, ci::gl::TextureRef texture) {
 	mTexturesMap[key] = texture;
 }
 
+bool ImageManager::hasRegion(const std::string & key) const {
+	return mRegionsMap.find(key) != mRegionsMap.end();
+}
+
+AtlasRegionRef ImageManager::getRegion(const std::string & key) const {
+	const auto & it = mRegionsMap.find(key);
+	if (it == mRegionsMap.end()) {
+		CI_LOG_W("Could not find image region with key '" << key << "'.");
+		return nullptr;
+	}
+	return it->second;
+}
+
 void ImageManager::removeAll() {
 	mTexturesMap.clear();
+	mRegionsMap.clear();
+	mContentMap.clear();
 }
 
 const ci::gl::Texture::Format & ImageManager::getDefaultFormat() {
@@ -10,6 +10,18 @@
 #include "cinder/gl/gl.h"
 #include "cinder/gl/Texture.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "AssetArchive.h"
+#include "CompressedTextureCache.h"
+#include "ContentHashIndex.h"
+#include "PixelBufferPool.h"
+#include "TextureAtlas.h"
+
 namespace bluecadet {
 namespace utils {
 
@@ -31,12 +43,16 @@ public:
 		inline LoadOptions & extensions(const std::set<std::string> & extensions)	{ mExtensions = extensions; return *this; }
 		inline LoadOptions & forceLowercaseExtensions(const bool force)				{ mForceLowercaseExtensions = force; return *this; }
 		inline LoadOptions & forceForwardSlashes(const bool force)					{ mForceForwardSlashes = force; return *this; }
+		inline LoadOptions & parallel(const bool parallel)							{ mParallel = parallel; return *this; }
+		inline LoadOptions & maxUploadTime(const double seconds)					{ mMaxUploadTime = seconds; return *this; }
 
 		inline const bool						getRecursive() const				{ return mRecursive; }
 		inline const KeyMapping					getKeyMapping() const				{ return mKeyMapping; }
 		inline const std::set<std::string> &	getExtensions() const				{ return mExtensions; }
 		inline const bool						getForceLowercaseExtensions() const { return mForceLowercaseExtensions; }
 		inline const bool						getForceForwardSlashes() const		{ return mForceForwardSlashes; }
+		inline const bool						getParallel() const					{ return mParallel; }
+		inline const double						getMaxUploadTime() const			{ return mMaxUploadTime; }
 
 	private:
 		bool					mRecursive = true;
@@ -44,6 +60,8 @@ public:
 		std::set<std::string>	mExtensions = {".jpg", ".jpeg", ".png"};
 		bool					mForceLowercaseExtensions = true;
 		bool					mForceForwardSlashes = true;
+		bool					mParallel = false;
+		double					mMaxUploadTime = 0.008;
 	};
 
 	static ImageManagerRef get() {
@@ -66,15 +84,55 @@ public:
 
 	/// <summary>
 	/// Loads all from dir.
+	/// If options.parallel() is enabled, this returns right away. Files are then read and decoded on a pool of threads across all cores
+	/// and uploaded on the main thread in slices of up to options.maxUploadTime() seconds per frame. Results are applied in the same
+	/// order as in the default mode, so keys, textures, regions and deduplicated content end up the same once loading completes.
 	/// </summary>
 	/// <param name="absDirPath">The absolute dir path.</param>
 	/// <param name="options">Options used or loading.</param>
 	/// <param name="format">The texture format used for textures.</param>
 	void loadAllFromDir(const ci::fs::path absDirPath, const LoadOptions options = LoadOptions(), const ci::gl::Texture::Format & format = getDefaultFormat());
 
+	/// <summary>
+	/// Decodes all files in absDirPath that match options into a single archive at archivePath that loadArchive() can load
+	/// with a few sequential reads. Meant to run as a build step (doesn't require GL). Keys are mapped the same way as by
+	/// loadAllFromDir(). If compress is true, images are stored as DXT1/DXT5 with mip levels 0 to maxMipLevel (which should match
+	/// the max mipmap level of the format passed to loadArchive()), otherwise as RGBA pixels. Returns false if the archive couldn't be written.
+	/// </summary>
+	static bool buildArchive(const ci::fs::path & absDirPath, const ci::fs::path & archivePath, const LoadOptions & options = LoadOptions(),
+		const bool compress = false, const int maxMipLevel = 0);
+
+	/// <summary>
+	/// Memory-maps the archive at archivePath and creates textures for all of its entries under their archived keys, reading
+	/// the archive front to back. RGBA entries that fit the texture atlas are packed into it. Emits the same progress and
+	/// completion signals as loadAllFromDir() (with archivePath). Returns the number of loaded entries.
+	/// </summary>
+	size_t loadArchive(const ci::fs::path & archivePath, const ci::gl::Texture::Format & format = getDefaultFormat());
+
+	/// <summary>
+	/// True while parallel loadAllFromDir() calls are still decoding or uploading files.
+	/// </summary>
+	bool isLoading() const { return !mBatches.empty(); }
+
+	/// <summary>
+	/// Triggered on the main thread after each file loaded by loadAllFromDir() with the number of files processed so far and the total number of files in that directory.
+	/// </summary>
+	ci::signals::Signal<void(size_t numLoaded, size_t numFiles)> & getLoadProgressSignal() { return mDidUpdateProgress; }
+
+	/// <summary>
+	/// Triggered on the main thread once all files of a loadAllFromDir() call have been loaded, with the directory's path.
+	/// </summary>
+	ci::signals::Signal<void(const ci::fs::path & absDirPath)> & getLoadCompleteSignal() { return mDidLoadAll; }
+
 	bool hasTexture(const std::string & key) const;
 	ci::gl::Texture2dRef getTexture(const std::string & key) const;
 
+	/// <summary>
+	/// Images that have been packed into the texture atlas (see setTextureAtlas()) are stored as regions instead of textures.
+	/// </summary>
+	bool hasRegion(const std::string & key) const;
+	AtlasRegionRef getRegion(const std::string & key) const;
+
 	/// <summary>
 	/// Adds a texture for 'key'.
 	/// If 'key' exists, the texture for that key will be overwritten.
@@ -88,13 +146,116 @@ public:
 	void removeAll();
 
 
+	/// <summary>
+	/// Optional cache that images are transcoded into once and loaded from as compressed DDS textures on subsequent loads.
+	/// Disabled (nullptr) by default.
+	/// </summary>
+	void setCompressedTextureCache(CompressedTextureCacheRef value) { mCompressedTextureCache = value; }
+	CompressedTextureCacheRef getCompressedTextureCache() const { return mCompressedTextureCache; }
+
+	/// <summary>
+	/// Optional atlas that images up to its max region size are packed into, so that grids of small images only need a few
+	/// texture binds. These images are accessed via getRegion() instead of getTexture(). Disabled (nullptr) by default.
+	/// </summary>
+	void setTextureAtlas(TextureAtlasRef value) { mTextureAtlas = value; }
+	TextureAtlasRef getTextureAtlas() const { return mTextureAtlas; }
+
+	/// <summary>
+	/// Optional index of file content hashes. If set, files with the same content as a previously loaded file (e.g. the same image
+	/// exported under several names) share that file's texture or region instead of being decoded and uploaded again, regardless
+	/// of the texture format they're loaded with. Disabled (nullptr) by default.
+	/// </summary>
+	void setContentHashIndex(ContentHashIndexRef value) { mContentHashIndex = value; }
+	ContentHashIndexRef getContentHashIndex() const { return mContentHashIndex; }
+
+	/// <summary>
+	/// Number of loaded files that share the texture or region of a file with identical content and the estimated memory that saved.
+	/// </summary>
+	size_t getNumDeduplicated() const { return mNumDeduplicated; }
+	size_t getNumBytesDeduplicated() const { return mNumBytesDeduplicated; }
+
 	static const ci::gl::Texture::Format & getDefaultFormat();
 	static void setDefaultFormat(ci::gl::Texture::Format value);
 
 private:
 
+	// Image of a single file, decoded up to the point where it needs a GL context
+	struct DecodedFile {
+		ci::fs::path path;
+		std::string key;
+		uint64_t contentHash = 0;
+		ci::ImageSourceRef image;		// sources that aren't 8-bit are uploaded by Cinder
+		PixelBufferRef pixels;			// tightly packed RGBA
+		int width = 0;
+		int height = 0;
+		bool hasAlpha = true;
+		bool fitsAtlas = false;
+		ci::BufferRef dds;				// compressed cache entry; replaces pixels if set
+		bool isDecoded = false;			// decoded without errors
+		bool isReady = false;			// decode task has finished
+	};
+	typedef std::shared_ptr<DecodedFile> DecodedFileRef;
+
+	// Files of a parallel loadAllFromDir() call
+	struct Batch {
+		ci::fs::path absDirPath;
+		ci::gl::Texture::Format format;
+		double maxUploadTime = 0;
+		std::vector<DecodedFileRef> files;
+		size_t numUploaded = 0;			// files are uploaded in order; guarded by mBatchMutex
+		std::atomic<size_t> nextIndex;	// next file to decode
+		std::vector<std::thread> threads;
+		CompressedTextureCacheRef compressedTextureCache;
+		TextureAtlasRef textureAtlas;
+		ContentHashIndexRef contentHashIndex;
+
+		Batch() : nextIndex(0) {}
+	};
+	typedef std::shared_ptr<Batch> BatchRef;
+
+	static std::vector<std::pair<ci::fs::path, std::string>> findFiles(const ci::fs::path & absDirPath, const LoadOptions & options);
+
+	// Reads and decodes file.path; thread-safe
+	static void decode(DecodedFile & file, const ci::gl::Texture::Format & format, CompressedTextureCacheRef compressedTextureCache, TextureAtlasRef textureAtlas);
+
+	// Stores the texture or region of a previously loaded file with identical content under file.key. Returns false if there is none.
+	bool shareContent(const DecodedFile & file);
+
+	// Creates the texture or region for a decoded file and stores it under file.key; main thread only
+	void upload(DecodedFile & file, const ci::gl::Texture::Format & format);
+
+	void decodeBatch(BatchRef batch); // on decode threads
+	void uploadBatches(); // on main thread
+	void joinThreads(Batch & batch);
+
 	// All preloaded textures
 	std::map<std::string, ci::gl::Texture2dRef>	mTexturesMap;
+	std::map<std::string, AtlasRegionRef>		mRegionsMap;
+
+	// First texture or region loaded for each content hash
+	struct Content {
+		ci::gl::Texture2dRef texture;
+		AtlasRegionRef region;
+	};
+	std::map<uint64_t, Content>					mContentMap;
+	size_t										mNumDeduplicated = 0;
+	size_t										mNumBytesDeduplicated = 0;
+
+	CompressedTextureCacheRef mCompressedTextureCache;
+	TextureAtlasRef mTextureAtlas;
+	ContentHashIndexRef mContentHashIndex;
+
+	// Parallel loading
+	std::deque<BatchRef> mBatches;		// main thread only
+	std::mutex mBatchMutex;				// guards decoded files of all batches
+	std::condition_variable mBatchCondition;
+	size_t mNumDecodeThreads;			// per batch
+	size_t mMaxDecodedFiles;			// max number of files per batch decoded ahead of the next upload; bounds memory use
+	bool mIsCanceled = false;
+	ci::signals::Connection mUpdateConnection;
+
+	ci::signals::Signal<void(size_t numLoaded, size_t numFiles)> mDidUpdateProgress;
+	ci::signals::Signal<void(const ci::fs::path & absDirPath)> mDidLoadAll;
 
 	static ci::gl::Texture2d::Format sDefaultFormat;
 	static bool sDefaultFormatInitialized;
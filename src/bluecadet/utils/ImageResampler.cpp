@@ -0,0 +1,107 @@
+#include "ImageResampler.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	ci::ivec2 ImageResampler::getFitSize(const ci::ivec2 & size, const int maxSize) {
+		if (maxSize <= 0 || (size.x <= maxSize && size.y <= maxSize)) {
+			return size;
+		}
+
+		if (size.x >= size.y) {
+			return ivec2(maxSize, max(1, (int)((int64_t)size.y * maxSize / size.x)));
+		}
+
+		return ivec2(max(1, (int)((int64_t)size.x * maxSize / size.y)), maxSize);
+	}
+
+	void ImageResampler::resize(const uint8_t * src, const int srcWidth, const int srcHeight, const ptrdiff_t srcRowBytes,
+		uint8_t * dst, const int dstWidth, const int dstHeight, const ptrdiff_t dstRowBytes) {
+
+		if (!src || !dst || srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0) {
+			return;
+		}
+
+		// source columns covered by each destination column
+		vector<int> columnStarts(dstWidth);
+		vector<int> columnEnds(dstWidth);
+
+		for (int x = 0; x < dstWidth; ++x) {
+			columnStarts[x] = (int)((int64_t)x * srcWidth / dstWidth);
+			columnEnds[x] = max(columnStarts[x] + 1, (int)((int64_t)(x + 1) * srcWidth / dstWidth));
+		}
+
+		// alpha weighted color and alpha sums of all source rows covered by the current destination row. averaging
+		// premultiplied colors and dividing by the averaged alpha keeps transparent pixels from bleeding into edges
+		vector<uint64_t> columnSums((size_t)srcWidth * 4);
+
+		for (int y = 0; y < dstHeight; ++y) {
+			const int rowStart = (int)((int64_t)y * srcHeight / dstHeight);
+			const int rowEnd = max(rowStart + 1, (int)((int64_t)(y + 1) * srcHeight / dstHeight));
+
+			fill(columnSums.begin(), columnSums.end(), 0);
+
+			for (int sy = rowStart; sy < rowEnd; ++sy) {
+				const uint8_t * srcRow = src + sy * srcRowBytes;
+				for (size_t i = 0; i < columnSums.size(); i += 4) {
+					const uint32_t alpha = srcRow[i + 3];
+					columnSums[i] += srcRow[i] * alpha;
+					columnSums[i + 1] += srcRow[i + 1] * alpha;
+					columnSums[i + 2] += srcRow[i + 2] * alpha;
+					columnSums[i + 3] += alpha;
+				}
+			}
+
+			uint8_t * dstRow = dst + y * dstRowBytes;
+			const int numRows = rowEnd - rowStart;
+
+			for (int x = 0; x < dstWidth; ++x) {
+				uint64_t sums[4] = {0, 0, 0, 0};
+
+				for (int sx = columnStarts[x]; sx < columnEnds[x]; ++sx) {
+					const uint64_t * pixel = &columnSums[(size_t)sx * 4];
+					sums[0] += pixel[0];
+					sums[1] += pixel[1];
+					sums[2] += pixel[2];
+					sums[3] += pixel[3];
+				}
+
+				const uint64_t numPixels = (uint64_t)(columnEnds[x] - columnStarts[x]) * numRows;
+				uint8_t * pixel = dstRow + x * 4;
+
+				const uint64_t alphaSum = sums[3];
+
+				// fully transparent pixels keep black, as premultiplied colors would
+				for (int c = 0; c < 3; ++c) {
+					pixel[c] = alphaSum > 0 ? (uint8_t)((sums[c] + alphaSum / 2) / alphaSum) : 0;
+				}
+
+				pixel[3] = (uint8_t)((alphaSum + numPixels / 2) / numPixels);
+			}
+		}
+	}
+
+	int ImageResampler::getNumMipLevels(const int width, const int height) {
+		int size = max(width, height);
+		int numLevels = 1;
+
+		while (size > 1) {
+			size /= 2;
+			numLevels++;
+		}
+
+		return numLevels;
+	}
+
+	ci::ivec2 ImageResampler::getMipSize(const int width, const int height, const int level) {
+		return ivec2(max(1, width >> level), max(1, height >> level));
+	}
+
+}
+}
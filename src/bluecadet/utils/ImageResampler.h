@@ -0,0 +1,35 @@
+#pragma once
+
+#include "cinder/Vector.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bluecadet {
+namespace utils {
+
+//! CPU helpers to resize 8-bit RGBA pixel buffers, e.g. to downscale decoded images before uploading them or to
+//! generate mip chains. Resizing uses a box filter that averages all source pixels covered by each destination pixel,
+//! which is fast and alias-free for the large reduction ratios typical for thumbnails. Colors are weighted by alpha,
+//! so transparent pixels don't darken the edges of straight alpha images. Resizing is scalar; PixelKernels only
+//! vectorizes per-pixel conversions.
+class ImageResampler {
+
+public:
+	//! Largest size that fits within maxSize x maxSize and preserves the aspect ratio of size. Never upscales and
+	//! returns size if maxSize is <= 0.
+	static ci::ivec2 getFitSize(const ci::ivec2 & size, const int maxSize);
+
+	//! Resizes RGBA pixels from src into dst. dst needs to hold at least dstRowBytes * dstHeight bytes.
+	static void resize(const uint8_t * src, const int srcWidth, const int srcHeight, const ptrdiff_t srcRowBytes,
+		uint8_t * dst, const int dstWidth, const int dstHeight, const ptrdiff_t dstRowBytes);
+
+	//! Number of levels in a mip chain for a width x height image, including the base level.
+	static int getNumMipLevels(const int width, const int height);
+
+	//! Size of mip level for a width x height base level.
+	static ci::ivec2 getMipSize(const int width, const int height, const int level);
+};
+
+}
+}
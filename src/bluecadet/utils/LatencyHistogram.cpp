@@ -0,0 +1,70 @@
+#include "LatencyHistogram.h"
+
+namespace bluecadet {
+namespace utils {
+
+	LatencyHistogram::LatencyHistogram() :
+		mHistogram(NUM_BUCKETS)
+	{
+	}
+
+	void LatencyHistogram::add(const double seconds) {
+		mHistogram.add(getBucketIndex(seconds));
+		mCount++;
+		mTotal += seconds;
+		mMax = std::max(mMax, seconds);
+	}
+
+	void LatencyHistogram::reset() {
+		mHistogram.reset();
+		mCount = 0;
+		mTotal = 0;
+		mMax = 0;
+	}
+
+	double LatencyHistogram::getPercentile(const double p) const {
+		if (mCount == 0) {
+			return 0.0;
+		}
+
+		const double rank = std::max(0.0, std::min(1.0, p)) * (double)mCount;
+		double count = 0;
+
+		for (int i = 0; i < NUM_BUCKETS; ++i) {
+			const double bucketCount = (double)mHistogram.at(i);
+
+			if (bucketCount > 0 && count + bucketCount >= rank) {
+				// assume durations are spread evenly within the bucket
+				const double t = (rank - count) / bucketCount;
+				const double value = getBucketMin(i) + t * (getBucketMax(i) - getBucketMin(i));
+				return std::min(value, mMax);
+			}
+
+			count += bucketCount;
+		}
+
+		return mMax;
+	}
+
+	double LatencyHistogram::getBucketMin(const int index) {
+		return index <= 0 ? 0.0 : std::ldexp(1.0e-6, index - 1);
+	}
+
+	double LatencyHistogram::getBucketMax(const int index) {
+		return std::ldexp(1.0e-6, std::max(0, index));
+	}
+
+	int LatencyHistogram::getBucketIndex(const double seconds) {
+		const double microseconds = seconds * 1.0e6;
+
+		if (!(microseconds >= 1.0)) {
+			return 0;
+		}
+
+		int exponent = 0;
+		std::frexp(microseconds, &exponent); // microseconds = m * 2^exponent with m in [0.5, 1)
+		return std::min(NUM_BUCKETS - 1, exponent);
+	}
+
+}
+}
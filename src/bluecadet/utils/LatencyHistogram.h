@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Histogram.h"
+
+namespace bluecadet {
+namespace utils {
+
+//! Distribution of durations in logarithmic buckets backed by a Histogram. Bucket 0 holds durations below 1 microsecond
+//! and bucket i holds durations from 2^(i-1) to 2^i microseconds, which covers up to ~2 minutes with a resolution of 2x.
+//! Not thread-safe.
+class LatencyHistogram {
+
+public:
+	static const int NUM_BUCKETS = 28;
+
+	LatencyHistogram();
+
+	void add(const double seconds);
+	void reset();
+
+	size_t getCount() const { return mCount; }
+	double getTotal() const { return mTotal; }
+	double getMax() const { return mMax; }
+	double getMean() const { return mCount > 0 ? mTotal / (double)mCount : 0.0; }
+
+	//! Estimated duration in seconds below which a fraction p (0-1) of durations fall, interpolated within its bucket.
+	double getPercentile(const double p) const;
+
+	//! Range of durations in seconds that fall into bucket index.
+	static double getBucketMin(const int index);
+	static double getBucketMax(const int index);
+	static int getBucketIndex(const double seconds);
+
+	const Histogram & getHistogram() const { return mHistogram; }
+
+protected:
+	Histogram mHistogram;
+	size_t mCount = 0;
+	double mTotal = 0;
+	double mMax = 0;
+};
+
+}
+}
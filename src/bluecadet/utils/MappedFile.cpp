@@ -0,0 +1,231 @@
+#include "MappedFile.h"
+
+#include "cinder/ImageIo.h"
+#include "cinder/Log.h"
+
+#include <chrono>
+#include <vector>
+
+#include "FileUtils.h"
+#include "MemoryImageTarget.h"
+#include "PixelBufferPool.h"
+
+#if defined(CINDER_MSW)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	MappedFileRef MappedFile::create(const ci::fs::path & path, const Access access) {
+		MappedFileRef file(new MappedFile(path));
+
+		if (!file->open(access)) {
+			return nullptr;
+		}
+
+		return file;
+	}
+
+	MappedFile::BenchmarkResult MappedFile::benchmark(const ci::fs::path & dir, const size_t maxNumFiles) {
+		typedef std::chrono::steady_clock Clock;
+
+		BenchmarkResult result;
+		vector<fs::path> files;
+
+		FileUtils::find(dir, [&](const ci::fs::path & path) {
+			if (maxNumFiles == 0 || files.size() < maxNumFiles) files.push_back(path);
+		}, {".jpg", ".jpeg", ".png"});
+
+		auto decode = [](const ImageSourceRef & image) {
+			const int width = image->getWidth();
+			const int height = image->getHeight();
+			auto pixels = PixelBufferPool::get()->acquire(MemoryImageTarget::getNumBytes(width, height));
+			MemoryImageTarget::load(image, pixels->getData(), width, height, MemoryImageTarget::getRowBytes(width));
+		};
+
+		auto getExtension = [](const fs::path & path) {
+			string extension = path.extension().string();
+			return !extension.empty() && extension[0] == '.' ? extension.substr(1) : extension;
+		};
+
+		uint32_t checksum = 0;
+
+		for (const auto & path : files) {
+			// read each file once, so that all variants below read from the page cache
+			if (auto file = create(path, Access::Sequential)) {
+				for (size_t i = 0; i < file->getSize(); i += 4096) checksum += file->getData()[i];
+				result.numBytes += file->getSize();
+				result.numFiles++;
+			}
+		}
+
+		for (const auto & path : files) {
+			try {
+				auto startTime = Clock::now();
+				const auto buffer = loadFile(path)->getBuffer();
+				result.streamReadSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+
+				startTime = Clock::now();
+				if (auto file = create(path, Access::Sequential)) {
+					for (size_t i = 0; i < file->getSize(); i += 4096) checksum += file->getData()[i];
+				}
+				result.mappedReadSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+
+				startTime = Clock::now();
+				decode(loadImage(loadFile(path)));
+				result.streamDecodeSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+
+				startTime = Clock::now();
+				if (auto file = create(path, Access::Sequential)) {
+					decode(loadImage(DataSourceBuffer::create(file->getBuffer()), ImageSource::Options(), getExtension(path)));
+				}
+				result.mappedDecodeSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not read '" + path.string() + "'", e);
+			}
+		}
+
+		CI_LOG_D("Mapped file benchmark checksum: " << checksum);
+
+		return result;
+	}
+
+	MappedFile::MappedFile(const ci::fs::path & path) :
+		mPath(path)
+	{
+	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	ci::BufferRef MappedFile::getBuffer() {
+		if (!mData) {
+			return nullptr;
+		}
+
+		// buffer doesn't own the data and holds on to the mapping instead
+		auto self = shared_from_this();
+		return ci::BufferRef(new Buffer((void *)mData, mSize), [self](Buffer * buffer) { delete buffer; });
+	}
+
+#if defined(CINDER_MSW)
+
+	bool MappedFile::open(const Access access) {
+		const DWORD flags = access == Access::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : (access == Access::Random ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL);
+		mFileHandle = CreateFileW(mPath.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, flags, nullptr);
+
+		if (mFileHandle == INVALID_HANDLE_VALUE) {
+			mFileHandle = nullptr;
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFileHandle, &size) || size.QuadPart <= 0) {
+			close();
+			return false;
+		}
+
+		mMappingHandle = CreateFileMappingW(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+		if (!mMappingHandle) {
+			close();
+			return false;
+		}
+
+		mData = (const uint8_t *)MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+		if (!mData) {
+			close();
+			return false;
+		}
+
+		mSize = (size_t)size.QuadPart;
+		return true;
+	}
+
+	void MappedFile::advise(const Access access) {
+		// the cache manager only takes hints when opening files
+	}
+
+	void MappedFile::close() {
+		if (mData) UnmapViewOfFile(mData);
+		if (mMappingHandle) CloseHandle(mMappingHandle);
+		if (mFileHandle) CloseHandle(mFileHandle);
+
+		mData = nullptr;
+		mSize = 0;
+		mMappingHandle = nullptr;
+		mFileHandle = nullptr;
+	}
+
+#else
+
+	bool MappedFile::open(const Access access) {
+		mFileDescriptor = ::open(mPath.c_str(), O_RDONLY);
+
+		if (mFileDescriptor < 0) {
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(mFileDescriptor, &info) != 0 || info.st_size <= 0) {
+			close();
+			return false;
+		}
+
+		void * data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, mFileDescriptor, 0);
+
+		if (data == MAP_FAILED) {
+			close();
+			return false;
+		}
+
+		mData = (const uint8_t *)data;
+		mSize = (size_t)info.st_size;
+
+		if (access != Access::Normal) {
+			advise(access);
+		}
+
+		return true;
+	}
+
+	void MappedFile::advise(const Access access) {
+		if (!mData) return;
+
+		int advice = MADV_NORMAL;
+
+		switch (access) {
+			case Access::Normal: advice = MADV_NORMAL; break;
+			case Access::Sequential: advice = MADV_SEQUENTIAL; break;
+			case Access::Random: advice = MADV_RANDOM; break;
+			case Access::WillNeed: advice = MADV_WILLNEED; break;
+		}
+
+		madvise((void *)mData, mSize, advice);
+	}
+
+	void MappedFile::close() {
+		if (mData) munmap((void *)mData, mSize);
+		if (mFileDescriptor >= 0) ::close(mFileDescriptor);
+
+		mData = nullptr;
+		mSize = 0;
+		mFileDescriptor = -1;
+	}
+
+#endif
+
+}
+}
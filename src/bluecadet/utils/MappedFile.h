@@ -0,0 +1,78 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+
+#include <cstdint>
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class MappedFile> MappedFileRef;
+
+//! Read-only memory mapping of a file. Pages are loaded by the OS on first access instead of being copied
+//! into a buffer up front. The mapping stays valid for the lifetime of this object.
+class MappedFile : public std::enable_shared_from_this<MappedFile> {
+
+public:
+	//! Hints how the mapped data will be accessed, which lets the OS tune its readahead.
+	enum class Access {
+		Normal,
+		Sequential,	//! Data is read front to back once (e.g. when decoding). Enables aggressive readahead.
+		Random,		//! Data is read in random order. Disables readahead.
+		WillNeed	//! Data will be read soon. Starts reading pages in the background.
+	};
+
+	//! Maps the file at path. Returns nullptr if the file doesn't exist, is empty or couldn't be mapped.
+	static MappedFileRef create(const ci::fs::path & path, const Access access = Access::Normal);
+
+	~MappedFile();
+
+	//! Changes the access hint. Only supported on POSIX systems; sequential access is only applied on open on Windows.
+	void advise(const Access access);
+
+	//! Returns a buffer that points to the mapped data without copying it and keeps this mapping alive while referenced.
+	//! Can be passed to decoders via ci::DataSourceBuffer::create(). The data must not be modified.
+	ci::BufferRef getBuffer();
+
+	const uint8_t * getData() const { return mData; }
+	size_t getSize() const { return mSize; }
+	const ci::fs::path & getPath() const { return mPath; }
+
+	//! Result of benchmark(); each value is the total for all files.
+	struct BenchmarkResult {
+		size_t numFiles = 0;
+		size_t numBytes = 0;				//! Encoded bytes read
+		double streamReadSeconds = 0;		//! Reading each file into a buffer via ci::loadFile()
+		double mappedReadSeconds = 0;		//! Mapping each file and touching all of its pages
+		double streamDecodeSeconds = 0;		//! ci::loadImage(ci::loadFile()) and decoding into RGBA, as before mapped reads
+		double mappedDecodeSeconds = 0;		//! Mapping each file and decoding straight from the mapped pages into RGBA
+	};
+
+	//! Compares stream reads with mapped reads over the jpg and png images in dir (recursively, up to maxNumFiles if > 0),
+	//! once for reading alone and once including decoding. All files are read once before timing, so both variants read
+	//! from the OS page cache and the difference is the cost of copying through streams and intermediate buffers. Runs on
+	//! the calling thread, which should be the main thread or have initialized Cinder's image loader (see
+	//! GlWorkerPool::initializeLoader()). Intended for diagnostics.
+	static BenchmarkResult benchmark(const ci::fs::path & dir, const size_t maxNumFiles = 0);
+
+protected:
+	MappedFile(const ci::fs::path & path);
+
+	bool open(const Access access);
+	void close();
+
+	ci::fs::path mPath;
+	const uint8_t * mData = nullptr;
+	size_t mSize = 0;
+
+#if defined(CINDER_MSW)
+	void * mFileHandle = nullptr;
+	void * mMappingHandle = nullptr;
+#else
+	int mFileDescriptor = -1;
+#endif
+};
+
+}
+}
@@ -0,0 +1,166 @@
+#include "MaxRectsPacker.h"
+
+#include <algorithm>
+#include <climits>
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		inline bool contains(const Area & outer, const Area & inner) {
+			return inner.x1 >= outer.x1 && inner.y1 >= outer.y1 && inner.x2 <= outer.x2 && inner.y2 <= outer.y2;
+		}
+
+		inline bool intersects(const Area & a, const Area & b) {
+			return a.x1 < b.x2 && a.x2 > b.x1 && a.y1 < b.y2 && a.y2 > b.y1;
+		}
+	}
+
+	MaxRectsPacker::MaxRectsPacker(const int width, const int height) {
+		reset(width, height);
+	}
+
+	void MaxRectsPacker::reset(const int width, const int height) {
+		mWidth = max(0, width);
+		mHeight = max(0, height);
+		mNumUsedPixels = 0;
+		mUsedRects.clear();
+		mFreeRects.clear();
+		mIsFragmented = false;
+
+		if (mWidth > 0 && mHeight > 0) {
+			mFreeRects.push_back(Area(0, 0, mWidth, mHeight));
+		}
+	}
+
+	bool MaxRectsPacker::insert(const int width, const int height, ci::Area & result) {
+		if (width <= 0 || height <= 0) {
+			return false;
+		}
+
+		if (!findPosition(width, height, result)) {
+			if (!mIsFragmented) {
+				return false;
+			}
+
+			// freed rects may have left space that isn't covered by a single free rect yet
+			rebuildFreeRects();
+
+			if (!findPosition(width, height, result)) {
+				return false;
+			}
+		}
+
+		splitFreeRects(result);
+
+		mNumUsedPixels += (size_t)width * height;
+		mUsedRects.push_back(result);
+		return true;
+	}
+
+	bool MaxRectsPacker::findPosition(const int width, const int height, ci::Area & result) const {
+		// best short side fit: pick the free rect that leaves the smallest leftover on its shorter side
+		int bestShortSide = INT_MAX;
+		int bestLongSide = INT_MAX;
+		const Area * bestRect = nullptr;
+
+		for (const auto & rect : mFreeRects) {
+			if (rect.getWidth() < width || rect.getHeight() < height) continue;
+
+			const int leftoverX = rect.getWidth() - width;
+			const int leftoverY = rect.getHeight() - height;
+			const int shortSide = min(leftoverX, leftoverY);
+			const int longSide = max(leftoverX, leftoverY);
+
+			if (shortSide < bestShortSide || (shortSide == bestShortSide && longSide < bestLongSide)) {
+				bestShortSide = shortSide;
+				bestLongSide = longSide;
+				bestRect = &rect;
+			}
+		}
+
+		if (!bestRect) {
+			return false;
+		}
+
+		result = Area(bestRect->x1, bestRect->y1, bestRect->x1 + width, bestRect->y1 + height);
+		return true;
+	}
+
+	void MaxRectsPacker::free(const ci::Area & area) {
+		auto it = find(mUsedRects.begin(), mUsedRects.end(), area);
+
+		if (it == mUsedRects.end()) {
+			return;
+		}
+
+		mUsedRects.erase(it);
+		mNumUsedPixels -= (size_t)area.getWidth() * area.getHeight();
+
+		if (mUsedRects.empty()) {
+			reset(mWidth, mHeight);
+			return;
+		}
+
+		mFreeRects.push_back(area);
+		mIsFragmented = true;
+	}
+
+	void MaxRectsPacker::splitFreeRects(const ci::Area & used) {
+		const size_t numRects = mFreeRects.size();
+
+		for (size_t i = 0; i < numRects; ++i) {
+			const Area rect = mFreeRects[i];
+
+			if (!intersects(rect, used)) continue;
+
+			// replace with up to four maximal rects around the used area
+			if (used.x1 > rect.x1) mFreeRects.push_back(Area(rect.x1, rect.y1, used.x1, rect.y2));
+			if (used.x2 < rect.x2) mFreeRects.push_back(Area(used.x2, rect.y1, rect.x2, rect.y2));
+			if (used.y1 > rect.y1) mFreeRects.push_back(Area(rect.x1, rect.y1, rect.x2, used.y1));
+			if (used.y2 < rect.y2) mFreeRects.push_back(Area(rect.x1, used.y2, rect.x2, rect.y2));
+
+			mFreeRects[i] = Area(0, 0, 0, 0); // marked for removal
+		}
+
+		// split rects are appended, so only those need to be pruned
+		const size_t firstNewRect = numRects;
+		pruneFreeRects(firstNewRect);
+
+		mFreeRects.erase(remove_if(mFreeRects.begin(), mFreeRects.end(), [](const Area & rect) { return rect.getWidth() <= 0 || rect.getHeight() <= 0; }), mFreeRects.end());
+	}
+
+	void MaxRectsPacker::pruneFreeRects(const size_t firstNewRect) {
+		// new rects are parts of rects that were already maximal, so only they can be contained in others
+		for (size_t i = firstNewRect; i < mFreeRects.size(); ++i) {
+			const Area rect = mFreeRects[i];
+
+			for (size_t j = 0; j < mFreeRects.size(); ++j) {
+				if (j == i || mFreeRects[j].getWidth() <= 0) continue;
+
+				// of two identical rects, only the later one is removed
+				if (contains(mFreeRects[j], rect) && (j < i || !(mFreeRects[j] == rect))) {
+					mFreeRects[i] = Area(0, 0, 0, 0); // marked for removal
+					break;
+				}
+			}
+		}
+	}
+
+	void MaxRectsPacker::rebuildFreeRects() {
+		// freed space can overlap several free rects, so the maximal rects are recomputed from the remaining ones
+		mFreeRects.clear();
+		mFreeRects.push_back(Area(0, 0, mWidth, mHeight));
+
+		for (const auto & used : mUsedRects) {
+			splitFreeRects(used);
+		}
+
+		mIsFragmented = false;
+	}
+
+}
+}
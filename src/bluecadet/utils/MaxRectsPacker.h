@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cinder/Area.h"
+#include "cinder/Vector.h"
+
+#include <vector>
+
+namespace bluecadet {
+namespace utils {
+
+//! Packs rectangles into a fixed-size bin with the MaxRects algorithm (best short side fit). Keeps a list of maximal
+//! free rectangles, so rectangles can be inserted incrementally in any order. Freed rectangles are added back to the
+//! free list right away; the list is only rebuilt from the remaining rectangles once an insert doesn't fit otherwise.
+//! Doesn't depend on GL and isn't thread-safe.
+class MaxRectsPacker {
+
+public:
+	MaxRectsPacker(const int width = 0, const int height = 0);
+
+	//! Removes all rectangles and resizes the bin.
+	void reset(const int width, const int height);
+
+	//! Finds space for a width x height rectangle and marks it as used. Returns false if it doesn't fit.
+	bool insert(const int width, const int height, ci::Area & result);
+
+	//! Returns an area that has been returned by insert() to the free space.
+	void free(const ci::Area & area);
+
+	ci::ivec2 getSize() const { return ci::ivec2(mWidth, mHeight); }
+	size_t getNumUsedPixels() const { return mNumUsedPixels; }
+	size_t getNumRects() const { return mUsedRects.size(); }
+
+	//! Ratio of used pixels to the bin's total pixels.
+	float getOccupancy() const { return mWidth > 0 && mHeight > 0 ? (float)mNumUsedPixels / ((float)mWidth * (float)mHeight) : 0.0f; }
+
+	bool isEmpty() const { return mUsedRects.empty(); }
+
+protected:
+	bool findPosition(const int width, const int height, ci::Area & result) const;
+	void splitFreeRects(const ci::Area & used);
+	void pruneFreeRects(const size_t firstNewRect); // removes rects from firstNewRect onward that are contained in others
+	void rebuildFreeRects();
+
+	int mWidth;
+	int mHeight;
+	size_t mNumUsedPixels = 0;
+	std::vector<ci::Area> mUsedRects;
+	std::vector<ci::Area> mFreeRects; // maximal free rects; may overlap
+	bool mIsFragmented = false; // true if rects have been freed since the free list was last rebuilt
+};
+
+}
+}
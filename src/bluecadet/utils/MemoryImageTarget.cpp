@@ -0,0 +1,39 @@
+#include "MemoryImageTarget.h"
+
+#include "PixelKernels.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	void MemoryImageTarget::load(const ci::ImageSourceRef & source, uint8_t * data, const int32_t width, const int32_t height, const ptrdiff_t rowBytes) {
+		const size_t numPixels = (size_t)width * (size_t)height;
+		const ImageIo::ChannelOrder channelOrder = source->getChannelOrder();
+		const bool isNative = source->getColorModel() == ImageIo::CM_RGB && source->getDataType() == ImageIo::UINT8
+			&& rowBytes == getRowBytes(width) && source->getWidth() == width && source->getHeight() == height;
+
+		if (isNative && (channelOrder == ImageIo::RGB || channelOrder == ImageIo::BGR)) {
+			// decode packed pixels into the last 3/4 of data, then expand front to back. writes never
+			// overtake reads, so this works in place without a second buffer.
+			uint8_t * packed = data + numPixels;
+			source->load(MemoryImageTargetRef(new MemoryImageTarget(packed, width, height, (ptrdiff_t)width * 3, channelOrder)));
+
+			if (channelOrder == ImageIo::RGB) {
+				PixelKernels::expandRgbToRgba(packed, data, numPixels);
+			} else {
+				PixelKernels::expandBgrToRgba(packed, data, numPixels);
+			}
+
+		} else if (isNative && channelOrder == ImageIo::BGRA) {
+			source->load(MemoryImageTargetRef(new MemoryImageTarget(data, width, height, rowBytes, ImageIo::BGRA)));
+			PixelKernels::swizzleBgraToRgba(data, data, numPixels);
+
+		} else {
+			source->load(create(data, width, height, rowBytes));
+		}
+	}
+
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cinder/ImageIo.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class MemoryImageTarget> MemoryImageTargetRef;
+
+//! Image target that decodes 8-bit RGBA pixels straight into externally owned memory (e.g. a mapped
+//! pixel buffer), so that ImageSource::load() doesn't need an intermediate ci::Surface.
+//! Images without alpha are decoded with an opaque alpha channel.
+class MemoryImageTarget : public ci::ImageTarget {
+
+public:
+	static MemoryImageTargetRef create(uint8_t * data, const int32_t width, const int32_t height, const ptrdiff_t rowBytes) {
+		return MemoryImageTargetRef(new MemoryImageTarget(data, width, height, rowBytes));
+	}
+
+	//! Decodes source into width x height RGBA pixels at data. Equivalent to source->load(create(...)), but 8-bit RGB, BGR
+	//! and BGRA sources are decoded in their native layout and converted with PixelKernels, which is several times
+	//! faster than ci::ImageSource's per-pixel conversion. Other sources are converted by ci::ImageSource.
+	static void load(const ci::ImageSourceRef & source, uint8_t * data, const int32_t width, const int32_t height, const ptrdiff_t rowBytes);
+
+	//! Tightly packed row size for RGBA pixels.
+	static ptrdiff_t getRowBytes(const int32_t width) { return (ptrdiff_t)width * 4; }
+
+	//! Number of bytes required to hold an image with width x height RGBA pixels.
+	static size_t getNumBytes(const int32_t width, const int32_t height) { return (size_t)getRowBytes(width) * (size_t)height; }
+
+	void * getRowPointer(int32_t row) override { return mData + row * mRowBytes; }
+
+	uint8_t * getData() const { return mData; }
+	ptrdiff_t getRowBytes() const { return mRowBytes; }
+
+protected:
+	MemoryImageTarget(uint8_t * data, const int32_t width, const int32_t height, const ptrdiff_t rowBytes,
+		const ci::ImageIo::ChannelOrder channelOrder = ci::ImageIo::RGBA) :
+		mData(data),
+		mRowBytes(rowBytes)
+	{
+		setSize(width, height);
+		setColorModel(ci::ImageIo::CM_RGB);
+		setChannelOrder(channelOrder);
+		setDataType(ci::ImageIo::UINT8);
+	}
+
+	uint8_t * mData;
+	ptrdiff_t mRowBytes;
+};
+
+}
+}
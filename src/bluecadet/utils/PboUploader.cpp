@@ -0,0 +1,283 @@
+#include "PboUploader.h"
+
+#include "cinder/Log.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	typedef std::chrono::steady_clock Clock;
+
+	PboUploaderRef PboUploader::getForCurrentThread() {
+		thread_local PboUploaderRef uploader = nullptr;
+		if (!uploader) {
+			uploader = create();
+		}
+		return uploader;
+	}
+
+	PboUploader::PboUploader(const size_t numSlots, const size_t initialSlotSize) :
+		mBuffers(max((size_t)1, numSlots))
+	{
+		const auto version = gl::getVersion();
+		mIsPersistent = version.first > 4 || (version.first == 4 && version.second >= 4) || gl::isExtensionAvailable("GL_ARB_buffer_storage");
+
+		for (auto & buffer : mBuffers) {
+			allocate(buffer, initialSlotSize);
+		}
+	}
+
+	PboUploader::~PboUploader() {
+		for (auto & buffer : mBuffers) {
+			destroy(buffer);
+		}
+	}
+
+	PboUploader::Slot PboUploader::acquire(const size_t numBytes) {
+		Slot slot;
+		Buffer & buffer = mBuffers[mNextSlot];
+
+		// make sure the gpu is done reading from this slot
+		waitForFence(buffer);
+
+		if (buffer.capacity < numBytes) {
+			// grow in 1MB steps to avoid reallocating for every slightly larger image
+			const size_t step = 1024 * 1024;
+			allocate(buffer, (numBytes + step - 1) / step * step);
+		}
+
+		if (!mIsPersistent) {
+			// orphan previous storage and map only the range we need
+			gl::ScopedBuffer scopedBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer.capacity, nullptr, GL_STREAM_DRAW);
+			buffer.mapping = (uint8_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, numBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		}
+
+		if (!buffer.mapping) {
+			CI_LOG_E("Could not map pixel buffer with " << numBytes << " bytes");
+			return slot;
+		}
+
+		slot.data = buffer.mapping;
+		slot.size = numBytes;
+		slot.index = (int)mNextSlot;
+
+		mNextSlot = (mNextSlot + 1) % mBuffers.size();
+
+		return slot;
+	}
+
+	ci::gl::Texture2dRef PboUploader::upload(const Slot & slot, const int width, const int height, ci::gl::Texture2d::Format format, const bool hasAlpha) {
+		if (!slot || slot.size < (size_t)width * (size_t)height * 4) {
+			release(slot);
+			return nullptr;
+		}
+
+		format.setInternalFormat(hasAlpha ? GL_RGBA8 : GL_RGB8);
+
+		auto texture = gl::Texture2d::create(width, height, format);
+		upload(slot, texture, 0, 0, width, height);
+
+		if (format.hasMipmapping()) {
+			gl::ScopedTextureBind scopedTexture(texture);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+
+		// rows are stored top to bottom in memory
+		texture->setTopDown(true);
+
+		return texture;
+	}
+
+	void PboUploader::upload(const Slot & slot, const ci::gl::Texture2dRef & texture, const int x, const int y, const int width, const int height, const GLenum dataFormat, const GLenum dataType, const int mipLevel) {
+		if (!slot || !texture) {
+			release(slot);
+			return;
+		}
+
+		const auto startTime = Clock::now();
+		Buffer & buffer = mBuffers[slot.index];
+
+		{
+			gl::ScopedTextureBind scopedTexture(texture);
+			gl::ScopedBuffer scopedBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+
+			if (!mIsPersistent) {
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				buffer.mapping = nullptr;
+			}
+
+			// pixels are read from the bound buffer at offset 0
+			glTexSubImage2D(texture->getTarget(), mipLevel, x, y, width, height, dataFormat, dataType, nullptr);
+		}
+
+		finishSlot(slot);
+
+		mStats.numUploads++;
+		mStats.numBytesUploaded += slot.size;
+		mStats.uploadTime += std::chrono::duration<double>(Clock::now() - startTime).count();
+	}
+
+	void PboUploader::release(const Slot & slot) {
+		if (slot.index < 0) {
+			return;
+		}
+
+		if (!mIsPersistent) {
+			Buffer & buffer = mBuffers[slot.index];
+			gl::ScopedBuffer scopedBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			buffer.mapping = nullptr;
+		}
+	}
+
+	void PboUploader::finishSlot(const Slot & slot) {
+		Buffer & buffer = mBuffers[slot.index];
+
+		if (buffer.fence) {
+			glDeleteSync(buffer.fence);
+		}
+
+		// slot can be reused once all commands up to here have been executed
+		buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void PboUploader::waitForFence(Buffer & buffer) {
+		if (!buffer.fence) {
+			return;
+		}
+
+		const auto startTime = Clock::now();
+
+		GLenum result = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (result == GL_TIMEOUT_EXPIRED) {
+			result = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms
+		}
+
+		if (result == GL_WAIT_FAILED) {
+			CI_LOG_E("Could not wait for pixel buffer fence");
+		}
+
+		glDeleteSync(buffer.fence);
+		buffer.fence = nullptr;
+
+		mStats.fenceWaitTime += std::chrono::duration<double>(Clock::now() - startTime).count();
+	}
+
+	void PboUploader::allocate(Buffer & buffer, const size_t capacity) {
+		destroy(buffer);
+
+		glGenBuffers(1, &buffer.id);
+		buffer.capacity = capacity;
+
+		gl::ScopedBuffer scopedBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+
+		if (mIsPersistent) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+			buffer.mapping = (uint8_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags);
+
+		} else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+		}
+	}
+
+	void PboUploader::destroy(Buffer & buffer) {
+		if (!buffer.id) {
+			return;
+		}
+
+		waitForFence(buffer);
+
+		if (buffer.mapping) {
+			gl::ScopedBuffer scopedBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+
+		glDeleteBuffers(1, &buffer.id);
+		buffer = Buffer();
+	}
+
+	PboUploader::BenchmarkResult PboUploader::benchmark(GlWorkerPoolRef pool, const int width, const int height, const size_t numUploads) {
+		BenchmarkResult result;
+
+		if (!pool) {
+			pool = GlWorkerPool::get();
+		}
+
+		if (!pool->getBackend()->hasGl() || width <= 0 || height <= 0) {
+			CI_LOG_E("Can't benchmark uploads without GL");
+			return result;
+		}
+
+		// workers must not wait for the main thread while it's running frames below
+		GlWorkerPool::initializeLoader(pool->getBackend());
+
+		const size_t numBytes = (size_t)width * (size_t)height * 4;
+		const std::vector<uint8_t> pixels(numBytes, 0x7f);
+		result.numBytes = numBytes * numUploads;
+
+		auto run = [&](const bool usePbo, double & megabytesPerSecond, double & frameTimeAvg, double & frameTimePeak) {
+			const auto clientId = pool->addClient();
+			std::atomic<size_t> numUploaded(0);
+			const auto startTime = Clock::now();
+
+			for (size_t i = 0; i < numUploads; ++i) {
+				pool->submit(clientId, [&, usePbo] {
+					gl::Texture2d::Format format;
+
+					// copy pixels like a decoder writing its output
+					if (usePbo) {
+						auto uploader = getForCurrentThread();
+						const Slot slot = uploader->acquire(numBytes);
+						if (slot) {
+							memcpy(slot.data, pixels.data(), numBytes);
+							uploader->upload(slot, width, height, format);
+						}
+					} else {
+						std::vector<uint8_t> decoded(pixels);
+						gl::Texture2d::create(decoded.data(), GL_RGBA, width, height, format);
+					}
+
+					// only count completed transfers
+					pool->getBackend()->finish();
+					numUploaded++;
+				});
+			}
+
+			size_t numFrames = 0;
+			double frameTimeTotal = 0;
+
+			while (numUploaded < numUploads) {
+				const auto frameStartTime = Clock::now();
+				glFinish();
+
+				const double frameTime = std::chrono::duration<double>(Clock::now() - frameStartTime).count();
+				frameTimeTotal += frameTime;
+				frameTimePeak = max(frameTimePeak, frameTime);
+				numFrames++;
+
+				this_thread::sleep_until(frameStartTime + std::chrono::microseconds(16667));
+			}
+
+			const double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+			pool->removeClient(clientId);
+
+			megabytesPerSecond = seconds > 0 ? (double)result.numBytes / (1024.0 * 1024.0) / seconds : 0;
+			frameTimeAvg = numFrames > 0 ? frameTimeTotal / (double)numFrames : 0;
+		};
+
+		run(true, result.pboMegabytesPerSecond, result.pboFrameTimeAvg, result.pboFrameTimePeak);
+		run(false, result.directMegabytesPerSecond, result.directFrameTimeAvg, result.directFrameTimePeak);
+
+		return result;
+	}
+
+}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+
+#include <atomic>
+
+#include "GlWorkerPool.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class PboUploader> PboUploaderRef;
+
+//! Streams pixel data to textures through a ring of persistently mapped pixel unpack buffers.
+//! Callers write pixels into a slot's mapped memory, after which the upload is issued from the buffer
+//! and the GPU transfers the data asynchronously instead of the driver copying from client memory
+//! during the call. Code that produces pixels on the GL thread (e.g. AsyncGlQueue tasks) can write them
+//! straight into the slot; AsyncImageLoader decodes on threads without a GL context and copies decoded
+//! pixels into the slot once. Each slot is guarded by a fence so it's only reused once the GPU has
+//! consumed its data.
+//!
+//! Uploaders need a current GL context and aren't thread-safe. Use getForCurrentThread() to get
+//! a lazily created uploader for the calling GL worker thread (e.g. inside AsyncGlQueue tasks).
+class PboUploader {
+
+public:
+	struct Slot {
+		uint8_t * data = nullptr;	//! Mapped memory to write pixels into
+		size_t size = 0;			//! Number of bytes requested for this slot
+		int index = -1;
+		explicit operator bool() const { return data != nullptr; }
+	};
+
+	struct Stats {
+		size_t numUploads = 0;
+		size_t numBytesUploaded = 0;
+		double uploadTime = 0;		//! Seconds spent issuing uploads
+		double fenceWaitTime = 0;	//! Seconds the uploading thread spent waiting for slots to be released by the GPU
+	};
+
+	//! Result of benchmark(). Frame times are measured on the calling thread while uploads run on worker threads.
+	struct BenchmarkResult {
+		double pboMegabytesPerSecond = 0;
+		double directMegabytesPerSecond = 0;	//! Uploads from client memory via ci::gl::Texture2d::create()
+		double pboFrameTimeAvg = 0;				//! Seconds
+		double pboFrameTimePeak = 0;
+		double directFrameTimeAvg = 0;
+		double directFrameTimePeak = 0;
+		size_t numBytes = 0;					//! Bytes uploaded per run
+	};
+
+	//! numSlots: Number of buffers in the ring.
+	//! initialSlotSize: Initial size of each buffer in bytes. Slots grow on demand to fit larger images.
+	static PboUploaderRef create(const size_t numSlots = 3, const size_t initialSlotSize = 16 * 1024 * 1024) {
+		return PboUploaderRef(new PboUploader(numSlots, initialSlotSize));
+	}
+
+	//! Returns the uploader for the calling thread and creates it if necessary. The uploader is
+	//! destroyed when the thread exits, so the thread's context must stay current until then.
+	static PboUploaderRef getForCurrentThread();
+
+	~PboUploader();
+
+	//! Returns the next slot in the ring with at least numBytes of mapped memory. Blocks until
+	//! the GPU has finished reading from that slot.
+	Slot acquire(const size_t numBytes);
+
+	//! Uploads tightly packed RGBA pixels from slot into a new texture. Mipmaps are generated on the GPU if
+	//! format has mipmapping enabled. The slot is released and can't be written to after this call.
+	ci::gl::Texture2dRef upload(const Slot & slot, const int width, const int height, ci::gl::Texture2d::Format format, const bool hasAlpha = true);
+
+	//! Uploads pixels from slot into a region of an existing texture. The slot is released and can't be written to after this call.
+	void upload(const Slot & slot, const ci::gl::Texture2dRef & texture, const int x, const int y, const int width, const int height,
+		const GLenum dataFormat = GL_RGBA, const GLenum dataType = GL_UNSIGNED_BYTE, const int mipLevel = 0);
+
+	//! Releases a slot without uploading anything.
+	void release(const Slot & slot);
+
+	//! True if buffers are persistently mapped (GL 4.4 or ARB_buffer_storage). Otherwise buffers are
+	//! mapped and unmapped for each upload.
+	bool isPersistent() const { return mIsPersistent; }
+
+	Stats getStats() const { return mStats; }
+	void resetStats() { mStats = Stats(); }
+
+	//! Uploads numUploads width x height RGBA images on pool's worker threads, once through PBOs and once from client memory,
+	//! while the calling thread runs 60 Hz frames that each wait for its own GL commands via glFinish(). Reports upload throughput
+	//! and how long these frames took. The calling thread acts as the main thread and needs a current context (e.g. the app's
+	//! main thread or an EGL context on llvmpipe). Requires a pool with GL (uses GlWorkerPool::get() if nullptr). Blocks until done;
+	//! intended for diagnostics, not for regular use at runtime.
+	static BenchmarkResult benchmark(GlWorkerPoolRef pool = nullptr, const int width = 2048, const int height = 2048, const size_t numUploads = 32);
+
+protected:
+	struct Buffer {
+		GLuint id = 0;
+		size_t capacity = 0;
+		uint8_t * mapping = nullptr;
+		GLsync fence = nullptr;
+	};
+
+	PboUploader(const size_t numSlots, const size_t initialSlotSize);
+
+	void allocate(Buffer & buffer, const size_t capacity);
+	void destroy(Buffer & buffer);
+	void waitForFence(Buffer & buffer);
+	void finishSlot(const Slot & slot);
+
+	bool mIsPersistent = false;
+	size_t mNextSlot = 0;
+	std::vector<Buffer> mBuffers;
+	Stats mStats;
+};
+
+}
+}
@@ -0,0 +1,316 @@
+#include "PixelBufferPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+
+#if defined(CINDER_MSW)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		const size_t MIN_BLOCK_SIZE = 64 * 1024;
+		const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	}
+
+	//==================================================
+	// PixelBuffer
+	//
+
+	PixelBuffer::PixelBuffer(std::weak_ptr<PixelBufferPool> pool, uint8_t * data, const size_t size, const size_t capacity) :
+		mPool(pool),
+		mData(data),
+		mSize(size),
+		mCapacity(capacity)
+	{
+	}
+
+	PixelBuffer::~PixelBuffer() {
+		auto pool = mPool.lock();
+
+		if (pool) {
+			pool->release(mData, mCapacity);
+		} else {
+			PixelBufferPool::freeBlock(mData, mCapacity);
+		}
+	}
+
+	//==================================================
+	// PixelBufferPool
+	//
+
+	PixelBufferPool::PixelBufferPool(const size_t maxRetainedBytes) :
+		mMaxRetainedBytes(maxRetainedBytes),
+		mPageFaultsAtReset(getNumPageFaults())
+	{
+	}
+
+	PixelBufferPool::~PixelBufferPool() {
+		// acquired buffers free their blocks themselves once the pool is gone
+		trim(0);
+	}
+
+	PixelBufferRef PixelBufferPool::acquire(const size_t numBytes) {
+		const size_t capacity = getSizeClass(numBytes);
+		uint8_t * data = nullptr;
+
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.numAcquired++;
+			mStats.numBytesInUse += capacity;
+
+			auto it = mBlocks.find(capacity);
+
+			if (it != mBlocks.end() && !it->second.empty()) {
+				data = it->second.back();
+				it->second.pop_back();
+				mStats.numReused++;
+				mStats.numBytesRetained -= capacity;
+			}
+		}
+
+		if (!data) {
+			data = allocateBlock(capacity);
+
+			lock_guard<mutex> lock(mMutex);
+
+			if (!data) {
+				mStats.numBytesInUse -= capacity;
+				throw std::bad_alloc();
+			}
+
+			mStats.numAllocated++;
+		}
+
+		return PixelBufferRef(new PixelBuffer(shared_from_this(), data, numBytes, capacity));
+	}
+
+	void PixelBufferPool::release(uint8_t * data, const size_t capacity) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.numBytesInUse -= capacity;
+
+			if (mStats.numBytesRetained + capacity <= mMaxRetainedBytes) {
+				mBlocks[capacity].push_back(data);
+				mStats.numBytesRetained += capacity;
+				return;
+			}
+
+			mStats.numFreed++;
+		}
+
+		freeBlock(data, capacity);
+	}
+
+	void PixelBufferPool::trim(const size_t maxRetainedBytes) {
+		std::vector<std::pair<uint8_t *, size_t>> blocks;
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			// free largest blocks first, which are the least likely to be reused
+			for (auto it = mBlocks.rbegin(); it != mBlocks.rend() && mStats.numBytesRetained > maxRetainedBytes; ++it) {
+				while (!it->second.empty() && mStats.numBytesRetained > maxRetainedBytes) {
+					blocks.push_back(make_pair(it->second.back(), it->first));
+					it->second.pop_back();
+					mStats.numBytesRetained -= it->first;
+					mStats.numFreed++;
+				}
+			}
+		}
+
+		for (const auto & block : blocks) {
+			freeBlock(block.first, block.second);
+		}
+	}
+
+	void PixelBufferPool::setMaxRetainedBytes(const size_t value) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			mMaxRetainedBytes = value;
+		}
+		trim(value);
+	}
+
+	size_t PixelBufferPool::getMaxRetainedBytes() {
+		lock_guard<mutex> lock(mMutex);
+		return mMaxRetainedBytes;
+	}
+
+	PixelBufferPool::Stats PixelBufferPool::getStats() {
+		lock_guard<mutex> lock(mMutex);
+		Stats stats = mStats;
+		stats.numPageFaults = getNumPageFaults() - mPageFaultsAtReset;
+		return stats;
+	}
+
+	void PixelBufferPool::resetStats() {
+		lock_guard<mutex> lock(mMutex);
+		mStats.numAcquired = 0;
+		mStats.numReused = 0;
+		mStats.numAllocated = 0;
+		mStats.numFreed = 0;
+		mPageFaultsAtReset = getNumPageFaults();
+	}
+
+	size_t PixelBufferPool::getSizeClass(const size_t numBytes) {
+		if (numBytes <= MIN_BLOCK_SIZE) {
+			return MIN_BLOCK_SIZE;
+		}
+
+		// four classes per power of two
+		size_t base = MIN_BLOCK_SIZE;
+		while (base * 2 < numBytes) base *= 2;
+
+		const size_t step = base / 4;
+		// classes from 8 MB up are multiples of the huge page size
+		return base + (numBytes - base + step - 1) / step * step;
+	}
+
+#if defined(CINDER_MSW)
+
+	size_t PixelBufferPool::getNumPageFaults() {
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+		return (size_t)counters.PageFaultCount;
+	}
+
+	uint8_t * PixelBufferPool::allocateBlock(const size_t capacity) {
+		if (capacity < HUGE_PAGE_SIZE) {
+			return (uint8_t *)_aligned_malloc(capacity, 64);
+		}
+
+		// large pages would require the lock pages privilege, so this only avoids heap fragmentation
+		return (uint8_t *)VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+
+	void PixelBufferPool::freeBlock(uint8_t * data, const size_t capacity) {
+		if (!data) return;
+
+		if (capacity < HUGE_PAGE_SIZE) {
+			_aligned_free(data);
+		} else {
+			VirtualFree(data, 0, MEM_RELEASE);
+		}
+	}
+
+#else
+
+	size_t PixelBufferPool::getNumPageFaults() {
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+		return (size_t)(usage.ru_minflt + usage.ru_majflt);
+	}
+
+	uint8_t * PixelBufferPool::allocateBlock(const size_t capacity) {
+		if (capacity < HUGE_PAGE_SIZE) {
+			void * data = nullptr;
+			return posix_memalign(&data, 64, capacity) == 0 ? (uint8_t *)data : nullptr;
+		}
+
+		// over-allocate so that the block can be aligned to a huge page boundary
+		const size_t mappedSize = capacity + HUGE_PAGE_SIZE;
+		void * mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapped == MAP_FAILED) {
+			return nullptr;
+		}
+
+		uint8_t * start = (uint8_t *)mapped;
+		uint8_t * aligned = (uint8_t *)(((uintptr_t)start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+		uint8_t * end = start + mappedSize;
+
+		// unmap the unaligned head and tail
+		if (aligned > start) munmap(start, aligned - start);
+		if (end > aligned + capacity) munmap(aligned + capacity, end - (aligned + capacity));
+
+#if defined(MADV_HUGEPAGE)
+		madvise(aligned, capacity, MADV_HUGEPAGE);
+#endif
+
+		return aligned;
+	}
+
+	void PixelBufferPool::freeBlock(uint8_t * data, const size_t capacity) {
+		if (!data) return;
+
+		if (capacity < HUGE_PAGE_SIZE) {
+			free(data);
+		} else {
+			munmap(data, capacity);
+		}
+	}
+
+#endif
+
+	PixelBufferPool::BenchmarkResult PixelBufferPool::benchmark(const size_t numIterations) {
+		typedef std::chrono::steady_clock Clock;
+
+		// typical decoded rgba sizes: thumbnails, hd and large photos
+		const size_t sizes[] = {
+			256 * 256 * 4,
+			1024 * 768 * 4,
+			1920 * 1080 * 4,
+			4000 * 3000 * 4
+		};
+
+		const size_t numInFlight = 4;
+		BenchmarkResult result;
+
+		auto run = [&](const std::function<void(size_t, size_t)> & fn) {
+			mt19937 random(0);
+			const auto startTime = Clock::now();
+			for (size_t i = 0; i < numIterations; ++i) fn(i % numInFlight, sizes[random() % 4]);
+			return std::chrono::duration<double>(Clock::now() - startTime).count();
+		};
+
+		{
+			// fresh pool that retains enough for all sizes in flight
+			auto pool = std::make_shared<PixelBufferPool>(numInFlight * 2 * getSizeClass(sizes[3]));
+			std::vector<PixelBufferRef> buffers(numInFlight);
+			size_t pageFaults = getNumPageFaults();
+
+			result.pooledSeconds = run([&](size_t slot, size_t numBytes) {
+				buffers[slot] = nullptr;
+				buffers[slot] = pool->acquire(numBytes);
+				memset(buffers[slot]->getData(), (int)slot, numBytes); // like a decoder writing every pixel
+			});
+
+			result.pooledPageFaults = getNumPageFaults() - pageFaults;
+		}
+
+		{
+			std::vector<std::vector<uint8_t>> buffers(numInFlight);
+			size_t pageFaults = getNumPageFaults();
+
+			result.heapSeconds = run([&](size_t slot, size_t numBytes) {
+				buffers[slot] = std::vector<uint8_t>();
+				buffers[slot].resize(numBytes);
+				memset(buffers[slot].data(), (int)slot, numBytes);
+			});
+
+			result.heapPageFaults = getNumPageFaults() - pageFaults;
+		}
+
+		mt19937 random(0);
+		for (size_t i = 0; i < numIterations; ++i) result.numBytes += sizes[random() % 4];
+
+		return result;
+	}
+
+}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class PixelBuffer> PixelBufferRef;
+typedef std::shared_ptr<class PixelBufferPool> PixelBufferPoolRef;
+
+//! Block of memory acquired from a PixelBufferPool. The block is returned to its pool once the last reference is released.
+class PixelBuffer {
+
+public:
+	~PixelBuffer();
+
+	uint8_t * getData() const { return mData; }
+
+	//! Number of bytes requested
+	size_t getSize() const { return mSize; }
+
+	//! Number of bytes allocated, which is the size class of the request
+	size_t getCapacity() const { return mCapacity; }
+
+protected:
+	friend class PixelBufferPool;
+
+	PixelBuffer(std::weak_ptr<PixelBufferPool> pool, uint8_t * data, const size_t size, const size_t capacity);
+
+	std::weak_ptr<PixelBufferPool> mPool;
+	uint8_t * mData;
+	size_t mSize;
+	size_t mCapacity;
+};
+
+//! Thread-safe pool of large memory blocks for decoded pixels. Allocating and freeing tens of megabytes for each image
+//! fragments the heap and causes page faults each time the OS maps fresh pages, so released blocks are kept for reuse.
+//!
+//! Requests are rounded up to size classes that are at most 25% apart, so that images of similar sizes share blocks.
+//! Blocks of 2 MB or more are allocated directly from the OS and aligned to 2 MB, which lets Linux back them with
+//! transparent huge pages. Released blocks are kept until the pool exceeds its retained byte budget.
+class PixelBufferPool : public std::enable_shared_from_this<PixelBufferPool> {
+
+public:
+	struct Stats {
+		size_t numAcquired = 0;			//! Calls to acquire()
+		size_t numReused = 0;			//! Calls to acquire() served by a retained block
+		size_t numAllocated = 0;		//! Blocks allocated from the OS or heap
+		size_t numFreed = 0;			//! Blocks returned to the OS or heap
+		size_t numBytesInUse = 0;		//! Capacity of blocks that are currently acquired
+		size_t numBytesRetained = 0;	//! Capacity of released blocks kept for reuse
+		size_t numPageFaults = 0;		//! Page faults of the whole process since the pool was created or its stats were reset
+	};
+
+	//! Result of benchmark(); each value is the total for all iterations.
+	struct BenchmarkResult {
+		double pooledSeconds = 0;
+		double heapSeconds = 0;
+		size_t pooledPageFaults = 0;
+		size_t heapPageFaults = 0;
+		size_t numBytes = 0;			//! Bytes written per run
+	};
+
+	//! Optional shared instance.
+	static PixelBufferPoolRef get() {
+		static auto instance = std::make_shared<PixelBufferPool>();
+		return instance;
+	}
+
+	//! maxRetainedBytes: Max capacity of released blocks kept for reuse. Blocks beyond this are freed right away.
+	PixelBufferPool(const size_t maxRetainedBytes = 256 * 1024 * 1024);
+	~PixelBufferPool();
+
+	//! Returns a buffer with at least numBytes of uninitialized memory. Throws std::bad_alloc if memory can't be allocated.
+	PixelBufferRef acquire(const size_t numBytes);
+
+	//! Frees retained blocks until at most maxRetainedBytes are kept.
+	void trim(const size_t maxRetainedBytes = 0);
+
+	void setMaxRetainedBytes(const size_t value);
+	size_t getMaxRetainedBytes();
+
+	Stats getStats();
+	void resetStats();
+
+	//! Capacity of the block that is used for a request of numBytes.
+	static size_t getSizeClass(const size_t numBytes);
+
+	//! Number of minor and major page faults of this process so far. 0 if not supported.
+	static size_t getNumPageFaults();
+
+	//! Simulates sustained loading by writing numIterations buffers of typical decoded image sizes, with a few buffers in
+	//! flight at any time, once via a new pool and once via std::vector. Intended for diagnostics, not for regular use at runtime.
+	static BenchmarkResult benchmark(const size_t numIterations = 200);
+
+protected:
+	friend class PixelBuffer;
+
+	void release(uint8_t * data, const size_t capacity); // called by PixelBuffer
+
+	static uint8_t * allocateBlock(const size_t capacity);
+	static void freeBlock(uint8_t * data, const size_t capacity);
+
+	std::mutex mMutex;
+	std::map<size_t, std::vector<uint8_t *>> mBlocks; // released blocks by capacity
+	size_t mMaxRetainedBytes;
+	size_t mPageFaultsAtReset;
+	Stats mStats;
+};
+
+}
+}
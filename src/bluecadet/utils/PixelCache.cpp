@@ -0,0 +1,403 @@
+#include "PixelCache.h"
+
+#include "cinder/ImageIo.h"
+#include "cinder/Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "ContentHashIndex.h"
+#include "FileUtils.h"
+#include "MemoryImageTarget.h"
+#include "PixelBufferPool.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		const char * MAGIC = "BCPX";
+		const uint32_t VERSION = 2;
+		const size_t PIXEL_ALIGNMENT = 64;
+		const std::string EXTENSION = ".px";
+	}
+
+	PixelCache::PixelCache(const ci::fs::path & cacheDir, const size_t budget) :
+		mCacheDir(cacheDir),
+		mBudget(budget)
+	{
+		static_assert(sizeof(Header) == 64, "PixelCache::Header needs to keep pixel rows 64 byte aligned");
+
+		try {
+			fs::create_directories(mCacheDir);
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not create pixel cache dir at '" + mCacheDir.string() + "'", e);
+		}
+
+		scanCacheDir();
+	}
+
+	PixelCache::EntryRef PixelCache::load(const ci::fs::path & sourcePath, const int maxSize) {
+		const string key = getCacheKey(sourcePath, maxSize);
+		const fs::path cachePath = getCachePath(sourcePath, maxSize);
+		const size_t pixelOffset = getPixelOffset(key.size());
+		const string filename = cachePath.filename().string();
+
+		int64_t modificationTime = 0;
+		uint64_t fileSize = 0;
+		MappedFileRef file = nullptr;
+
+		if (getSourceInfo(sourcePath, modificationTime, fileSize)) {
+			file = MappedFile::create(cachePath, MappedFile::Access::Sequential);
+		}
+
+		if (!file) {
+			lock_guard<mutex> lock(mMutex);
+			mStats.numMisses++;
+			return nullptr;
+		}
+
+		Header header;
+		bool isValid = file->getSize() >= sizeof(Header);
+
+		if (isValid) {
+			memcpy(&header, file->getData(), sizeof(Header));
+			isValid = memcmp(header.magic, MAGIC, 4) == 0
+				&& header.version == VERSION
+				&& header.width > 0 && header.height > 0
+				&& file->getSize() >= pixelOffset + (size_t)header.width * header.height * 4
+				// filenames are hashes, so make sure this is the entry that was requested
+				&& header.keyLength == key.size()
+				&& memcmp(file->getData() + sizeof(Header), key.data(), key.size()) == 0;
+		}
+
+		const bool isCurrent = isValid && header.sourceModificationTime == modificationTime && header.sourceFileSize == fileSize;
+
+		lock_guard<mutex> lock(mMutex);
+
+		if (!isCurrent) {
+			// source has changed or file is corrupt
+			file = nullptr;
+			mStats.numMisses++;
+			mStats.numInvalidations++;
+
+			try {
+				fs::remove(cachePath);
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not remove pixel cache file at '" + cachePath.string() + "'", e);
+			}
+
+			removeFile(filename);
+			return nullptr;
+		}
+
+		mStats.numHits++;
+
+		auto it = mFiles.find(filename);
+		if (it != mFiles.end()) {
+			mLru.splice(mLru.end(), mLru, it->second.lruIt);
+		} else {
+			addFile(filename, file->getSize());
+		}
+
+		EntryRef entry = make_shared<Entry>();
+		entry->file = file;
+		entry->pixels = file->getData() + pixelOffset;
+		entry->width = (int)header.width;
+		entry->height = (int)header.height;
+		entry->hasAlpha = header.hasAlpha != 0;
+		return entry;
+	}
+
+	bool PixelCache::store(const ci::fs::path & sourcePath, const uint8_t * pixels, const int width, const int height, const bool hasAlpha, const int maxSize) {
+		if (!pixels || width <= 0 || height <= 0) {
+			return false;
+		}
+
+		Header header;
+		memset(&header, 0, sizeof(Header));
+		memcpy(header.magic, MAGIC, 4);
+		header.version = VERSION;
+		header.width = (uint32_t)width;
+		header.height = (uint32_t)height;
+		header.hasAlpha = hasAlpha ? 1 : 0;
+
+		const string key = getCacheKey(sourcePath, maxSize);
+		header.keyLength = (uint32_t)key.size();
+
+		if (!getSourceInfo(sourcePath, header.sourceModificationTime, header.sourceFileSize)) {
+			return false;
+		}
+
+		const fs::path cachePath = getCachePath(sourcePath, maxSize);
+		const size_t numPixelBytes = (size_t)width * height * 4;
+		const size_t pixelOffset = getPixelOffset(key.size());
+		const vector<char> padding(pixelOffset - sizeof(Header) - key.size(), 0);
+
+		// write to a temp file first so that readers never see partial files
+		stringstream tempFilename;
+		tempFilename << cachePath.filename().string() << "." << std::hash<std::thread::id>()(this_thread::get_id()) << ".tmp";
+		const fs::path tempPath = mCacheDir / tempFilename.str();
+
+		try {
+			{
+				ofstream file(tempPath.string(), ios::binary | ios::trunc);
+				file.write((const char *)&header, sizeof(Header));
+				file.write(key.data(), key.size());
+				file.write(padding.data(), padding.size());
+				file.write((const char *)pixels, numPixelBytes);
+
+				if (!file) {
+					throw ci::Exception("Could not write file");
+				}
+			}
+
+			lock_guard<mutex> lock(mMutex);
+			fs::rename(tempPath, cachePath);
+			addFile(cachePath.filename().string(), pixelOffset + numPixelBytes);
+			mStats.numStores++;
+			trim();
+			return true;
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not write pixel cache file at '" + cachePath.string() + "'", e);
+		}
+
+		try {
+			fs::remove(tempPath);
+		} catch (...) {}
+
+		return false;
+	}
+
+	void PixelCache::remove(const ci::fs::path & sourcePath, const int maxSize) {
+		const fs::path cachePath = getCachePath(sourcePath, maxSize);
+		lock_guard<mutex> lock(mMutex);
+
+		try {
+			fs::remove(cachePath);
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not remove pixel cache file at '" + cachePath.string() + "'", e);
+		}
+
+		removeFile(cachePath.filename().string());
+	}
+
+	void PixelCache::clear() {
+		lock_guard<mutex> lock(mMutex);
+
+		try {
+			for (const auto & entry : fs::directory_iterator(mCacheDir)) {
+				if (entry.path().extension() == EXTENSION) {
+					fs::remove(entry.path());
+				}
+			}
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not clear pixel cache at '" + mCacheDir.string() + "'", e);
+		}
+
+		mLru.clear();
+		mFiles.clear();
+		mNumBytes = 0;
+	}
+
+	ci::fs::path PixelCache::getCachePath(const ci::fs::path & sourcePath, const int maxSize) const {
+		const string key = getCacheKey(sourcePath, maxSize);
+		return mCacheDir / (ContentHashIndex::toString(ContentHashIndex::hash(key.data(), key.size())) + EXTENSION);
+	}
+
+	std::string PixelCache::getCacheKey(const ci::fs::path & sourcePath, const int maxSize) {
+		stringstream key;
+		key << fs::absolute(sourcePath).string() << "|" << maxSize;
+		return key.str();
+	}
+
+	size_t PixelCache::getPixelOffset(const size_t keyLength) {
+		return (sizeof(Header) + keyLength + PIXEL_ALIGNMENT - 1) / PIXEL_ALIGNMENT * PIXEL_ALIGNMENT;
+	}
+
+	void PixelCache::setBudget(const size_t value) {
+		lock_guard<mutex> lock(mMutex);
+		mBudget = value;
+		trim();
+	}
+
+	PixelCache::Stats PixelCache::getStats() {
+		lock_guard<mutex> lock(mMutex);
+		Stats stats = mStats;
+		stats.numEntries = mFiles.size();
+		stats.numBytes = mNumBytes;
+		return stats;
+	}
+
+	void PixelCache::resetStats() {
+		lock_guard<mutex> lock(mMutex);
+		mStats = Stats();
+	}
+
+	PixelCache::BenchmarkResult PixelCache::benchmark(const ci::fs::path & dir, const size_t maxNumFiles) {
+		typedef std::chrono::steady_clock Clock;
+
+		BenchmarkResult result;
+		vector<fs::path> files;
+
+		FileUtils::find(dir, [&](const ci::fs::path & path) {
+			if (maxNumFiles == 0 || files.size() < maxNumFiles) files.push_back(path);
+		}, {".jpg", ".jpeg", ".png"});
+
+		// separate cache so that the shared instance isn't affected
+		const fs::path cacheDir = fs::temp_directory_path() / ("bluecadet_pixel_cache_benchmark_" + to_string(std::hash<std::thread::id>()(this_thread::get_id())));
+		PixelCache cache(cacheDir);
+
+		for (const auto & path : files) {
+			try {
+				auto startTime = Clock::now();
+
+				const auto image = loadImage(loadFile(path));
+				const int width = image->getWidth();
+				const int height = image->getHeight();
+				auto pixels = PixelBufferPool::get()->acquire(MemoryImageTarget::getNumBytes(width, height));
+				MemoryImageTarget::load(image, pixels->getData(), width, height, MemoryImageTarget::getRowBytes(width));
+
+				result.decodeSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+				startTime = Clock::now();
+
+				if (!cache.store(path, pixels->getData(), width, height, image->hasAlpha())) {
+					continue;
+				}
+
+				result.storeSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+				result.numBytes += MemoryImageTarget::getNumBytes(width, height);
+				result.numFiles++;
+
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not decode '" + path.string() + "'", e);
+			}
+		}
+
+		uint32_t checksum = 0;
+
+		for (const auto & path : files) {
+			const auto startTime = Clock::now();
+			auto entry = cache.load(path);
+
+			if (entry) {
+				// read every cache line like an upload would
+				const size_t numBytes = MemoryImageTarget::getNumBytes(entry->width, entry->height);
+				for (size_t i = 0; i < numBytes; i += 64) {
+					checksum += entry->pixels[i];
+				}
+			}
+
+			entry = nullptr;
+			result.mappedSeconds += std::chrono::duration<double>(Clock::now() - startTime).count();
+		}
+
+		CI_LOG_D("Pixel cache benchmark checksum: " << checksum);
+
+		cache.clear();
+
+		try {
+			fs::remove_all(cacheDir);
+		} catch (...) {}
+
+		return result;
+	}
+
+	bool PixelCache::getSourceInfo(const ci::fs::path & sourcePath, int64_t & modificationTime, uint64_t & fileSize) {
+		try {
+			if (!fs::exists(sourcePath)) {
+				return false;
+			}
+
+			modificationTime = FileUtils::getModificationTime(sourcePath);
+			fileSize = (uint64_t)fs::file_size(sourcePath);
+			return true;
+
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not read file info of '" + sourcePath.string() + "'", e);
+			return false;
+		}
+	}
+
+	void PixelCache::scanCacheDir() {
+		struct ScannedFile {
+			int64_t modificationTime;
+			std::string filename;
+			size_t numBytes;
+			bool operator<(const ScannedFile & other) const { return modificationTime < other.modificationTime; }
+		};
+
+		vector<ScannedFile> files;
+
+		try {
+			for (const auto & entry : fs::directory_iterator(mCacheDir)) {
+				const fs::path & path = entry.path();
+
+				if (path.extension() == ".tmp") {
+					// left over from an interrupted store
+					fs::remove(path);
+
+				} else if (path.extension() == EXTENSION) {
+					files.push_back({FileUtils::getModificationTime(path), path.filename().string(), (size_t)fs::file_size(path)});
+				}
+			}
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not scan pixel cache at '" + mCacheDir.string() + "'", e);
+		}
+
+		// without access times, files written least recently are evicted first
+		sort(files.begin(), files.end());
+
+		lock_guard<mutex> lock(mMutex);
+
+		for (const auto & file : files) {
+			addFile(file.filename, file.numBytes);
+		}
+
+		trim();
+	}
+
+	void PixelCache::addFile(const std::string & filename, const size_t numBytes) {
+		removeFile(filename);
+
+		FileInfo & info = mFiles[filename];
+		info.lruIt = mLru.insert(mLru.end(), filename);
+		info.numBytes = numBytes;
+		mNumBytes += numBytes;
+	}
+
+	void PixelCache::removeFile(const std::string & filename) {
+		auto it = mFiles.find(filename);
+		if (it == mFiles.end()) return;
+
+		mNumBytes -= it->second.numBytes;
+		mLru.erase(it->second.lruIt);
+		mFiles.erase(it);
+	}
+
+	void PixelCache::trim() {
+		while (mBudget > 0 && mNumBytes > mBudget && !mLru.empty()) {
+			const string filename = mLru.front();
+
+			try {
+				// mapped entries stay valid until they're released
+				fs::remove(mCacheDir / filename);
+			} catch (std::exception & e) {
+				CI_LOG_EXCEPTION("Could not evict pixel cache file '" + filename + "'", e);
+			}
+
+			removeFile(filename);
+			mStats.numEvictions++;
+		}
+	}
+
+}
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+
+#include "MappedFile.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class PixelCache> PixelCacheRef;
+
+//! Disk cache of decoded RGBA pixels that lets apps skip decoding images they've loaded on a previous run.
+//!
+//! Each entry is a flat file with a small header followed by tightly packed RGBA rows. Cache hits are memory-mapped,
+//! so pixels are read straight from the OS page cache into the upload path without decoding or an intermediate copy.
+//!
+//! Files are named by the XXH64 of their key and store the full key, so hash collisions are detected on load and cache
+//! directories can be shared between builds. Entries are invalidated when the source's modification time or file size
+//! changes. Files are evicted in least-recently-used order once the cache exceeds its budget. All methods are thread-safe
+//! and don't require GL.
+class PixelCache {
+
+public:
+	//! A mapped cache entry. pixels point into the mapped file and stay valid as long as the entry is referenced.
+	struct Entry {
+		MappedFileRef file;
+		const uint8_t * pixels = nullptr;
+		int width = 0;
+		int height = 0;
+		bool hasAlpha = true;
+	};
+	typedef std::shared_ptr<Entry> EntryRef;
+
+	struct Stats {
+		size_t numEntries = 0;
+		size_t numBytes = 0;			//! Size of all cache files on disk
+		size_t numHits = 0;				//! Calls to load() that returned an entry
+		size_t numMisses = 0;			//! Calls to load() that didn't find a valid entry
+		size_t numInvalidations = 0;	//! Entries removed because their source has changed
+		size_t numStores = 0;
+		size_t numEvictions = 0;		//! Entries removed due to the budget
+	};
+
+	//! Optional shared instance that stores files in a directory in the system's temp directory with a 2 GB budget.
+	static PixelCacheRef get() {
+		static auto instance = std::make_shared<PixelCache>(ci::fs::temp_directory_path() / "bluecadet_pixel_cache", (size_t)2048 * 1024 * 1024);
+		return instance;
+	}
+
+	//! cacheDir: Directory that cache files are stored in. Created if it doesn't exist.
+	//! budget: Max number of bytes of all cache files. 0 means unlimited.
+	PixelCache(const ci::fs::path & cacheDir, const size_t budget = 0);
+
+	//! Maps the cached pixels for sourcePath at maxSize. Returns nullptr if there's no entry or the source has changed since.
+	EntryRef load(const ci::fs::path & sourcePath, const int maxSize = 0);
+
+	//! Writes width x height RGBA pixels decoded from sourcePath to the cache and evicts old entries if the budget is exceeded.
+	//! maxSize is only used as part of the key and should match the argument passed to load(). Returns false on failure.
+	bool store(const ci::fs::path & sourcePath, const uint8_t * pixels, const int width, const int height, const bool hasAlpha, const int maxSize = 0);
+
+	void remove(const ci::fs::path & sourcePath, const int maxSize = 0);
+
+	//! Removes all cached files.
+	void clear();
+
+	//! Path of the cache file for sourcePath at maxSize.
+	ci::fs::path getCachePath(const ci::fs::path & sourcePath, const int maxSize = 0) const;
+
+	const ci::fs::path & getCacheDir() const { return mCacheDir; }
+
+	//! Max number of bytes of all cache files. 0 means unlimited.
+	void setBudget(const size_t value);
+	size_t getBudget() const { return mBudget; }
+
+	Stats getStats();
+	void resetStats();
+
+	//! Result of benchmark(); each value is the total for all files.
+	struct BenchmarkResult {
+		size_t numFiles = 0;
+		size_t numBytes = 0;		//! Decoded RGBA bytes
+		double decodeSeconds = 0;	//! Cold start: decoding each source into RGBA pixels
+		double storeSeconds = 0;	//! Writing the decoded pixels to the cache
+		double mappedSeconds = 0;	//! Warm start: mapping each cache hit and reading all of its pixels
+	};
+
+	//! Compares cold and warm starts over the jpg and png images in dir (recursively, up to maxNumFiles if > 0). Each image is
+	//! decoded and stored in a temporary cache, then loaded from that cache. Cache files are still in the OS page cache when
+	//! they're loaded, like after an app restart without a reboot. Runs on the calling thread, which should be the main thread
+	//! or have initialized Cinder's image loader (see GlWorkerPool::initializeLoader()). Intended for diagnostics.
+	static BenchmarkResult benchmark(const ci::fs::path & dir, const size_t maxNumFiles = 0);
+
+protected:
+	//! Header at the start of each file. Followed by the entry's full key (keyLength bytes) and the pixels, which start at
+	//! the next multiple of 64 bytes to keep rows 64 byte aligned.
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t hasAlpha;
+		uint32_t keyLength;
+		int64_t sourceModificationTime;
+		uint64_t sourceFileSize;
+		uint8_t padding[24];
+	};
+
+	//! Full key of an entry, which is stored in its file and compared on load. Filenames are only a hash of this key.
+	static std::string getCacheKey(const ci::fs::path & sourcePath, const int maxSize);
+
+	//! Offset of the pixels of an entry whose key has keyLength bytes.
+	static size_t getPixelOffset(const size_t keyLength);
+
+	struct FileInfo {
+		std::list<std::string>::iterator lruIt;
+		size_t numBytes = 0;
+	};
+
+	static bool getSourceInfo(const ci::fs::path & sourcePath, int64_t & modificationTime, uint64_t & fileSize);
+
+	void scanCacheDir();
+	void addFile(const std::string & filename, const size_t numBytes); // requires lock
+	void removeFile(const std::string & filename); // requires lock
+	void trim(); // requires lock
+
+	ci::fs::path mCacheDir;
+	size_t mBudget;
+	size_t mNumBytes = 0;
+	Stats mStats;
+
+	std::list<std::string> mLru; // filenames, least recently used first
+	std::map<std::string, FileInfo> mFiles;
+	std::mutex mMutex;
+};
+
+}
+}
@@ -0,0 +1,451 @@
+#include "PixelKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <random>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BC_PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// gcc and clang need to be allowed to emit instructions per function; msvc always allows intrinsics
+#if defined(BC_PIXEL_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define BC_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define BC_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#else
+#define BC_TARGET_SSSE3
+#define BC_TARGET_AVX2
+#endif
+
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	namespace {
+		typedef void(*ConvertFn)(const uint8_t * src, uint8_t * dst, const size_t numPixels);
+		typedef void(*HalfFn)(const uint8_t * src, uint16_t * dst, const size_t numValues);
+
+		struct Kernels {
+			ConvertFn expandRgbToRgba;
+			ConvertFn expandBgrToRgba;
+			ConvertFn swizzleBgraToRgba;
+			ConvertFn premultiply;
+			HalfFn convertToHalf;
+		};
+
+		//==================================================
+		// Scalar
+		//
+
+		template <int R, int B>
+		void expandScalar(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			for (size_t i = 0; i < numPixels; ++i, src += 3, dst += 4) {
+				const uint8_t r = src[R], g = src[1], b = src[B];
+				dst[0] = r;
+				dst[1] = g;
+				dst[2] = b;
+				dst[3] = 255;
+			}
+		}
+
+		void swizzleScalar(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			for (size_t i = 0; i < numPixels; ++i, src += 4, dst += 4) {
+				const uint8_t b = src[0], g = src[1], r = src[2], a = src[3];
+				dst[0] = r;
+				dst[1] = g;
+				dst[2] = b;
+				dst[3] = a;
+			}
+		}
+
+		inline uint8_t multiply(const uint32_t value, const uint32_t alpha) {
+			// rounds value * alpha / 255 exactly
+			const uint32_t t = value * alpha + 128;
+			return (uint8_t)((t + (t >> 8)) >> 8);
+		}
+
+		void premultiplyScalar(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			for (size_t i = 0; i < numPixels; ++i, src += 4, dst += 4) {
+				const uint32_t a = src[3];
+				dst[0] = multiply(src[0], a);
+				dst[1] = multiply(src[1], a);
+				dst[2] = multiply(src[2], a);
+				dst[3] = (uint8_t)a;
+			}
+		}
+
+		uint16_t floatToHalf(const float value) {
+			// only needs to handle normalized values between 0 and 1
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+
+			const int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+			uint32_t mantissa = bits & 0x7fffff;
+
+			if (exponent <= 0) {
+				if (exponent < -10) return 0;
+				// subnormal: shift in implicit bit and round to nearest even
+				mantissa |= 0x800000;
+				const uint32_t shift = (uint32_t)(14 - exponent);
+				uint32_t half = mantissa >> shift;
+				const uint32_t remainder = mantissa & ((1u << shift) - 1);
+				const uint32_t midpoint = 1u << (shift - 1);
+				if (remainder > midpoint || (remainder == midpoint && (half & 1))) half++;
+				return (uint16_t)half;
+			}
+
+			// round to nearest even; carries into the exponent where needed
+			uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+			const uint32_t remainder = mantissa & 0x1fff;
+			if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) half++;
+			return (uint16_t)half;
+		}
+
+		const uint16_t * getHalfTable() {
+			static const vector<uint16_t> table = [] {
+				vector<uint16_t> values(256);
+				for (int i = 0; i < 256; ++i) values[i] = floatToHalf((float)i / 255.0f);
+				return values;
+			}();
+			return table.data();
+		}
+
+		void convertToHalfScalar(const uint8_t * src, uint16_t * dst, const size_t numValues) {
+			const uint16_t * table = getHalfTable();
+			for (size_t i = 0; i < numValues; ++i) {
+				dst[i] = table[src[i]];
+			}
+		}
+
+		const Kernels SCALAR_KERNELS = {
+			&expandScalar<0, 2>,
+			&expandScalar<2, 0>,
+			&swizzleScalar,
+			&premultiplyScalar,
+			&convertToHalfScalar
+		};
+
+#if defined(BC_PIXEL_KERNELS_X86)
+
+		//==================================================
+		// SSSE3
+		//
+
+		template <int R, int B>
+		BC_TARGET_SSSE3 void expandSsse3(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			// 4 pixels per shuffle; three 16 byte loads cover 16 pixels without reading past the end
+			const __m128i mask = _mm_setr_epi8(R, 1, B, -1, 3 + R, 4, 3 + B, -1, 6 + R, 7, 6 + B, -1, 9 + R, 10, 9 + B, -1);
+			const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+			size_t i = 0;
+
+			for (; i + 16 <= numPixels; i += 16, src += 48, dst += 64) {
+				const __m128i a = _mm_loadu_si128((const __m128i *)src);
+				const __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+				const __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+
+				_mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_shuffle_epi8(a, mask), alpha));
+				_mm_storeu_si128((__m128i *)(dst + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), alpha));
+				_mm_storeu_si128((__m128i *)(dst + 32), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), alpha));
+				_mm_storeu_si128((__m128i *)(dst + 48), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), alpha));
+			}
+
+			expandScalar<R, B>(src, dst, numPixels - i);
+		}
+
+		BC_TARGET_SSSE3 void swizzleSsse3(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+			size_t i = 0;
+
+			for (; i + 4 <= numPixels; i += 4, src += 16, dst += 16) {
+				_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), mask));
+			}
+
+			swizzleScalar(src, dst, numPixels - i);
+		}
+
+		BC_TARGET_SSSE3 inline __m128i multiplySsse3(const __m128i pixels) {
+			// pixels holds two RGBA pixels as 16 bit values; alpha is multiplied by 255 to keep it unchanged
+			__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm_or_si128(_mm_and_si128(alpha, _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0)), _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255));
+
+			const __m128i t = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha), _mm_set1_epi16(128));
+			return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+
+		BC_TARGET_SSSE3 void premultiplySsse3(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			const __m128i zero = _mm_setzero_si128();
+			size_t i = 0;
+
+			for (; i + 4 <= numPixels; i += 4, src += 16, dst += 16) {
+				const __m128i pixels = _mm_loadu_si128((const __m128i *)src);
+				const __m128i lo = multiplySsse3(_mm_unpacklo_epi8(pixels, zero));
+				const __m128i hi = multiplySsse3(_mm_unpackhi_epi8(pixels, zero));
+				_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+			}
+
+			premultiplyScalar(src, dst, numPixels - i);
+		}
+
+		const Kernels SSSE3_KERNELS = {
+			&expandSsse3<0, 2>,
+			&expandSsse3<2, 0>,
+			&swizzleSsse3,
+			&premultiplySsse3,
+			&convertToHalfScalar // the lookup table is as fast as it gets without f16c
+		};
+
+		//==================================================
+		// AVX2
+		//
+
+		template <int R, int B>
+		BC_TARGET_AVX2 void expandAvx2(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			// moves the 12 bytes of pixels 0-3 into the low lane and pixels 4-7 into the high lane, then shuffles within lanes
+			const __m256i permute = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+			const __m256i mask = _mm256_setr_epi8(
+				R, 1, B, -1, 3 + R, 4, 3 + B, -1, 6 + R, 7, 6 + B, -1, 9 + R, 10, 9 + B, -1,
+				R, 1, B, -1, 3 + R, 4, 3 + B, -1, 6 + R, 7, 6 + B, -1, 9 + R, 10, 9 + B, -1);
+			const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+			size_t i = 0;
+
+			// each iteration reads 32 bytes but only consumes 24, so stop early enough to stay within src
+			for (; i + 11 <= numPixels; i += 8, src += 24, dst += 32) {
+				const __m256i pixels = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)src), permute);
+				_mm256_storeu_si256((__m256i *)dst, _mm256_or_si256(_mm256_shuffle_epi8(pixels, mask), alpha));
+			}
+
+			expandSsse3<R, B>(src, dst, numPixels - i);
+		}
+
+		BC_TARGET_AVX2 void swizzleAvx2(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			const __m256i mask = _mm256_setr_epi8(
+				2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+				2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+			size_t i = 0;
+
+			for (; i + 8 <= numPixels; i += 8, src += 32, dst += 32) {
+				_mm256_storeu_si256((__m256i *)dst, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), mask));
+			}
+
+			swizzleScalar(src, dst, numPixels - i);
+		}
+
+		BC_TARGET_AVX2 inline __m256i multiplyAvx2(const __m256i pixels) {
+			__m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm256_or_si256(
+				_mm256_and_si256(alpha, _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0)),
+				_mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255));
+
+			const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha), _mm256_set1_epi16(128));
+			return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+		}
+
+		BC_TARGET_AVX2 void premultiplyAvx2(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+			const __m256i zero = _mm256_setzero_si256();
+			size_t i = 0;
+
+			for (; i + 8 <= numPixels; i += 8, src += 32, dst += 32) {
+				// unpack and pack both work within lanes, so pixel order is preserved
+				const __m256i pixels = _mm256_loadu_si256((const __m256i *)src);
+				const __m256i lo = multiplyAvx2(_mm256_unpacklo_epi8(pixels, zero));
+				const __m256i hi = multiplyAvx2(_mm256_unpackhi_epi8(pixels, zero));
+				_mm256_storeu_si256((__m256i *)dst, _mm256_packus_epi16(lo, hi));
+			}
+
+			premultiplyScalar(src, dst, numPixels - i);
+		}
+
+		BC_TARGET_AVX2 void convertToHalfAvx2(const uint8_t * src, uint16_t * dst, const size_t numValues) {
+			const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+			size_t i = 0;
+
+			for (; i + 8 <= numValues; i += 8) {
+				const __m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+				const __m256 normalized = _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale);
+				_mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(normalized, _MM_FROUND_TO_NEAREST_INT));
+			}
+
+			convertToHalfScalar(src + i, dst + i, numValues - i);
+		}
+
+		const Kernels AVX2_KERNELS = {
+			&expandAvx2<0, 2>,
+			&expandAvx2<2, 0>,
+			&swizzleAvx2,
+			&premultiplyAvx2,
+			&convertToHalfAvx2
+		};
+
+		void cpuid(int info[4], const int function, const int subfunction) {
+#if defined(_MSC_VER)
+			__cpuidex(info, function, subfunction);
+#else
+			__cpuid_count(function, subfunction, info[0], info[1], info[2], info[3]);
+#endif
+		}
+
+		uint64_t getXcr0() {
+#if defined(_MSC_VER)
+			return _xgetbv(0);
+#else
+			uint32_t eax, edx;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return ((uint64_t)edx << 32) | eax;
+#endif
+		}
+
+#endif
+
+		PixelKernels::InstructionSet detectInstructionSet() {
+#if defined(BC_PIXEL_KERNELS_X86)
+			int info[4] = {0, 0, 0, 0};
+			cpuid(info, 0, 0);
+			const int maxFunction = info[0];
+
+			cpuid(info, 1, 0);
+			const bool hasSsse3 = (info[2] & (1 << 9)) != 0;
+			const bool hasF16c = (info[2] & (1 << 29)) != 0;
+			const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+
+			bool hasAvx2 = false;
+
+			if (maxFunction >= 7 && hasOsxsave && hasF16c && (getXcr0() & 0x6) == 0x6) {
+				// os saves ymm registers
+				cpuid(info, 7, 0);
+				hasAvx2 = (info[1] & (1 << 5)) != 0;
+			}
+
+			if (hasAvx2) return PixelKernels::InstructionSet::AVX2;
+			if (hasSsse3) return PixelKernels::InstructionSet::SSSE3;
+#endif
+			return PixelKernels::InstructionSet::Scalar;
+		}
+
+		const Kernels & getKernels(const PixelKernels::InstructionSet instructionSet) {
+#if defined(BC_PIXEL_KERNELS_X86)
+			switch (instructionSet) {
+				case PixelKernels::InstructionSet::AVX2: return AVX2_KERNELS;
+				case PixelKernels::InstructionSet::SSSE3: return SSSE3_KERNELS;
+				default: break;
+			}
+#endif
+			return SCALAR_KERNELS;
+		}
+
+		std::atomic<PixelKernels::InstructionSet> & getActiveInstructionSet() {
+			static std::atomic<PixelKernels::InstructionSet> instructionSet(PixelKernels::getSupportedInstructionSet());
+			return instructionSet;
+		}
+
+		inline const Kernels & getActiveKernels() {
+			return getKernels(getActiveInstructionSet().load(std::memory_order_relaxed));
+		}
+	}
+
+	void PixelKernels::expandRgbToRgba(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+		getActiveKernels().expandRgbToRgba(src, dst, numPixels);
+	}
+
+	void PixelKernels::expandBgrToRgba(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+		getActiveKernels().expandBgrToRgba(src, dst, numPixels);
+	}
+
+	void PixelKernels::swizzleBgraToRgba(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+		getActiveKernels().swizzleBgraToRgba(src, dst, numPixels);
+	}
+
+	void PixelKernels::premultiply(const uint8_t * src, uint8_t * dst, const size_t numPixels) {
+		getActiveKernels().premultiply(src, dst, numPixels);
+	}
+
+	void PixelKernels::convertToHalf(const uint8_t * src, uint16_t * dst, const size_t numValues) {
+		getActiveKernels().convertToHalf(src, dst, numValues);
+	}
+
+	PixelKernels::InstructionSet PixelKernels::getInstructionSet() {
+		return getActiveInstructionSet();
+	}
+
+	PixelKernels::InstructionSet PixelKernels::getSupportedInstructionSet() {
+		static const InstructionSet instructionSet = detectInstructionSet();
+		return instructionSet;
+	}
+
+	void PixelKernels::setInstructionSet(const InstructionSet value) {
+		getActiveInstructionSet() = (int)value <= (int)getSupportedInstructionSet() ? value : getSupportedInstructionSet();
+	}
+
+	std::vector<PixelKernels::BenchmarkResult> PixelKernels::benchmark(const size_t numPixels) {
+		typedef std::chrono::steady_clock Clock;
+
+		vector<uint8_t> src(numPixels * 4);
+		vector<uint8_t> dst(numPixels * 4);
+		vector<uint16_t> halfs(numPixels * 4);
+
+		mt19937 random(0);
+		for (auto & value : src) value = (uint8_t)random();
+
+		const Kernels & scalar = SCALAR_KERNELS;
+		const Kernels & active = getActiveKernels();
+
+		// best of a few runs to reduce noise
+		auto measure = [&](const size_t numBytes, const std::function<void()> & fn) {
+			double bestTime = 1e9;
+			for (int i = 0; i < 5; ++i) {
+				const auto startTime = Clock::now();
+				fn();
+				bestTime = min(bestTime, std::chrono::duration<double>(Clock::now() - startTime).count());
+			}
+			return (double)numBytes / max(bestTime, 1e-9) / 1e9;
+		};
+
+		auto addResult = [&](vector<BenchmarkResult> & results, const std::string & kernel, const size_t numBytes,
+			const std::function<void()> & scalarFn, const std::function<void()> & activeFn) {
+			BenchmarkResult result;
+			result.kernel = kernel;
+			result.instructionSet = getInstructionSet();
+			result.scalarGBps = measure(numBytes, scalarFn);
+			result.simdGBps = measure(numBytes, activeFn);
+			results.push_back(result);
+		};
+
+		vector<BenchmarkResult> results;
+		addResult(results, "expandRgbToRgba", numPixels * 3,
+			[&] { scalar.expandRgbToRgba(src.data(), dst.data(), numPixels); },
+			[&] { active.expandRgbToRgba(src.data(), dst.data(), numPixels); });
+		addResult(results, "expandBgrToRgba", numPixels * 3,
+			[&] { scalar.expandBgrToRgba(src.data(), dst.data(), numPixels); },
+			[&] { active.expandBgrToRgba(src.data(), dst.data(), numPixels); });
+		addResult(results, "swizzleBgraToRgba", numPixels * 4,
+			[&] { scalar.swizzleBgraToRgba(src.data(), dst.data(), numPixels); },
+			[&] { active.swizzleBgraToRgba(src.data(), dst.data(), numPixels); });
+		addResult(results, "premultiply", numPixels * 4,
+			[&] { scalar.premultiply(src.data(), dst.data(), numPixels); },
+			[&] { active.premultiply(src.data(), dst.data(), numPixels); });
+		addResult(results, "convertToHalf", numPixels * 4,
+			[&] { scalar.convertToHalf(src.data(), halfs.data(), numPixels * 4); },
+			[&] { active.convertToHalf(src.data(), halfs.data(), numPixels * 4); });
+
+		return results;
+	}
+
+	std::string PixelKernels::getName(const InstructionSet value) {
+		switch (value) {
+			case InstructionSet::AVX2: return "AVX2";
+			case InstructionSet::SSSE3: return "SSSE3";
+			default: return "Scalar";
+		}
+	}
+
+}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bluecadet {
+namespace utils {
+
+//! Pixel format conversions for the image pipeline with SSSE3 and AVX2 implementations and a scalar fallback.
+//! The fastest instruction set supported by the CPU is detected once at runtime; all kernels produce the same
+//! results regardless of the instruction set. Functions are thread-safe and src and dst may point to the same
+//! memory for kernels that don't change the pixel size. The expand kernels also work in place if src starts
+//! numPixels bytes or more after dst, e.g. when RGB pixels were decoded into the last 3/4 of an RGBA buffer.
+class PixelKernels {
+
+public:
+	enum class InstructionSet {
+		Scalar,
+		SSSE3,
+		AVX2	//! AVX2 and F16C
+	};
+
+	struct BenchmarkResult {
+		std::string kernel;
+		InstructionSet instructionSet;
+		double scalarGBps = 0;	//! Source bytes processed per second (in GB) by the scalar implementation
+		double simdGBps = 0;	//! Source bytes processed per second (in GB) by the active implementation
+	};
+
+	//! Packed 8-bit RGB to RGBA with opaque alpha.
+	static void expandRgbToRgba(const uint8_t * src, uint8_t * dst, const size_t numPixels);
+
+	//! Packed 8-bit BGR to RGBA with opaque alpha.
+	static void expandBgrToRgba(const uint8_t * src, uint8_t * dst, const size_t numPixels);
+
+	//! Swaps red and blue channels of 8-bit BGRA pixels. Also converts RGBA to BGRA.
+	static void swizzleBgraToRgba(const uint8_t * src, uint8_t * dst, const size_t numPixels);
+
+	//! Multiplies the color channels of 8-bit RGBA pixels by alpha with correct rounding.
+	static void premultiply(const uint8_t * src, uint8_t * dst, const size_t numPixels);
+
+	//! Converts 8-bit unsigned normalized values (e.g. RGBA channels) to half floats in the range 0 to 1, e.g. for GL_RGBA16F textures.
+	static void convertToHalf(const uint8_t * src, uint16_t * dst, const size_t numValues);
+
+	//! Instruction set used by all kernels.
+	static InstructionSet getInstructionSet();
+
+	//! Best instruction set supported by the CPU and OS.
+	static InstructionSet getSupportedInstructionSet();
+
+	//! Overrides the instruction set, e.g. to compare implementations. Values that aren't supported are lowered to the best supported one.
+	static void setInstructionSet(const InstructionSet value);
+
+	//! Measures throughput of each kernel for the scalar and the active implementation on numPixels random pixels.
+	//! Takes a few hundred milliseconds; intended for diagnostics and tuning, not for regular use at runtime.
+	static std::vector<BenchmarkResult> benchmark(const size_t numPixels = 4 * 1024 * 1024);
+
+	static std::string getName(const InstructionSet value);
+};
+
+}
+}
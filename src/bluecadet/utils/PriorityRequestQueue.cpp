@@ -0,0 +1,88 @@
+#include "PriorityRequestQueue.h"
+
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	void PriorityRequestQueue::push(const std::string & key, const int priority) {
+		remove(key);
+		insert(key, mGeneration, priority);
+	}
+
+	bool PriorityRequestQueue::pop(std::string & key, int * priority) {
+		if (mItems.empty()) {
+			return false;
+		}
+
+		auto it = mItems.begin();
+		key = it->key;
+
+		if (priority) {
+			*priority = it->priority;
+		}
+
+		mItemsByKey.erase(it->key);
+		mItems.erase(it);
+		return true;
+	}
+
+	bool PriorityRequestQueue::setPriority(const std::string & key, const int priority) {
+		auto it = mItemsByKey.find(key);
+
+		if (it == mItemsByKey.end()) {
+			return false;
+		}
+
+		const size_t generation = it->second->generation;
+		mItems.erase(it->second);
+		mItemsByKey.erase(it);
+		insert(key, generation, priority);
+		return true;
+	}
+
+	void PriorityRequestQueue::prioritizeOnly(const std::set<std::string> & keys) {
+		mGeneration++;
+
+		for (const auto & key : keys) {
+			auto it = mItemsByKey.find(key);
+
+			if (it == mItemsByKey.end()) {
+				continue;
+			}
+
+			const int priority = it->second->priority;
+			mItems.erase(it->second);
+			mItemsByKey.erase(it);
+			insert(key, mGeneration, priority);
+		}
+	}
+
+	bool PriorityRequestQueue::remove(const std::string & key) {
+		auto it = mItemsByKey.find(key);
+
+		if (it == mItemsByKey.end()) {
+			return false;
+		}
+
+		mItems.erase(it->second);
+		mItemsByKey.erase(it);
+		return true;
+	}
+
+	void PriorityRequestQueue::clear() {
+		mItems.clear();
+		mItemsByKey.clear();
+	}
+
+	void PriorityRequestQueue::insert(const std::string & key, const size_t generation, const int priority) {
+		Item item;
+		item.generation = generation;
+		item.priority = priority;
+		item.index = mNumItemsCreated++;
+		item.key = key;
+		mItemsByKey[key] = mItems.insert(item).first;
+	}
+
+}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class PriorityRequestQueue> PriorityRequestQueueRef;
+
+//! Queue of unique keys (e.g. image paths) ordered by priority that supports changing the priority of queued keys
+//! in O(log n). Higher priorities are popped first and keys with the same priority are popped in first-in-first-out order.
+//!
+//! Keys are also grouped in generations: prioritizeOnly() starts a new generation and moves only the given keys into it,
+//! so all other queued keys fall behind them without having to be touched. Keys pushed afterwards join the new generation.
+//!
+//! This class is not thread-safe.
+class PriorityRequestQueue {
+
+public:
+	PriorityRequestQueue() {}
+
+	//! Adds key with priority. If key is already queued, its priority is updated and it's moved to the current generation.
+	void push(const std::string & key, const int priority = 0);
+
+	//! Removes the key with the highest priority. Returns false if the queue is empty.
+	bool pop(std::string & key, int * priority = nullptr);
+
+	//! Changes the priority of a queued key within its generation. Returns false if key isn't queued.
+	bool setPriority(const std::string & key, const int priority);
+
+	//! Moves keys into a new generation so that they're popped before all other currently queued keys, regardless of
+	//! those keys' priorities. Keys that aren't queued are ignored. Costs O(k log n) for k keys.
+	void prioritizeOnly(const std::set<std::string> & keys);
+
+	bool remove(const std::string & key);
+	bool contains(const std::string & key) const { return mItemsByKey.find(key) != mItemsByKey.end(); }
+	void clear();
+
+	size_t size() const { return mItems.size(); }
+	bool empty() const { return mItems.empty(); }
+
+protected:
+	struct Item {
+		size_t generation;
+		int priority;
+		size_t index; // insertion order
+		std::string key;
+
+		bool operator<(const Item & other) const {
+			if (generation != other.generation) return generation > other.generation;
+			if (priority != other.priority) return priority > other.priority;
+			return index < other.index;
+		}
+	};
+
+	typedef std::set<Item> ItemSet;
+
+	void insert(const std::string & key, const size_t generation, const int priority);
+
+	ItemSet mItems; // first item is popped next
+	std::map<std::string, ItemSet::iterator> mItemsByKey;
+	size_t mGeneration = 0;
+	size_t mNumItemsCreated = 0;
+};
+
+}
+}
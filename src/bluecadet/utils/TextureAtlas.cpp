@@ -0,0 +1,250 @@
+#include "TextureAtlas.h"
+
+#include "cinder/Log.h"
+#include "cinder/gl/gl.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "MaxRectsPacker.h"
+#include "MemoryImageTarget.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	struct TextureAtlasPage {
+		ci::gl::Texture2dRef texture;
+		MaxRectsPacker packer;
+	};
+
+	AtlasRegion::AtlasRegion(const std::string & key, const ci::gl::Texture2dRef & texture) :
+		mKey(key),
+		mTexture(texture)
+	{
+		if (mTexture) {
+			mArea = mTexture->getBounds();
+			mPaddedArea = mArea;
+			mTexCoords = mTexture->getAreaTexCoords(mArea);
+		}
+	}
+
+	TextureAtlas::TextureAtlas(const int pageSize, const int maxRegionSize, const int padding, GpuMemoryBudgetRef budget) :
+		mPageSize(max(1, pageSize)),
+		mMaxRegionSize(max(1, min(maxRegionSize, pageSize - 2 * max(0, padding)))),
+		mPadding(max(0, padding)),
+		mMemoryBudget(budget ? budget : GpuMemoryBudget::get())
+	{
+	}
+
+	TextureAtlas::~TextureAtlas() {
+		// regions that are still referenced keep their page textures alive, but aren't accounted for anymore
+		mMemoryBudget->release(mPages.size() * GpuMemoryBudget::estimateTextureBytes(mPageSize, mPageSize, 4, false));
+	}
+
+	AtlasRegionRef TextureAtlas::insert(const std::string & key, const uint8_t * pixels, const int width, const int height, const ptrdiff_t rowBytes) {
+		if (!pixels || !fits(width, height)) {
+			return nullptr;
+		}
+
+		lock_guard<mutex> lock(mMutex);
+
+		auto existingIt = mRegions.find(key);
+
+		if (existingIt != mRegions.end()) {
+			auto existing = existingIt->second.lock();
+			if (existing) return existing;
+		}
+
+		// find space in existing pages first
+		const int paddedWidth = width + 2 * mPadding;
+		const int paddedHeight = height + 2 * mPadding;
+		Area paddedArea;
+		PageRef page = nullptr;
+
+		for (const auto & candidate : mPages) {
+			if (candidate->packer.insert(paddedWidth, paddedHeight, paddedArea)) {
+				page = candidate;
+				break;
+			}
+		}
+
+		if (!page) {
+			page = addPage();
+
+			if (!page || !page->packer.insert(paddedWidth, paddedHeight, paddedArea)) {
+				return nullptr;
+			}
+		}
+
+		// copy pixels and repeat edge pixels into padding
+		const ptrdiff_t srcRowBytes = rowBytes > 0 ? rowBytes : MemoryImageTarget::getRowBytes(width);
+		const size_t dstRowBytes = (size_t)paddedWidth * 4;
+		mPaddedPixels.resize(dstRowBytes * paddedHeight);
+
+		for (int y = 0; y < paddedHeight; ++y) {
+			const int srcY = min(max(y - mPadding, 0), height - 1);
+			const uint8_t * srcRow = pixels + srcY * srcRowBytes;
+			uint8_t * dstRow = mPaddedPixels.data() + y * dstRowBytes;
+
+			for (int x = 0; x < mPadding; ++x) {
+				memcpy(dstRow + x * 4, srcRow, 4);
+				memcpy(dstRow + (mPadding + width + x) * 4, srcRow + (width - 1) * 4, 4);
+			}
+
+			memcpy(dstRow + mPadding * 4, srcRow, (size_t)width * 4);
+		}
+
+		try {
+			page->texture->update(mPaddedPixels.data(), GL_RGBA, GL_UNSIGNED_BYTE, 0, paddedWidth, paddedHeight, paddedArea.getUL());
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not upload atlas region for '" + key + "'", e);
+			page->packer.free(paddedArea);
+			return nullptr;
+		}
+
+		auto region = new AtlasRegion();
+		region->mKey = key;
+		region->mTexture = page->texture;
+		region->mPaddedArea = paddedArea;
+		region->mArea = Area(paddedArea.x1 + mPadding, paddedArea.y1 + mPadding, paddedArea.x2 - mPadding, paddedArea.y2 - mPadding);
+		region->mTexCoords = page->texture->getAreaTexCoords(region->mArea);
+		region->mPage = page;
+
+		// free space once the last handle is released, as long as the atlas still exists
+		std::weak_ptr<TextureAtlas> weakAtlas = shared_from_this();
+		AtlasRegionRef regionRef(region, [weakAtlas](AtlasRegion * region) {
+			auto atlas = weakAtlas.lock();
+			if (atlas) atlas->free(region);
+			delete region;
+		});
+
+		mRegions[key] = regionRef;
+		return regionRef;
+	}
+
+	AtlasRegionRef TextureAtlas::insert(const std::string & key, const ci::Surface8u & surface) {
+		if (!surface) {
+			return nullptr;
+		}
+
+		const auto & order = surface.getChannelOrder();
+
+		if (order.getCode() == SurfaceChannelOrder::RGBA) {
+			return insert(key, surface.getData(), surface.getWidth(), surface.getHeight(), surface.getRowBytes());
+		}
+
+		Surface8u rgba(surface.getWidth(), surface.getHeight(), true, SurfaceChannelOrder::RGBA);
+		rgba.copyFrom(surface, surface.getBounds());
+		return insert(key, rgba.getData(), rgba.getWidth(), rgba.getHeight(), rgba.getRowBytes());
+	}
+
+	AtlasRegionRef TextureAtlas::get(const std::string & key) {
+		lock_guard<mutex> lock(mMutex);
+		auto it = mRegions.find(key);
+		return it != mRegions.end() ? it->second.lock() : nullptr;
+	}
+
+	bool TextureAtlas::contains(const std::string & key) {
+		return get(key) != nullptr;
+	}
+
+	void TextureAtlas::clear() {
+		lock_guard<mutex> lock(mMutex);
+
+		while (!mPages.empty()) {
+			removePage(mPages.back());
+		}
+
+		mRegions.clear();
+	}
+
+	size_t TextureAtlas::getNumPages() {
+		lock_guard<mutex> lock(mMutex);
+		return mPages.size();
+	}
+
+	ci::gl::Texture2dRef TextureAtlas::getPage(const size_t index) {
+		lock_guard<mutex> lock(mMutex);
+		return index < mPages.size() ? mPages[index]->texture : nullptr;
+	}
+
+	TextureAtlas::Stats TextureAtlas::getStats() {
+		lock_guard<mutex> lock(mMutex);
+
+		Stats stats;
+		stats.numPages = mPages.size();
+
+		for (const auto & page : mPages) {
+			stats.numRegions += page->packer.getNumRects();
+			stats.numUsedPixels += page->packer.getNumUsedPixels();
+		}
+
+		if (stats.numPages > 0) {
+			stats.occupancy = (float)((double)stats.numUsedPixels / ((double)mPageSize * mPageSize * stats.numPages));
+		}
+
+		return stats;
+	}
+
+	TextureAtlas::PageRef TextureAtlas::addPage() {
+		auto format = gl::Texture2d::Format()
+			.internalFormat(GL_RGBA8)
+			.mipmap(false)
+			.minFilter(GL_LINEAR)
+			.magFilter(GL_LINEAR)
+			.wrap(GL_CLAMP_TO_EDGE);
+
+		auto page = make_shared<TextureAtlasPage>();
+
+		try {
+			page->texture = gl::Texture2d::create(mPageSize, mPageSize, format);
+		} catch (std::exception & e) {
+			CI_LOG_EXCEPTION("Could not create atlas page", e);
+			return nullptr;
+		}
+
+		// rows are uploaded top to bottom
+		page->texture->setTopDown(true);
+		page->packer.reset(mPageSize, mPageSize);
+
+		mMemoryBudget->reserve(GpuMemoryBudget::estimateTextureBytes(mPageSize, mPageSize, 4, false));
+		mPages.push_back(page);
+		return page;
+	}
+
+	void TextureAtlas::removePage(const PageRef & page) {
+		auto it = find(mPages.begin(), mPages.end(), page);
+
+		if (it != mPages.end()) {
+			mPages.erase(it);
+			mMemoryBudget->release(GpuMemoryBudget::estimateTextureBytes(mPageSize, mPageSize, 4, false));
+		}
+	}
+
+	void TextureAtlas::free(AtlasRegion * region) {
+		lock_guard<mutex> lock(mMutex);
+
+		auto regionIt = mRegions.find(region->mKey);
+
+		if (regionIt != mRegions.end() && regionIt->second.expired()) {
+			mRegions.erase(regionIt);
+		}
+
+		auto page = region->mPage.lock();
+
+		if (!page || find(mPages.begin(), mPages.end(), page) == mPages.end()) {
+			return; // page has been cleared
+		}
+
+		page->packer.free(region->mPaddedArea);
+
+		if (page->packer.isEmpty() && mPages.size() > 1) {
+			removePage(page);
+		}
+	}
+
+}
+}
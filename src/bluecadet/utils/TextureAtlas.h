@@ -0,0 +1,129 @@
+#pragma once
+
+#include "cinder/Area.h"
+#include "cinder/Rect.h"
+#include "cinder/Surface.h"
+#include "cinder/gl/Texture.h"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "GpuMemoryBudget.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class TextureAtlas> TextureAtlasRef;
+typedef std::shared_ptr<class AtlasRegion> AtlasRegionRef;
+
+struct TextureAtlasPage; // page texture and packer
+
+//! Handle to an image packed into a page of a TextureAtlas. The region's space is freed once the last handle is released.
+class AtlasRegion {
+
+public:
+	//! Region that covers all of a standalone texture, e.g. for images that are too large for an atlas.
+	AtlasRegion(const std::string & key, const ci::gl::Texture2dRef & texture);
+
+	//! The atlas page texture that contains this region. Pages aren't mipmapped.
+	const ci::gl::Texture2dRef & getTexture() const { return mTexture; }
+
+	//! Pixel area of the image within the page texture, e.g. for ci::gl::draw(getTexture(), getArea(), dstRect).
+	const ci::Area & getArea() const { return mArea; }
+
+	//! Normalized texture coordinates of the image within the page as returned by ci::gl::Texture2d::getAreaTexCoords().
+	const ci::Rectf & getTexCoords() const { return mTexCoords; }
+
+	ci::ivec2 getSize() const { return mArea.getSize(); }
+	const std::string & getKey() const { return mKey; }
+
+protected:
+	friend class TextureAtlas;
+
+	AtlasRegion() {}
+
+	std::string mKey;
+	ci::gl::Texture2dRef mTexture;
+	ci::Area mArea;
+	ci::Area mPaddedArea; // area reserved in the page including padding
+	ci::Rectf mTexCoords;
+	std::weak_ptr<TextureAtlasPage> mPage;
+};
+
+//! Packs small images into shared page textures, so that many of them can be drawn with a few texture binds. Images
+//! are placed incrementally with a MaxRectsPacker and surrounded by a padding of repeated edge pixels to avoid
+//! bleeding when sampling with linear filtering. New pages are added when an image doesn't fit into existing ones,
+//! and empty pages other than the first one are released.
+//!
+//! All methods are thread-safe. insert() uploads pixels and requires a current GL context that shares objects with the
+//! context that draws the pages (e.g. a GlWorkerPool thread followed by a finish before the region is used elsewhere).
+class TextureAtlas : public std::enable_shared_from_this<TextureAtlas> {
+
+public:
+	struct Stats {
+		size_t numPages = 0;
+		size_t numRegions = 0;
+		size_t numUsedPixels = 0;	//! Pixels used by regions including padding
+		float occupancy = 0;		//! Ratio of used pixels to the pixels of all pages
+	};
+
+	//! Optional shared instance with 2048 x 2048 pages for images up to 256 x 256 pixels.
+	static TextureAtlasRef get() {
+		static auto instance = std::make_shared<TextureAtlas>();
+		return instance;
+	}
+
+	//! pageSize: Width and height of each page texture.
+	//! maxRegionSize: Max width and height of images that are accepted.
+	//! padding: Number of pixels of repeated edge pixels around each image.
+	//! budget: Page textures are reserved on this budget. Defaults to GpuMemoryBudget::get().
+	TextureAtlas(const int pageSize = 2048, const int maxRegionSize = 256, const int padding = 1, GpuMemoryBudgetRef budget = nullptr);
+	~TextureAtlas();
+
+	//! Copies width x height RGBA pixels into the atlas. Returns nullptr if the image is larger than the max region size.
+	//! Returns the existing region if key is already in the atlas. rowBytes defaults to width * 4.
+	AtlasRegionRef insert(const std::string & key, const uint8_t * pixels, const int width, const int height, const ptrdiff_t rowBytes = 0);
+
+	//! Copies surface into the atlas. Surfaces that aren't RGBA are converted first.
+	AtlasRegionRef insert(const std::string & key, const ci::Surface8u & surface);
+
+	//! Returns the region for key if it's still referenced anywhere or nullptr.
+	AtlasRegionRef get(const std::string & key);
+	bool contains(const std::string & key);
+
+	//! True if an image of this size can be inserted.
+	bool fits(const int width, const int height) const { return width > 0 && height > 0 && width <= mMaxRegionSize && height <= mMaxRegionSize; }
+
+	//! Forgets all pages and regions. Existing regions keep their page textures alive until released.
+	void clear();
+
+	size_t getNumPages();
+	ci::gl::Texture2dRef getPage(const size_t index);
+
+	int getPageSize() const { return mPageSize; }
+	int getMaxRegionSize() const { return mMaxRegionSize; }
+	int getPadding() const { return mPadding; }
+
+	Stats getStats();
+
+protected:
+	typedef std::shared_ptr<TextureAtlasPage> PageRef;
+
+	PageRef addPage(); // requires lock
+	void removePage(const PageRef & page); // requires lock
+	void free(AtlasRegion * region); // called when the last handle is released
+
+	const int mPageSize;
+	const int mMaxRegionSize;
+	const int mPadding;
+	GpuMemoryBudgetRef mMemoryBudget;
+
+	std::mutex mMutex;
+	std::vector<PageRef> mPages;
+	std::map<std::string, std::weak_ptr<AtlasRegion>> mRegions;
+	std::vector<uint8_t> mPaddedPixels; // reused staging buffer; requires lock
+};
+
+}
+}
@@ -0,0 +1,388 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	TextureCache::TextureCache(const size_t budget, GpuMemoryBudgetRef memoryBudget) :
+		mClock(0),
+		mNumBytes(0),
+		mBudget(budget)
+	{
+		setMemoryBudget(memoryBudget);
+	}
+
+	TextureCache::~TextureCache() {
+		mMemoryBudget->removeEvictionHook(mEvictionHookId);
+		clear();
+	}
+
+	void TextureCache::insert(const std::string & key, ci::gl::TextureRef texture, const size_t numBytes) {
+		{
+			Shard & shard = getShard(key);
+			lock_guard<mutex> lock(shard.mutex);
+
+			auto entries = make_shared<EntryMap>(*getEntries(shard));
+			erase(*entries, key);
+			(*entries)[key] = make_shared<Entry>(texture, numBytes, ++mClock);
+			mNumBytes += numBytes;
+
+			setEntries(shard, entries);
+		}
+
+		{
+			lock_guard<mutex> lock(mMutex);
+			evictToBudget();
+		}
+
+		reclaim();
+	}
+
+	ci::gl::TextureRef TextureCache::get(const std::string & key) {
+		Shard & shard = getShard(key);
+		const auto entries = getEntries(shard);
+
+		auto it = entries->find(key);
+		if (it == entries->end()) {
+			shard.numMisses++;
+			return nullptr;
+		}
+
+		// mark as most recently used
+		it->second->lastUsed = ++mClock;
+		shard.numHits++;
+		return it->second->texture;
+	}
+
+	ci::gl::TextureRef TextureCache::peek(const std::string & key) {
+		const auto entries = getEntries(getShard(key));
+		auto it = entries->find(key);
+		return it != entries->end() ? it->second->texture : nullptr;
+	}
+
+	bool TextureCache::contains(const std::string & key) {
+		const auto entries = getEntries(getShard(key));
+		return entries->find(key) != entries->end();
+	}
+
+	void TextureCache::remove(const std::string & key) {
+		{
+			Shard & shard = getShard(key);
+			lock_guard<mutex> lock(shard.mutex);
+
+			const auto current = getEntries(shard);
+			if (current->find(key) != current->end()) {
+				auto entries = make_shared<EntryMap>(*current);
+				erase(*entries, key);
+				setEntries(shard, entries);
+			}
+		}
+
+		reclaim();
+	}
+
+	void TextureCache::clear() {
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			for (auto & shard : mShards) {
+				lock_guard<mutex> shardLock(shard.mutex);
+
+				for (const auto & it : *getEntries(shard)) {
+					mMemoryBudget->release(it.second->numBytes);
+					mNumBytes -= it.second->numBytes;
+					retire(it.second);
+				}
+
+				setEntries(shard, make_shared<EntryMap>());
+			}
+		}
+
+		reclaim();
+	}
+
+	void TextureCache::trim() {
+		{
+			lock_guard<mutex> lock(mMutex);
+			evictToBudget();
+		}
+
+		reclaim();
+	}
+
+	size_t TextureCache::evict(const size_t numBytes) {
+		// evicted entries are destroyed on the next call that has a GL context
+		lock_guard<mutex> lock(mMutex);
+		return evictLeastRecentlyUsed(numBytes);
+	}
+
+	void TextureCache::setWorkingSet(const std::set<std::string> & keys) {
+		lock_guard<mutex> lock(mMutex);
+		mWorkingSet = keys;
+	}
+
+	void TextureCache::addToWorkingSet(const std::string & key) {
+		lock_guard<mutex> lock(mMutex);
+		mWorkingSet.insert(key);
+	}
+
+	void TextureCache::removeFromWorkingSet(const std::string & key) {
+		lock_guard<mutex> lock(mMutex);
+		mWorkingSet.erase(key);
+	}
+
+	void TextureCache::clearWorkingSet() {
+		lock_guard<mutex> lock(mMutex);
+		mWorkingSet.clear();
+	}
+
+	void TextureCache::setBudget(const size_t value) {
+		lock_guard<mutex> lock(mMutex);
+		mBudget = value;
+		evictToBudget();
+	}
+
+	void TextureCache::setMemoryBudget(GpuMemoryBudgetRef value) {
+		if (mMemoryBudget) {
+			mMemoryBudget->removeEvictionHook(mEvictionHookId);
+		}
+
+		mMemoryBudget = value ? value : GpuMemoryBudget::get();
+		mEvictionHookId = mMemoryBudget->addEvictionHook(bind(&TextureCache::evict, this, placeholders::_1));
+	}
+
+	TextureCache::Stats TextureCache::getStats() {
+		lock_guard<mutex> lock(mMutex);
+		Stats stats = mStats;
+		stats.numBytes = mNumBytes;
+
+		for (auto & shard : mShards) {
+			const auto entries = getEntries(shard);
+			stats.numEntries += entries->size();
+			stats.numHits += shard.numHits;
+			stats.numMisses += shard.numMisses;
+
+			for (const auto & it : *entries) {
+				if (it.second->texture.use_count() > 1) {
+					stats.numPinnedEntries++;
+				}
+			}
+		}
+
+		return stats;
+	}
+
+	void TextureCache::resetStats() {
+		lock_guard<mutex> lock(mMutex);
+		mStats = Stats();
+
+		for (auto & shard : mShards) {
+			shard.numHits = 0;
+			shard.numMisses = 0;
+		}
+	}
+
+	TextureCache::BenchmarkResult TextureCache::benchmark(const size_t numReaders, const size_t numLookupsPerReader, const size_t numKeys) {
+		typedef std::chrono::steady_clock Clock;
+
+		BenchmarkResult result;
+		result.numReaders = max((size_t)1, numReaders);
+		result.numLookups = result.numReaders * numLookupsPerReader;
+
+		vector<string> keys;
+		for (size_t i = 0; i < max((size_t)1, numKeys); ++i) {
+			keys.push_back("assets/images/gallery/image_" + to_string(i) + ".jpg");
+		}
+
+		// runs all readers and optionally a writer until the readers are done; returns lookups per second
+		auto run = [&](const function<void(const string &)> & lookup, const function<void(const string &)> & insert, const bool withWriter, size_t * numInserts) {
+			atomic<bool> isDone(false);
+			vector<thread> threads;
+			size_t numWriterInserts = 0;
+
+			thread writer;
+			if (withWriter) {
+				writer = thread([&] {
+					for (size_t i = 0; !isDone; ++i, ++numWriterInserts) {
+						insert(keys[(i * 7919) % keys.size()]);
+					}
+				});
+			}
+
+			const auto startTime = Clock::now();
+
+			for (size_t r = 0; r < result.numReaders; ++r) {
+				threads.push_back(thread([&, r] {
+					uint32_t state = (uint32_t)r * 2654435761u + 1;
+					for (size_t i = 0; i < numLookupsPerReader; ++i) {
+						state = state * 1664525u + 1013904223u; // lcg
+						lookup(keys[(state >> 8) % keys.size()]);
+					}
+				}));
+			}
+
+			for (auto & thread : threads) {
+				thread.join();
+			}
+
+			const double seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+			isDone = true;
+
+			if (writer.joinable()) {
+				writer.join();
+			}
+
+			if (numInserts) {
+				*numInserts = numWriterInserts;
+			}
+
+			return seconds > 0 ? (double)result.numLookups / seconds : 0;
+		};
+
+		{
+			// entries without textures and bytes, so neither GL nor the shared memory budget are involved
+			TextureCache cache(0, make_shared<GpuMemoryBudget>());
+			for (const auto & key : keys) cache.insert(key, nullptr, 0);
+
+			auto lookup = [&](const string & key) { cache.get(key); };
+			auto insert = [&](const string & key) { cache.insert(key, nullptr, 0); };
+			result.lookupsPerSecond = run(lookup, insert, false, nullptr);
+			result.lookupsPerSecondWithWriter = run(lookup, insert, true, &result.numInserts);
+		}
+
+		{
+			// single lock for all keys
+			std::mutex mapMutex;
+			unordered_map<string, ci::gl::TextureRef> map;
+			for (const auto & key : keys) map[key] = nullptr;
+
+			auto lookup = [&](const string & key) { lock_guard<mutex> lock(mapMutex); map.find(key); };
+			auto insert = [&](const string & key) { lock_guard<mutex> lock(mapMutex); map[key] = nullptr; };
+			result.mutexLookupsPerSecond = run(lookup, insert, false, nullptr);
+			result.mutexLookupsPerSecondWithWriter = run(lookup, insert, true, nullptr);
+		}
+
+		return result;
+	}
+
+	size_t TextureCache::erase(EntryMap & entries, const std::string & key) {
+		auto it = entries.find(key);
+
+		if (it == entries.end()) {
+			return 0;
+		}
+
+		const size_t numBytes = it->second->numBytes;
+		mMemoryBudget->release(numBytes);
+		mNumBytes -= numBytes;
+		retire(it->second);
+		entries.erase(it);
+		return numBytes;
+	}
+
+	void TextureCache::retire(const EntryRef & entry) {
+		lock_guard<mutex> lock(mRetiredMutex);
+		mRetiredEntries.push_back(entry);
+	}
+
+	void TextureCache::reclaim() {
+		std::vector<EntryRef> entries; // destroyed after unlocking
+
+		{
+			lock_guard<mutex> lock(mRetiredMutex);
+
+			// entries that are only referenced by this list aren't part of any snapshot that readers might still be using
+			auto it = std::partition(mRetiredEntries.begin(), mRetiredEntries.end(), [](const EntryRef & entry) { return entry.use_count() > 1; });
+			entries.assign(std::make_move_iterator(it), std::make_move_iterator(mRetiredEntries.end()));
+			mRetiredEntries.erase(it, mRetiredEntries.end());
+		}
+	}
+
+	void TextureCache::evictToBudget() {
+		const size_t numBytes = mNumBytes;
+
+		if (mBudget > 0 && numBytes > mBudget) {
+			evictLeastRecentlyUsed(numBytes - mBudget);
+		}
+	}
+
+	size_t TextureCache::evictLeastRecentlyUsed(const size_t numBytesToFree) {
+		struct Candidate {
+			uint64_t lastUsed;
+			size_t shardIndex;
+			std::string key;
+			EntryRef entry;
+			bool operator<(const Candidate & other) const { return lastUsed < other.lastUsed; }
+		};
+
+		// gather evictable entries across all shards
+		std::vector<Candidate> candidates;
+
+		for (size_t i = 0; i < NUM_SHARDS; ++i) {
+			for (const auto & it : *getEntries(mShards[i])) {
+				if (isEvictable(it.first, *it.second)) {
+					candidates.push_back({it.second->lastUsed, i, it.first, it.second});
+				}
+			}
+		}
+
+		sort(candidates.begin(), candidates.end());
+
+		// pick from least to most recently used, then remove them with one copy per shard
+		std::map<size_t, std::vector<const Candidate *>> victimsByShard;
+		size_t numBytesSelected = 0;
+
+		for (const auto & candidate : candidates) {
+			if (numBytesSelected >= numBytesToFree) {
+				break;
+			}
+
+			victimsByShard[candidate.shardIndex].push_back(&candidate);
+			numBytesSelected += candidate.entry->numBytes;
+		}
+
+		size_t numBytesFreed = 0;
+
+		for (const auto & it : victimsByShard) {
+			Shard & shard = mShards[it.first];
+			lock_guard<mutex> lock(shard.mutex);
+			auto entries = make_shared<EntryMap>(*getEntries(shard));
+
+			for (const Candidate * candidate : it.second) {
+				auto entryIt = entries->find(candidate->key);
+
+				// skip entries that have been used, replaced or pinned since
+				if (entryIt == entries->end() || entryIt->second != candidate->entry
+					|| entryIt->second->lastUsed != candidate->lastUsed || !isEvictable(entryIt->first, *entryIt->second)) {
+					continue;
+				}
+
+				const size_t numBytes = erase(*entries, candidate->key);
+				numBytesFreed += numBytes;
+				mStats.numEvictions++;
+				mStats.numBytesEvicted += numBytes;
+			}
+
+			setEntries(shard, entries);
+		}
+
+		return numBytesFreed;
+	}
+
+	bool TextureCache::isEvictable(const std::string & key, const Entry & entry) const {
+		// textures referenced outside of the cache are pinned
+		if (entry.texture.use_count() > 1) {
+			return false;
+		}
+		return mWorkingSet.find(key) == mWorkingSet.end();
+	}
+
+}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "GpuMemoryBudget.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class TextureCache> TextureCacheRef;
+
+//! Thread-safe cache of textures with a byte budget and least-recently-used eviction.
+//!
+//! Entries are split across shards by key hash. Each shard publishes an immutable snapshot of its entries that is
+//! replaced as a whole on writes (read-copy-update), so lookups from any thread (render, workers, callbacks) only
+//! load the current snapshot and record their access in an atomic timestamp. Reads never wait for writers or other
+//! readers. Writes copy one shard's entries and are serialized per shard; entries that have been removed are only
+//! destroyed once no snapshot that a reader might still be using refers to them. Eviction is rarer and scans all
+//! shards for the least recently used entries.
+//!
+//! Textures that are still referenced outside of the cache are pinned and won't be evicted until they're released.
+//! Keys in the working set are kept resident regardless of the budget, which is useful to keep textures that will
+//! be needed again soon (e.g. neighbors of the currently visible items) from being evicted.
+//!
+//! Each entry's bytes are expected to be reserved on the memory budget by whoever created the texture and are
+//! released by the cache once the entry is removed or evicted. The cache registers itself as an eviction hook on
+//! that budget, so other GPU allocations can evict unused textures. Since the hook may be called from threads
+//! without a GL context, textures evicted that way are only destroyed on the next call to insert(), remove(),
+//! clear() or trim(), which need a GL context.
+class TextureCache {
+
+public:
+	struct Stats {
+		size_t numEntries = 0;
+		size_t numBytes = 0;			//! Estimated GPU memory of all cached textures
+		size_t numPinnedEntries = 0;	//! Entries referenced outside of the cache
+		size_t numHits = 0;				//! Calls to get() that returned a cached texture
+		size_t numMisses = 0;			//! Calls to get() that didn't find a cached texture
+		size_t numEvictions = 0;		//! Entries evicted due to the cache's budget or the memory budget
+		size_t numBytesEvicted = 0;
+	};
+
+	//! budget: Max number of bytes of cached textures. 0 means unlimited.
+	//! memoryBudget: The budget that entries' bytes are released to. Defaults to GpuMemoryBudget::get().
+	TextureCache(const size_t budget = 0, GpuMemoryBudgetRef memoryBudget = nullptr);
+	~TextureCache();
+
+	//! Adds or replaces the texture for key and marks it as most recently used. Evicts least recently used entries if the budget is exceeded.
+	void insert(const std::string & key, ci::gl::TextureRef texture, const size_t numBytes);
+
+	//! Returns the texture for key or nullptr and marks it as most recently used. Counts as hit or miss.
+	ci::gl::TextureRef get(const std::string & key);
+
+	//! Returns the texture for key or nullptr without affecting the LRU order or stats.
+	ci::gl::TextureRef peek(const std::string & key);
+
+	bool contains(const std::string & key);
+	void remove(const std::string & key);
+	void clear();
+
+	//! Evicts least recently used entries that aren't pinned or in the working set until the cache is within its budget.
+	//! Called automatically on insert(), but can be called to free textures that have been unpinned since.
+	void trim();
+
+	//! Evicts least recently used entries that aren't pinned or in the working set until at least numBytes have been freed.
+	//! Returns the number of bytes freed.
+	size_t evict(const size_t numBytes);
+
+	//! Hint to keep textures for these keys resident regardless of the budget. Keys don't need to be cached yet.
+	void setWorkingSet(const std::set<std::string> & keys);
+	void addToWorkingSet(const std::string & key);
+	void removeFromWorkingSet(const std::string & key);
+	void clearWorkingSet();
+
+	//! Max number of bytes of cached textures. 0 means unlimited.
+	void setBudget(const size_t value);
+	size_t getBudget() const { return mBudget; }
+
+	//! The budget that entries' bytes are released to. Defaults to GpuMemoryBudget::get().
+	void setMemoryBudget(GpuMemoryBudgetRef value);
+	GpuMemoryBudgetRef getMemoryBudget() const { return mMemoryBudget; }
+
+	Stats getStats();
+	void resetStats(); // resets hit, miss and eviction counters
+
+	//! Result of benchmark(). Lookups per second are totals across all readers.
+	struct BenchmarkResult {
+		size_t numReaders = 0;
+		size_t numLookups = 0;						//! Per run across all readers
+		double lookupsPerSecond = 0;				//! Readers only
+		double lookupsPerSecondWithWriter = 0;		//! While another thread keeps inserting into the cache
+		double mutexLookupsPerSecond = 0;			//! Same workload on an unordered_map behind a single mutex
+		double mutexLookupsPerSecondWithWriter = 0;
+		size_t numInserts = 0;						//! Inserts by the writer while readers were running
+	};
+
+	//! Runs numReaders threads that each look up numLookupsPerReader random keys out of numKeys, once without and once
+	//! with a concurrent writer, and compares the cache with a map behind a single mutex. Doesn't require GL (entries
+	//! have no textures). Intended for diagnostics.
+	static BenchmarkResult benchmark(const size_t numReaders = 4, const size_t numLookupsPerReader = 1000000, const size_t numKeys = 4096);
+
+protected:
+	static const size_t NUM_SHARDS = 16;
+
+	//! Entries are shared between snapshots and only lastUsed changes after they've been inserted.
+	struct Entry {
+		Entry(ci::gl::TextureRef texture, const size_t numBytes, const uint64_t lastUsed) : texture(texture), numBytes(numBytes), lastUsed(lastUsed) {}
+		const ci::gl::TextureRef texture;
+		const size_t numBytes;
+		std::atomic<uint64_t> lastUsed; // value of mClock at last access
+	};
+	typedef std::shared_ptr<Entry> EntryRef;
+	typedef std::unordered_map<std::string, EntryRef> EntryMap;
+	typedef std::shared_ptr<const EntryMap> EntryMapRef;
+
+	struct Shard {
+		std::mutex mutex; // serializes writers; readers don't lock
+		EntryMapRef entries; // current snapshot; only accessed via std::atomic_load() and std::atomic_store()
+		std::atomic<size_t> numHits;
+		std::atomic<size_t> numMisses;
+
+		Shard() : entries(std::make_shared<EntryMap>()), numHits(0), numMisses(0) {}
+	};
+
+	Shard & getShard(const std::string & key) { return mShards[std::hash<std::string>()(key) % NUM_SHARDS]; }
+	static EntryMapRef getEntries(const Shard & shard) { return std::atomic_load(&shard.entries); }
+	static void setEntries(Shard & shard, const std::shared_ptr<EntryMap> & entries) { std::atomic_store(&shard.entries, EntryMapRef(entries)); } // requires shard lock
+
+	size_t erase(EntryMap & entries, const std::string & key); // on a copy of a shard's entries; returns number of bytes released
+	void retire(const EntryRef & entry); // keeps entry until no snapshot refers to it
+	void reclaim(); // destroys retired entries that aren't referenced anymore; needs a GL context
+	void evictToBudget(); // requires mMutex
+	size_t evictLeastRecentlyUsed(const size_t numBytesToFree); // requires mMutex
+	bool isEvictable(const std::string & key, const Entry & entry) const; // requires mMutex
+
+	Shard mShards[NUM_SHARDS];
+	std::atomic<uint64_t> mClock; // incremented on each access to order entries by recency
+	std::atomic<size_t> mNumBytes;
+
+	GpuMemoryBudgetRef mMemoryBudget;
+	GpuMemoryBudget::EvictionHookId mEvictionHookId = -1;
+
+	std::mutex mMutex; // for eviction, budget, working set and stats; taken before shard locks
+	size_t mBudget;
+	Stats mStats;
+	std::set<std::string> mWorkingSet;
+
+	std::mutex mRetiredMutex; // taken after all other locks
+	std::vector<EntryRef> mRetiredEntries; // removed entries that may still be referenced by snapshots or lack a GL context
+};
+
+}
+}
@@ -0,0 +1,236 @@
+#include "TexturePool.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "ImageResampler.h"
+
+using namespace ci;
+using namespace std;
+
+namespace bluecadet {
+namespace utils {
+
+	bool TexturePool::Key::operator<(const Key & other) const {
+		return tie(width, height, internalFormat, numLevels) < tie(other.width, other.height, other.internalFormat, other.numLevels);
+	}
+
+	TexturePool::TexturePool(const size_t maxIdleBytes, GpuMemoryBudgetRef memoryBudget) :
+		mMaxIdleBytes(maxIdleBytes)
+	{
+		setMemoryBudget(memoryBudget);
+	}
+
+	TexturePool::~TexturePool() {
+		mMemoryBudget->removeEvictionHook(mEvictionHookId);
+		mMemoryBudget->release(mStats.numIdleBytes);
+	}
+
+	ci::gl::Texture2dRef TexturePool::acquire(const int width, const int height, const ci::gl::Texture2d::Format & format) {
+		Key key;
+		key.width = width;
+		key.height = height;
+		key.internalFormat = format.getInternalFormat();
+		key.numLevels = getNumLevels(width, height, format);
+
+		std::vector<ci::gl::Texture2dRef> deferredTextures; // destroyed after unlocking
+		ci::gl::Texture2dRef texture = nullptr;
+		size_t numBytesReused = 0;
+
+		{
+			lock_guard<mutex> lock(mMutex);
+			deferredTextures.swap(mDeferredTextures);
+			mStats.numAcquired++;
+
+			auto it = mIdleTexturesByKey.find(key);
+
+			if (it != mIdleTexturesByKey.end()) {
+				texture = it->second->texture;
+				numBytesReused = it->second->numBytes;
+				mIdleTextures.erase(it->second);
+				mIdleTexturesByKey.erase(it);
+				mStats.numIdleTextures--;
+				mStats.numIdleBytes -= numBytesReused;
+				mStats.numReused++;
+			} else {
+				mStats.numCreated++;
+			}
+		}
+
+		if (texture) {
+			// the caller reserves memory for the texture it requested
+			mMemoryBudget->release(numBytesReused);
+
+			// reset state that previous users may have changed
+			texture->setMinFilter(format.getMinFilter());
+			texture->setMagFilter(format.getMagFilter());
+			texture->setWrap(format.getWrapS(), format.getWrapT());
+			texture->setTopDown(false);
+
+		} else {
+			auto storageFormat = format;
+			storageFormat.immutableStorage(true);
+			texture = gl::Texture2d::create(width, height, storageFormat);
+		}
+
+		return wrap(key, texture);
+	}
+
+	ci::gl::Texture2dRef TexturePool::wrap(const Key & key, ci::gl::Texture2dRef texture) {
+		std::weak_ptr<TexturePool> weakPool = shared_from_this();
+
+		// the returned reference owns the pooled one and hands it back once released
+		return ci::gl::Texture2dRef(texture.get(), [weakPool, key, texture](ci::gl::Texture2d *) mutable {
+			auto pool = weakPool.lock();
+
+			if (pool) {
+				pool->release(key, texture);
+			}
+
+			texture = nullptr;
+		});
+	}
+
+	void TexturePool::release(const Key & key, ci::gl::Texture2dRef texture) {
+		const size_t numBytes = getNumBytes(key);
+
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.numReleased++;
+
+			// don't hold on to memory that's needed elsewhere; the texture is destroyed once it goes out of scope
+			const size_t budget = mMemoryBudget->getBudget();
+			const bool isBudgetExhausted = budget > 0 && mMemoryBudget->getReservedBytes() + numBytes > budget;
+
+			if (numBytes > mMaxIdleBytes || isBudgetExhausted) {
+				mStats.numDestroyed++;
+				return;
+			}
+
+			if (mStats.numIdleBytes + numBytes > mMaxIdleBytes) {
+				evictOldest(mStats.numIdleBytes + numBytes - mMaxIdleBytes);
+			}
+
+			Idle idle;
+			idle.key = key;
+			idle.texture = texture;
+			idle.numBytes = numBytes;
+
+			auto it = mIdleTextures.insert(mIdleTextures.end(), idle);
+			mIdleTexturesByKey.insert(make_pair(key, it));
+			mStats.numIdleTextures++;
+			mStats.numIdleBytes += numBytes;
+		}
+
+		mMemoryBudget->reserve(numBytes);
+	}
+
+	void TexturePool::trim(const size_t maxIdleBytes) {
+		std::vector<ci::gl::Texture2dRef> deferredTextures; // destroyed after unlocking
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			if (mStats.numIdleBytes > maxIdleBytes) {
+				evictOldest(mStats.numIdleBytes - maxIdleBytes);
+			}
+
+			deferredTextures.swap(mDeferredTextures);
+		}
+	}
+
+	size_t TexturePool::evict(const size_t numBytes) {
+		lock_guard<mutex> lock(mMutex);
+		return evictOldest(numBytes);
+	}
+
+	size_t TexturePool::evictOldest(const size_t numBytesToFree) {
+		size_t numBytesFreed = 0;
+
+		while (numBytesFreed < numBytesToFree && !mIdleTextures.empty()) {
+			auto it = mIdleTextures.begin();
+			auto range = mIdleTexturesByKey.equal_range(it->key);
+
+			for (auto keyIt = range.first; keyIt != range.second; ++keyIt) {
+				if (keyIt->second == it) {
+					mIdleTexturesByKey.erase(keyIt);
+					break;
+				}
+			}
+
+			mDeferredTextures.push_back(it->texture);
+			numBytesFreed += it->numBytes;
+			mStats.numIdleTextures--;
+			mStats.numIdleBytes -= it->numBytes;
+			mStats.numDestroyed++;
+			mIdleTextures.erase(it);
+		}
+
+		mMemoryBudget->release(numBytesFreed);
+		return numBytesFreed;
+	}
+
+	void TexturePool::setMaxIdleBytes(const size_t value) {
+		lock_guard<mutex> lock(mMutex);
+		mMaxIdleBytes = value;
+
+		if (mStats.numIdleBytes > mMaxIdleBytes) {
+			evictOldest(mStats.numIdleBytes - mMaxIdleBytes);
+		}
+	}
+
+	size_t TexturePool::getMaxIdleBytes() {
+		lock_guard<mutex> lock(mMutex);
+		return mMaxIdleBytes;
+	}
+
+	void TexturePool::setMemoryBudget(GpuMemoryBudgetRef value) {
+		// removing the hook waits for running evictions, which need mMutex
+		if (mMemoryBudget) {
+			mMemoryBudget->removeEvictionHook(mEvictionHookId);
+		}
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			if (mMemoryBudget) {
+				mMemoryBudget->release(mStats.numIdleBytes);
+			}
+
+			mMemoryBudget = value ? value : GpuMemoryBudget::get();
+			mMemoryBudget->reserve(mStats.numIdleBytes);
+		}
+
+		mEvictionHookId = mMemoryBudget->addEvictionHook(bind(&TexturePool::evict, this, placeholders::_1));
+	}
+
+	TexturePool::Stats TexturePool::getStats() {
+		lock_guard<mutex> lock(mMutex);
+		return mStats;
+	}
+
+	void TexturePool::resetStats() {
+		lock_guard<mutex> lock(mMutex);
+		Stats stats;
+		stats.numIdleTextures = mStats.numIdleTextures;
+		stats.numIdleBytes = mStats.numIdleBytes;
+		mStats = stats;
+	}
+
+	int TexturePool::getNumLevels(const int width, const int height, const ci::gl::Texture2d::Format & format) {
+		if (!format.hasMipmapping()) {
+			return 1;
+		}
+
+		const int numLevels = ImageResampler::getNumMipLevels(width, height);
+		const int maxLevel = format.getMaxMipmapLevel();
+		return maxLevel >= 0 ? min(numLevels, maxLevel + 1) : numLevels;
+	}
+
+	size_t TexturePool::getNumBytes(const Key & key) {
+		const size_t bytesPerPixel = key.internalFormat == GL_RGB8 ? 3 : 4;
+		return GpuMemoryBudget::estimateTextureBytes(key.width, key.height, bytesPerPixel, key.numLevels > 1);
+	}
+
+}
+}
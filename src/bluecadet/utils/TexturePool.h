@@ -0,0 +1,115 @@
+#pragma once
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "GpuMemoryBudget.h"
+
+namespace bluecadet {
+namespace utils {
+
+typedef std::shared_ptr<class TexturePool> TexturePoolRef;
+
+//! Thread-safe pool of GL textures with immutable storage, keyed by size, internal format and number of mip levels.
+//!
+//! Textures returned by acquire() go back to the pool once their last reference is released (e.g. when they're removed
+//! from or evicted by a TextureCache) instead of being deleted. The next request for the same dimensions and format
+//! re-uploads into that storage via glTexSubImage2D, which avoids the driver stalls of allocating and freeing storage
+//! for every image while scrolling through galleries.
+//!
+//! Idle textures are kept up to a byte budget, oldest first, and stay reserved on the memory budget. The pool registers
+//! itself as an eviction hook on that budget and won't keep released textures while the budget is exhausted. Since the
+//! hook may be called from threads without a GL context, textures evicted that way are only destroyed on the next call
+//! to acquire() or trim(). Instances must be created via std::make_shared.
+class TexturePool : public std::enable_shared_from_this<TexturePool> {
+
+public:
+	struct Stats {
+		size_t numAcquired = 0;			//! Calls to acquire()
+		size_t numReused = 0;			//! Calls to acquire() served by an idle texture
+		size_t numCreated = 0;			//! Textures allocated by acquire()
+		size_t numReleased = 0;			//! Textures returned to the pool
+		size_t numDestroyed = 0;		//! Released textures that weren't kept or were evicted
+		size_t numIdleTextures = 0;
+		size_t numIdleBytes = 0;		//! Estimated GPU memory of idle textures
+	};
+
+	//! Optional shared instance used by AsyncImageLoader. This class can still be independently instantiated.
+	static TexturePoolRef get() {
+		static auto instance = std::make_shared<TexturePool>();
+		return instance;
+	}
+
+	//! maxIdleBytes: Max GPU memory of idle textures.
+	//! memoryBudget: The budget that idle textures are reserved on. Defaults to GpuMemoryBudget::get().
+	TexturePool(const size_t maxIdleBytes = 128 * 1024 * 1024, GpuMemoryBudgetRef memoryBudget = nullptr);
+	~TexturePool();
+
+	//! Returns a texture with immutable storage for format, reusing an idle texture with the same size, internal format
+	//! and number of levels if possible. The contents of reused textures are undefined and their filters and wrap modes
+	//! are reset to format's. Must be called on a thread with a GL context.
+	ci::gl::Texture2dRef acquire(const int width, const int height, const ci::gl::Texture2d::Format & format);
+
+	//! Destroys idle textures until at most maxIdleBytes are kept. Must be called on a thread with a GL context.
+	void trim(const size_t maxIdleBytes = 0);
+
+	//! Releases idle textures' reservations from the memory budget and destroys them on the next call to acquire() or trim().
+	//! Returns the number of bytes freed.
+	size_t evict(const size_t numBytes);
+
+	//! Max GPU memory of idle textures. Idle textures beyond this are destroyed on the next call to acquire() or trim().
+	void setMaxIdleBytes(const size_t value);
+	size_t getMaxIdleBytes();
+
+	//! The budget that idle textures are reserved on. Defaults to GpuMemoryBudget::get().
+	void setMemoryBudget(GpuMemoryBudgetRef value);
+	GpuMemoryBudgetRef getMemoryBudget() const { return mMemoryBudget; }
+
+	Stats getStats();
+	void resetStats(); // resets all counters except idle textures and bytes
+
+	//! Number of mip levels allocated for a width x height texture with format.
+	static int getNumLevels(const int width, const int height, const ci::gl::Texture2d::Format & format);
+
+protected:
+	struct Key {
+		int width = 0;
+		int height = 0;
+		GLint internalFormat = 0;
+		int numLevels = 1;
+
+		bool operator<(const Key & other) const;
+	};
+
+	struct Idle {
+		Key key;
+		ci::gl::Texture2dRef texture;
+		size_t numBytes = 0;
+	};
+
+	typedef std::list<Idle> IdleList;
+
+	void release(const Key & key, ci::gl::Texture2dRef texture); // called when handed out textures are released
+	size_t evictOldest(const size_t numBytesToFree); // requires mMutex; moves textures to mDeferredTextures
+	ci::gl::Texture2dRef wrap(const Key & key, ci::gl::Texture2dRef texture);
+
+	static size_t getNumBytes(const Key & key);
+
+	GpuMemoryBudgetRef mMemoryBudget;
+	GpuMemoryBudget::EvictionHookId mEvictionHookId = -1;
+
+	std::mutex mMutex;
+	size_t mMaxIdleBytes;
+	IdleList mIdleTextures; // least recently released first
+	std::multimap<Key, IdleList::iterator> mIdleTexturesByKey;
+	std::vector<ci::gl::Texture2dRef> mDeferredTextures; // evicted from threads that may not have a GL context
+	Stats mStats;
+};
+
+}
+}